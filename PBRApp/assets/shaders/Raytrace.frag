@@ -4,24 +4,28 @@ in vec3 vOrigin;
 in vec3 vRay;
 
 uniform vec3 uLightPosition;
+uniform vec2 uLightSample; // CpuRaytracer::GetLightSample() of the sample, zero unless accumulating
 uniform samplerCube uCubemap;
 
-const uint KDTREE_MAX_INDICES = 12; // Multiple of 4
 struct KDTreeNode // std430 layout
 {
 	vec4 boxMin; // vec3
 	vec4 boxMax; // vec3
-	ivec4 childIndices; // ivec2
-	int atomIndices[KDTREE_MAX_INDICES];
+	ivec4 childIndices; // x, y = children, -1 for leaves; z = first entry in atomIndices, w = atom count of leaves
 };
 
 struct BufferSphere // std430 layout
 {
-	vec4 properties; // x = radius, y = transparency, z = reflection
+	vec4 properties; // x = radius, y = transparency, z = reflection, w = index into bufferMaterials (low 16 bits), baked occlusion (high 16 bits)
 	vec4 center;
 	vec4 surfaceColor;
 };
 
+struct BufferMaterial // std430 layout
+{
+	vec4 properties; // x = metallic, y = roughness, z = F0 of the dielectric part
+};
+
 struct Ray
 {
 	vec3 origin;
@@ -47,9 +51,40 @@ layout(std430, binding = 1) buffer KDTree
 	KDTreeNode nodes[];
 };
 
+layout(std430, binding = 2) buffer KDTreeAtomIndices
+{
+	int atomIndices[];
+};
+
+// Alternative compact kd-tree, 8 bytes per node. x = split position bits of interior nodes, first
+// entry in compactAtomIndices of leaves; y = bits 0-1 split axis or 3 for leaves, bits 2-31 above
+// child of interior nodes or atom count of leaves. The below child is the node after its parent
+layout(std430, binding = 3) buffer CompactKDTree
+{
+	uvec2 compactNodes[];
+};
+
+layout(std430, binding = 4) buffer CompactKDTreeAtomIndices
+{
+	int compactAtomIndices[];
+};
+
+// Parent of every node of KDTree, -1 for the root
+layout(std430, binding = 5) buffer KDTreeParentIndices
+{
+	int parentIndices[];
+};
+
+// Deduplicated materials of the atom templates and residues of the scheme
+layout(std430, binding = 7) buffer Materials
+{
+	BufferMaterial bufferMaterials[];
+};
+
 out vec4 oFragColor;
 
 const vec3 lightColor = vec3(1.0, 0.0, 1.0);
+const float lightRadius = 0.5;
 const float lightPower = 40.0;
 const float screenGamma = 2.2;
 
@@ -101,135 +136,491 @@ const float MAX_DISTANCE = 1000000000.0;
 uniform int uSpheresCount;
 uniform int uKDTreeNodesCount;
 
-float IntersectAABB(Ray ray, vec3 boxMin, vec3 boxMax)
+// Work of the rays of this invocation, added to TraversalStatistics at the end of main()
+uint gRayCount = 0u;
+uint gNodeVisits = 0u;
+uint gSphereTests = 0u;
+
+// True if the ray passes the box before maxDistance, hits down to MIN_DISTANCE count like the ones
+// of the spheres. entry is where the ray enters the box, negative when it starts inside
+bool EnterBox(Ray ray, vec3 boxMin, vec3 boxMax, float maxDistance, out float entry)
 {
 	vec3 tMin = (boxMin - ray.origin) / ray.dir;
 	vec3 tMax = (boxMax - ray.origin) / ray.dir;
 	vec3 t1 = min(tMin, tMax);
 	vec3 t2 = max(tMin, tMax);
-	float tNear = max(max(t1.x, t1.y), t1.z);
+	entry = max(max(t1.x, t1.y), t1.z);
 	float tFar = min(min(t2.x, t2.y), t2.z);
+	return entry <= tFar && tFar > MIN_DISTANCE && entry < maxDistance;
+}
 
-	if (tNear > tFar)
+void TestSphere(Ray ray, int globalIndex, inout Intersection intersection)
+{
+	++gSphereTests;
+	vec3 p = bufferSpheres[globalIndex].center.xyz;
+	float t = HitSphereOutside(ray, p, bufferSpheres[globalIndex].properties.x);
+	if (t > MIN_DISTANCE && t < intersection.distance)
 	{
-		return -1.0;
+		intersection.distance = t;
+		intersection.hitPoint = ray.origin + t * ray.dir;
+		intersection.normal = normalize(intersection.hitPoint - p);
+		intersection.sphereIndex = globalIndex;
 	}
-
-	return tNear;
 }
 
-Intersection FindNearestIntersection(Ray ray)
+// Only nodes with both children hit push, so the stack is never deeper than the tree. MainLayer
+// defines KDTREE_STACK_SIZE as AtomKDTree::TraversalStackSize, the builders keep every tree within
+// it. A deeper tree from elsewhere drops the far child instead of writing past the stack
+#ifndef KDTREE_STACK_SIZE
+#error KDTREE_STACK_SIZE is defined by the application
+#endif
+
+// Front to back: of two children that are both hit the nearer one is walked first and the other
+// waits on the stack with its entry distance, so once a hit is found every waiting node that
+// starts behind it is dropped without touching its subtree
+void TraverseKDTree(Ray ray, inout Intersection intersection)
 {
-	Intersection intersection;
-	intersection.sphereIndex = -2;
-	intersection.distance = MAX_DISTANCE;
-	intersection.ray = ray;
+	float entry;
+	if (!EnterBox(ray, nodes[0].boxMin.xyz, nodes[0].boxMax.xyz, intersection.distance, entry))
+	{
+		return;
+	}
 
-	if (IntersectAABB(ray, nodes[0].boxMin.xyz, nodes[0].boxMax.xyz) > 0.0)
+	int stackNodes[KDTREE_STACK_SIZE];
+	float stackEntries[KDTREE_STACK_SIZE];
+	int stackSize = 0;
+	int index = 0;
+	while (true)
 	{
-		int index = 0;
-		int farNodes[500];
-		int nIndex = 0;
-		while (true)
+		++gNodeVisits;
+		ivec4 childIndices = nodes[index].childIndices;
+		if (childIndices.x >= 0) // We have children
 		{
-			int leftIndex = nodes[index].childIndices[0];
-			int rightIndex = nodes[index].childIndices[1];
-			if (leftIndex >= 0) // We have children
+			KDTreeNode leftNode = nodes[childIndices.x];
+			KDTreeNode rightNode = nodes[childIndices.y];
+
+			float leftEntry;
+			float rightEntry;
+			bool leftHit = EnterBox(ray, leftNode.boxMin.xyz, leftNode.boxMax.xyz, intersection.distance, leftEntry);
+			bool rightHit = EnterBox(ray, rightNode.boxMin.xyz, rightNode.boxMax.xyz, intersection.distance, rightEntry);
+			if (leftHit && rightHit)
 			{
-				KDTreeNode leftNode = nodes[leftIndex];
-				KDTreeNode rightNode = nodes[rightIndex];
-
-				float leftDist = IntersectAABB(ray, leftNode.boxMin.xyz, leftNode.boxMax.xyz);
-				float rightDist = IntersectAABB(ray, rightNode.boxMin.xyz, rightNode.boxMax.xyz);
-
-				int farNodeIndex = -1;
-				int finalIndex = -1;
-				if (leftDist > 0.0 && leftDist >= rightDist)
+				bool leftFirst = leftEntry <= rightEntry;
+				if (stackSize < KDTREE_STACK_SIZE)
 				{
-					farNodeIndex = rightIndex;
-					finalIndex = leftIndex;
-				}
-				else if (rightDist > 0.0 && rightDist >= leftDist)
-				{
-					farNodeIndex = leftIndex;
-					finalIndex = rightIndex;
+					stackNodes[stackSize] = leftFirst ? childIndices.y : childIndices.x;
+					stackEntries[stackSize] = leftFirst ? rightEntry : leftEntry;
+					++stackSize;
 				}
 
-				if (finalIndex == -1)
-				{
-					break;
-				}
-				else
+				index = leftFirst ? childIndices.x : childIndices.y;
+				continue;
+			}
+
+			if (leftHit || rightHit)
+			{
+				index = leftHit ? childIndices.x : childIndices.y;
+				continue;
+			}
+		}
+		else
+		{
+			for (int i = 0; i < childIndices.w; ++i)
+			{
+				TestSphere(ray, atomIndices[childIndices.z + i], intersection);
+			}
+		}
+
+		// The next waiting node that still starts before the closest hit so far
+		do
+		{
+			if (stackSize == 0)
+			{
+				return;
+			}
+
+			--stackSize;
+		} while (stackEntries[stackSize] >= intersection.distance);
+
+		index = stackNodes[stackSize];
+	}
+}
+
+// Any-hit walk for shadow and occlusion rays: true as soon as a sphere is hit in (0, maxDistance),
+// so the order of the children does not matter
+bool IsOccluded(Ray ray, float maxDistance)
+{
+	++gRayCount;
+	float entry;
+	if (!EnterBox(ray, nodes[0].boxMin.xyz, nodes[0].boxMax.xyz, maxDistance, entry))
+	{
+		return false;
+	}
+
+	int stack[KDTREE_STACK_SIZE];
+	int stackSize = 0;
+	int index = 0;
+	while (true)
+	{
+		++gNodeVisits;
+		ivec4 childIndices = nodes[index].childIndices;
+		if (childIndices.x >= 0)
+		{
+			bool leftHit = EnterBox(ray, nodes[childIndices.x].boxMin.xyz, nodes[childIndices.x].boxMax.xyz, maxDistance, entry);
+			bool rightHit = EnterBox(ray, nodes[childIndices.y].boxMin.xyz, nodes[childIndices.y].boxMax.xyz, maxDistance, entry);
+			if (leftHit && rightHit && stackSize < KDTREE_STACK_SIZE)
+			{
+				stack[stackSize] = childIndices.y;
+				++stackSize;
+			}
+
+			if (leftHit || rightHit)
+			{
+				index = leftHit ? childIndices.x : childIndices.y;
+				continue;
+			}
+		}
+		else
+		{
+			for (int i = 0; i < childIndices.w; ++i)
+			{
+				++gSphereTests;
+				int globalIndex = atomIndices[childIndices.z + i];
+				float t = HitSphereOutside(ray, bufferSpheres[globalIndex].center.xyz, bufferSpheres[globalIndex].properties.x);
+				if (t > 0.0 && t < maxDistance)
 				{
-					farNodes[nIndex] = farNodeIndex;
-					index = finalIndex;
-					++nIndex;
+					return true;
 				}
 			}
+		}
+
+		if (stackSize == 0)
+		{
+			return false;
+		}
+
+		--stackSize;
+		index = stack[stackSize];
+	}
+}
+
+uniform bool uUseParentLinks = false;
+
+const int FROM_PARENT = 0;
+const int FROM_SIBLING = 1;
+const int FROM_CHILD = 2;
+
+// The child whose box center comes first along the ray, the same on the way down and up
+int NearChild(Ray ray, int index)
+{
+	ivec4 children = nodes[index].childIndices;
+	vec3 leftCenter = nodes[children.x].boxMin.xyz + nodes[children.x].boxMax.xyz;
+	vec3 rightCenter = nodes[children.y].boxMin.xyz + nodes[children.y].boxMax.xyz;
+	return dot(leftCenter - rightCenter, ray.dir) <= 0.0 ? children.x : children.y;
+}
+
+int Sibling(int index)
+{
+	ivec4 children = nodes[parentIndices[index]].childIndices;
+	return children.x == index ? children.y : children.x;
+}
+
+// Stackless walk over the parent links that finds the closest hit, without the per-invocation
+// stack arrays of TraverseKDTree. Children are visited near one first and the state says where
+// the walk came from, so going back up finds the next subtree. Subtrees whose box starts behind the
+// closest hit so far are skipped
+void TraverseKDTreeParentLinks(Ray ray, inout Intersection intersection)
+{
+	int index = 0;
+	int state = FROM_PARENT;
+	while (true)
+	{
+		if (state == FROM_CHILD)
+		{
+			if (index == 0)
+			{
+				return;
+			}
+
+			int parent = parentIndices[index];
+			if (index == NearChild(ray, parent))
+			{
+				index = Sibling(index);
+				state = FROM_SIBLING;
+			}
 			else
 			{
-				KDTreeNode node = nodes[index];
-				for (int i = 0; i < KDTREE_MAX_INDICES; ++i)
-				{
-					int globalIndex = node.atomIndices[i];
-					if (globalIndex < 0)
-					{
-						break;
-					}
-
-					vec3 p = bufferSpheres[globalIndex].center.xyz;
-					float t = HitSphereOutside(ray, p, bufferSpheres[globalIndex].properties.x);
-					if (t > MIN_DISTANCE && t < intersection.distance)
-					{
-						intersection.distance = t;
-						intersection.hitPoint = ray.origin + t * ray.dir;
-						intersection.normal = normalize(intersection.hitPoint - bufferSpheres[globalIndex].center.xyz);
-						intersection.sphereIndex = globalIndex;
-					}
-				}
+				index = parent;
+			}
 
-				if (intersection.distance != MAX_DISTANCE)
-				{
-					break;
-				}
+			continue;
+		}
 
-				bool end = true;
-				for (int i = nIndex; i >= 0; --i)
-				{
-					--nIndex;
-					if (farNodes[i] >= 0)
-					{
-						index = farNodes[i];
-						farNodes[i] = -1;
-						end = false;
-						break;
-					}
-				}
+		++gNodeVisits;
+		float entry;
+		if (EnterBox(ray, nodes[index].boxMin.xyz, nodes[index].boxMax.xyz, intersection.distance, entry))
+		{
+			ivec4 childIndices = nodes[index].childIndices;
+			if (childIndices.x >= 0)
+			{
+				index = NearChild(ray, index);
+				state = FROM_PARENT;
+				continue;
+			}
 
-				if (end)
-				{
-					break;
-				}
+			for (int i = 0; i < childIndices.w; ++i)
+			{
+				TestSphere(ray, atomIndices[childIndices.z + i], intersection);
 			}
 		}
 
-		// Check for scene spheres intersections
-		/*for (int i = 0; i < uSpheresCount; ++i)
+		// Done with this subtree, the far sibling of a near child is next, otherwise the parent is
+		if (index == 0)
 		{
-			vec3 p = bufferSpheres[i].center.xyz;
-			float t = HitSphereOutside(ray, p, bufferSpheres[i].properties.x);
-			if (t > MIN_DISTANCE && t < intersection.distance)
+			return;
+		}
+
+		if (state == FROM_PARENT)
+		{
+			index = Sibling(index);
+			state = FROM_SIBLING;
+		}
+		else
+		{
+			index = parentIndices[index];
+			state = FROM_CHILD;
+		}
+	}
+}
+
+uniform bool uUseCompactKDTree = false;
+uniform vec3 uCompactKDTreeMin;
+uniform vec3 uCompactKDTreeMax;
+
+const uint COMPACT_KDTREE_LEAF = 3u;
+
+// CompactKDTree::MaxDepth, defined by MainLayer like KDTREE_STACK_SIZE
+#ifndef COMPACT_KDTREE_MAX_DEPTH
+#error COMPACT_KDTREE_MAX_DEPTH is defined by the application
+#endif
+
+// Front to back walk over the split planes, a leaf only has to be left for the far side when no
+// hit was found before the end of its t interval
+void TraverseCompactKDTree(Ray ray, inout Intersection intersection)
+{
+	vec3 t1 = (uCompactKDTreeMin - ray.origin) / ray.dir;
+	vec3 t2 = (uCompactKDTreeMax - ray.origin) / ray.dir;
+	vec3 tNear = min(t1, t2);
+	vec3 tFar = max(t1, t2);
+	float tMin = max(max(max(tNear.x, tNear.y), tNear.z), 0.0);
+	float tMax = min(min(tFar.x, tFar.y), tFar.z);
+	if (tMin > tMax)
+	{
+		return;
+	}
+
+	uint todoNodes[COMPACT_KDTREE_MAX_DEPTH];
+	vec2 todoIntervals[COMPACT_KDTREE_MAX_DEPTH];
+	int todoCount = 0;
+	uint index = 0u;
+	while (intersection.distance >= tMin)
+	{
+		++gNodeVisits;
+		uvec2 node = compactNodes[index];
+		uint axis = node.y & 3u;
+		if (axis != COMPACT_KDTREE_LEAF)
+		{
+			float split = uintBitsToFloat(node.x);
+			float tPlane = (split - ray.origin[axis]) / ray.dir[axis];
+			bool belowFirst = ray.origin[axis] < split || (ray.origin[axis] == split && ray.dir[axis] <= 0.0);
+			uint firstChild = belowFirst ? index + 1u : node.y >> 2;
+			uint secondChild = belowFirst ? node.y >> 2 : index + 1u;
+			if (tPlane > tMax || tPlane <= 0.0)
 			{
-				intersection.distance = t;
-				intersection.hitPoint = ray.origin + t * ray.dir;
-				intersection.normal = normalize(intersection.hitPoint - bufferSpheres[i].center.xyz);
-				intersection.sphereIndex = i;
+				index = firstChild;
 			}
-		}*/
+			else if (tPlane < tMin)
+			{
+				index = secondChild;
+			}
+			else
+			{
+				todoNodes[todoCount] = secondChild;
+				todoIntervals[todoCount] = vec2(tPlane, tMax);
+				++todoCount;
+				index = firstChild;
+				tMax = tPlane;
+			}
+
+			continue;
+		}
+
+		uint atomCount = node.y >> 2;
+		for (uint i = 0u; i < atomCount; ++i)
+		{
+			TestSphere(ray, compactAtomIndices[node.x + i], intersection);
+		}
+
+		if (todoCount == 0)
+		{
+			break;
+		}
+
+		--todoCount;
+		index = todoNodes[todoCount];
+		tMin = todoIntervals[todoCount].x;
+		tMax = todoIntervals[todoCount].y;
+	}
+}
+
+// Distance field of the molecular surface, sparse bricks of 8^3 samples built by
+// MolecularSurface on the CPU. Bricks without samples read as +/-uSurfaceBandWidth
+layout(std430, binding = 8) buffer SurfaceBricks
+{
+	uint surfaceBricks[]; // Slot of every brick, x fastest, 0xFFFFFFFF empty, 0xFFFFFFFE interior
+};
+
+layout(std430, binding = 9) buffer SurfaceDistances
+{
+	float surfaceDistances[]; // 512 per slot, x fastest
+};
+
+layout(std430, binding = 10) buffer SurfaceNearestAtoms
+{
+	uint surfaceNearestAtoms[]; // Sphere whose color and material the sample takes
+};
+
+uniform bool uSurface = false;
+uniform vec3 uSurfaceOrigin;
+uniform float uSurfaceVoxelSize;
+uniform float uSurfaceBandWidth;
+uniform ivec3 uSurfaceBrickCounts;
+
+const uint emptyBrick = 0xFFFFFFFFu;
+const uint interiorBrick = 0xFFFFFFFEu;
+const int maxSurfaceSteps = 1024;
+const float surfaceHitDistance = 0.05; // In voxels
+
+uint GetSurfaceBrick(ivec3 brick)
+{
+	if (any(lessThan(brick, ivec3(0))) || any(greaterThanEqual(brick, uSurfaceBrickCounts)))
+		return emptyBrick;
+	return surfaceBricks[(brick.z * uSurfaceBrickCounts.y + brick.y) * uSurfaceBrickCounts.x + brick.x];
+}
+
+float GetSurfaceDistance(ivec3 voxel)
+{
+	uint slot = GetSurfaceBrick(voxel >> 3);
+	if (slot == emptyBrick)
+		return uSurfaceBandWidth;
+	if (slot == interiorBrick)
+		return -uSurfaceBandWidth;
+
+	ivec3 local = voxel & 7;
+	return surfaceDistances[slot * 512u + uint((local.z * 8 + local.y) * 8 + local.x)];
+}
+
+// Trilinear like MolecularSurface::SampleDistance()
+float SampleSurface(vec3 position)
+{
+	vec3 local = (position - uSurfaceOrigin) / uSurfaceVoxelSize;
+	vec3 base = floor(local);
+	vec3 f = local - base;
+	ivec3 voxel = ivec3(base);
+
+	float d00 = mix(GetSurfaceDistance(voxel), GetSurfaceDistance(voxel + ivec3(1, 0, 0)), f.x);
+	float d10 = mix(GetSurfaceDistance(voxel + ivec3(0, 1, 0)), GetSurfaceDistance(voxel + ivec3(1, 1, 0)), f.x);
+	float d01 = mix(GetSurfaceDistance(voxel + ivec3(0, 0, 1)), GetSurfaceDistance(voxel + ivec3(1, 0, 1)), f.x);
+	float d11 = mix(GetSurfaceDistance(voxel + ivec3(0, 1, 1)), GetSurfaceDistance(voxel + ivec3(1, 1, 1)), f.x);
+	return mix(mix(d00, d10, f.y), mix(d01, d11, f.y), f.z);
+}
+
+int GetSurfaceNearestAtom(vec3 position)
+{
+	ivec3 voxel = ivec3(floor((position - uSurfaceOrigin) / uSurfaceVoxelSize + 0.5));
+	uint slot = GetSurfaceBrick(voxel >> 3);
+	if (slot == emptyBrick || slot == interiorBrick)
+		return 0;
+
+	ivec3 local = voxel & 7;
+	return int(surfaceNearestAtoms[slot * 512u + uint((local.z * 8 + local.y) * 8 + local.x)]);
+}
+
+// Sphere tracing, CpuRaytracer::TraceSurface(): empty bricks are skipped whole, in the others the
+// ray advances by the sampled distance. Hits sit just outside the surface
+void TraceSurface(Ray ray, inout Intersection intersection)
+{
+	vec3 boxMax = uSurfaceOrigin + vec3(uSurfaceBrickCounts * 8 - 1) * uSurfaceVoxelSize;
+	vec3 t1 = (uSurfaceOrigin - ray.origin) / ray.dir;
+	vec3 t2 = (boxMax - ray.origin) / ray.dir;
+	vec3 tNear = min(t1, t2);
+	vec3 tFar = max(t1, t2);
+	float t = max(max(max(tNear.x, tNear.y), tNear.z), 0.0);
+	float tExit = min(min(min(tFar.x, tFar.y), tFar.z), intersection.distance);
+
+	float brickEdge = 8.0 * uSurfaceVoxelSize;
+	float hitDistance = surfaceHitDistance * uSurfaceVoxelSize;
+	for (int i = 0; i < maxSurfaceSteps && t < tExit; ++i)
+	{
+		++gNodeVisits;
+		vec3 position = ray.origin + t * ray.dir;
+		ivec3 brick = clamp(ivec3(floor((position - uSurfaceOrigin) / brickEdge)), ivec3(0), uSurfaceBrickCounts - 1);
+		uint slot = GetSurfaceBrick(brick);
+		if (slot == emptyBrick)
+		{
+			vec3 brickMin = uSurfaceOrigin + vec3(brick) * brickEdge;
+			vec3 brickExit = max((brickMin - ray.origin) / ray.dir, (brickMin + brickEdge - ray.origin) / ray.dir);
+			t = max(min(min(brickExit.x, brickExit.y), brickExit.z), t) + 1e-3 * uSurfaceVoxelSize;
+			continue;
+		}
+
+		float d = slot == interiorBrick ? -uSurfaceBandWidth : SampleSurface(position);
+		if (d < hitDistance)
+		{
+			float h = 0.5 * uSurfaceVoxelSize;
+			vec3 gradient = vec3(
+				SampleSurface(position + vec3(h, 0.0, 0.0)) - SampleSurface(position - vec3(h, 0.0, 0.0)),
+				SampleSurface(position + vec3(0.0, h, 0.0)) - SampleSurface(position - vec3(0.0, h, 0.0)),
+				SampleSurface(position + vec3(0.0, 0.0, h)) - SampleSurface(position - vec3(0.0, 0.0, h)));
+
+			intersection.distance = t;
+			intersection.normal = length(gradient) > 0.0 ? normalize(gradient) : -ray.dir;
+			intersection.hitPoint = position + 2.0 * hitDistance * intersection.normal;
+			intersection.sphereIndex = GetSurfaceNearestAtom(position);
+			return;
+		}
+
+		t += d;
+	}
+}
+
+Intersection FindNearestIntersection(Ray ray)
+{
+	++gRayCount;
+	Intersection intersection;
+	intersection.sphereIndex = -2;
+	intersection.distance = MAX_DISTANCE;
+	intersection.ray = ray;
+
+	if (uSurface)
+	{
+		TraceSurface(ray, intersection);
+	}
+	else if (uUseCompactKDTree)
+	{
+		TraverseCompactKDTree(ray, intersection);
+	}
+	else if (uUseParentLinks)
+	{
+		TraverseKDTreeParentLinks(ray, intersection);
+	}
+	else
+	{
+		TraverseKDTree(ray, intersection);
 	}
 
 	// Check for light intersection
-	float lightT = HitSphereOutside(ray, uLightPosition, 0.5);
+	float lightT = HitSphereOutside(ray, uLightPosition, lightRadius);
 	if (lightT > MIN_DISTANCE && lightT < intersection.distance)
 	{
 		intersection.distance = lightT;
@@ -241,16 +632,159 @@ Intersection FindNearestIntersection(Ray ray)
 	return intersection;
 }
 
+uniform bool uShadows = false;
+
+const float shadowFactor = 0.35;
+
+// Image-based lighting precomputed by EnvironmentLighting on the CPU
+uniform bool uUseIBL = false;
+uniform vec3 uIrradianceSH[9];    // Convolved with the cosine lobe and divided by pi
+uniform sampler2D uSpecular;      // Equirectangular, level i prefiltered for roughness i / (uSpecularLevelCount - 1)
+uniform int uSpecularLevelCount;
+uniform sampler2D uBrdfTable;     // x = scale, y = bias of F0 by N.V and roughness
+
+// Cook-Torrance shading of the light, on top of an ambient or the image-based term
+uniform bool uDirectLighting = false;
+uniform int uMaterialCount;
+
+// Per-atom ambient occlusion baked by BakeAmbientOcclusion() on the CPU
+uniform bool uAmbientOcclusion = false;
+
+const float PI = 3.14159265;
+const float lightIntensity = PI; // A white Lambertian sphere shows its albedo where it faces the light
+const float ambientFactor = 0.1;
+const float minRoughness = 0.045;
+const BufferMaterial defaultMaterial = BufferMaterial(vec4(0.0, 0.5, 0.04, 0.0));
+
+BufferMaterial GetMaterial(int sphereIndex)
+{
+	uint materialIndex = floatBitsToUint(bufferSpheres[sphereIndex].properties.w) & 0xFFFFu;
+	return materialIndex < uint(uMaterialCount) ? bufferMaterials[materialIndex] : defaultMaterial;
+}
+
+vec3 GetF0(vec3 albedo, BufferMaterial material)
+{
+	return mix(vec3(material.properties.z), albedo, material.properties.x);
+}
+
+// BRDF times N.L: GGX distribution, Smith-Schlick visibility for analytic lights (Karis 2013) and
+// Schlick's Fresnel over a Lambertian base. EvaluateCookTorrance() of Shading.cpp
+vec3 EvaluateCookTorrance(vec3 albedo, BufferMaterial material, vec3 normal, vec3 view, vec3 light)
+{
+	float NdotL = dot(normal, light);
+	float NdotV = dot(normal, view);
+	if (NdotL <= 0.0 || NdotV <= 0.0)
+		return vec3(0.0);
+
+	vec3 halfVector = normalize(view + light);
+	float NdotH = max(dot(normal, halfVector), 0.0);
+	float VdotH = max(dot(view, halfVector), 0.0);
+
+	float roughness = max(material.properties.y, minRoughness);
+	float alpha2 = roughness * roughness * roughness * roughness;
+	float denominator = NdotH * NdotH * (alpha2 - 1.0) + 1.0;
+	float distribution = alpha2 / (PI * denominator * denominator);
+
+	float k = (roughness + 1.0) * (roughness + 1.0) / 8.0;
+	float visibility = 1.0 / (4.0 * (NdotV * (1.0 - k) + k) * (NdotL * (1.0 - k) + k));
+
+	vec3 f0 = GetF0(albedo, material);
+	vec3 fresnel = f0 + (1.0 - f0) * pow(1.0 - VdotH, 5.0);
+
+	vec3 diffuse = (1.0 - fresnel) * (1.0 - material.properties.x) * albedo / PI;
+	return (diffuse + fresnel * (distribution * visibility)) * NdotL;
+}
+
+vec2 ToEquirect(vec3 direction)
+{
+	return vec2(atan(direction.z, direction.x) / (2.0 * PI) + 0.5, acos(clamp(direction.y, -1.0, 1.0)) / PI);
+}
+
+vec3 EvaluateIrradiance(vec3 n)
+{
+	vec3 irradiance = uIrradianceSH[0] * 0.282095
+		+ uIrradianceSH[1] * 0.488603 * n.y
+		+ uIrradianceSH[2] * 0.488603 * n.z
+		+ uIrradianceSH[3] * 0.488603 * n.x
+		+ uIrradianceSH[4] * 1.092548 * n.x * n.y
+		+ uIrradianceSH[5] * 1.092548 * n.y * n.z
+		+ uIrradianceSH[6] * 0.315392 * (3.0 * n.z * n.z - 1.0)
+		+ uIrradianceSH[7] * 1.092548 * n.x * n.z
+		+ uIrradianceSH[8] * 0.546274 * (n.x * n.x - n.y * n.y);
+	return max(irradiance, vec3(0.0));
+}
+
+vec3 SampleSpecular(vec3 direction, float roughness)
+{
+	return textureLod(uSpecular, ToEquirect(direction), roughness * float(uSpecularLevelCount - 1)).rgb;
+}
+
+// Split-sum lighting of the material, the diffuse base gets the light the specular reflection leaves
+vec3 ShadeImageBased(vec3 albedo, BufferMaterial material, vec3 normal, vec3 view)
+{
+	float NdotV = max(dot(normal, view), 1e-4);
+	float roughness = material.properties.y;
+	vec2 brdf = texture(uBrdfTable, vec2(NdotV, roughness)).rg;
+	vec3 specularWeight = GetF0(albedo, material) * brdf.x + brdf.y;
+	vec3 specular = SampleSpecular(reflect(-view, normal), roughness) * specularWeight;
+	return (1.0 - specularWeight) * (1.0 - material.properties.x) * albedo * EvaluateIrradiance(normal) + specular;
+}
+
 vec3 GetFragColorFromIntersection(Intersection intersection)
 {
 	if (intersection.sphereIndex == -1)
 		return lightColor;
 	else if (intersection.sphereIndex == -2)
-		return texture(uCubemap, intersection.ray.dir).rgb;
+		return uUseIBL ? SampleSpecular(intersection.ray.dir, 0.0) : texture(uCubemap, intersection.ray.dir).rgb;
 	else if (intersection.sphereIndex == -3)
 		return vec3(0.0);
-	else
-		return bufferSpheres[intersection.sphereIndex].surfaceColor.rgb;
+
+	vec3 albedo = bufferSpheres[intersection.sphereIndex].surfaceColor.rgb;
+	BufferMaterial material = GetMaterial(intersection.sphereIndex);
+	vec3 view = -intersection.ray.dir;
+
+	vec3 color = albedo;
+	if (uUseIBL)
+		color = ShadeImageBased(albedo, material, intersection.normal, view);
+	else if (uDirectLighting)
+		color = ambientFactor * albedo;
+
+	// Only the light arriving from all around is occluded, never the direct light
+	if (uAmbientOcclusion)
+		color *= 1.0 - float(floatBitsToUint(bufferSpheres[intersection.sphereIndex].properties.w) >> 16) / 65535.0;
+
+	if (!uShadows && !uDirectLighting)
+		return color;
+
+	// The shadow ray aims at a point of the disk the light sphere covers seen from the hit, so the
+	// accumulated samples integrate the penumbra
+	vec3 origin = intersection.hitPoint + 0.001 * intersection.normal;
+	vec3 axis = normalize(uLightPosition - origin);
+	float axisSign = axis.z >= 0.0 ? 1.0 : -1.0;
+	float a = -1.0 / (axisSign + axis.z);
+	float b = axis.x * axis.y * a;
+	vec3 tangent = vec3(1.0 + axisSign * axis.x * axis.x * a, axisSign * b, -axisSign * axis.x);
+	vec3 bitangent = vec3(b, axisSign + axis.y * axis.y * a, -axis.y);
+	vec3 lightPoint = uLightPosition + lightRadius * (uLightSample.x * tangent + uLightSample.y * bitangent);
+
+	// Any sphere between the hit and the light sphere shadows it, the light itself is not an occluder
+	vec3 toLight = lightPoint - origin;
+	float lightDistance = length(toLight);
+	vec3 lightDir = toLight / lightDistance;
+	bool inShadow = uShadows && IsOccluded(Ray(origin, lightDir), lightDistance - lightRadius);
+
+	// With direct light a shadow only takes the light away, without it the whole color darkens
+	if (uDirectLighting)
+	{
+		if (!inShadow)
+			color += EvaluateCookTorrance(albedo, material, intersection.normal, view, lightDir) * lightIntensity;
+	}
+	else if (inShadow)
+	{
+		color *= shadowFactor;
+	}
+
+	return color;
 }
 
 uniform int uMaxDepth = 1;
@@ -285,7 +819,12 @@ vec3 trace(Ray primaryRay)
 					gIntersections[pushIntersectionIndex] = reflectIntersection;
 				}
 
-				// Refract
+				// Refract, the molecular surface is opaque
+				if (uSurface)
+				{
+					gIntersections[pushIntersectionIndex + 1].sphereIndex = -3;
+				}
+				else
 				{
 					vec3 refractDir = normalize(refract(intersection.ray.dir, intersection.normal, 1.0 / 1.45));
 					Ray refractRay = Ray(intersection.hitPoint + 0.001 * refractDir, refractDir);
@@ -340,12 +879,59 @@ vec3 trace(Ray primaryRay)
 	}
 }
 
+// Progressive accumulation while the camera is still. rgb sums the linear colors of all samples
+// of the pixel, a counts them. Sample 0 starts over, once uMaxSamples are in the pixel is only
+// resolved and nothing is traced anymore
+uniform bool uAccumulate;
+uniform int uSampleIndex;
+uniform int uMaxSamples;
+layout(binding = 0, rgba32f) uniform image2D uAccumulation;
+
+// Rays, node visits and sphere tests of the whole frame, zeroed by the application before the draw
+uniform bool uCollectStatistics = false;
+
+layout(std430, binding = 6) buffer TraversalStatistics
+{
+	uint statisticsRayCount;
+	uint statisticsNodeVisits;
+	uint statisticsSphereTests;
+};
+
+void AddStatistics()
+{
+	if (uCollectStatistics)
+	{
+		atomicAdd(statisticsRayCount, gRayCount);
+		atomicAdd(statisticsNodeVisits, gNodeVisits);
+		atomicAdd(statisticsSphereTests, gSphereTests);
+	}
+}
+
 void main()
 {
 	Ray ray;
 	ray.origin = vOrigin;
 	ray.dir = normalize(vRay);
 
-	vec3 color = trace(ray);
-	oFragColor = vec4(pow(color, vec3(1.0 / 2.2)), 1.0);
+	if (!uAccumulate)
+	{
+		vec3 color = trace(ray);
+		AddStatistics();
+		oFragColor = vec4(pow(color, vec3(1.0 / 2.2)), 1.0);
+		return;
+	}
+
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec4 accumulation = uSampleIndex > 0 ? imageLoad(uAccumulation, pixel) : vec4(0.0);
+	if (uSampleIndex < uMaxSamples)
+	{
+		// Refractions at grazing angles can end in NaN, which would spoil every later average
+		vec3 color = trace(ray);
+		if (!any(isnan(color)))
+			accumulation += vec4(color, 1.0);
+		imageStore(uAccumulation, pixel, accumulation);
+		AddStatistics();
+	}
+
+	oFragColor = vec4(pow(accumulation.rgb / max(accumulation.a, 1.0), vec3(1.0 / screenGamma)), 1.0);
 }
@@ -0,0 +1,152 @@
+#include "AmbientOcclusion.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Core/ThreadPool.h"
+#include "Core/Timer.h"
+
+static constexpr float Pi = 3.14159265358979f;
+
+// Atoms per task, enough work to hide the scheduling and few enough to balance buried and
+// exposed regions across the threads
+static constexpr uint32_t AtomsPerTask = 256;
+
+static uint32_t HashAtomIndex(uint32_t value)
+{
+	value ^= value >> 16;
+	value *= 0x7FEB352Du;
+	value ^= value >> 15;
+	value *= 0x846CA68Bu;
+	return value ^ (value >> 16);
+}
+
+static float Fract(float value)
+{
+	return value - std::floor(value);
+}
+
+OcclusionRay GetOcclusionRay(const glm::vec3& center, float radius, uint32_t atomIndex, uint32_t rayIndex, uint32_t rayCount)
+{
+	const uint32_t hash = HashAtomIndex(atomIndex);
+	const float rotation = (hash & 0xFFFF) / 65536.0f;
+	const float offset = (hash >> 16) / 65536.0f;
+
+	// Fibonacci spiral for the start points on the sphere
+	constexpr float goldenAngle = 2.39996323f;
+	const float z = 1.0f - 2.0f * (rayIndex + 0.5f) / rayCount;
+	const float ringRadius = std::sqrt(std::max(1.0f - z * z, 0.0f));
+	const float phi = rayIndex * goldenAngle + 2.0f * Pi * rotation;
+	const glm::vec3 normal(ringRadius * std::cos(phi), ringRadius * std::sin(phi), z);
+
+	// Orthonormal basis of Duff et al. 2017 around the normal
+	const float sign = std::copysign(1.0f, normal.z);
+	const float a = -1.0f / (sign + normal.z);
+	const float b = normal.x * normal.y * a;
+	const glm::vec3 tangent(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+	const glm::vec3 bitangent(b, sign + normal.y * normal.y * a, -normal.y);
+
+	// R2 sequence for the cosine-weighted directions
+	const float u = Fract(offset + rayIndex * 0.7548776662f);
+	const float v = Fract(rotation + rayIndex * 0.5698402910f);
+	const float sinTheta = std::sqrt(u);
+	const float lobePhi = 2.0f * Pi * v;
+	const glm::vec3 direction = tangent * (sinTheta * std::cos(lobePhi)) + bitangent * (sinTheta * std::sin(lobePhi)) + normal * std::sqrt(1.0f - u);
+
+	OcclusionRay ray;
+	ray.origin = center + normal * (radius * 1.0001f);
+	ray.direction = glm::normalize(direction);
+	return ray;
+}
+
+static bool HitsBox(const OcclusionRay& ray, const glm::vec3& invDir, const ArrayNode& node, float maxDistance)
+{
+	const glm::vec3 tMin = (glm::vec3(node.boxMin) - ray.origin) * invDir;
+	const glm::vec3 tMax = (glm::vec3(node.boxMax) - ray.origin) * invDir;
+	const glm::vec3 t1 = glm::min(tMin, tMax);
+	const glm::vec3 t2 = glm::max(tMin, tMax);
+	const float entry = std::max(std::max(t1.x, t1.y), t1.z);
+	const float exit = std::min(std::min(t2.x, t2.y), t2.z);
+	return entry <= exit && exit > 0.0f && entry < maxDistance;
+}
+
+// Any sphere but the atom's own that the ray is inside of or enters before maxDistance, walked
+// like the shadow rays of CpuRaytracer::IsOccluded()
+static bool IsOccluded(const OcclusionRay& ray, float maxDistance, uint32_t self, const std::vector<ArrayNode>& nodes, const std::vector<uint32_t>& atomIndices,
+	const std::vector<glm::vec4>& spheres)
+{
+	const glm::vec3 invDir = 1.0f / ray.direction;
+	const auto entersBox = [&](const ArrayNode& node) { return HitsBox(ray, invDir, node, maxDistance); };
+	const auto hitsLeaf = [&](const ArrayNode& leaf)
+	{
+		for (int i = 0; i < leaf.childIndices.w; ++i)
+		{
+			const uint32_t atomIndex = atomIndices[leaf.childIndices.z + i];
+			if (atomIndex == self)
+				continue;
+
+			const glm::vec4& sphere = spheres[atomIndex];
+			const glm::vec3 toOrigin = ray.origin - glm::vec3(sphere);
+			const float b = glm::dot(toOrigin, ray.direction);
+			const float discriminant = b * b - (glm::dot(toOrigin, toOrigin) - sphere.w * sphere.w);
+			if (discriminant < 0.0f)
+				continue;
+
+			const float root = std::sqrt(discriminant);
+			if (-b + root > 0.0f && -b - root < maxDistance)
+				return true;
+		}
+
+		return false;
+	};
+
+	uint64_t nodeVisits = 0;
+	return FindAnyHit(nodes.data(), nodes.size(), entersBox, hitsLeaf, nodeVisits);
+}
+
+AmbientOcclusionStatistics BakeAmbientOcclusion(const AtomKDTree& tree, std::vector<Sphere>& spheres, const AmbientOcclusionSpecification& specification)
+{
+	return BakeAmbientOcclusion(CreateArrayNodes(tree), tree.GetAtomIndices(), spheres, specification);
+}
+
+AmbientOcclusionStatistics BakeAmbientOcclusion(const std::vector<ArrayNode>& nodes, const std::vector<uint32_t>& atomIndices, std::vector<Sphere>& spheres,
+	const AmbientOcclusionSpecification& specification)
+{
+	Timer timer;
+	AmbientOcclusionStatistics stats;
+	stats.atomCount = spheres.size();
+	if (spheres.empty() || nodes.empty())
+		return stats;
+
+	const uint32_t rayCount = std::max(specification.rayCount, 1u);
+
+	// Center and radius next to each other, Sphere itself is three times as large
+	std::vector<glm::vec4> packedSpheres(spheres.size());
+	for (size_t i = 0; i < spheres.size(); ++i)
+		packedSpheres[i] = glm::vec4(glm::vec3(spheres[i].position), spheres[i].radius);
+
+	ThreadPool pool(specification.threadCount);
+	stats.threadCount = pool.GetThreadCount();
+	const uint32_t taskCount = static_cast<uint32_t>((spheres.size() + AtomsPerTask - 1) / AtomsPerTask);
+	pool.ParallelFor(taskCount, [&](uint32_t task)
+	{
+		const uint32_t begin = task * AtomsPerTask;
+		const uint32_t end = static_cast<uint32_t>(std::min<size_t>(begin + AtomsPerTask, spheres.size()));
+		for (uint32_t atom = begin; atom < end; ++atom)
+		{
+			const glm::vec4& sphere = packedSpheres[atom];
+			uint32_t blocked = 0;
+			for (uint32_t ray = 0; ray < rayCount; ++ray)
+			{
+				const OcclusionRay occlusionRay = GetOcclusionRay(glm::vec3(sphere), sphere.w, atom, ray, rayCount);
+				blocked += IsOccluded(occlusionRay, specification.maxDistance, atom, nodes, atomIndices, packedSpheres);
+			}
+
+			spheres[atom].occlusion = static_cast<uint16_t>((static_cast<uint64_t>(blocked) * 65535u + rayCount / 2) / rayCount);
+		}
+	});
+
+	stats.rayCount = static_cast<uint64_t>(spheres.size()) * rayCount;
+	stats.milliseconds = timer.ElapsedNs() / 1e6f;
+	return stats;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "AtomLoader.h"
+#include "AtomKDTree.h"
+#include "Scene.h"
+
+struct AmbientOcclusionSpecification
+{
+	uint32_t rayCount = 64;     // Per atom, each one leaves its own point of the sphere surface
+	float maxDistance = 6.0f;   // Spheres further along a ray than this do not occlude it
+	uint32_t threadCount = 0;   // 0 means one thread per hardware core, 1 bakes on the calling thread
+};
+
+struct AmbientOcclusionStatistics
+{
+	uint64_t atomCount = 0;
+	uint64_t rayCount = 0;
+	uint32_t threadCount = 0;
+	float milliseconds = 0.0f;
+
+	float GetAtomsPerSecond() const { return milliseconds > 0.0f ? atomCount / (milliseconds * 1e-3f) : 0.0f; }
+	float GetMraysPerSecond() const { return milliseconds > 0.0f ? rayCount / (milliseconds * 1e3f) : 0.0f; }
+};
+
+struct OcclusionRay
+{
+	glm::vec3 origin;
+	glm::vec3 direction;
+};
+
+// Ray rayIndex of the atom: starts on the surface of the sphere, on a spiral of points that covers
+// it evenly, and leaves into the cosine-weighted hemisphere above that point. The pattern is
+// rotated by a hash of atomIndex, so neighbouring atoms do not share their blind spots
+OcclusionRay GetOcclusionRay(const glm::vec3& center, float radius, uint32_t atomIndex, uint32_t rayIndex, uint32_t rayCount);
+
+// Writes Sphere::occlusion, the fraction of the rays of every atom that hit another sphere of the
+// tree within maxDistance. Rays that start inside a neighbour count as blocked, so buried atoms go
+// dark. spheres are the CreateSpheres() of the atoms the tree was built from
+AmbientOcclusionStatistics BakeAmbientOcclusion(const AtomKDTree& tree, std::vector<Sphere>& spheres,
+	const AmbientOcclusionSpecification& specification = AmbientOcclusionSpecification());
+// Same from the buffers of a built scene, nodes and atomIndices are the tree over the spheres
+AmbientOcclusionStatistics BakeAmbientOcclusion(const std::vector<ArrayNode>& nodes, const std::vector<uint32_t>& atomIndices, std::vector<Sphere>& spheres,
+	const AmbientOcclusionSpecification& specification = AmbientOcclusionSpecification());
@@ -1,97 +1,731 @@
 #include "AtomKDTree.h"
 
+#include <algorithm>
 #include <array>
+#include <functional>
 #include <limits>
 
-AtomKDTree::AtomKDTree(const std::vector<Atom>& atoms)
+#include "Core/Base.h"
+#include "Core/ThreadPool.h"
+
+// Subtrees with fewer atoms are built on the thread that split their parent
+static constexpr size_t ParallelBuildCutoff = 4096;
+
+// Nodes with more atoms bin their atoms on the whole pool instead of a single thread
+static constexpr size_t ParallelBinningCutoff = 1 << 16;
+
+static constexpr uint32_t MaxSAHBinCount = 64;
+
+// Positions per task of the batched queries, and atoms per task of the pair search
+static constexpr uint32_t QueriesPerTask = 1024;
+
+// Marks a node whose subtree was built by another task, offset is the index into Fragment::links
+static constexpr uint32_t LinkNode = KDTreeNode::InteriorNode - 1;
+
+struct BuildContext
+{
+	KDTreeBuilder builder;
+	uint32_t sahBinCount;
+	uint32_t maxLeafAtoms;
+	const Atom* atoms; // Start of the partitioned atoms, leaves store their offset from here
+	ThreadPool* pool;
+	TaskGroup* group;
+};
+
+// Nodes built by one task in depth-first order. Subtrees handed to other tasks leave a link node
+// behind, which is replaced by the nodes of their fragment when the tree is assembled
+struct Fragment
+{
+	std::vector<KDTreeNode> nodes;
+	std::vector<Scope<Fragment>> links;
+};
+
+struct SAHBin
+{
+	glm::vec3 boxMin;
+	glm::vec3 boxMax;
+	size_t count;
+};
+
+static const SAHBin EmptySAHBin = {
+	glm::vec3(std::numeric_limits<float>::max()),
+	glm::vec3(std::numeric_limits<float>::lowest()),
+	0
+};
+
+struct SAHSplit
+{
+	int axis = -1;
+	uint32_t bin = 0;
+	float cost = std::numeric_limits<float>::max();
+
+	// Exact bounds of both sides, the union of the bins on each side of the plane
+	glm::vec3 leftMin, leftMax;
+	glm::vec3 rightMin, rightMax;
+};
+
+static void ComputeBounds(const Atom* atoms, size_t count, glm::vec3& boxMin, glm::vec3& boxMax)
+{
+	boxMin = glm::vec3(std::numeric_limits<float>::max());
+	boxMax = glm::vec3(std::numeric_limits<float>::lowest());
+	for (size_t i = 0; i < count; ++i)
+	{
+		const glm::vec3 radius(atoms[i].atomTemplate->radius);
+		boxMin = glm::min(boxMin, atoms[i].position - radius);
+		boxMax = glm::max(boxMax, atoms[i].position + radius);
+	}
+}
+
+static void ComputeCenterBounds(const Atom* atoms, size_t count, glm::vec3& centerMin, glm::vec3& centerMax)
+{
+	centerMin = glm::vec3(std::numeric_limits<float>::max());
+	centerMax = glm::vec3(std::numeric_limits<float>::lowest());
+	for (size_t i = 0; i < count; ++i)
+	{
+		centerMin = glm::min(centerMin, atoms[i].position);
+		centerMax = glm::max(centerMax, atoms[i].position);
+	}
+}
+
+static float SurfaceArea(const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+	const glm::vec3 extent = glm::max(boxMax - boxMin, glm::vec3(0.0f));
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+static uint32_t SAHBinIndex(float position, float centerMin, float binScale, uint32_t binCount)
+{
+	return std::min(binCount - 1, static_cast<uint32_t>((position - centerMin) * binScale));
+}
+
+// Bins of all three axes, bins[axis * binCount + i]
+static void BinAtoms(const Atom* atoms, size_t count, const glm::vec3& centerMin, const glm::vec3& binScale, uint32_t binCount, SAHBin* bins)
+{
+	std::fill(bins, bins + 3 * binCount, EmptySAHBin);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const glm::vec3 radius(atoms[i].atomTemplate->radius);
+		const glm::vec3 atomMin = atoms[i].position - radius;
+		const glm::vec3 atomMax = atoms[i].position + radius;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			SAHBin& bin = bins[axis * binCount + SAHBinIndex(atoms[i].position[axis], centerMin[axis], binScale[axis], binCount)];
+			bin.boxMin = glm::min(bin.boxMin, atomMin);
+			bin.boxMax = glm::max(bin.boxMax, atomMax);
+			++bin.count;
+		}
+	}
+}
+
+static SAHSplit FindSAHSplit(const Atom* atoms, size_t count, float parentArea, uint32_t maxBinCount, ThreadPool* pool, glm::vec3& centerMin, glm::vec3& binScale, uint32_t& binCount)
 {
-	constexpr float minFloat = std::numeric_limits<float>::min();
-	constexpr float maxFloat = std::numeric_limits<float>::max();
-	for (int i = 0; i < 3; ++i)
+	// More bins than atoms cannot find better planes, only slows down the sweeps on small nodes
+	binCount = static_cast<uint32_t>(std::min<size_t>(maxBinCount, std::max<size_t>(count, 2)));
+
+	std::array<SAHBin, 3 * MaxSAHBinCount> bins;
+	glm::vec3 centerMax;
+	if (pool && count >= ParallelBinningCutoff)
+	{
+		const uint32_t blockCount = pool->GetThreadCount() * 4;
+		const size_t blockSize = (count + blockCount - 1) / blockCount;
+		auto blockRange = [&](uint32_t block, size_t& begin, size_t& size)
+		{
+			begin = std::min(count, block * blockSize);
+			size = std::min(count, begin + blockSize) - begin;
+		};
+
+		std::vector<glm::vec3> blockMin(blockCount), blockMax(blockCount);
+		pool->ParallelFor(blockCount, [&](uint32_t block)
+		{
+			size_t begin, size;
+			blockRange(block, begin, size);
+			ComputeCenterBounds(atoms + begin, size, blockMin[block], blockMax[block]);
+		});
+
+		ComputeCenterBounds(nullptr, 0, centerMin, centerMax);
+		for (uint32_t block = 0; block < blockCount; ++block)
+		{
+			centerMin = glm::min(centerMin, blockMin[block]);
+			centerMax = glm::max(centerMax, blockMax[block]);
+		}
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float extent = centerMax[axis] - centerMin[axis];
+			binScale[axis] = extent > 0.0f ? binCount / extent : 0.0f;
+		}
+
+		std::vector<SAHBin> blockBins(static_cast<size_t>(blockCount) * 3 * binCount);
+		pool->ParallelFor(blockCount, [&](uint32_t block)
+		{
+			size_t begin, size;
+			blockRange(block, begin, size);
+			BinAtoms(atoms + begin, size, centerMin, binScale, binCount, &blockBins[static_cast<size_t>(block) * 3 * binCount]);
+		});
+
+		std::fill(bins.begin(), bins.begin() + 3 * binCount, EmptySAHBin);
+		for (uint32_t block = 0; block < blockCount; ++block)
+		{
+			for (uint32_t i = 0; i < 3 * binCount; ++i)
+			{
+				const SAHBin& blockBin = blockBins[static_cast<size_t>(block) * 3 * binCount + i];
+				bins[i].boxMin = glm::min(bins[i].boxMin, blockBin.boxMin);
+				bins[i].boxMax = glm::max(bins[i].boxMax, blockBin.boxMax);
+				bins[i].count += blockBin.count;
+			}
+		}
+	}
+	else
 	{
-		m_BoxMin[i] = maxFloat;
-		m_BoxMax[i] = minFloat;
+		// Bins are laid out over the bounds of the atom centers, the split candidates are the
+		// planes between neighbouring bins
+		ComputeCenterBounds(atoms, count, centerMin, centerMax);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float extent = centerMax[axis] - centerMin[axis];
+			binScale[axis] = extent > 0.0f ? binCount / extent : 0.0f;
+		}
+
+		BinAtoms(atoms, count, centerMin, binScale, binCount, bins.data());
 	}
 
-	for (const Atom& atom : atoms)
+	SAHSplit best;
+	std::array<SAHBin, MaxSAHBinCount> rightBins;
+	for (int axis = 0; axis < 3; ++axis)
 	{
-		float radius = atom.atomTemplate->radius;
-		for (int i = 0; i < 3; ++i)
+		const SAHBin* axisBins = &bins[axis * binCount];
+
+		// rightBins[i] is the union of bins [i, binCount)
+		SAHBin accumulated = EmptySAHBin;
+		for (uint32_t i = binCount - 1; i > 0; --i)
 		{
-			const float currMin = atom.position[i] - radius;
-			const float currMax = atom.position[i] + radius;
+			accumulated.boxMin = glm::min(accumulated.boxMin, axisBins[i].boxMin);
+			accumulated.boxMax = glm::max(accumulated.boxMax, axisBins[i].boxMax);
+			accumulated.count += axisBins[i].count;
+			rightBins[i] = accumulated;
+		}
 
-			if (currMin < m_BoxMin[i])
+		accumulated = EmptySAHBin;
+		for (uint32_t i = 1; i < binCount; ++i)
+		{
+			accumulated.boxMin = glm::min(accumulated.boxMin, axisBins[i - 1].boxMin);
+			accumulated.boxMax = glm::max(accumulated.boxMax, axisBins[i - 1].boxMax);
+			accumulated.count += axisBins[i - 1].count;
+			const SAHBin& right = rightBins[i];
+			if (accumulated.count == 0 || right.count == 0)
 			{
-				m_BoxMin[i] = currMin;
+				continue;
 			}
-			if (currMax > m_BoxMax[i])
+
+			const float leftCost = SurfaceArea(accumulated.boxMin, accumulated.boxMax) * accumulated.count;
+			const float rightCost = SurfaceArea(right.boxMin, right.boxMax) * right.count;
+			const float cost = AtomKDTree::TraversalCost + AtomKDTree::IntersectionCost * (leftCost + rightCost) / parentArea;
+			if (cost < best.cost)
 			{
-				m_BoxMax[i] = currMax;
+				best.cost = cost;
+				best.axis = axis;
+				best.bin = i;
+				best.leftMin = accumulated.boxMin;
+				best.leftMax = accumulated.boxMax;
+				best.rightMin = right.boxMin;
+				best.rightMax = right.boxMax;
 			}
 		}
 	}
 
-	AAtomKDTree(std::vector<Atom>(atoms), 0);
+	return best;
+}
+
+static uint32_t PushNode(Fragment& fragment, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+	KDTreeNode node;
+	node.boxMin = boxMin;
+	node.boxMax = boxMax;
+	node.offset = 0;
+	node.atomCount = KDTreeNode::InteriorNode;
+	fragment.nodes.push_back(node);
+	return static_cast<uint32_t>(fragment.nodes.size() - 1);
+}
+
+static void MakeLeaf(KDTreeNode& node, const Atom* atoms, size_t count, const BuildContext& context)
+{
+	node.offset = static_cast<uint32_t>(atoms - context.atoms);
+	node.atomCount = static_cast<uint32_t>(count);
+}
+
+static void BuildNode(Atom* atoms, size_t count, const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t depth, Fragment& fragment, const BuildContext& context);
+
+// Builds the subtree into the fragment, or into a new fragment on another task if it is big
+static void BuildSubtree(Atom* atoms, size_t count, const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t depth, Fragment& fragment, const BuildContext& context)
+{
+	if (!context.group || count < ParallelBuildCutoff)
+	{
+		BuildNode(atoms, count, boxMin, boxMax, depth, fragment, context);
+		return;
+	}
+
+	const uint32_t linkIndex = PushNode(fragment, boxMin, boxMax);
+	fragment.nodes[linkIndex].offset = static_cast<uint32_t>(fragment.links.size());
+	fragment.nodes[linkIndex].atomCount = LinkNode;
+	fragment.links.push_back(CreateScope<Fragment>());
+
+	Fragment* subtree = fragment.links.back().get();
+	context.group->Run([=, &context]() { BuildNode(atoms, count, boxMin, boxMax, depth, *subtree, context); });
+}
+
+// Summed in double, a float sum of many atoms far from the origin can drift outside all of them.
+// Clamped to the centers anyway so the atom with the smallest one always goes left
+static float MeanSplitPlane(const Atom* atoms, size_t count, uint32_t axis)
+{
+	double totalAxisSum = 0.0;
+	float axisMin = std::numeric_limits<float>::max();
+	float axisMax = std::numeric_limits<float>::lowest();
+	for (size_t i = 0; i < count; ++i)
+	{
+		totalAxisSum += atoms[i].position[axis];
+		axisMin = std::min(axisMin, atoms[i].position[axis]);
+		axisMax = std::max(axisMax, atoms[i].position[axis]);
+	}
+
+	return std::clamp(static_cast<float>(totalAxisSum / count), axisMin, axisMax);
 }
 
-AtomKDTree::AtomKDTree(std::vector<Atom>&& atoms, const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t depth)
-	: m_BoxMin(boxMin), m_BoxMax(boxMax)
+// Atoms overlapping the plane go left, so the split fails when that is every atom or none
+static bool MeanSplitSeparates(const Atom* atoms, size_t count, uint32_t axis)
 {
-	AAtomKDTree(std::move(atoms), depth);
+	const float half = MeanSplitPlane(atoms, count, axis);
+	size_t leftCount = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (atoms[i].position[axis] - atoms[i].atomTemplate->radius <= half)
+			++leftCount;
+	}
+
+	return leftCount > 0 && leftCount < count;
 }
 
-void AtomKDTree::AAtomKDTree(std::vector<Atom>&& atoms, uint32_t depth)
+static void BuildMeanSplit(Atom* atoms, size_t count, const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t depth, Fragment& fragment, const BuildContext& context)
 {
+	const uint32_t nodeIndex = PushNode(fragment, boxMin, boxMax);
+	if (count <= context.maxLeafAtoms || depth >= AtomKDTree::MaxDepth)
+	{
+		MakeLeaf(fragment.nodes[nodeIndex], atoms, count, context);
+		return;
+	}
+
 	constexpr uint32_t AXIS_COUNT = 3;
 	uint32_t axis = depth % AXIS_COUNT;
 
-	float totalAxisSum = 0.0f;
-	for (const auto& atom : atoms)
+	float half = MeanSplitPlane(atoms, count, axis);
+	Atom* middle = std::partition(atoms, atoms + count, [&](const Atom& atom)
 	{
-		totalAxisSum += atom.position[axis];
+		return atom.position[axis] - atom.atomTemplate->radius <= half;
+	});
+
+	// A failed split only moves on to the next axis, when none of them separates the atoms the
+	// same atoms would be split forever
+	const size_t leftCount = middle - atoms;
+	if ((leftCount == 0 || leftCount == count) && !MeanSplitSeparates(atoms, count, (axis + 1) % AXIS_COUNT) && !MeanSplitSeparates(atoms, count, (axis + 2) % AXIS_COUNT))
+	{
+		MakeLeaf(fragment.nodes[nodeIndex], atoms, count, context);
+		return;
 	}
 
-	float half = totalAxisSum / atoms.size();
-	std::vector<Atom> left, right;
-	for (const Atom& atom : atoms)
+	glm::vec3 minHalfBounds = boxMin;
+	glm::vec3 maxHalfBounds = boxMax;
+	minHalfBounds[axis] = half;
+	maxHalfBounds[axis] = half;
+
+	BuildSubtree(atoms, leftCount, boxMin, maxHalfBounds, depth + 1, fragment, context);
+	fragment.nodes[nodeIndex].offset = static_cast<uint32_t>(fragment.nodes.size());
+	BuildMeanSplit(middle, count - leftCount, minHalfBounds, boxMax, depth + 1, fragment, context);
+}
+
+static void BuildSAH(Atom* atoms, size_t count, const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t depth, Fragment& fragment, const BuildContext& context)
+{
+	const uint32_t nodeIndex = PushNode(fragment, boxMin, boxMax);
+	if (count <= 1 || depth >= AtomKDTree::MaxDepth)
+	{
+		MakeLeaf(fragment.nodes[nodeIndex], atoms, count, context);
+		return;
+	}
+
+	glm::vec3 centerMin, binScale;
+	uint32_t binCount;
+	const SAHSplit split = FindSAHSplit(atoms, count, SurfaceArea(boxMin, boxMax), context.sahBinCount, context.pool, centerMin, binScale, binCount);
+
+	const float leafCost = AtomKDTree::IntersectionCost * count;
+	if (count <= context.maxLeafAtoms && (split.axis < 0 || split.cost >= leafCost))
 	{
-		if (atom.position[axis] - atom.atomTemplate->radius <= half)
+		MakeLeaf(fragment.nodes[nodeIndex], atoms, count, context);
+		return;
+	}
+
+	Atom* middle = atoms + count / 2;
+	glm::vec3 leftMin, leftMax, rightMin, rightMax;
+	if (split.axis >= 0)
+	{
+		const int axis = split.axis;
+		middle = std::partition(atoms, atoms + count, [&](const Atom& atom)
 		{
-			left.emplace_back(atom);
+			return SAHBinIndex(atom.position[axis], centerMin[axis], binScale[axis], binCount) < split.bin;
+		});
+
+		leftMin = split.leftMin;
+		leftMax = split.leftMax;
+		rightMin = split.rightMin;
+		rightMax = split.rightMax;
+	}
+	else
+	{
+		// Every center is the same point and any split is as good as another, halve the atoms
+		ComputeBounds(atoms, count / 2, leftMin, leftMax);
+		ComputeBounds(middle, count - count / 2, rightMin, rightMax);
+	}
+
+	const size_t leftCount = middle - atoms;
+	BuildSubtree(atoms, leftCount, leftMin, leftMax, depth + 1, fragment, context);
+	fragment.nodes[nodeIndex].offset = static_cast<uint32_t>(fragment.nodes.size());
+	BuildSAH(middle, count - leftCount, rightMin, rightMax, depth + 1, fragment, context);
+}
+
+static void BuildNode(Atom* atoms, size_t count, const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t depth, Fragment& fragment, const BuildContext& context)
+{
+	switch (context.builder)
+	{
+		case KDTreeBuilder::MeanSplit:
+			BuildMeanSplit(atoms, count, boxMin, boxMax, depth, fragment, context);
+			break;
+		case KDTreeBuilder::SAH:
+			BuildSAH(atoms, count, boxMin, boxMax, depth, fragment, context);
+			break;
+	}
+}
+
+// Copies the fragment to the end of nodes with every link node replaced by its whole subtree, so
+// the result stays in depth-first order
+static void AppendFragment(const Fragment& fragment, std::vector<KDTreeNode>& nodes)
+{
+	std::vector<uint32_t> outputIndices(fragment.nodes.size());
+	for (size_t i = 0; i < fragment.nodes.size(); ++i)
+	{
+		const KDTreeNode& node = fragment.nodes[i];
+		outputIndices[i] = static_cast<uint32_t>(nodes.size());
+		if (node.atomCount == LinkNode)
+			AppendFragment(*fragment.links[node.offset], nodes);
+		else
+			nodes.push_back(node);
+	}
+
+	for (size_t i = 0; i < fragment.nodes.size(); ++i)
+	{
+		if (fragment.nodes[i].atomCount == KDTreeNode::InteriorNode)
+			nodes[outputIndices[i]].offset = outputIndices[fragment.nodes[i].offset];
+	}
+}
+
+AtomKDTree::AtomKDTree(const std::vector<Atom>& atoms, const KDTreeSpecification& specification)
+{
+	glm::vec3 boxMin, boxMax;
+	ComputeBounds(atoms.data(), atoms.size(), boxMin, boxMax);
+
+	std::vector<Atom> workAtoms(atoms);
+	Scope<ThreadPool> pool;
+	Scope<TaskGroup> group;
+	if (specification.threadCount != 1 && atoms.size() >= ParallelBuildCutoff)
+	{
+		pool = CreateScope<ThreadPool>(specification.threadCount);
+		group = CreateScope<TaskGroup>(*pool);
+	}
+
+	BuildContext context;
+	context.builder = specification.builder;
+	context.sahBinCount = std::clamp(specification.sahBinCount, 2u, MaxSAHBinCount);
+	context.maxLeafAtoms = std::max(specification.maxLeafAtoms, 1u);
+	context.atoms = workAtoms.data();
+	context.pool = pool.get();
+	context.group = group.get();
+
+	Fragment root;
+	BuildNode(workAtoms.data(), workAtoms.size(), boxMin, boxMax, 0, root, context);
+
+	if (group)
+	{
+		group->Wait();
+	}
+
+	if (root.links.empty())
+	{
+		m_Nodes = std::move(root.nodes);
+	}
+	else
+	{
+		AppendFragment(root, m_Nodes);
+	}
+
+	m_AtomIndices.resize(workAtoms.size());
+	m_Spheres.resize(workAtoms.size());
+	for (size_t i = 0; i < workAtoms.size(); ++i)
+	{
+		m_AtomIndices[i] = workAtoms[i].index;
+		m_Spheres[i] = glm::vec4(workAtoms[i].position, workAtoms[i].atomTemplate->radius);
+	}
+
+	// Bounds of the centers and spheres below every node against its box. Children come after their
+	// parent, and the mean-split boxes need not lie within their parent's, so every node counts
+	std::vector<glm::vec3> centerMins(m_Nodes.size()), centerMaxs(m_Nodes.size());
+	std::vector<glm::vec3> sphereMins(m_Nodes.size()), sphereMaxs(m_Nodes.size());
+	m_BoxSlack = 0.0f;
+	m_CenterSlack = std::numeric_limits<float>::lowest();
+	for (size_t n = m_Nodes.size(); n-- > 0;)
+	{
+		const KDTreeNode& node = m_Nodes[n];
+		if (node.IsLeaf())
+		{
+			ComputeCenterBounds(nullptr, 0, centerMins[n], centerMaxs[n]);
+			ComputeCenterBounds(nullptr, 0, sphereMins[n], sphereMaxs[n]);
+			for (uint32_t i = node.offset; i < node.offset + node.atomCount; ++i)
+			{
+				const glm::vec3 center(m_Spheres[i]);
+				centerMins[n] = glm::min(centerMins[n], center);
+				centerMaxs[n] = glm::max(centerMaxs[n], center);
+				sphereMins[n] = glm::min(sphereMins[n], center - m_Spheres[i].w);
+				sphereMaxs[n] = glm::max(sphereMaxs[n], center + m_Spheres[i].w);
+			}
+
+			if (node.atomCount == 0)
+				continue;
 		}
-		else if (atom.position[axis] + atom.atomTemplate->radius >= half)
+		else
 		{
-			right.emplace_back(atom);
+			centerMins[n] = glm::min(centerMins[n + 1], centerMins[node.offset]);
+			centerMaxs[n] = glm::max(centerMaxs[n + 1], centerMaxs[node.offset]);
+			sphereMins[n] = glm::min(sphereMins[n + 1], sphereMins[node.offset]);
+			sphereMaxs[n] = glm::max(sphereMaxs[n + 1], sphereMaxs[node.offset]);
 		}
+
+		const glm::vec3 centerOverhang = glm::max(node.boxMin - centerMins[n], centerMaxs[n] - node.boxMax);
+		const glm::vec3 sphereOverhang = glm::max(node.boxMin - sphereMins[n], sphereMaxs[n] - node.boxMax);
+		m_CenterSlack = std::max(m_CenterSlack, std::max(std::max(centerOverhang.x, centerOverhang.y), centerOverhang.z));
+		m_BoxSlack = std::max(m_BoxSlack, std::max(std::max(sphereOverhang.x, sphereOverhang.y), sphereOverhang.z));
 	}
 
-	constexpr size_t minCount = 12;
-	if (left.size() + right.size() <= minCount)
+	// Without atoms no query finds anything anyway
+	if (m_CenterSlack == std::numeric_limits<float>::lowest())
+		m_CenterSlack = 0.0f;
+}
+
+KDTreeStatistics AtomKDTree::ComputeStatistics() const
+{
+	KDTreeStatistics statistics;
+	statistics.minLeafAtoms = std::numeric_limits<uint32_t>::max();
+	AccumulateStatistics(statistics, 0, 0, SurfaceArea(m_Nodes[0].boxMin, m_Nodes[0].boxMax));
+	if (statistics.leafCount == 0)
 	{
-		m_Atoms = std::move(left);
-		m_Atoms.insert(m_Atoms.end(), std::make_move_iterator(right.begin()), std::make_move_iterator(right.end()));
+		statistics.minLeafAtoms = 0;
 	}
-	else
+
+	return statistics;
+}
+
+void AtomKDTree::AccumulateStatistics(KDTreeStatistics& statistics, uint32_t nodeIndex, uint32_t depth, float rootArea) const
+{
+	const KDTreeNode& node = m_Nodes[nodeIndex];
+	const float relativeArea = rootArea > 0.0f ? SurfaceArea(node.boxMin, node.boxMax) / rootArea : 1.0f;
+
+	++statistics.nodeCount;
+	statistics.maxDepth = std::max(statistics.maxDepth, depth);
+	if (!node.IsLeaf())
 	{
-		glm::vec3 minHalfBounds = m_BoxMin;
-		glm::vec3 maxHalfBounds = m_BoxMax;
-		minHalfBounds[axis] = half;
-		maxHalfBounds[axis] = half;
+		statistics.sahCost += TraversalCost * relativeArea;
+		AccumulateStatistics(statistics, nodeIndex + 1, depth + 1, rootArea);
+		AccumulateStatistics(statistics, node.offset, depth + 1, rootArea);
+		return;
+	}
 
-		m_LeftChild = new AtomKDTree(std::move(left), m_BoxMin, maxHalfBounds, depth + 1);
-		m_RightChild = new AtomKDTree(std::move(right), minHalfBounds, m_BoxMax, depth + 1);
+	++statistics.leafCount;
+	if (node.atomCount == 0)
+		++statistics.emptyLeafCount;
+	statistics.minLeafAtoms = std::min(statistics.minLeafAtoms, node.atomCount);
+	statistics.maxLeafAtoms = std::max(statistics.maxLeafAtoms, node.atomCount);
+	statistics.leafAtomReferences += node.atomCount;
+	statistics.sahCost += IntersectionCost * node.atomCount * relativeArea;
+}
+
+static void RunTasks(uint32_t taskCount, const std::function<void(uint32_t)>& func, ThreadPool* pool)
+{
+	if (pool)
+	{
+		pool->ParallelFor(taskCount, func);
+		return;
 	}
+
+	for (uint32_t task = 0; task < taskCount; ++task)
+	{
+		func(task);
+	}
+}
+
+static uint32_t GetTaskCount(size_t count)
+{
+	return static_cast<uint32_t>((count + QueriesPerTask - 1) / QueriesPerTask);
 }
 
-AtomKDTree::~AtomKDTree()
+// Nearer first, ties by atom so the k nearest are the same for any tree
+static bool IsNearer(const AtomNeighbor& a, const AtomNeighbor& b)
 {
-	if (m_LeftChild)
+	return a.distance2 < b.distance2 || (a.distance2 == b.distance2 && a.atomIndex < b.atomIndex);
+}
+
+uint32_t AtomKDTree::FindNearest(const glm::vec3& position, uint32_t k, AtomNeighbor* neighbors, float maxDistance) const
+{
+	if (k == 0 || m_Nodes.empty())
+		return 0;
+
+	// Squared, kept finite
+	const float clampedDistance = std::min(maxDistance, 1e18f);
+	float bound2 = clampedDistance * clampedDistance;
+
+	struct StackEntry
 	{
-		delete m_LeftChild;
+		uint32_t index;
+		float distance2;
+	};
+
+	// neighbors is a max-heap of the best atoms so far, once it is full its root is the one to beat
+	uint32_t count = 0;
+	StackEntry stack[TraversalStackSize];
+	int stackSize = 0;
+	stack[stackSize++] = { 0, GetBoxDistance2(m_Nodes[0], position, m_CenterSlack) };
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		if (entry.distance2 > bound2)
+			continue;
+
+		const KDTreeNode& node = m_Nodes[entry.index];
+		if (node.IsLeaf())
+		{
+			for (uint32_t i = node.offset; i < node.offset + node.atomCount; ++i)
+			{
+				const glm::vec3 offset = glm::vec3(m_Spheres[i]) - position;
+				const AtomNeighbor candidate = { m_AtomIndices[i], glm::dot(offset, offset) };
+				if (candidate.distance2 > bound2)
+					continue;
+
+				if (count < k)
+				{
+					neighbors[count++] = candidate;
+					std::push_heap(neighbors, neighbors + count, IsNearer);
+				}
+				else if (IsNearer(candidate, neighbors[0]))
+				{
+					std::pop_heap(neighbors, neighbors + k, IsNearer);
+					neighbors[k - 1] = candidate;
+					std::push_heap(neighbors, neighbors + k, IsNearer);
+				}
+
+				if (count == k)
+					bound2 = neighbors[0].distance2;
+			}
+
+			continue;
+		}
+
+		// The nearer child goes on top so it is walked first and tightens the bound for the other. Each
+		// node pops itself first, so within MaxDepth the far child always fits
+		const StackEntry left = { entry.index + 1, GetBoxDistance2(m_Nodes[entry.index + 1], position, m_CenterSlack) };
+		const StackEntry right = { node.offset, GetBoxDistance2(m_Nodes[node.offset], position, m_CenterSlack) };
+		const bool leftNearer = left.distance2 <= right.distance2;
+		const StackEntry& nearChild = leftNearer ? left : right;
+		const StackEntry& farChild = leftNearer ? right : left;
+		if (farChild.distance2 <= bound2 && stackSize + 1 < TraversalStackSize)
+			stack[stackSize++] = farChild;
+		if (nearChild.distance2 <= bound2)
+			stack[stackSize++] = nearChild;
 	}
-	if (m_RightChild)
+
+	std::sort_heap(neighbors, neighbors + count, IsNearer);
+	return count;
+}
+
+void AtomKDTree::FindInRadius(const std::vector<glm::vec3>& positions, float radius, AtomNeighborLists& lists, ThreadPool* pool) const
+{
+	// Every task collects the atoms of its positions on its own, the counts give the offsets after
+	const uint32_t taskCount = GetTaskCount(positions.size());
+	std::vector<std::vector<uint32_t>> taskAtomIndices(taskCount);
+	lists.offsets.assign(positions.size() + 1, 0);
+	RunTasks(taskCount, [&](uint32_t task)
+	{
+		const size_t begin = static_cast<size_t>(task) * QueriesPerTask;
+		const size_t end = std::min(begin + QueriesPerTask, positions.size());
+		std::vector<uint32_t>& atomIndices = taskAtomIndices[task];
+		for (size_t i = begin; i < end; ++i)
+		{
+			const size_t first = atomIndices.size();
+			ForEachInRadius(positions[i], radius, [&](uint32_t atomIndex, float) { atomIndices.push_back(atomIndex); });
+			lists.offsets[i + 1] = atomIndices.size() - first;
+		}
+	}, pool);
+
+	for (size_t i = 0; i < positions.size(); ++i)
+	{
+		lists.offsets[i + 1] += lists.offsets[i];
+	}
+
+	lists.atomIndices.resize(lists.offsets.back());
+	RunTasks(taskCount, [&](uint32_t task)
+	{
+		const std::vector<uint32_t>& atomIndices = taskAtomIndices[task];
+		std::copy(atomIndices.begin(), atomIndices.end(), lists.atomIndices.begin() + lists.offsets[static_cast<size_t>(task) * QueriesPerTask]);
+	}, pool);
+}
+
+void AtomKDTree::FindNearest(const std::vector<glm::vec3>& positions, uint32_t k, std::vector<AtomNeighbor>& neighbors, ThreadPool* pool, float maxDistance) const
+{
+	neighbors.resize(positions.size() * k);
+	RunTasks(GetTaskCount(positions.size()), [&](uint32_t task)
 	{
-		delete m_RightChild;
+		const size_t begin = static_cast<size_t>(task) * QueriesPerTask;
+		const size_t end = std::min(begin + QueriesPerTask, positions.size());
+		for (size_t i = begin; i < end; ++i)
+		{
+			AtomNeighbor* queryNeighbors = neighbors.data() + i * k;
+			const uint32_t count = FindNearest(positions[i], k, queryNeighbors, maxDistance);
+			std::fill(queryNeighbors + count, queryNeighbors + k, AtomNeighbor{ InvalidAtom, std::numeric_limits<float>::max() });
+		}
+	}, pool);
+}
+
+void AtomKDTree::FindOverlappingPairs(float margin, std::vector<AtomPair>& pairs, ThreadPool* pool) const
+{
+	// Every atom looks for its partners with a larger index, so each pair turns up once
+	const uint32_t taskCount = GetTaskCount(m_Spheres.size());
+	std::vector<std::vector<AtomPair>> taskPairs(taskCount);
+	RunTasks(taskCount, [&](uint32_t task)
+	{
+		const size_t begin = static_cast<size_t>(task) * QueriesPerTask;
+		const size_t end = std::min(begin + QueriesPerTask, m_Spheres.size());
+		for (size_t i = begin; i < end; ++i)
+		{
+			const uint32_t atomIndex = m_AtomIndices[i];
+			ForEachOverlapping(m_Spheres[i], margin, [&](uint32_t otherIndex, float)
+			{
+				if (otherIndex > atomIndex)
+					taskPairs[task].push_back({ atomIndex, otherIndex });
+			});
+		}
+	}, pool);
+
+	std::vector<size_t> taskOffsets(taskCount + 1, 0);
+	for (uint32_t task = 0; task < taskCount; ++task)
+	{
+		taskOffsets[task + 1] = taskOffsets[task] + taskPairs[task].size();
 	}
+
+	pairs.resize(taskOffsets.back());
+	RunTasks(taskCount, [&](uint32_t task)
+	{
+		std::copy(taskPairs[task].begin(), taskPairs[task].end(), pairs.begin() + taskOffsets[task]);
+	}, pool);
 }
@@ -2,27 +2,210 @@
 
 #include "AtomLoader.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <limits>
 #include <vector>
 
+class ThreadPool;
+
+enum class KDTreeBuilder
+{
+	MeanSplit = 0, // Mean position along a round-robin axis
+	SAH            // Binned surface area heuristic over all three axes
+};
+
+struct KDTreeSpecification
+{
+	KDTreeBuilder builder = KDTreeBuilder::SAH;
+	uint32_t sahBinCount = 32;  // SAH only, candidate split planes per axis + 1, at most 64
+	uint32_t maxLeafAtoms = 12; // Largest leaf, the SAH builder stops splitting earlier when that is cheaper
+	uint32_t threadCount = 0;   // 0 means one thread per hardware core, 1 builds on the calling thread
+};
+
+struct KDTreeStatistics
+{
+	uint32_t nodeCount = 0;
+	uint32_t leafCount = 0;
+	uint32_t emptyLeafCount = 0;
+	uint32_t maxDepth = 0;
+	uint32_t minLeafAtoms = 0;
+	uint32_t maxLeafAtoms = 0;
+	uint64_t leafAtomReferences = 0;
+	float sahCost = 0.0f; // Expected cost of a ray hitting the root box, see TraversalCost/IntersectionCost
+};
+
+// 32 bytes, nodes are stored in depth-first order so the left child of an interior node is always
+// the node right after it
+struct KDTreeNode
+{
+	static constexpr uint32_t InteriorNode = 0xFFFFFFFF;
+
+	glm::vec3 boxMin;
+	uint32_t offset;    // Right child of interior nodes, first entry in AtomKDTree::GetAtomIndices() of leaves
+	glm::vec3 boxMax;
+	uint32_t atomCount; // InteriorNode for interior nodes
+
+	bool IsLeaf() const { return atomCount != InteriorNode; }
+};
+
+// Atom found by a query, with the squared distance from the query position to its center
+struct AtomNeighbor
+{
+	uint32_t atomIndex; // Atom::index, AtomKDTree::InvalidAtom for unused entries
+	float distance2;
+};
+
+struct AtomPair
+{
+	uint32_t first;  // Atom::index, always the smaller one
+	uint32_t second;
+};
+
+// Results of a batch of radius queries, query i owns atomIndices[offsets[i]] up to atomIndices[offsets[i + 1]]
+struct AtomNeighborLists
+{
+	std::vector<uint64_t> offsets;
+	std::vector<uint32_t> atomIndices;
+};
+
 class AtomKDTree
 {
 public:
-	AtomKDTree(const std::vector<Atom>& atoms);
-	~AtomKDTree();
-
-	const AtomKDTree* GetLeftChild() const { return m_LeftChild; }
-	const AtomKDTree* GetRightChild() const { return m_RightChild; }
-	const glm::vec3& GetBoxMin() const { return m_BoxMin; }
-	const glm::vec3& GetBoxMax() const { return m_BoxMax; }
-	const std::vector<Atom>& GetAtoms() const { return m_Atoms; }
+	// Relative costs of the SAH, one step of the traversal loop (two child box tests in
+	// Raytrace.frag) versus one sphere test
+	static constexpr float TraversalCost = 2.0f;
+	static constexpr float IntersectionCost = 1.0f;
+
+	// Deepest level either builder splits to, the root is level 0. Nodes there become leaves however
+	// many atoms they hold, so a traversal that keeps at most one node per level waiting never needs
+	// more than TraversalStackSize entries. KDTREE_STACK_SIZE of Raytrace.frag is the same
+	static constexpr uint32_t MaxDepth = 63;
+	static constexpr int TraversalStackSize = MaxDepth + 1;
+
+	static constexpr uint32_t InvalidAtom = 0xFFFFFFFF;
+public:
+	AtomKDTree(const std::vector<Atom>& atoms, const KDTreeSpecification& specification = KDTreeSpecification());
+
+	// The root is node 0
+	const std::vector<KDTreeNode>& GetNodes() const { return m_Nodes; }
+
+	// Atom::index of the atoms of every leaf, each leaf owns one contiguous range
+	const std::vector<uint32_t>& GetAtomIndices() const { return m_AtomIndices; }
+
+	// Center and radius of the same atoms in the same order, what the queries read
+	const std::vector<glm::vec4>& GetSpheres() const { return m_Spheres; }
+
+	KDTreeStatistics ComputeStatistics() const;
+
+	// Calls func(uint32_t atomIndex, float distance2) for every atom whose center lies within radius
+	// of the position. No allocations, the atoms come in tree order
+	template<typename Func>
+	void ForEachInRadius(const glm::vec3& position, float radius, Func&& func) const
+	{
+		const float radius2 = radius * radius;
+		ForEachLeafInReach(position, radius, m_CenterSlack, [&](const KDTreeNode& node)
+		{
+			for (uint32_t i = node.offset; i < node.offset + node.atomCount; ++i)
+			{
+				const glm::vec3 offset = glm::vec3(m_Spheres[i]) - position;
+				const float distance2 = glm::dot(offset, offset);
+				if (distance2 <= radius2)
+					func(m_AtomIndices[i], distance2);
+			}
+		});
+	}
+
+	// Calls func(uint32_t atomIndex, float distance2) for every atom whose sphere overlaps the given
+	// one, so the centers are closer than the sum of the radii + margin. A negative margin asks for
+	// that much penetration, a clash test. No allocations
+	template<typename Func>
+	void ForEachOverlapping(const glm::vec4& sphere, float margin, Func&& func) const
+	{
+		// The grown boxes hold the spheres of their atoms, so an overlapping atom's box is at most this far away
+		const float reach = std::max(sphere.w + margin, 0.0f);
+		ForEachLeafInReach(glm::vec3(sphere), reach, m_BoxSlack, [&](const KDTreeNode& node)
+		{
+			for (uint32_t i = node.offset; i < node.offset + node.atomCount; ++i)
+			{
+				const glm::vec3 offset = glm::vec3(m_Spheres[i]) - glm::vec3(sphere);
+				const float distance2 = glm::dot(offset, offset);
+				const float contact = m_Spheres[i].w + sphere.w + margin;
+				if (contact > 0.0f && distance2 < contact * contact)
+					func(m_AtomIndices[i], distance2);
+			}
+		});
+	}
+
+	// The k atoms with the nearest centers no farther than maxDistance, nearest first. neighbors
+	// holds k entries, returns how many were filled. No allocations
+	uint32_t FindNearest(const glm::vec3& position, uint32_t k, AtomNeighbor* neighbors, float maxDistance = std::numeric_limits<float>::max()) const;
+
+	// Batches of the queries above, split across the pool or run on the calling thread without one.
+	// The results do not depend on the thread count
+	void FindInRadius(const std::vector<glm::vec3>& positions, float radius, AtomNeighborLists& lists, ThreadPool* pool = nullptr) const;
+	// k entries per position, the ones past the atoms found have atomIndex InvalidAtom
+	void FindNearest(const std::vector<glm::vec3>& positions, uint32_t k, std::vector<AtomNeighbor>& neighbors, ThreadPool* pool = nullptr,
+		float maxDistance = std::numeric_limits<float>::max()) const;
+	// Every pair of atoms whose spheres overlap like in ForEachOverlapping(), once. In the order of
+	// GetAtomIndices() of their first atom, not sorted
+	void FindOverlappingPairs(float margin, std::vector<AtomPair>& pairs, ThreadPool* pool = nullptr) const;
 private:
-	AtomKDTree(std::vector<Atom>&& atoms, const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t depth);
+	void AccumulateStatistics(KDTreeStatistics& statistics, uint32_t nodeIndex, uint32_t depth, float rootArea) const;
+
+	// Squared distance from the position to the box of the node grown by slack, 0 inside it
+	static float GetBoxDistance2(const KDTreeNode& node, const glm::vec3& position, float slack)
+	{
+		const glm::vec3 offset = glm::max(glm::max(node.boxMin - slack - position, position - node.boxMax - slack), glm::vec3(0.0f));
+		return glm::dot(offset, offset);
+	}
+
+	// Calls func(const KDTreeNode&) for every leaf whose box grown by slack lies within reach of the position
+	template<typename Func>
+	void ForEachLeafInReach(const glm::vec3& position, float reach, float slack, Func&& func) const
+	{
+		const float reach2 = reach * reach;
+		if (m_Nodes.empty() || GetBoxDistance2(m_Nodes[0], position, slack) > reach2)
+			return;
+
+		uint32_t stack[TraversalStackSize];
+		int stackSize = 0;
+		uint32_t index = 0;
+		while (true)
+		{
+			const KDTreeNode& node = m_Nodes[index];
+			if (node.IsLeaf())
+			{
+				func(node);
+			}
+			else
+			{
+				const uint32_t left = index + 1;
+				const uint32_t right = node.offset;
+				const bool visitLeft = GetBoxDistance2(m_Nodes[left], position, slack) <= reach2;
+				const bool visitRight = GetBoxDistance2(m_Nodes[right], position, slack) <= reach2;
+				if (visitLeft && visitRight && stackSize < TraversalStackSize)
+					stack[stackSize++] = right;
+
+				if (visitLeft || visitRight)
+				{
+					index = visitLeft ? left : right;
+					continue;
+				}
+			}
 
-	void AAtomKDTree(std::vector<Atom>&& atoms, uint32_t depth);
+			if (stackSize == 0)
+				return;
+			index = stack[--stackSize];
+		}
+	}
 private:
-	glm::vec3 m_BoxMin;
-	glm::vec3 m_BoxMax;
-	std::vector<Atom> m_Atoms;
-	AtomKDTree* m_LeftChild = nullptr;
-	AtomKDTree* m_RightChild = nullptr;
+	std::vector<KDTreeNode> m_Nodes;
+	std::vector<uint32_t> m_AtomIndices;
+	std::vector<glm::vec4> m_Spheres;
+	// How far the spheres and the centers below a node reach out of its box at most, the queries grow
+	// every box by these. The mean-split boxes are cut at the planes, the SAH boxes keep the centers at
+	// least the smallest radius inside, a negative slack
+	float m_BoxSlack = 0.0f;
+	float m_CenterSlack = 0.0f;
 };
@@ -5,366 +5,763 @@
 #include <sstream>
 #include <unordered_map>
 
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iterator>
 #include <limits>
+#include <string_view>
 
-struct FileMapping
+#include "Core/MappedFile.h"
+#include "Core/ThreadPool.h"
+
+static std::vector<Atom> LoadAtoms(const std::string& pdbPath, std::unordered_map<char, AtomTemplate>& atomTemplates, std::unordered_map<std::string, Residue>& residues)
 {
-	std::string filepath;
+	std::vector<Atom> atoms;
+	std::ifstream file(pdbPath);
+	if (!file)
+	{
+		std::cerr << "Could not open " << pdbPath << '\n';
+		return {};
+	}
 
-	std::pair<uint64_t, uint64_t> atoms;
-	std::pair<uint64_t, uint64_t> atomsMapping;
-	std::pair<uint64_t, uint64_t> residues;
-	std::pair<uint64_t, uint64_t> residuesMapping;
-	std::pair<uint64_t, uint64_t> radius;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.compare(0, 4, "ATOM") == 0)
+		{
+			std::istringstream iss(line);
+			std::string temp[2];
+			std::string residueString;
+			std::string atomTag;
+			uint64_t atomId, residueId;
+			glm::vec3 position;
+
+			// ATOM 1 N ILE A 15 11.749 81.774 51.160 1.00 13.80 N
+			iss >> temp[0] >> atomId >> atomTag >> residueString >> temp[1] >> residueId >> position[0] >> position[1] >> position[2];
+
+			Atom atom;
+			char element = atomTag[0];
+			atom.atomTemplate = &atomTemplates[element];
+			atom.position = position;
+			atom.residue = &residues[residueString];
+			atom.index = atoms.size();
+			atoms.push_back(std::move(atom));
+		}
+	}
+
+	file.close();
+	return atoms;
+}
+
+// Columns of the ATOM record, 0-based and end-exclusive (wwPDB format v3.3)
+namespace PDBColumns {
+
+	static constexpr size_t SerialBegin = 6, SerialEnd = 11;
+	static constexpr size_t NameBegin = 12, NameEnd = 16;
+	static constexpr size_t ResidueNameBegin = 17, ResidueNameEnd = 20;
+	static constexpr size_t ChainID = 21;
+	static constexpr size_t ResidueSequenceBegin = 22, ResidueSequenceEnd = 26;
+	static constexpr size_t XBegin = 30, YBegin = 38, ZBegin = 46, CoordinateWidth = 8;
+
+	// Shortest line that still holds all the columns above
+	static constexpr size_t MinAtomRecordLength = ZBegin + CoordinateWidth;
+
+}
+
+struct PDBAtomRecord
+{
+	int32_t serial;
+	char element;
+	char residueName[3];
+	uint8_t residueNameLength;
+	char chainID;
+	int32_t residueSequence;
+	glm::vec3 position;
 };
 
-static void GotoLine(std::ifstream& file, uint64_t num)
+static int32_t ParseFixedInt(const char* begin, const char* end)
 {
-	file.seekg(std::ios::beg);
-	for (uint64_t i = 0; i < num; ++i)
+	while (begin < end && *begin == ' ')
+		++begin;
+
+	bool negative = false;
+	if (begin < end && (*begin == '-' || *begin == '+'))
 	{
-		file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+		negative = *begin == '-';
+		++begin;
 	}
+
+	int32_t value = 0;
+	for (; begin < end && *begin >= '0' && *begin <= '9'; ++begin)
+	{
+		value = value * 10 + (*begin - '0');
+	}
+
+	return negative ? -value : value;
 }
 
-static std::string FindPropertyInXMLLine(const std::string& line, const std::string& prop)
+static float ParseFixedFloat(const char* begin, const char* end)
 {
-	uint64_t startPos = line.find(prop + '=');
-	if (startPos == std::string::npos)
+	static constexpr double powersOf10[] = { 1.0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8 };
+
+	while (begin < end && *begin == ' ')
+		++begin;
+
+	bool negative = false;
+	if (begin < end && (*begin == '-' || *begin == '+'))
 	{
-		std::cerr << "Could not find " << prop << " in the line " << line;
-		return "";
+		negative = *begin == '-';
+		++begin;
 	}
 
-	startPos += prop.length() + 2; // + 2 to account for '="'
+	// Accumulate all digits into one integer mantissa and scale once at the end. Coordinates
+	// have at most 8 significant digits, so the mantissa and the division are exact enough
+	// to round to the same float as std::istream does
+	int64_t mantissa = 0;
+	for (; begin < end && *begin >= '0' && *begin <= '9'; ++begin)
+	{
+		mantissa = mantissa * 10 + (*begin - '0');
+	}
 
-	uint64_t endPos = line.find('"', startPos);
-	if (endPos == std::string::npos)
+	uint32_t fractionDigits = 0;
+	if (begin < end && *begin == '.')
 	{
-		std::cerr << "Invalid line " << line << '\n';
-		return "";
+		for (++begin; begin < end && *begin >= '0' && *begin <= '9' && fractionDigits < 8; ++begin, ++fractionDigits)
+		{
+			mantissa = mantissa * 10 + (*begin - '0');
+		}
 	}
 
-	return line.substr(startPos, endPos - startPos);
+	const double value = static_cast<double>(mantissa) / powersOf10[fractionDigits];
+	return static_cast<float>(negative ? -value : value);
 }
 
-static glm::vec3 LoadColorFromXMLLine(const std::string& line)
+static bool ParseAtomRecord(const char* line, const char* lineEnd, PDBAtomRecord& record)
 {
-	glm::vec3 color;
-	const std::string rgb = "rgb";
-	for (uint8_t i = 0; i < 3; ++i)
-	{
-		std::string channel = rgb.substr(i, 1);
-		std::string valueStr = FindPropertyInXMLLine(line, channel);
-		std::stringstream ss;
-		ss << valueStr;
-		ss >> color[i];
+	const size_t length = lineEnd - line;
+	if (length < PDBColumns::MinAtomRecordLength || std::memcmp(line, "ATOM", 4) != 0)
+	{
+		return false;
 	}
 
-	return color;
-}
+	record.serial = ParseFixedInt(line + PDBColumns::SerialBegin, line + PDBColumns::SerialEnd);
 
-static std::unordered_map<std::string, Residue> LoadResidues(const FileMapping& fileMapping)
-{
-	std::ifstream file(fileMapping.filepath);
-	if (!file)
+	// The element is the first character of the atom name, same as the stream parser
+	record.element = ' ';
+	for (size_t i = PDBColumns::NameBegin; i < PDBColumns::NameEnd; ++i)
 	{
-		return {};
+		if (line[i] != ' ')
+		{
+			record.element = line[i];
+			break;
+		}
 	}
 
-	std::unordered_map<uint64_t, glm::vec3> colors;
-	GotoLine(file, fileMapping.residues.first);
-	for (uint64_t i = fileMapping.residues.first; i < fileMapping.residues.second; ++i)
+	record.residueNameLength = 0;
+	for (size_t i = PDBColumns::ResidueNameBegin; i < PDBColumns::ResidueNameEnd; ++i)
 	{
-		std::string line;
-		std::getline(file, line);
-		if (line._Starts_with("    <!--"))
+		if (line[i] != ' ')
 		{
-			continue;
+			record.residueName[record.residueNameLength++] = line[i];
 		}
+	}
+
+	record.chainID = line[PDBColumns::ChainID];
+	record.residueSequence = ParseFixedInt(line + PDBColumns::ResidueSequenceBegin, line + PDBColumns::ResidueSequenceEnd);
+
+	const char* x = line + PDBColumns::XBegin;
+	const char* y = line + PDBColumns::YBegin;
+	const char* z = line + PDBColumns::ZBegin;
+	record.position = glm::vec3(
+		ParseFixedFloat(x, x + PDBColumns::CoordinateWidth),
+		ParseFixedFloat(y, y + PDBColumns::CoordinateWidth),
+		ParseFixedFloat(z, z + PDBColumns::CoordinateWidth)
+	);
+
+	return true;
+}
 
-		std::string idStr = FindPropertyInXMLLine(line, "id");
-		std::stringstream ss;
-		ss << idStr;
-		uint64_t id;
-		ss >> id;
+// Every ATOM record is 81 bytes including the line break, so this bounds the atom count of a range
+static constexpr uint64_t PDBAtomRecordSize = 81;
 
-		glm::vec3 color = LoadColorFromXMLLine(line);
-		colors[id] = color;
+// Calls func(line, lineEnd) for every line in [begin, end), without the line break
+template<typename Func>
+static void ForEachLine(const char* begin, const char* end, Func&& func)
+{
+	while (begin < end)
+	{
+		const char* lineEnd = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+		const char* next = lineEnd ? lineEnd + 1 : end;
+		if (!lineEnd)
+			lineEnd = end;
+		if (lineEnd > begin && lineEnd[-1] == '\r')
+			--lineEnd;
+
+		func(begin, lineEnd);
+		begin = next;
 	}
+}
 
-	std::unordered_map<std::string, Residue> result;
-	GotoLine(file, fileMapping.residuesMapping.first);
-	for (uint64_t i = fileMapping.residuesMapping.first; i < fileMapping.residuesMapping.second; ++i)
+static bool IsSameResidueName(const PDBAtomRecord& record, const char* name, uint8_t nameLength)
+{
+	return record.residueNameLength == nameLength && std::memcmp(record.residueName, name, nameLength) == 0;
+}
+
+static std::vector<Atom> LoadAtomsMapped(const MappedFile& file, std::unordered_map<char, AtomTemplate>& atomTemplates, std::unordered_map<std::string, Residue>& residues)
+{
+	std::vector<Atom> atoms;
+	atoms.reserve(file.GetSize() / PDBAtomRecordSize + 1);
+
+	// Consecutive records almost always share the element table and residue, so both are
+	// resolved through small caches instead of a hash lookup per atom
+	std::array<const AtomTemplate*, 256> templateCache = {};
+	Residue* lastResidue = nullptr;
+	char lastResidueName[3] = {};
+	uint8_t lastResidueNameLength = 0;
+
+	ForEachLine(file.GetData(), file.GetData() + file.GetSize(), [&](const char* line, const char* lineEnd)
 	{
-		std::string line;
-		std::getline(file, line);
-		if (line._Starts_with("    <!--"))
+		PDBAtomRecord record;
+		if (!ParseAtomRecord(line, lineEnd, record))
 		{
-			continue;
+			return;
 		}
 
-		std::string idStr = FindPropertyInXMLLine(line, "id");
-		std::stringstream ss;
-		ss << idStr;
-		uint64_t id;
-		ss >> id;
+		const AtomTemplate*& atomTemplate = templateCache[static_cast<uint8_t>(record.element)];
+		if (!atomTemplate)
+		{
+			atomTemplate = &atomTemplates[record.element];
+		}
 
-		std::string identifier = FindPropertyInXMLLine(line, "identifier");
-		Residue residue;
-		residue.color = colors[id];
-		result[identifier] = residue;
-	}
+		if (!lastResidue || !IsSameResidueName(record, lastResidueName, lastResidueNameLength))
+		{
+			lastResidue = &residues[std::string(record.residueName, record.residueNameLength)];
+			std::memcpy(lastResidueName, record.residueName, sizeof(lastResidueName));
+			lastResidueNameLength = record.residueNameLength;
+		}
 
-	file.close();
-	return result;
+		Atom atom;
+		atom.position = record.position;
+		atom.atomTemplate = atomTemplate;
+		atom.residue = lastResidue;
+		atom.index = static_cast<uint32_t>(atoms.size());
+		atoms.push_back(atom);
+	});
+
+	return atoms;
 }
 
-static std::unordered_map<char, AtomTemplate> LoadAtomTemplates(const FileMapping& fileMapping)
+struct PDBChunk
 {
-	std::ifstream file(fileMapping.filepath);
-	if (!file)
-	{
-		return {};
-	}
+	const char* begin;
+	const char* end;
+	std::vector<PDBAtomRecord> records;
 
-	GotoLine(file, fileMapping.atoms.first);
-	std::unordered_map<uint64_t, glm::vec3> colors;
-	for (uint64_t i = fileMapping.atoms.first; i < fileMapping.atoms.second; ++i)
+	// Distinct keys seen in this chunk, so the shared tables can be filled before resolving
+	std::array<bool, 256> elements = {};
+	std::vector<std::string> residueNames;
+};
+
+static void ParsePDBChunk(PDBChunk& chunk)
+{
+	chunk.records.reserve((chunk.end - chunk.begin) / PDBAtomRecordSize + 1);
+	ForEachLine(chunk.begin, chunk.end, [&](const char* line, const char* lineEnd)
 	{
-		std::string line;
-		std::getline(file, line);
+		PDBAtomRecord record;
+		if (!ParseAtomRecord(line, lineEnd, record))
+		{
+			return;
+		}
+
+		chunk.elements[static_cast<uint8_t>(record.element)] = true;
+		const bool sameAsLast = !chunk.records.empty()
+			&& IsSameResidueName(record, chunk.records.back().residueName, chunk.records.back().residueNameLength);
+		if (!sameAsLast)
+		{
+			std::string name(record.residueName, record.residueNameLength);
+			if (std::find(chunk.residueNames.begin(), chunk.residueNames.end(), name) == chunk.residueNames.end())
+			{
+				chunk.residueNames.push_back(std::move(name));
+			}
+		}
 
-		std::string idStr = FindPropertyInXMLLine(line, "id");
-		std::stringstream ss;
-		ss << idStr;
-		uint64_t id;
-		ss >> id;
+		chunk.records.push_back(record);
+	});
+}
 
-		glm::vec3 color = LoadColorFromXMLLine(line);
-		colors[id] = color;
+static std::vector<Atom> LoadAtomsMappedParallel(const MappedFile& file, std::unordered_map<char, AtomTemplate>& atomTemplates, std::unordered_map<std::string, Residue>& residues, uint32_t threadCount)
+{
+	// Below this size per chunk, thread start-up and the merge cost more than the parsing itself
+	constexpr uint64_t minChunkSize = 1 << 20;
+	constexpr uint32_t chunksPerThread = 4;
+
+	ThreadPool pool(threadCount);
+	const uint64_t maxChunkCount = static_cast<uint64_t>(pool.GetThreadCount()) * chunksPerThread;
+	const uint32_t chunkCount = static_cast<uint32_t>(std::min(maxChunkCount, file.GetSize() / minChunkSize));
+	if (chunkCount <= 1)
+	{
+		return LoadAtomsMapped(file, atomTemplates, residues);
 	}
 
-	GotoLine(file, fileMapping.radius.first);
-	std::unordered_map<uint64_t, float> radius;
-	for (uint64_t i = fileMapping.radius.first; i < fileMapping.radius.second; ++i)
+	// Split at line boundaries: every chunk starts right after a line break
+	const char* const data = file.GetData();
+	const char* const dataEnd = data + file.GetSize();
+	std::vector<PDBChunk> chunks(chunkCount);
+	const char* chunkBegin = data;
+	for (uint32_t i = 0; i < chunkCount; ++i)
 	{
-		std::string line;
-		std::getline(file, line);
+		const char* chunkEnd = dataEnd;
+		if (i + 1 < chunkCount)
+		{
+			chunkEnd = std::max(chunkBegin, data + file.GetSize() * (i + 1) / chunkCount);
+			const char* lineBreak = static_cast<const char*>(std::memchr(chunkEnd, '\n', dataEnd - chunkEnd));
+			chunkEnd = lineBreak ? lineBreak + 1 : dataEnd;
+		}
+
+		chunks[i].begin = chunkBegin;
+		chunks[i].end = chunkEnd;
+		chunkBegin = chunkEnd;
+	}
 
-		uint64_t id;
+	pool.ParallelFor(chunkCount, [&](uint32_t i) { ParsePDBChunk(chunks[i]); });
+
+	// Insert every key into the shared tables up front, after this they are only read
+	std::array<const AtomTemplate*, 256> templateTable = {};
+	std::vector<uint64_t> chunkOffsets(chunkCount + 1, 0);
+	for (uint32_t i = 0; i < chunkCount; ++i)
+	{
+		for (uint32_t element = 0; element < 256; ++element)
 		{
-			std::string idStr = FindPropertyInXMLLine(line, "id");
-			std::stringstream ss;
-			ss << idStr;
-			ss >> id;
+			if (chunks[i].elements[element] && !templateTable[element])
+			{
+				templateTable[element] = &atomTemplates[static_cast<char>(element)];
+			}
 		}
 
-		float r;
+		for (const std::string& name : chunks[i].residueNames)
 		{
-			std::string radiusStr = FindPropertyInXMLLine(line, "radius");
-			std::stringstream ss;
-			ss << radiusStr;
-			ss >> r;
+			residues[name];
 		}
 
-		radius[id] = r;
+		chunkOffsets[i + 1] = chunkOffsets[i] + chunks[i].records.size();
 	}
 
-	GotoLine(file, fileMapping.atomsMapping.first);
-	std::unordered_map<char, AtomTemplate> result;
-	for (uint64_t i = fileMapping.atomsMapping.first; i < fileMapping.atomsMapping.second; ++i)
+	// Ordered merge: chunk i writes its atoms right after all atoms of chunks [0, i), so indices
+	// match the serial loader
+	std::vector<Atom> atoms(chunkOffsets[chunkCount]);
+	pool.ParallelFor(chunkCount, [&](uint32_t i)
 	{
-		std::string line;
-		std::getline(file, line);
-
-		std::string identifier = FindPropertyInXMLLine(line, "identifier");
-		if (identifier.length() == 1)
+		const PDBChunk& chunk = chunks[i];
+		const PDBAtomRecord* lastRecord = nullptr;
+		Residue* lastResidue = nullptr;
+		for (size_t j = 0; j < chunk.records.size(); ++j)
 		{
-			char element = identifier[0];
-			uint64_t number;
+			const PDBAtomRecord& record = chunk.records[j];
+			if (!lastRecord || !IsSameResidueName(record, lastRecord->residueName, lastRecord->residueNameLength))
 			{
-				std::string numberStr = FindPropertyInXMLLine(line, "number");
-				std::stringstream ss;
-				ss << numberStr;
-				ss >> number;
+				lastResidue = &residues.find(std::string(record.residueName, record.residueNameLength))->second;
+				lastRecord = &record;
 			}
 
-			AtomTemplate atomTemplate;
-			atomTemplate.color = colors[number];
-			atomTemplate.radius = radius[number];
-			result[element] = atomTemplate;
+			Atom& atom = atoms[chunkOffsets[i] + j];
+			atom.position = record.position;
+			atom.atomTemplate = templateTable[static_cast<uint8_t>(record.element)];
+			atom.residue = lastResidue;
+			atom.index = static_cast<uint32_t>(chunkOffsets[i] + j);
 		}
-	}
+	});
 
-	file.close();
-	return result;
+	return atoms;
 }
 
-static std::vector<Atom> LoadAtoms(const std::string& pdbPath, std::unordered_map<char, AtomTemplate>& atomTemplates, std::unordered_map<std::string, Residue>& residues)
+// Streaming scheme XML reader: one forward pass over the mapped file, no per-line allocations.
+// Only the subset of XML the scheme files use is supported: elements, attributes and comments
+struct XMLAttribute
 {
-	std::vector<Atom> atoms;
-	std::ifstream file(pdbPath);
-	if (!file)
+	std::string_view name;
+	std::string_view value;
+};
+
+struct XMLTag
+{
+	std::string_view name;
+	bool closing = false;
+	XMLAttribute attributes[16];
+	uint32_t attributeCount = 0;
+
+	std::string_view Find(std::string_view attributeName) const
 	{
-		std::cerr << "Could not open " << pdbPath << '\n';
+		for (uint32_t i = 0; i < attributeCount; ++i)
+		{
+			if (attributes[i].name == attributeName)
+				return attributes[i].value;
+		}
+
 		return {};
 	}
+};
 
-	std::string line;
-	while (std::getline(file, line))
+static bool IsXMLSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Reads the next tag at or after cursor and advances cursor past it, skipping comments and the
+// text between tags. Returns false at the end of the input
+static bool NextXMLTag(const char*& cursor, const char* end, XMLTag& tag)
+{
+	while (true)
 	{
-		if (line._Starts_with("ATOM"))
+		cursor = static_cast<const char*>(std::memchr(cursor, '<', end - cursor));
+		if (!cursor)
 		{
-			std::istringstream iss(line);
-			std::string temp[2];
-			std::string residueString;
-			std::string atomTag;
-			uint64_t atomId, residueId;
-			glm::vec3 position;
+			cursor = end;
+			return false;
+		}
 
-			// ATOM 1 N ILE A 15 11.749 81.774 51.160 1.00 13.80 N
-			iss >> temp[0] >> atomId >> atomTag >> residueString >> temp[1] >> residueId >> position[0] >> position[1] >> position[2];
+		std::string_view rest(cursor, end - cursor);
+		if (rest.compare(0, 4, "<!--") == 0)
+		{
+			const size_t commentEnd = rest.find("-->", 4);
+			cursor = commentEnd == std::string_view::npos ? end : cursor + commentEnd + 3;
+			continue;
+		}
 
-			Atom atom;
-			char element = atomTag[0];
-			atom.atomTemplate = &atomTemplates[element];
-			atom.position = position;
-			atom.residue = &residues[temp[1]];
-			atom.index = atoms.size();
-			atoms.push_back(std::move(atom));
+		if (rest.compare(0, 2, "<?") == 0)
+		{
+			const size_t declarationEnd = rest.find("?>", 2);
+			cursor = declarationEnd == std::string_view::npos ? end : cursor + declarationEnd + 2;
+			continue;
 		}
+
+		break;
 	}
 
-	file.close();
-	return atoms;
+	++cursor;
+	tag = XMLTag();
+	if (cursor < end && *cursor == '/')
+	{
+		tag.closing = true;
+		++cursor;
+	}
+
+	const char* nameBegin = cursor;
+	while (cursor < end && !IsXMLSpace(*cursor) && *cursor != '/' && *cursor != '>')
+		++cursor;
+	tag.name = std::string_view(nameBegin, cursor - nameBegin);
+
+	while (cursor < end && *cursor != '>')
+	{
+		if (IsXMLSpace(*cursor) || *cursor == '/')
+		{
+			++cursor;
+			continue;
+		}
+
+		const char* attributeBegin = cursor;
+		while (cursor < end && *cursor != '=' && *cursor != '>' && !IsXMLSpace(*cursor))
+			++cursor;
+		std::string_view attributeName(attributeBegin, cursor - attributeBegin);
+
+		while (cursor < end && (IsXMLSpace(*cursor) || *cursor == '='))
+			++cursor;
+		if (cursor >= end || (*cursor != '"' && *cursor != '\''))
+		{
+			continue;
+		}
+
+		const char quote = *cursor++;
+		const char* valueBegin = cursor;
+		cursor = static_cast<const char*>(std::memchr(cursor, quote, end - cursor));
+		if (!cursor)
+		{
+			cursor = end;
+			break;
+		}
+
+		if (tag.attributeCount < std::size(tag.attributes))
+		{
+			tag.attributes[tag.attributeCount++] = { attributeName, std::string_view(valueBegin, cursor - valueBegin) };
+		}
+
+		++cursor;
+	}
+
+	if (cursor < end)
+		++cursor;
+	return true;
+}
+
+static uint32_t ParseXMLId(std::string_view value)
+{
+	return static_cast<uint32_t>(std::max(0, ParseFixedInt(value.data(), value.data() + value.size())));
 }
 
-static FileMapping PreProcessXML(const std::string& xmlPath)
+static float ParseXMLFloat(std::string_view value)
 {
-	FileMapping mapping;
-	mapping.filepath = xmlPath;
+	return ParseFixedFloat(value.data(), value.data() + value.size());
+}
 
-	std::ifstream file(xmlPath);
-	if (!file)
+// Ids the XML skips are zero, the default constructor of glm vectors leaves them uninitialized
+template<typename T>
+static void StoreAt(std::vector<T>& table, uint32_t index, const T& value)
+{
+	if (table.size() <= index)
+		table.resize(index + 1, T(0));
+	table[index] = value;
+}
+
+// Attributes the tag leaves out keep the defaults of Material
+static Material ParseXMLMaterial(const XMLTag& tag)
+{
+	Material material;
+	const std::string_view metallic = tag.Find("metallic");
+	const std::string_view roughness = tag.Find("roughness");
+	const std::string_view reflectance = tag.Find("reflectance");
+	if (!metallic.empty())
+		material.metallic = std::clamp(ParseXMLFloat(metallic), 0.0f, 1.0f);
+	if (!roughness.empty())
+		material.roughness = std::clamp(ParseXMLFloat(roughness), 0.0f, 1.0f);
+	if (!reflectance.empty())
+		material.reflectance = std::clamp(ParseXMLFloat(reflectance), 0.0f, 1.0f);
+	return material;
+}
+
+enum class SchemeType
+{
+	None = 0, Atoms, Residues, ResiduesMapping, AtomsMapping, Radius, Materials
+};
+
+static SchemeType SchemeTypeFromString(std::string_view type)
+{
+	if (type == "Atoms") return SchemeType::Atoms;
+	if (type == "Residues") return SchemeType::Residues;
+	if (type == "ResiduesMapping") return SchemeType::ResiduesMapping;
+	if (type == "AtomsMapping") return SchemeType::AtomsMapping;
+	if (type == "Radius") return SchemeType::Radius;
+	if (type == "Materials") return SchemeType::Materials;
+	return SchemeType::None;
+}
+
+static SchemeTables LoadSchemes(const std::string& xmlPath)
+{
+	SchemeTables tables;
+	MappedFile file(xmlPath);
+	if (!file.IsOpen())
 	{
-		std::cerr << "Could not open " << xmlPath << '\n';
-		return mapping;
+		return tables;
 	}
 
-	std::string line;
-	uint64_t lineNum = 0;
+	const char* cursor = file.GetData();
+	const char* const end = cursor + file.GetSize();
 
-	uint64_t* end = nullptr;
-	while (std::getline(file, line))
+	SchemeType scheme = SchemeType::None;
+	ColorScheme* colorScheme = nullptr;
+	XMLTag tag;
+	while (NextXMLTag(cursor, end, tag))
 	{
-		if (line._Starts_with("<scheme type="))
+		if (tag.name == "scheme")
 		{
-			if (line._Starts_with("<scheme type=\"Atoms\""))
-			{
-				mapping.atoms.first = lineNum + 1;
-				end = &mapping.atoms.second;
-			}
-			else if (line._Starts_with("<scheme type=\"Residues\""))
+			if (tag.closing)
 			{
-				mapping.residues.first = lineNum + 1;
-				end = &mapping.residues.second;
+				scheme = SchemeType::None;
+				colorScheme = nullptr;
+				continue;
 			}
-			else if (line._Starts_with("<scheme type=\"ResiduesMapping\""))
-			{
-				mapping.residuesMapping.first = lineNum + 1;
-				end = &mapping.residuesMapping.second;
-			}
-			else if (line._Starts_with("<scheme type=\"AtomsMapping\""))
+
+			const std::string_view type = tag.Find("type");
+			scheme = SchemeTypeFromString(type);
+			if (scheme == SchemeType::Atoms || scheme == SchemeType::Residues)
 			{
-				mapping.atomsMapping.first = lineNum + 1;
-				end = &mapping.atomsMapping.second;
+				auto& schemes = scheme == SchemeType::Atoms ? tables.atomColorSchemes : tables.residueColorSchemes;
+				schemes.emplace_back().name = std::string(tag.Find("name"));
+				colorScheme = &schemes.back();
 			}
-			else if (line._Starts_with("<scheme type=\"Radius\""))
+			else if (scheme == SchemeType::None)
 			{
-				mapping.radius.first = lineNum + 1;
-				end = &mapping.radius.second;
-			}
-			else
-			{
-				std::cerr << "Invalid scheme type " << line << '\n';
-				goto cleanup;
+				std::cerr << "Invalid scheme type " << type << '\n';
 			}
+
+			continue;
 		}
-		else if (line == "</scheme>" && end)
+
+		if (tag.closing)
 		{
-			*end = lineNum;
+			continue;
 		}
 
-		++lineNum;
+		switch (scheme)
+		{
+			case SchemeType::Atoms:
+			case SchemeType::Residues:
+			{
+				// <color id="1" r="0.900" g="0.900" b="0.900"/>
+				const glm::vec3 color(ParseXMLFloat(tag.Find("r")), ParseXMLFloat(tag.Find("g")), ParseXMLFloat(tag.Find("b")));
+				StoreAt(colorScheme->colors, ParseXMLId(tag.Find("id")), color);
+				break;
+			}
+			case SchemeType::ResiduesMapping:
+				// <residue id="1" type="aa_20" identifier="ALA" shortcut="A" name="Alanine" ... />
+				tables.residuesMapping.emplace_back(std::string(tag.Find("identifier")), ParseXMLId(tag.Find("id")));
+				break;
+			case SchemeType::AtomsMapping:
+				// <atom identifier="H" name="Hydrogen" number="1" electronegativity="2.00" valenceElectrons="1"/>
+				tables.atomsMapping.emplace_back(std::string(tag.Find("identifier")), ParseXMLId(tag.Find("number")));
+				break;
+			case SchemeType::Radius:
+				// <vdw id="1" radius="1.200"/>
+				StoreAt(tables.radius, ParseXMLId(tag.Find("id")), ParseXMLFloat(tag.Find("radius")));
+				break;
+			case SchemeType::Materials:
+				// <atom identifier="S" metallic="0.0" roughness="0.3" reflectance="0.5"/> or <residue identifier="HOH" ... />
+				if (tag.name == "atom")
+					tables.atomMaterials.emplace_back(std::string(tag.Find("identifier")), ParseXMLMaterial(tag));
+				else if (tag.name == "residue")
+					tables.residueMaterials.emplace_back(std::string(tag.Find("identifier")), ParseXMLMaterial(tag));
+				break;
+			case SchemeType::None:
+				break;
+		}
 	}
 
-cleanup:
-	file.close();
-	return mapping;
+	return tables;
 }
 
-static void ProcessAtoms(std::vector<Atom>& atoms, const FileMapping& mapping)
+template<typename T>
+static T LookUp(const std::vector<T>& table, uint32_t index)
 {
-	std::ifstream file(mapping.filepath);
-	if (!file)
+	return index < table.size() ? table[index] : T();
+}
+
+static const ColorScheme* FindColorScheme(const std::vector<ColorScheme>& schemes, const std::string& name)
+{
+	for (const ColorScheme& scheme : schemes)
 	{
-		std::cerr << "Could not open " << mapping.filepath << '\n';
-		return;
+		if (scheme.name == name)
+			return &scheme;
 	}
 
-	std::unordered_map<std::string, uint64_t> elementToXMLIdMapping;
+	return nullptr;
+}
+
+static void ApplyResidueColors(std::unordered_map<std::string, Residue>& residues, const SchemeTables& tables, const ColorScheme& scheme)
+{
+	for (const auto& [identifier, id] : tables.residuesMapping)
 	{
-		uint64_t curLineNum = mapping.atomsMapping.first;
-		GotoLine(file, curLineNum);
-		std::string line;
-		for (; curLineNum < mapping.atomsMapping.second; ++curLineNum)
+		residues[identifier].color = LookUp(scheme.colors, id);
+	}
+}
+
+static void ApplyAtomColors(std::unordered_map<char, AtomTemplate>& atomTemplates, const SchemeTables& tables, const ColorScheme& scheme)
+{
+	for (const auto& [identifier, number] : tables.atomsMapping)
+	{
+		// Templates are keyed by the first character of the PDB atom name, so only single letter
+		// elements can be matched
+		if (identifier.length() == 1)
 		{
-			std::getline(file, line);
+			atomTemplates[identifier[0]].color = LookUp(scheme.colors, number);
+		}
+	}
+}
+
+static std::unordered_map<std::string, Residue> CreateResidues(const SchemeTables& tables)
+{
+	std::unordered_map<std::string, Residue> result;
+	if (!tables.residueColorSchemes.empty())
+	{
+		ApplyResidueColors(result, tables, tables.residueColorSchemes.front());
+	}
 
-			// <atom identifier = "H" name = "Hydrogen" number = "1" electronegativity = "2.00" valenceElectrons = "1" />
-			std::string identifier = FindPropertyInXMLLine(line, "identifier");
+	for (const auto& [identifier, material] : tables.residueMaterials)
+	{
+		Residue& residue = result[identifier];
+		residue.material = material;
+		residue.hasMaterial = true;
+	}
 
-			std::stringstream ss;
-			ss << FindPropertyInXMLLine(line, "number");
-			uint64_t number;
-			ss >> number;
+	return result;
+}
 
-			elementToXMLIdMapping[identifier] = number;
+static std::unordered_map<char, AtomTemplate> CreateAtomTemplates(const SchemeTables& tables)
+{
+	std::unordered_map<char, AtomTemplate> result;
+	for (const auto& [identifier, number] : tables.atomsMapping)
+	{
+		if (identifier.length() == 1)
+		{
+			AtomTemplate& atomTemplate = result[identifier[0]];
+			atomTemplate.color = glm::vec3(0.0f);
+			atomTemplate.radius = LookUp(tables.radius, number);
 		}
 	}
 
-	std::unordered_map<uint64_t, glm::vec3> xmlIdToColorMapping;
+	if (!tables.atomColorSchemes.empty())
+	{
+		ApplyAtomColors(result, tables, tables.atomColorSchemes.front());
+	}
+
+	// Same single letter keys as the colors, only elements that have a template get a material
+	for (const auto& [identifier, material] : tables.atomMaterials)
+	{
+		const auto it = identifier.length() == 1 ? result.find(identifier[0]) : result.end();
+		if (it != result.end())
+			it->second.material = material;
+	}
+
+	return result;
+}
+
+AtomLoader::AtomLoader(const std::string& pdbPath, const std::string& xmlPath, const AtomLoaderSpecification& specification)
+{
+	mSchemes = LoadSchemes(xmlPath);
+	mResidues = CreateResidues(mSchemes);
+	mAtomTemplates = CreateAtomTemplates(mSchemes);
+	if (pdbPath.empty())
+		return;
+
+	switch (specification.parser)
 	{
-		uint64_t curLineNum = mapping.atoms.first;
-		GotoLine(file, curLineNum);
-		for (; curLineNum < mapping.atoms.second; ++curLineNum)
+		case PDBParser::Stream:
+			mAtoms = LoadAtoms(pdbPath, mAtomTemplates, mResidues);
+			break;
+		case PDBParser::Mapped:
+		case PDBParser::MappedParallel:
 		{
-			std::string line;
-			std::getline(file, line);
-
-			// <color id="1" r="0.900" g="0.900" b="0.900"/>
-			std::stringstream ss;
-			ss << FindPropertyInXMLLine(line, "id") << ' ';
-			ss << FindPropertyInXMLLine(line, "r") << ' ';
-			ss << FindPropertyInXMLLine(line, "g") << ' ';
-			ss << FindPropertyInXMLLine(line, "b");
-
-			uint64_t id;
-			glm::vec3 color;
-			ss >> id >> color.r >> color.g >> color.b;
-			xmlIdToColorMapping[id] = color;
+			MappedFile file(pdbPath);
+			if (!file.IsOpen())
+				break;
+
+			if (specification.parser == PDBParser::Mapped)
+				mAtoms = LoadAtomsMapped(file, mAtomTemplates, mResidues);
+			else
+				mAtoms = LoadAtomsMappedParallel(file, mAtomTemplates, mResidues, specification.threadCount);
+			break;
 		}
 	}
+}
 
-	file.close();
+bool AtomLoader::SetAtomColorScheme(const std::string& name)
+{
+	const ColorScheme* scheme = FindColorScheme(mSchemes.atomColorSchemes, name);
+	if (!scheme)
+	{
+		return false;
+	}
+
+	ApplyAtomColors(mAtomTemplates, mSchemes, *scheme);
+	return true;
 }
 
-AtomLoader::AtomLoader(const std::string& pdbPath, const std::string& xmlPath)
+bool AtomLoader::SetResidueColorScheme(const std::string& name)
 {
-	const FileMapping fileMapping = PreProcessXML(xmlPath);
+	const ColorScheme* scheme = FindColorScheme(mSchemes.residueColorSchemes, name);
+	if (!scheme)
+	{
+		return false;
+	}
 
-	mResidues = LoadResidues(fileMapping);
-	mAtomTemplates = LoadAtomTemplates(fileMapping);
-	mAtoms = LoadAtoms(pdbPath, mAtomTemplates, mResidues);
+	ApplyResidueColors(mResidues, mSchemes, *scheme);
+	return true;
 }
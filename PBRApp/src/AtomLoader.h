@@ -8,15 +8,50 @@
 #include <vector>
 #include <unordered_map>
 
+// Metallic-roughness parameters of the Cook-Torrance shading, the albedo is the scheme color
+struct Material
+{
+	float metallic = 0.0f;
+	float roughness = 0.5f;
+	float reflectance = 0.5f; // Of dielectrics, F0 = 0.16 * reflectance^2, so 0.5 is the 4% of most of them
+
+	bool operator==(const Material& other) const
+	{
+		return metallic == other.metallic && roughness == other.roughness && reflectance == other.reflectance;
+	}
+};
+
 struct Residue
 {
 	glm::vec3 color;
+	Material material;
+	bool hasMaterial = false; // Replaces the materials of the atoms of the residue
 };
 
 struct AtomTemplate
 {
 	glm::vec3 color;
 	float radius;
+	Material material;
+};
+
+// One named color table of the scheme XML, indexed by the color id used in the file
+struct ColorScheme
+{
+	std::string name;
+	std::vector<glm::vec3> colors;
+};
+
+// Flat lookup tables of all schemes in the scheme XML
+struct SchemeTables
+{
+	std::vector<ColorScheme> atomColorSchemes;    // <scheme type="Atoms">, indexed by atom number
+	std::vector<ColorScheme> residueColorSchemes; // <scheme type="Residues">, indexed by residue id
+	std::vector<std::pair<std::string, uint32_t>> residuesMapping; // Residue identifier -> residue id
+	std::vector<std::pair<std::string, uint32_t>> atomsMapping;    // Atom identifier -> atom number
+	std::vector<float> radius; // Indexed by atom number
+	std::vector<std::pair<std::string, Material>> atomMaterials;    // <scheme type="Materials">, atom identifier -> material
+	std::vector<std::pair<std::string, Material>> residueMaterials; // Residue identifier -> material
 };
 
 struct Atom
@@ -27,15 +62,36 @@ struct Atom
 	uint32_t index;
 };
 
+enum class PDBParser
+{
+	Stream = 0,    // std::getline + std::istringstream per record
+	Mapped,        // Memory-mapped file, fixed PDB columns
+	MappedParallel // Mapped, split into line-aligned chunks parsed on a thread pool
+};
+
+struct AtomLoaderSpecification
+{
+	PDBParser parser = PDBParser::MappedParallel;
+	uint32_t threadCount = 0; // MappedParallel only, 0 means one thread per hardware core
+};
+
 class AtomLoader
 {
 public:
-	AtomLoader(const std::string& pdbPath, const std::string& xmlPath);
+	// An empty pdbPath loads the schemes and templates of the XML alone
+	AtomLoader(const std::string& pdbPath, const std::string& xmlPath, const AtomLoaderSpecification& specification = AtomLoaderSpecification());
+
+	// Recolor the loaded templates/residues in place from another scheme of the same XML, atoms
+	// keep pointing to the same objects. Returns false if there is no scheme with that name
+	bool SetAtomColorScheme(const std::string& name);
+	bool SetResidueColorScheme(const std::string& name);
 
+	const SchemeTables& GetSchemes() const { return mSchemes; }
 	const std::unordered_map<std::string, Residue>& GetResidues() const { return mResidues; }
 	const std::unordered_map<char, AtomTemplate>& GetAtomTemplates() const { return mAtomTemplates; }
 	const std::vector<Atom>& GetAtoms() const { return mAtoms; }
 private:
+	SchemeTables mSchemes;
 	std::unordered_map<std::string, Residue> mResidues;
 	std::unordered_map<char, AtomTemplate> mAtomTemplates;
 	std::vector<Atom> mAtoms;
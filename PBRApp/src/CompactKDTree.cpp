@@ -0,0 +1,253 @@
+#include "CompactKDTree.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+static constexpr uint32_t MaxCompactKDBinCount = 64;
+
+// After this many splits in a row that cost more than a leaf, the subtree is given up
+static constexpr uint32_t MaxBadRefines = 3;
+
+struct CompactKDBuildContext
+{
+	const CompactKDTreeSpecification* specification;
+	std::vector<glm::vec3> atomMin;
+	std::vector<glm::vec3> atomMax;
+	const std::vector<Atom>* atoms;
+	std::vector<CompactKDNode>* nodes;
+	std::vector<uint32_t>* atomIndices;
+};
+
+struct CompactKDSplit
+{
+	int axis = -1;
+	float position = 0.0f;
+	float cost = std::numeric_limits<float>::max();
+};
+
+static float BoxSurfaceArea(const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+	const glm::vec3 extent = glm::max(boxMax - boxMin, glm::vec3(0.0f));
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+static void MakeCompactLeaf(CompactKDNode& node, const std::vector<uint32_t>& refs, CompactKDBuildContext& context)
+{
+	node.data = static_cast<uint32_t>(context.atomIndices->size());
+	node.flags = static_cast<uint32_t>(refs.size()) << 2 | CompactKDNode::LeafAxis;
+	for (uint32_t ref : refs)
+	{
+		context.atomIndices->push_back((*context.atoms)[ref].index);
+	}
+}
+
+// Atoms are counted in the bins of their lower and of their upper bound, an atom is below every
+// plane after its upper bin and above every plane before its lower bin
+static CompactKDSplit FindCompactKDSplit(const std::vector<uint32_t>& refs, const glm::vec3& boxMin, const glm::vec3& boxMax, const CompactKDBuildContext& context)
+{
+	const CompactKDTreeSpecification& specification = *context.specification;
+	const uint32_t binCount = std::clamp(specification.binCount, 2u, MaxCompactKDBinCount);
+	const float invArea = 1.0f / BoxSurfaceArea(boxMin, boxMax);
+	const glm::vec3 extent = boxMax - boxMin;
+	const size_t count = refs.size();
+
+	CompactKDSplit best;
+	std::array<uint32_t, MaxCompactKDBinCount> starts, ends;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (extent[axis] <= 0.0f)
+		{
+			continue;
+		}
+
+		const float scale = binCount / extent[axis];
+		auto binIndex = [&](float position)
+		{
+			const float bin = (std::clamp(position, boxMin[axis], boxMax[axis]) - boxMin[axis]) * scale;
+			return std::min(binCount - 1, static_cast<uint32_t>(bin));
+		};
+
+		std::fill(starts.begin(), starts.begin() + binCount, 0);
+		std::fill(ends.begin(), ends.begin() + binCount, 0);
+		for (uint32_t ref : refs)
+		{
+			++starts[binIndex(context.atomMin[ref][axis])];
+			++ends[binIndex(context.atomMax[ref][axis])];
+		}
+
+		const int otherAxis0 = (axis + 1) % 3;
+		const int otherAxis1 = (axis + 2) % 3;
+		const float sideArea = extent[otherAxis0] * extent[otherAxis1];
+		const float perimeter = extent[otherAxis0] + extent[otherAxis1];
+
+		size_t below = 0, above = count;
+		for (uint32_t i = 1; i < binCount; ++i)
+		{
+			below += starts[i - 1];
+			above -= ends[i - 1];
+
+			const float position = boxMin[axis] + i * extent[axis] / binCount;
+			const float belowArea = 2.0f * (sideArea + (position - boxMin[axis]) * perimeter);
+			const float aboveArea = 2.0f * (sideArea + (boxMax[axis] - position) * perimeter);
+			const float bonus = below == 0 || above == 0 ? specification.emptyBonus : 0.0f;
+			const float cost = specification.traversalCost + specification.intersectionCost * (1.0f - bonus)
+				* (belowArea * invArea * below + aboveArea * invArea * above);
+			if (cost < best.cost)
+			{
+				best.cost = cost;
+				best.axis = axis;
+				best.position = position;
+			}
+		}
+	}
+
+	return best;
+}
+
+static void BuildCompactKDNode(std::vector<uint32_t>& refs, const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t depth, uint32_t badRefines, CompactKDBuildContext& context)
+{
+	std::vector<CompactKDNode>& nodes = *context.nodes;
+	const uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+
+	const size_t count = refs.size();
+	if (count <= context.specification->maxLeafAtoms || depth == 0)
+	{
+		MakeCompactLeaf(nodes[nodeIndex], refs, context);
+		return;
+	}
+
+	const CompactKDSplit split = FindCompactKDSplit(refs, boxMin, boxMax, context);
+	const float leafCost = context.specification->intersectionCost * count;
+	if (split.cost > leafCost)
+	{
+		++badRefines;
+	}
+
+	if (split.axis < 0 || (split.cost > 4.0f * leafCost && count < 16) || badRefines == MaxBadRefines)
+	{
+		MakeCompactLeaf(nodes[nodeIndex], refs, context);
+		return;
+	}
+
+	// Classified against the plane itself, atoms touching it go to both sides
+	const int axis = split.axis;
+	std::vector<uint32_t> belowRefs, aboveRefs;
+	for (uint32_t ref : refs)
+	{
+		if (context.atomMin[ref][axis] <= split.position)
+			belowRefs.push_back(ref);
+		if (context.atomMax[ref][axis] >= split.position)
+			aboveRefs.push_back(ref);
+	}
+
+	if (belowRefs.size() == count && aboveRefs.size() == count)
+	{
+		MakeCompactLeaf(nodes[nodeIndex], refs, context);
+		return;
+	}
+
+	refs.clear();
+	refs.shrink_to_fit();
+
+	glm::vec3 belowMax = boxMax, aboveMin = boxMin;
+	belowMax[axis] = split.position;
+	aboveMin[axis] = split.position;
+
+	BuildCompactKDNode(belowRefs, boxMin, belowMax, depth - 1, badRefines, context);
+
+	const uint32_t aboveChild = static_cast<uint32_t>(nodes.size());
+	std::memcpy(&nodes[nodeIndex].data, &split.position, sizeof(float));
+	nodes[nodeIndex].flags = aboveChild << 2 | static_cast<uint32_t>(axis);
+
+	BuildCompactKDNode(aboveRefs, aboveMin, boxMax, depth - 1, badRefines, context);
+}
+
+CompactKDTree::CompactKDTree(const std::vector<Atom>& atoms, const CompactKDTreeSpecification& specification)
+	: mSpecification(specification)
+{
+	CompactKDBuildContext context;
+	context.specification = &mSpecification;
+	context.atoms = &atoms;
+	context.nodes = &mNodes;
+	context.atomIndices = &mAtomIndices;
+
+	context.atomMin.resize(atoms.size());
+	context.atomMax.resize(atoms.size());
+	mBoxMin = glm::vec3(std::numeric_limits<float>::max());
+	mBoxMax = glm::vec3(std::numeric_limits<float>::lowest());
+	for (size_t i = 0; i < atoms.size(); ++i)
+	{
+		const glm::vec3 radius(atoms[i].atomTemplate->radius);
+		context.atomMin[i] = atoms[i].position - radius;
+		context.atomMax[i] = atoms[i].position + radius;
+		mBoxMin = glm::min(mBoxMin, context.atomMin[i]);
+		mBoxMax = glm::max(mBoxMax, context.atomMax[i]);
+	}
+
+	if (atoms.empty())
+	{
+		mBoxMin = glm::vec3(0.0f);
+		mBoxMax = glm::vec3(0.0f);
+	}
+
+	uint32_t maxDepth = mSpecification.maxDepth;
+	if (maxDepth == 0)
+	{
+		maxDepth = static_cast<uint32_t>(std::round(8.0f + 1.3f * std::log2(static_cast<float>(std::max<size_t>(atoms.size(), 1)))));
+	}
+	maxDepth = std::min(maxDepth, MaxDepth);
+
+	std::vector<uint32_t> refs(atoms.size());
+	for (uint32_t i = 0; i < refs.size(); ++i)
+	{
+		refs[i] = i;
+	}
+
+	BuildCompactKDNode(refs, mBoxMin, mBoxMax, maxDepth, 0, context);
+}
+
+KDTreeStatistics CompactKDTree::ComputeStatistics() const
+{
+	KDTreeStatistics statistics;
+	statistics.minLeafAtoms = std::numeric_limits<uint32_t>::max();
+	AccumulateStatistics(statistics, 0, 0, mBoxMin, mBoxMax, BoxSurfaceArea(mBoxMin, mBoxMax));
+	if (statistics.leafCount == 0)
+	{
+		statistics.minLeafAtoms = 0;
+	}
+
+	return statistics;
+}
+
+void CompactKDTree::AccumulateStatistics(KDTreeStatistics& statistics, uint32_t nodeIndex, uint32_t depth, const glm::vec3& boxMin, const glm::vec3& boxMax, float rootArea) const
+{
+	const CompactKDNode& node = mNodes[nodeIndex];
+	const float relativeArea = rootArea > 0.0f ? BoxSurfaceArea(boxMin, boxMax) / rootArea : 1.0f;
+
+	++statistics.nodeCount;
+	statistics.maxDepth = std::max(statistics.maxDepth, depth);
+	if (!node.IsLeaf())
+	{
+		const uint32_t axis = node.GetAxis();
+		glm::vec3 belowMax = boxMax, aboveMin = boxMin;
+		belowMax[axis] = node.GetSplit();
+		aboveMin[axis] = node.GetSplit();
+
+		statistics.sahCost += mSpecification.traversalCost * relativeArea;
+		AccumulateStatistics(statistics, nodeIndex + 1, depth + 1, boxMin, belowMax, rootArea);
+		AccumulateStatistics(statistics, node.GetAboveChild(), depth + 1, aboveMin, boxMax, rootArea);
+		return;
+	}
+
+	const uint32_t atomCount = node.GetAtomCount();
+	++statistics.leafCount;
+	if (atomCount == 0)
+		++statistics.emptyLeafCount;
+	statistics.minLeafAtoms = std::min(statistics.minLeafAtoms, atomCount);
+	statistics.maxLeafAtoms = std::max(statistics.maxLeafAtoms, atomCount);
+	statistics.leafAtomReferences += atomCount;
+	statistics.sahCost += mSpecification.intersectionCost * atomCount * relativeArea;
+}
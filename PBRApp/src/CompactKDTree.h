@@ -0,0 +1,74 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "AtomLoader.h"
+#include "AtomKDTree.h"
+
+struct CompactKDTreeSpecification
+{
+	uint32_t maxLeafAtoms = 4;
+	uint32_t maxDepth = 0;          // 0 means 8 + 1.3 log2(atom count), at most CompactKDTree::MaxDepth
+	uint32_t binCount = 32;         // Candidate split planes per axis + 1, at most 64
+	float traversalCost = 2.0f;     // One step of the traversal loop, relative to intersectionCost
+	float intersectionCost = 1.0f;  // One sphere test
+	float emptyBonus = 0.2f;        // Discount of splits that cut off empty space, larger values duplicate more atoms
+};
+
+// 8 bytes, one uvec2 in Raytrace.frag. The below child of an interior node is always the node
+// right after it
+struct CompactKDNode
+{
+	static constexpr uint32_t LeafAxis = 3;
+
+	uint32_t data;  // Split position bits of interior nodes, first entry in the atom index buffer of leaves
+	uint32_t flags; // Bits 0-1 split axis or LeafAxis, bits 2-31 above child of interior nodes or atom count of leaves
+
+	bool IsLeaf() const { return (flags & 3) == LeafAxis; }
+	uint32_t GetAxis() const { return flags & 3; }
+	uint32_t GetAboveChild() const { return flags >> 2; }
+	uint32_t GetAtomCount() const { return flags >> 2; }
+	uint32_t GetAtomOffset() const { return data; }
+	float GetSplit() const
+	{
+		float split;
+		std::memcpy(&split, &data, sizeof(split));
+		return split;
+	}
+};
+
+// Spatial kd-tree with splits chosen by a binned SAH. Atoms crossing a split plane are referenced
+// by both children, so cells never overlap and a ray walks them front to back
+class CompactKDTree
+{
+public:
+	// A walk keeps at most one far child per level waiting, so MaxDepth entries are all its todo
+	// stack ever needs. COMPACT_KDTREE_MAX_DEPTH of Raytrace.frag is the same
+	static constexpr uint32_t MaxDepth = 64;
+public:
+	CompactKDTree(const std::vector<Atom>& atoms, const CompactKDTreeSpecification& specification = CompactKDTreeSpecification());
+
+	// The root is node 0 and covers GetBoxMin() to GetBoxMax()
+	const std::vector<CompactKDNode>& GetNodes() const { return mNodes; }
+
+	// Atom::index of the atoms of every leaf, each leaf owns one contiguous range
+	const std::vector<uint32_t>& GetAtomIndices() const { return mAtomIndices; }
+
+	const glm::vec3& GetBoxMin() const { return mBoxMin; }
+	const glm::vec3& GetBoxMax() const { return mBoxMax; }
+
+	// sahCost uses the costs of the specification
+	KDTreeStatistics ComputeStatistics() const;
+private:
+	void AccumulateStatistics(KDTreeStatistics& statistics, uint32_t nodeIndex, uint32_t depth, const glm::vec3& boxMin, const glm::vec3& boxMax, float rootArea) const;
+private:
+	CompactKDTreeSpecification mSpecification;
+	glm::vec3 mBoxMin;
+	glm::vec3 mBoxMax;
+	std::vector<CompactKDNode> mNodes;
+	std::vector<uint32_t> mAtomIndices;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+// Blocking FIFO between the threads of a pipeline. Push() waits while the queue is full, so a fast
+// stage cannot run ahead of a slow one by more than capacity items
+template<typename T>
+class BoundedQueue
+{
+public:
+	BoundedQueue(size_t capacity)
+		: mCapacity(capacity > 0 ? capacity : 1) {}
+
+	BoundedQueue(const BoundedQueue&) = delete;
+	BoundedQueue(BoundedQueue&&) = delete;
+
+	BoundedQueue& operator=(const BoundedQueue&) = delete;
+	BoundedQueue& operator=(BoundedQueue&&) = delete;
+
+	// Returns false without taking item if the queue was closed
+	bool Push(T item)
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mNotFull.wait(lock, [this] { return mItems.size() < mCapacity || mClosed; });
+		if (mClosed)
+			return false;
+
+		mItems.push_back(std::move(item));
+		mNotEmpty.notify_one();
+		return true;
+	}
+
+	// Waits for the next item, empty once the queue is closed and drained
+	std::optional<T> Pop()
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mNotEmpty.wait(lock, [this] { return !mItems.empty() || mClosed; });
+		if (mItems.empty())
+			return std::nullopt;
+
+		std::optional<T> item(std::move(mItems.front()));
+		mItems.pop_front();
+		mNotFull.notify_one();
+		return item;
+	}
+
+	// No more pushes, Pop() still hands out what is left
+	void Close()
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mClosed = true;
+		mNotFull.notify_all();
+		mNotEmpty.notify_all();
+	}
+private:
+	std::mutex mMutex;
+	std::condition_variable mNotFull;
+	std::condition_variable mNotEmpty;
+	std::deque<T> mItems;
+	size_t mCapacity;
+	bool mClosed = false;
+};
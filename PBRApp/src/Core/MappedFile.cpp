@@ -0,0 +1,114 @@
+#include "MappedFile.h"
+
+#include <iostream>
+
+#ifdef _WIN32
+	#include <Windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path)
+{
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		std::cerr << "Could not open " << path << '\n';
+		return;
+	}
+
+	mFileHandle = file;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		std::cerr << "Could not query size of " << path << '\n';
+		return;
+	}
+
+	mSize = static_cast<uint64_t>(size.QuadPart);
+	mIsOpen = true;
+	if (mSize == 0)
+	{
+		// Empty files cannot be mapped, but are still valid
+		return;
+	}
+
+	mMappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMappingHandle == nullptr)
+	{
+		std::cerr << "Could not map " << path << '\n';
+		mIsOpen = false;
+		return;
+	}
+
+	mData = static_cast<const char*>(MapViewOfFile(mMappingHandle, FILE_MAP_READ, 0, 0, 0));
+	if (mData == nullptr)
+	{
+		std::cerr << "Could not map " << path << '\n';
+		mIsOpen = false;
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	if (mData)
+		UnmapViewOfFile(mData);
+	if (mMappingHandle)
+		CloseHandle(mMappingHandle);
+	if (mFileHandle)
+		CloseHandle(mFileHandle);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path)
+{
+	mFileDescriptor = open(path.c_str(), O_RDONLY);
+	if (mFileDescriptor < 0)
+	{
+		std::cerr << "Could not open " << path << '\n';
+		return;
+	}
+
+	struct stat info;
+	if (fstat(mFileDescriptor, &info) != 0)
+	{
+		std::cerr << "Could not query size of " << path << '\n';
+		return;
+	}
+
+	mSize = static_cast<uint64_t>(info.st_size);
+	mIsOpen = true;
+	if (mSize == 0)
+	{
+		// Empty files cannot be mapped, but are still valid
+		return;
+	}
+
+	void* data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, mFileDescriptor, 0);
+	if (data == MAP_FAILED)
+	{
+		std::cerr << "Could not map " << path << '\n';
+		mIsOpen = false;
+		return;
+	}
+
+	madvise(data, mSize, MADV_SEQUENTIAL);
+	mData = static_cast<const char*>(data);
+}
+
+MappedFile::~MappedFile()
+{
+	if (mData)
+		munmap(const_cast<char*>(mData), mSize);
+	if (mFileDescriptor >= 0)
+		close(mFileDescriptor);
+}
+
+#endif
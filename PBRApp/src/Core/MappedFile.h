@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Read-only view of a whole file mapped into the address space
+class MappedFile
+{
+public:
+	MappedFile(const std::string& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile(MappedFile&&) = delete;
+
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile& operator=(MappedFile&&) = delete;
+
+	bool IsOpen() const { return mIsOpen; }
+	const char* GetData() const { return mData; }
+	uint64_t GetSize() const { return mSize; }
+private:
+	const char* mData = nullptr;
+	uint64_t mSize = 0;
+	bool mIsOpen = false;
+#ifdef _WIN32
+	void* mFileHandle = nullptr;
+	void* mMappingHandle = nullptr;
+#else
+	int mFileDescriptor = -1;
+#endif
+};
@@ -0,0 +1,188 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+// Index of the current thread in the pool it belongs to, threads outside any pool use the shared queue
+static thread_local const ThreadPool* sCurrentPool = nullptr;
+static thread_local uint32_t sCurrentWorkerIndex = 0;
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+	if (threadCount == 0)
+	{
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		mQueues.emplace_back(std::make_unique<TaskQueue>());
+	}
+
+	mWorkers.reserve(threadCount - 1);
+	for (uint32_t i = 0; i + 1 < threadCount; ++i)
+	{
+		mWorkers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+		mStopping = true;
+	}
+
+	mCondition.notify_all();
+	for (std::thread& worker : mWorkers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::ParallelFor(uint32_t count, const std::function<void(uint32_t)>& func)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	const uint32_t helperCount = std::min(count, GetThreadCount()) - 1;
+	if (helperCount == 0)
+	{
+		for (uint32_t i = 0; i < count; ++i)
+			func(i);
+		return;
+	}
+
+	std::atomic<uint32_t> nextIndex = 0;
+	auto run = [&]()
+	{
+		for (uint32_t i = nextIndex++; i < count; i = nextIndex++)
+		{
+			func(i);
+		}
+	};
+
+	TaskGroup group(*this);
+	for (uint32_t i = 0; i < helperCount; ++i)
+	{
+		group.Run(run);
+	}
+
+	run();
+	group.Wait();
+}
+
+void ThreadPool::Submit(Task task)
+{
+	const bool isWorker = sCurrentPool == this;
+	TaskQueue& queue = *mQueues[isWorker ? sCurrentWorkerIndex : mQueues.size() - 1];
+
+	// Counted before it becomes visible, so a thief can never take the counter below zero
+	++mPendingTasks;
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+
+	// Taking the lock orders this with a worker that checked mPendingTasks and is about to sleep
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+	}
+
+	mCondition.notify_one();
+}
+
+bool ThreadPool::TryPop(TaskQueue& queue, bool newest, Task& task)
+{
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.tasks.empty())
+	{
+		return false;
+	}
+
+	if (newest)
+	{
+		task = std::move(queue.tasks.back());
+		queue.tasks.pop_back();
+	}
+	else
+	{
+		task = std::move(queue.tasks.front());
+		queue.tasks.pop_front();
+	}
+
+	--mPendingTasks;
+	return true;
+}
+
+bool ThreadPool::TryRunPendingTask()
+{
+	if (mPendingTasks == 0)
+	{
+		return false;
+	}
+
+	const uint32_t queueCount = static_cast<uint32_t>(mQueues.size());
+	const bool isWorker = sCurrentPool == this;
+	const uint32_t ownIndex = isWorker ? sCurrentWorkerIndex : queueCount - 1;
+
+	// Own queue newest first keeps the working set hot, everything else is stolen oldest first
+	// because older tasks tend to be the bigger ones
+	Task task;
+	bool found = TryPop(*mQueues[ownIndex], true, task);
+	for (uint32_t i = 1; i < queueCount && !found; ++i)
+	{
+		found = TryPop(*mQueues[(ownIndex + i) % queueCount], false, task);
+	}
+
+	if (!found)
+	{
+		return false;
+	}
+
+	task();
+	return true;
+}
+
+void ThreadPool::WorkerLoop(uint32_t workerIndex)
+{
+	sCurrentPool = this;
+	sCurrentWorkerIndex = workerIndex;
+
+	while (true)
+	{
+		if (TryRunPendingTask())
+		{
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mSleepMutex);
+		mCondition.wait(lock, [this]() { return mStopping || mPendingTasks > 0; });
+		if (mStopping && mPendingTasks == 0)
+		{
+			return;
+		}
+	}
+}
+
+void TaskGroup::Run(ThreadPool::Task task)
+{
+	++mPendingTasks;
+	mPool.Submit([this, task = std::move(task)]()
+	{
+		task();
+		--mPendingTasks;
+	});
+}
+
+void TaskGroup::Wait()
+{
+	while (mPendingTasks > 0)
+	{
+		if (!mPool.TryRunPendingTask())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+
+// Work-stealing pool: tasks spawned from a worker go to that worker's own deque and are taken
+// newest first, idle workers steal the oldest tasks of the others
+class ThreadPool
+{
+public:
+	using Task = std::function<void()>;
+public:
+	// threadCount counts the calling thread too, 0 means one thread per hardware core
+	ThreadPool(uint32_t threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool(ThreadPool&&) = delete;
+
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	ThreadPool& operator=(ThreadPool&&) = delete;
+
+	uint32_t GetThreadCount() const { return static_cast<uint32_t>(mWorkers.size()) + 1; }
+
+	// Runs func(i) for every i in [0, count) and returns once all of them finished. The calling
+	// thread takes part in the work, so nested calls from inside a task cannot deadlock
+	void ParallelFor(uint32_t count, const std::function<void(uint32_t)>& func);
+private:
+	struct TaskQueue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+private:
+	void Submit(Task task);
+	bool TryRunPendingTask();
+	bool TryPop(TaskQueue& queue, bool newest, Task& task);
+	void WorkerLoop(uint32_t workerIndex);
+private:
+	std::vector<std::thread> mWorkers;
+
+	// One queue per worker plus a shared one at the end for threads outside the pool
+	std::vector<std::unique_ptr<TaskQueue>> mQueues;
+	std::atomic<uint32_t> mPendingTasks = 0;
+
+	std::mutex mSleepMutex;
+	std::condition_variable mCondition;
+	bool mStopping = false;
+
+	friend class TaskGroup;
+};
+
+// Set of tasks that can spawn more tasks into the same group. Wait() runs pending tasks of the
+// pool while the group is not finished instead of blocking
+class TaskGroup
+{
+public:
+	TaskGroup(ThreadPool& pool)
+		: mPool(pool) {}
+	~TaskGroup() { Wait(); }
+
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup(TaskGroup&&) = delete;
+
+	TaskGroup& operator=(const TaskGroup&) = delete;
+	TaskGroup& operator=(TaskGroup&&) = delete;
+
+	void Run(ThreadPool::Task task);
+	void Wait();
+private:
+	ThreadPool& mPool;
+	std::atomic<uint32_t> mPendingTasks = 0;
+};
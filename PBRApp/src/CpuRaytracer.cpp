@@ -0,0 +1,960 @@
+#include "CpuRaytracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <numeric>
+
+#include <stb_image.h>
+
+#include "Core/ThreadPool.h"
+#include "Core/Timer.h"
+#include "AtomKDTree.h"
+#include "EnvironmentLighting.h"
+#include "MolecularSurface.h"
+#include "RayCaster.h"
+#include "Shading.h"
+
+// Constants of Raytrace.frag
+static const glm::vec3 LightColor = glm::vec3(1.0f, 0.0f, 1.0f);
+static constexpr float LightRadius = 0.5f;
+static constexpr float Pi = 3.14159265358979f;
+static constexpr float MinDistance = -0.001f;
+static constexpr float MaxDistance = 1000000000.0f;
+static constexpr float RefractiveIndex = 1.45f;
+static constexpr float ScreenGamma = 2.2f;
+static constexpr float ShadowFactor = 0.35f;
+static constexpr float LightIntensity = 3.14159265f; // A white Lambertian sphere shows its albedo where it faces the light
+static constexpr float AmbientFactor = 0.1f;         // Of the albedo, direct light without image-based lighting
+static constexpr int KDTreeStackSize = AtomKDTree::TraversalStackSize;
+static constexpr int MaxSurfaceSteps = 1024;
+static constexpr float SurfaceHitDistance = 0.05f; // In voxels of the surface
+
+static float HitSphereOutside(const CpuRaytracer::Ray& ray, const glm::vec3& center, float radius)
+{
+	const glm::vec3 tro = ray.origin - center;
+	const float a = glm::dot(ray.dir, ray.dir);
+	const float b = 2.0f * glm::dot(ray.dir, tro);
+	const float c = glm::dot(tro, tro) - radius * radius;
+	const float D = b * b - 4.0f * a * c;
+	if (D < 0.0f)
+		return -1.0f;
+
+	const float sqrtD = std::sqrt(D);
+	const float denom = 2.0f * a;
+	return std::min((-b - sqrtD) / denom, (-b + sqrtD) / denom);
+}
+
+static float HitSphereInside(const CpuRaytracer::Ray& ray, const glm::vec3& center, float radius)
+{
+	const glm::vec3 tro = ray.origin - center;
+	const float a = glm::dot(ray.dir, ray.dir);
+	const float b = 2.0f * glm::dot(ray.dir, tro);
+	const float c = glm::dot(tro, tro) - radius * radius;
+	const float D = b * b - 4.0f * a * c;
+	if (D < 0.0f)
+		return -1.0f;
+
+	const float sqrtD = std::sqrt(D);
+	const float denom = 2.0f * a;
+	const float r1 = (-b - sqrtD) / denom;
+	const float r2 = (-b + sqrtD) / denom;
+	if ((r1 > 0.0f && r2 < 0.0f) || (r1 < 0.0f && r2 > 0.0f))
+		return std::max(r1, r2);
+
+	return -1.0f;
+}
+
+// True if the ray passes the box before maxDistance, hits down to MinDistance count like in
+// TestSphere(). entry is where the ray enters the box, negative when it starts inside
+static bool EnterBox(const CpuRaytracer::Ray& ray, const glm::vec4& boxMin, const glm::vec4& boxMax, float maxDistance, float& entry)
+{
+	const glm::vec3 tMin = (glm::vec3(boxMin) - ray.origin) / ray.dir;
+	const glm::vec3 tMax = (glm::vec3(boxMax) - ray.origin) / ray.dir;
+	const glm::vec3 t1 = glm::min(tMin, tMax);
+	const glm::vec3 t2 = glm::max(tMin, tMax);
+	entry = std::max(std::max(t1.x, t1.y), t1.z);
+	const float tFar = std::min(std::min(t2.x, t2.y), t2.z);
+	return entry <= tFar && tFar > MinDistance && entry < maxDistance;
+}
+
+CpuCubemap::CpuCubemap(const std::vector<std::string>& faces)
+	: mFaces(faces.size())
+{
+	mIsValid = faces.size() == 6;
+	for (size_t i = 0; i < faces.size(); ++i)
+	{
+		int width, height, channelCount;
+		unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &channelCount, 3);
+		if (!data)
+		{
+			std::cerr << "Cubemap tex failed to load at path: " << faces[i] << '\n';
+			mIsValid = false;
+			continue;
+		}
+
+		Face& face = mFaces[i];
+		face.width = width;
+		face.height = height;
+		face.texels.resize(static_cast<size_t>(width) * height);
+		for (size_t j = 0; j < face.texels.size(); ++j)
+		{
+			face.texels[j] = glm::vec3(data[3 * j], data[3 * j + 1], data[3 * j + 2]) / 255.0f;
+		}
+
+		stbi_image_free(data);
+	}
+}
+
+glm::vec3 CpuCubemap::Sample(const glm::vec3& direction) const
+{
+	if (!mIsValid)
+		return glm::vec3(0.0f);
+
+	// Face selection and face coordinates of the OpenGL specification, table 8.19
+	const glm::vec3 a = glm::abs(direction);
+	uint32_t faceIndex;
+	float sc, tc, ma;
+	if (a.x >= a.y && a.x >= a.z)
+	{
+		faceIndex = direction.x >= 0.0f ? 0 : 1;
+		sc = direction.x >= 0.0f ? -direction.z : direction.z;
+		tc = -direction.y;
+		ma = a.x;
+	}
+	else if (a.y >= a.z)
+	{
+		faceIndex = direction.y >= 0.0f ? 2 : 3;
+		sc = direction.x;
+		tc = direction.y >= 0.0f ? direction.z : -direction.z;
+		ma = a.y;
+	}
+	else
+	{
+		faceIndex = direction.z >= 0.0f ? 4 : 5;
+		sc = direction.z >= 0.0f ? direction.x : -direction.x;
+		tc = -direction.y;
+		ma = a.z;
+	}
+
+	const Face& face = mFaces[faceIndex];
+	const float u = 0.5f * (sc / ma + 1.0f) * face.width - 0.5f;
+	const float v = 0.5f * (tc / ma + 1.0f) * face.height - 0.5f;
+	const float u0 = std::floor(u);
+	const float v0 = std::floor(v);
+	const float fu = u - u0;
+	const float fv = v - v0;
+	const int x0 = std::clamp(static_cast<int>(u0), 0, face.width - 1);
+	const int x1 = std::clamp(static_cast<int>(u0) + 1, 0, face.width - 1);
+	const int y0 = std::clamp(static_cast<int>(v0), 0, face.height - 1);
+	const int y1 = std::clamp(static_cast<int>(v0) + 1, 0, face.height - 1);
+
+	const glm::vec3 top = glm::mix(face.texels[y0 * face.width + x0], face.texels[y0 * face.width + x1], fu);
+	const glm::vec3 bottom = glm::mix(face.texels[y1 * face.width + x0], face.texels[y1 * face.width + x1], fu);
+	return glm::mix(top, bottom, fv);
+}
+
+CpuRaytracer::CpuRaytracer(const RaytraceScene& scene, const CpuCubemap& cubemap, const CpuRaytracerSpecification& specification)
+	: mScene(scene), mCubemap(cubemap), mSpecification(specification)
+{
+	mSpecification.maxDepth = std::clamp(mSpecification.maxDepth, 1, MaxDepth);
+	mSpecification.tileSize = std::max(mSpecification.tileSize, 1u);
+	mPool = CreateScope<ThreadPool>(mSpecification.threadCount);
+
+	const bool stackWalk = !mSpecification.useCompactKDTree && !mSpecification.useParentLinks && !(mSpecification.traceSurface && mScene.surface);
+	if (mSpecification.packetPrimaryRays && stackWalk)
+		mRayCaster = CreateScope<RayCaster>(mScene);
+}
+
+CpuRaytracer::~CpuRaytracer() = default;
+
+CpuRenderStatistics CpuRaytracer::Render(const glm::mat4& invProjView, uint32_t width, uint32_t height, std::vector<glm::vec4>& pixels)
+{
+	pixels.resize(static_cast<size_t>(width) * height);
+
+	const bool gammaCorrect = mSpecification.gammaCorrect;
+	return TracePixels(invProjView, width, height, 0, [&](size_t pixel, const glm::vec3& color)
+	{
+		pixels[pixel] = glm::vec4(gammaCorrect ? glm::pow(color, glm::vec3(1.0f / ScreenGamma)) : color, 1.0f);
+	});
+}
+
+// The accumulating paths skip NaN samples like Raytrace.frag, a refraction at a grazing angle
+// normalizes the zero vector refract() returns for total internal reflection
+static bool IsNan(const glm::vec3& color)
+{
+	return std::isnan(color.r) || std::isnan(color.g) || std::isnan(color.b);
+}
+
+CpuRenderStatistics CpuRaytracer::Accumulate(const glm::mat4& invProjView, uint32_t width, uint32_t height, uint32_t sampleIndex, std::vector<glm::vec4>& accumulation)
+{
+	const size_t pixelCount = static_cast<size_t>(width) * height;
+	if (sampleIndex == 0 || accumulation.size() != pixelCount)
+		accumulation.assign(pixelCount, glm::vec4(0.0f));
+
+	return TracePixels(invProjView, width, height, sampleIndex, [&](size_t pixel, const glm::vec3& color)
+	{
+		if (!IsNan(color))
+			accumulation[pixel] += glm::vec4(color, 1.0f);
+	});
+}
+
+void CpuRaytracer::ResolveAccumulation(const std::vector<glm::vec4>& accumulation, std::vector<glm::vec4>& pixels) const
+{
+	pixels.resize(accumulation.size());
+	for (size_t i = 0; i < accumulation.size(); ++i)
+	{
+		const glm::vec3 color = glm::vec3(accumulation[i]) / std::max(accumulation[i].a, 1.0f);
+		pixels[i] = glm::vec4(mSpecification.gammaCorrect ? glm::pow(color, glm::vec3(1.0f / ScreenGamma)) : color, 1.0f);
+	}
+}
+
+// Radical inverse in the given base, the Halton sequence
+static float Halton(uint32_t index, uint32_t base)
+{
+	float result = 0.0f;
+	float digitWeight = 1.0f / base;
+	for (; index > 0; index /= base, digitWeight /= base)
+		result += digitWeight * (index % base);
+
+	return result;
+}
+
+glm::vec2 CpuRaytracer::GetSampleJitter(uint32_t sampleIndex)
+{
+	if (sampleIndex == 0)
+		return glm::vec2(0.0f);
+
+	return glm::vec2(Halton(sampleIndex, 2), Halton(sampleIndex, 3)) - 0.5f;
+}
+
+glm::vec2 CpuRaytracer::GetLightSample(uint32_t sampleIndex)
+{
+	// Bases 5 and 7 keep the light samples independent of the pixel jitter, sample 0 is the center
+	const float radius = std::sqrt(Halton(sampleIndex, 5));
+	const float phi = 2.0f * Pi * Halton(sampleIndex, 7);
+	return radius * glm::vec2(std::cos(phi), std::sin(phi));
+}
+
+CpuRenderStatistics CpuRaytracer::RenderAdaptive(const glm::mat4& invProjView, uint32_t width, uint32_t height, const AdaptiveSamplingSpecification& sampling,
+	std::vector<glm::vec4>& pixels)
+{
+	const uint32_t maxSamples = std::max(sampling.maxSamples, 1u);
+	const uint32_t minSamples = std::clamp(sampling.minSamples, 1u, maxSamples);
+	const uint32_t tileSize = mSpecification.tileSize;
+	const uint32_t tilesX = (width + tileSize - 1) / tileSize;
+	const uint32_t tilesY = (height + tileSize - 1) / tileSize;
+	const size_t pixelCount = static_cast<size_t>(width) * height;
+	const uint64_t sampleBudget = sampling.sampleBudget > 0 ? static_cast<uint64_t>(sampling.sampleBudget) * pixelCount : std::numeric_limits<uint64_t>::max();
+
+	// The sums before the last pass of a tile hold the first half of its samples. Their average
+	// differs from the one of all samples by about the error of the first half, which unlike the
+	// sample variance shrinks as fast as the error of the low discrepancy jitter does. Any other
+	// split of the Halton samples, like odd and even ones, does not cover the pixel evenly
+	std::vector<glm::vec4> accumulation(pixelCount, glm::vec4(0.0f));
+	std::vector<glm::vec4> halfAccumulation(pixelCount, glm::vec4(0.0f));
+	std::vector<uint32_t> tileSamples(tilesX * tilesY, 0);
+	std::vector<float> tileErrors(tilesX * tilesY, std::numeric_limits<float>::infinity());
+
+	// Half of minSamples first, so the error is known once a tile has minSamples
+	const auto getNextSampleCount = [&](uint32_t sampleCount)
+	{
+		if (sampleCount == 0)
+			return std::max(minSamples / 2, 1u);
+		return std::min(sampleCount < minSamples ? minSamples : 2 * sampleCount, maxSamples);
+	};
+
+	CpuRenderStatistics statistics;
+	Timer timer;
+
+	std::vector<uint32_t> tiles(tilesX * tilesY);
+	std::vector<uint32_t> passTiles;
+	while (true)
+	{
+		// Tiles without an error estimate yet and the noisier half of the others double their samples,
+		// so the samples go to the noisiest tiles long before the budget runs out. Ties go to the
+		// lower tile index, so the order does not depend on the threads
+		tiles.clear();
+		size_t unestimated = 0;
+		for (uint32_t tile = 0; tile < tileSamples.size(); ++tile)
+		{
+			if (tileSamples[tile] < maxSamples && !(tileErrors[tile] <= sampling.targetError))
+			{
+				tiles.push_back(tile);
+				unestimated += std::isinf(tileErrors[tile]);
+			}
+		}
+		std::stable_sort(tiles.begin(), tiles.end(), [&](uint32_t a, uint32_t b) { return tileErrors[a] > tileErrors[b]; });
+
+		// Only as many tiles as the budget has samples left for, apart from the first minSamples
+		const size_t passTileCount = unestimated + (tiles.size() - unestimated + 1) / 2;
+		size_t selected = 0;
+		for (uint64_t samples = statistics.sampleCount; selected < passTileCount; ++selected)
+		{
+			const uint32_t tile = tiles[selected];
+			const uint64_t tilePixels = static_cast<uint64_t>(std::min((tile % tilesX + 1) * tileSize, width) - tile % tilesX * tileSize)
+				* (std::min((tile / tilesX + 1) * tileSize, height) - tile / tilesX * tileSize);
+			const uint64_t tileCost = tilePixels * (getNextSampleCount(tileSamples[tile]) - tileSamples[tile]);
+			if (tileSamples[tile] >= minSamples && samples + tileCost > sampleBudget)
+				break;
+			samples += tileCost;
+		}
+		tiles.resize(selected);
+		if (tiles.empty())
+			break;
+
+		// TraceTiles() shares one sample range between its tiles, so the pass goes in groups of
+		// tiles that have the same sample count
+		std::sort(tiles.begin(), tiles.end(), [&](uint32_t a, uint32_t b) { return tileSamples[a] != tileSamples[b] ? tileSamples[a] < tileSamples[b] : a < b; });
+		for (size_t begin = 0, end = 0; begin < tiles.size(); begin = end)
+		{
+			const uint32_t sampleCount = tileSamples[tiles[begin]];
+			for (end = begin; end < tiles.size() && tileSamples[tiles[end]] == sampleCount; ++end)
+				;
+			passTiles.assign(tiles.begin() + begin, tiles.begin() + end);
+
+			for (uint32_t tile : passTiles)
+			{
+				const uint32_t beginX = tile % tilesX * tileSize;
+				const uint32_t beginY = tile / tilesX * tileSize;
+				const uint32_t endX = std::min(beginX + tileSize, width);
+				for (uint32_t y = beginY; y < std::min(beginY + tileSize, height); ++y)
+					std::copy(accumulation.begin() + static_cast<size_t>(y) * width + beginX, accumulation.begin() + static_cast<size_t>(y) * width + endX,
+						halfAccumulation.begin() + static_cast<size_t>(y) * width + beginX);
+			}
+
+			const uint32_t endSample = getNextSampleCount(sampleCount);
+			const CpuRenderStatistics pass = TraceTiles(invProjView, width, height, passTiles, sampleCount, endSample, [&](size_t pixel, const glm::vec3& color)
+			{
+				if (!IsNan(color))
+					accumulation[pixel] += glm::vec4(color, 1.0f);
+			});
+			statistics.rayCount += pass.rayCount;
+			statistics.nodeVisits += pass.nodeVisits;
+			statistics.sphereTests += pass.sphereTests;
+			statistics.sampleCount += pass.sampleCount;
+			for (uint32_t tile : passTiles)
+				tileSamples[tile] = endSample;
+		}
+
+		// A tile is as noisy as its noisiest pixels, all but one in a hundred have to be below the
+		// target. The average of the tile would let a few noisy silhouette pixels hide among flat ones
+		mPool->ParallelFor(static_cast<uint32_t>(tiles.size()), [&](uint32_t i)
+		{
+			const uint32_t tile = tiles[i];
+			if (tileSamples[tile] < std::max(minSamples, 2u))
+				return;
+
+			const uint32_t beginX = tile % tilesX * tileSize;
+			const uint32_t beginY = tile / tilesX * tileSize;
+			const uint32_t endX = std::min(beginX + tileSize, width);
+			const uint32_t endY = std::min(beginY + tileSize, height);
+
+			std::vector<float> errors;
+			errors.reserve(static_cast<size_t>(endX - beginX) * (endY - beginY));
+			for (uint32_t y = beginY; y < endY; ++y)
+			{
+				for (uint32_t x = beginX; x < endX; ++x)
+				{
+					const size_t pixel = static_cast<size_t>(y) * width + x;
+					const glm::vec3 difference = glm::vec3(accumulation[pixel]) / std::max(accumulation[pixel].a, 1.0f)
+						- glm::vec3(halfAccumulation[pixel]) / std::max(halfAccumulation[pixel].a, 1.0f);
+					errors.push_back(std::sqrt(glm::dot(difference, difference) / 3.0f));
+				}
+			}
+
+			const auto percentile = errors.begin() + errors.size() * 99 / 100;
+			std::nth_element(errors.begin(), percentile, errors.end());
+			tileErrors[tile] = *percentile;
+		});
+	}
+
+	statistics.milliseconds = timer.ElapsedNs() / 1e6f;
+	statistics.threadCount = mPool->GetThreadCount();
+	ResolveAccumulation(accumulation, pixels);
+	return statistics;
+}
+
+CpuRenderStatistics CpuRaytracer::TracePixels(const glm::mat4& invProjView, uint32_t width, uint32_t height, uint32_t sampleIndex,
+	const std::function<void(size_t, const glm::vec3&)>& store)
+{
+	const uint32_t tileSize = mSpecification.tileSize;
+	std::vector<uint32_t> tiles(((width + tileSize - 1) / tileSize) * ((height + tileSize - 1) / tileSize));
+	std::iota(tiles.begin(), tiles.end(), 0);
+	return TraceTiles(invProjView, width, height, tiles, sampleIndex, sampleIndex + 1, store);
+}
+
+CpuRenderStatistics CpuRaytracer::TraceTiles(const glm::mat4& invProjView, uint32_t width, uint32_t height, const std::vector<uint32_t>& tiles,
+	uint32_t firstSample, uint32_t endSample, const std::function<void(size_t, const glm::vec3&)>& store)
+{
+	const uint32_t tileSize = mSpecification.tileSize;
+	const uint32_t tilesX = (width + tileSize - 1) / tileSize;
+	const float nearPlane = mSpecification.nearPlane;
+	const float farPlane = mSpecification.farPlane;
+	std::vector<RayCounters> tileCounters(tiles.size());
+
+	Timer timer;
+	mPool->ParallelFor(static_cast<uint32_t>(tiles.size()), [&](uint32_t i)
+	{
+		const uint32_t beginX = tiles[i] % tilesX * tileSize;
+		const uint32_t beginY = tiles[i] / tilesX * tileSize;
+		const uint32_t endX = std::min(beginX + tileSize, width);
+		const uint32_t endY = std::min(beginY + tileSize, height);
+
+		RayCounters counters;
+		std::vector<Ray> rays;
+		std::vector<RayHit> hits;
+		for (uint32_t sample = firstSample; sample < endSample; ++sample)
+		{
+			// Row by row, so the packets are runs of neighbouring pixels
+			const glm::vec2 jitterNdc = 2.0f * GetSampleJitter(sample) / glm::vec2(width, height); // uJitter
+			const glm::vec2 lightSample = GetLightSample(sample); // uLightSample
+			rays.clear();
+			for (uint32_t y = beginY; y < endY; ++y)
+			{
+				for (uint32_t x = beginX; x < endX; ++x)
+				{
+					// Raytrace.vert at the pixel center, the varyings are linear in aPos
+					const glm::vec2 aPos = glm::vec2((x + 0.5f) / width * 2.0f - 1.0f, 1.0f - (y + 0.5f) / height * 2.0f) + jitterNdc;
+					Ray ray;
+					ray.origin = glm::vec3(invProjView * glm::vec4(aPos, -1.0f, 1.0f) * nearPlane);
+					ray.dir = glm::normalize(glm::vec3(invProjView * glm::vec4(aPos * (farPlane - nearPlane), farPlane + nearPlane, farPlane - nearPlane)));
+					rays.push_back(ray);
+				}
+			}
+
+			if (mRayCaster)
+			{
+				hits.resize(rays.size());
+				mRayCaster->IntersectPackets(rays.data(), rays.size(), hits.data());
+			}
+
+			size_t ray = 0;
+			for (uint32_t y = beginY; y < endY; ++y)
+			{
+				for (uint32_t x = beginX; x < endX; ++x, ++ray)
+				{
+					const Intersection primary = mRayCaster ? GetPacketIntersection(rays[ray], hits[ray]) : FindNearestIntersection(rays[ray], counters);
+					store(static_cast<size_t>(y) * width + x, TraceFrom(primary, lightSample, counters));
+				}
+			}
+		}
+
+		tileCounters[i] = counters;
+	});
+
+	CpuRenderStatistics statistics;
+	statistics.milliseconds = timer.ElapsedNs() / 1e6f;
+	statistics.threadCount = mPool->GetThreadCount();
+	for (size_t i = 0; i < tiles.size(); ++i)
+	{
+		const uint32_t tileWidth = std::min((tiles[i] % tilesX + 1) * tileSize, width) - tiles[i] % tilesX * tileSize;
+		const uint32_t tileHeight = std::min((tiles[i] / tilesX + 1) * tileSize, height) - tiles[i] / tilesX * tileSize;
+		statistics.rayCount += tileCounters[i].rayCount;
+		statistics.nodeVisits += tileCounters[i].nodeVisits;
+		statistics.sphereTests += tileCounters[i].sphereTests;
+		statistics.sampleCount += static_cast<uint64_t>(tileWidth) * tileHeight * (endSample - firstSample);
+	}
+
+	return statistics;
+}
+
+// The shader keeps every hit of the binary tree of reflection (odd) and refraction (even) rays
+// in one array, children of entry i at 2i + 1 and 2i + 2. The first level is the color of the
+// primary hit, every deeper level adds half of the average color of its hits
+glm::vec3 CpuRaytracer::Trace(const Ray& primaryRay, RayCounters& counters) const
+{
+	return TraceFrom(FindNearestIntersection(primaryRay, counters), glm::vec2(0.0f), counters);
+}
+
+glm::vec3 CpuRaytracer::TraceFrom(const Intersection& primary, const glm::vec2& lightSample, RayCounters& counters) const
+{
+	Intersection intersections[(1 << MaxDepth) - 1];
+	const int intersectionCount = (1 << mSpecification.maxDepth) - 1;
+
+	intersections[0] = primary;
+	++counters.rayCount;
+	for (int i = 0; 2 * i + 2 < intersectionCount; ++i)
+	{
+		const Intersection& intersection = intersections[i];
+		Intersection& reflectIntersection = intersections[2 * i + 1];
+		Intersection& refractIntersection = intersections[2 * i + 2];
+		if (intersection.sphereIndex < 0) // Ray hits nothing or light
+		{
+			reflectIntersection.sphereIndex = -3;
+			refractIntersection.sphereIndex = -3;
+			continue;
+		}
+
+		{
+			Ray reflectRay;
+			reflectRay.origin = intersection.hitPoint;
+			reflectRay.dir = glm::reflect(intersection.ray.dir, intersection.normal);
+			reflectIntersection = FindNearestIntersection(reflectRay, counters);
+		}
+
+		// The surface is opaque, the spheres of its atoms are not what the rays pass through
+		if (mSpecification.traceSurface && mScene.surface)
+		{
+			refractIntersection.sphereIndex = -3;
+		}
+		else
+		{
+			const Sphere& sphere = mScene.spheres[intersection.sphereIndex];
+			const glm::vec3 center(sphere.position);
+			Ray refractRay;
+			refractRay.dir = glm::normalize(glm::refract(intersection.ray.dir, intersection.normal, 1.0f / RefractiveIndex));
+			refractRay.origin = intersection.hitPoint + 0.001f * refractRay.dir;
+			const float dist = HitSphereInside(refractRay, center, sphere.radius);
+			const glm::vec3 hitPoint = refractRay.origin + dist * refractRay.dir;
+			const glm::vec3 normal = -glm::normalize(hitPoint - center);
+
+			refractRay.dir = glm::normalize(glm::refract(refractRay.dir, normal, RefractiveIndex));
+			refractRay.origin = hitPoint + 0.001f * refractRay.dir;
+			refractIntersection = FindNearestIntersection(refractRay, counters);
+		}
+
+		counters.rayCount += 2;
+	}
+
+	glm::vec3 color = GetColor(intersections[0], lightSample, counters);
+	for (int depth = 1; depth < mSpecification.maxDepth; ++depth)
+	{
+		const int levelCount = 1 << depth;
+		for (int i = levelCount - 1; i < 2 * levelCount - 1; ++i)
+		{
+			color += GetColor(intersections[i], lightSample, counters) / static_cast<float>(levelCount) / 2.0f;
+		}
+	}
+
+	return color;
+}
+
+CpuRaytracer::Intersection CpuRaytracer::FindNearestIntersection(const Ray& ray, RayCounters& counters) const
+{
+	Intersection intersection;
+	intersection.sphereIndex = -2;
+	intersection.distance = MaxDistance;
+	intersection.ray = ray;
+
+	if (mSpecification.traceSurface && mScene.surface)
+		TraceSurface(ray, intersection, counters);
+	else if (mSpecification.useCompactKDTree)
+		TraverseCompactKDTree(ray, intersection, counters);
+	else if (mSpecification.useParentLinks)
+		TraverseKDTreeParentLinks(ray, intersection, counters);
+	else
+		TraverseKDTree(ray, intersection, counters);
+
+	TestLight(ray, intersection);
+	return intersection;
+}
+
+CpuRaytracer::Intersection CpuRaytracer::GetPacketIntersection(const Ray& ray, const RayHit& hit) const
+{
+	Intersection intersection;
+	intersection.sphereIndex = -2;
+	intersection.distance = MaxDistance;
+	intersection.ray = ray;
+	if (hit.sphereIndex >= 0)
+	{
+		const glm::vec3 center(mScene.spheres[hit.sphereIndex].position);
+		intersection.distance = hit.distance;
+		intersection.hitPoint = ray.origin + hit.distance * ray.dir;
+		intersection.normal = glm::normalize(intersection.hitPoint - center);
+		intersection.sphereIndex = hit.sphereIndex;
+	}
+
+	TestLight(ray, intersection);
+	return intersection;
+}
+
+void CpuRaytracer::TestLight(const Ray& ray, Intersection& intersection) const
+{
+	const float lightT = HitSphereOutside(ray, mSpecification.lightPosition, LightRadius);
+	if (lightT > MinDistance && lightT < intersection.distance)
+	{
+		intersection.distance = lightT;
+		intersection.hitPoint = ray.origin + lightT * ray.dir;
+		intersection.normal = glm::normalize(intersection.hitPoint - mSpecification.lightPosition);
+		intersection.sphereIndex = -1;
+	}
+}
+
+// Front to back: of two children that are both hit the nearer one is walked first and the other
+// waits on the stack with its entry distance, so once a hit is found every waiting node that
+// starts behind it is dropped without touching its subtree. Only nodes with both children hit
+// push, so the stack never gets deeper than the tree, and both builders stop splitting at
+// AtomKDTree::MaxDepth. A deeper tree drops the far child rather than overrun the stack
+void CpuRaytracer::TraverseKDTree(const Ray& ray, Intersection& intersection, RayCounters& counters) const
+{
+	const ArrayNode* nodes = mScene.nodes;
+	float entry;
+	if (mScene.nodeCount == 0 || !EnterBox(ray, nodes[0].boxMin, nodes[0].boxMax, intersection.distance, entry))
+		return;
+
+	int stackNodes[KDTreeStackSize];
+	float stackEntries[KDTreeStackSize];
+	int stackSize = 0;
+	int index = 0;
+	while (true)
+	{
+		++counters.nodeVisits;
+		const glm::ivec4& children = nodes[index].childIndices;
+		if (children.x >= 0) // We have children
+		{
+			float leftEntry, rightEntry;
+			const bool leftHit = EnterBox(ray, nodes[children.x].boxMin, nodes[children.x].boxMax, intersection.distance, leftEntry);
+			const bool rightHit = EnterBox(ray, nodes[children.y].boxMin, nodes[children.y].boxMax, intersection.distance, rightEntry);
+			if (leftHit && rightHit)
+			{
+				const bool leftFirst = leftEntry <= rightEntry;
+				if (stackSize < KDTreeStackSize)
+				{
+					stackNodes[stackSize] = leftFirst ? children.y : children.x;
+					stackEntries[stackSize] = leftFirst ? rightEntry : leftEntry;
+					++stackSize;
+				}
+
+				index = leftFirst ? children.x : children.y;
+				continue;
+			}
+
+			if (leftHit || rightHit)
+			{
+				index = leftHit ? children.x : children.y;
+				continue;
+			}
+		}
+		else
+		{
+			for (int i = 0; i < children.w; ++i)
+			{
+				TestSphere(ray, mScene.atomIndices[children.z + i], intersection, counters);
+			}
+		}
+
+		// The next waiting node that still starts before the closest hit so far
+		do
+		{
+			if (stackSize == 0)
+				return;
+
+			--stackSize;
+		} while (stackEntries[stackSize] >= intersection.distance);
+
+		index = stackNodes[stackSize];
+	}
+}
+
+// Any hit is as good as the closest one, the walk ends at the first sphere in front of maxDistance
+bool CpuRaytracer::IsOccluded(const Ray& ray, float maxDistance, RayCounters& counters) const
+{
+	++counters.rayCount;
+	const auto entersBox = [&](const ArrayNode& node)
+	{
+		float entry;
+		return EnterBox(ray, node.boxMin, node.boxMax, maxDistance, entry);
+	};
+	const auto hitsLeaf = [&](const ArrayNode& leaf)
+	{
+		for (int i = 0; i < leaf.childIndices.w; ++i)
+		{
+			++counters.sphereTests;
+			const Sphere& sphere = mScene.spheres[mScene.atomIndices[leaf.childIndices.z + i]];
+			const float t = HitSphereOutside(ray, glm::vec3(sphere.position), sphere.radius);
+			if (t > 0.0f && t < maxDistance)
+				return true;
+		}
+
+		return false;
+	};
+	return FindAnyHit(mScene.nodes, mScene.nodeCount, entersBox, hitsLeaf, counters.nodeVisits);
+}
+
+// Stackless walk over the parent links (Hapala et al. 2011), TraverseKDTreeParentLinks() of the
+// shader. Children are visited near one first, the state says where the walk came from, so going
+// back up finds the next subtree without a stack. Subtrees whose box starts behind the closest hit
+// so far are skipped, every other leaf is tested, so the closest hit is exact
+void CpuRaytracer::TraverseKDTreeParentLinks(const Ray& ray, Intersection& intersection, RayCounters& counters) const
+{
+	const ArrayNode* nodes = mScene.nodes;
+	const int32_t* parents = mScene.parentIndices;
+	if (mScene.nodeCount == 0 || mScene.parentIndexCount != mScene.nodeCount)
+		return;
+
+	// The child whose box center comes first along the ray, the same on the way down and up
+	const auto nearChild = [&](int index)
+	{
+		const glm::ivec4& children = nodes[index].childIndices;
+		const glm::vec4 leftCenter = nodes[children.x].boxMin + nodes[children.x].boxMax;
+		const glm::vec4 rightCenter = nodes[children.y].boxMin + nodes[children.y].boxMax;
+		return glm::dot(glm::vec3(leftCenter - rightCenter), ray.dir) <= 0.0f ? children.x : children.y;
+	};
+	const auto sibling = [&](int index)
+	{
+		const glm::ivec4& children = nodes[parents[index]].childIndices;
+		return children.x == index ? children.y : children.x;
+	};
+
+	enum class State { FromParent, FromSibling, FromChild };
+	int index = 0;
+	State state = State::FromParent;
+	while (true)
+	{
+		if (state == State::FromChild)
+		{
+			if (index == 0)
+				return;
+
+			const int parent = parents[index];
+			if (index == nearChild(parent))
+			{
+				index = sibling(index);
+				state = State::FromSibling;
+			}
+			else
+			{
+				index = parent;
+			}
+
+			continue;
+		}
+
+		++counters.nodeVisits;
+		const ArrayNode& node = nodes[index];
+		float entry;
+		if (EnterBox(ray, node.boxMin, node.boxMax, intersection.distance, entry))
+		{
+			if (node.childIndices.x >= 0)
+			{
+				index = nearChild(index);
+				state = State::FromParent;
+				continue;
+			}
+
+			for (int i = 0; i < node.childIndices.w; ++i)
+			{
+				TestSphere(ray, mScene.atomIndices[node.childIndices.z + i], intersection, counters);
+			}
+		}
+
+		// Done with this subtree, the far sibling of a near child is next, otherwise the parent is
+		if (index == 0)
+			return;
+
+		if (state == State::FromParent)
+		{
+			index = sibling(index);
+			state = State::FromSibling;
+		}
+		else
+		{
+			index = parents[index];
+			state = State::FromChild;
+		}
+	}
+}
+
+void CpuRaytracer::TraverseCompactKDTree(const Ray& ray, Intersection& intersection, RayCounters& counters) const
+{
+	if (mScene.compactNodeCount == 0)
+		return;
+
+	const glm::vec3 t1 = (mScene.compactBoxMin - ray.origin) / ray.dir;
+	const glm::vec3 t2 = (mScene.compactBoxMax - ray.origin) / ray.dir;
+	const glm::vec3 tNear = glm::min(t1, t2);
+	const glm::vec3 tFar = glm::max(t1, t2);
+	float tMin = std::max(std::max(std::max(tNear.x, tNear.y), tNear.z), 0.0f);
+	float tMax = std::min(std::min(tFar.x, tFar.y), tFar.z);
+	if (tMin > tMax)
+		return;
+
+	struct Todo
+	{
+		uint32_t node;
+		float tMin, tMax;
+	};
+
+	Todo todo[CompactKDTree::MaxDepth];
+	int todoCount = 0;
+	uint32_t index = 0;
+	while (intersection.distance >= tMin)
+	{
+		++counters.nodeVisits;
+		const CompactKDNode& node = mScene.compactNodes[index];
+		if (!node.IsLeaf())
+		{
+			const uint32_t axis = node.GetAxis();
+			const float split = node.GetSplit();
+			const float tPlane = (split - ray.origin[axis]) / ray.dir[axis];
+			const bool belowFirst = ray.origin[axis] < split || (ray.origin[axis] == split && ray.dir[axis] <= 0.0f);
+			const uint32_t first = belowFirst ? index + 1 : node.GetAboveChild();
+			const uint32_t second = belowFirst ? node.GetAboveChild() : index + 1;
+			if (tPlane > tMax || tPlane <= 0.0f)
+			{
+				index = first;
+			}
+			else if (tPlane < tMin)
+			{
+				index = second;
+			}
+			else
+			{
+				todo[todoCount++] = { second, tPlane, tMax };
+				index = first;
+				tMax = tPlane;
+			}
+
+			continue;
+		}
+
+		for (uint32_t i = 0; i < node.GetAtomCount(); ++i)
+		{
+			TestSphere(ray, mScene.compactAtomIndices[node.GetAtomOffset() + i], intersection, counters);
+		}
+
+		if (todoCount == 0)
+			break;
+
+		--todoCount;
+		index = todo[todoCount].node;
+		tMin = todo[todoCount].tMin;
+		tMax = todo[todoCount].tMax;
+	}
+}
+
+void CpuRaytracer::TestSphere(const Ray& ray, uint32_t sphereIndex, Intersection& intersection, RayCounters& counters) const
+{
+	++counters.sphereTests;
+	const Sphere& sphere = mScene.spheres[sphereIndex];
+	const glm::vec3 center(sphere.position);
+	const float t = HitSphereOutside(ray, center, sphere.radius);
+	if (t > MinDistance && t < intersection.distance)
+	{
+		intersection.distance = t;
+		intersection.hitPoint = ray.origin + t * ray.dir;
+		intersection.normal = glm::normalize(intersection.hitPoint - center);
+		intersection.sphereIndex = static_cast<int>(sphereIndex);
+	}
+}
+
+// Sphere tracing of the distance field. Empty bricks are skipped whole, in the others the ray
+// advances by the sampled distance, which does not cross the surface. The hit takes the nearest
+// atom of the surface point and sits just outside the surface, so rays leaving it do not hit it again
+void CpuRaytracer::TraceSurface(const Ray& ray, Intersection& intersection, RayCounters& counters) const
+{
+	const MolecularSurface& surface = *mScene.surface;
+	const std::vector<uint32_t>& bricks = surface.GetBricks();
+	if (bricks.empty())
+		return;
+
+	const glm::vec3 boxMin = surface.GetOrigin();
+	const glm::vec3 boxMax = surface.GetBoxMax();
+	const glm::vec3 t1 = (boxMin - ray.origin) / ray.dir;
+	const glm::vec3 t2 = (boxMax - ray.origin) / ray.dir;
+	const glm::vec3 tNear = glm::min(t1, t2);
+	const glm::vec3 tFar = glm::max(t1, t2);
+	float t = std::max(std::max(std::max(tNear.x, tNear.y), tNear.z), 0.0f);
+	const float exit = std::min(std::min(std::min(tFar.x, tFar.y), tFar.z), intersection.distance);
+
+	const float voxelSize = surface.GetVoxelSize();
+	const float brickEdge = MolecularSurface::BrickSize * voxelSize;
+	const glm::uvec3 brickCounts = surface.GetBrickCounts();
+	const float hitDistance = SurfaceHitDistance * voxelSize;
+	for (int step = 0; step < MaxSurfaceSteps && t < exit; ++step)
+	{
+		++counters.nodeVisits;
+		const glm::vec3 position = ray.origin + t * ray.dir;
+		const glm::uvec3 brick = glm::uvec3(glm::clamp(glm::ivec3(glm::floor((position - boxMin) / brickEdge)), glm::ivec3(0), glm::ivec3(brickCounts) - 1));
+		const uint32_t slot = bricks[(static_cast<uint64_t>(brick.z) * brickCounts.y + brick.y) * brickCounts.x + brick.x];
+		if (slot == MolecularSurface::EmptyBrick)
+		{
+			const glm::vec3 brickMin = boxMin + glm::vec3(brick) * brickEdge;
+			const glm::vec3 brickExit = glm::max((brickMin - ray.origin) / ray.dir, (brickMin + brickEdge - ray.origin) / ray.dir);
+			t = std::max(std::min(std::min(brickExit.x, brickExit.y), brickExit.z), t) + 1e-3f * voxelSize;
+			continue;
+		}
+
+		const float distance = slot == MolecularSurface::InteriorBrick ? -surface.GetBandWidth() : surface.SampleDistance(position);
+		if (distance < hitDistance)
+		{
+			const float h = 0.5f * voxelSize;
+			const glm::vec3 gradient(
+				surface.SampleDistance(position + glm::vec3(h, 0.0f, 0.0f)) - surface.SampleDistance(position - glm::vec3(h, 0.0f, 0.0f)),
+				surface.SampleDistance(position + glm::vec3(0.0f, h, 0.0f)) - surface.SampleDistance(position - glm::vec3(0.0f, h, 0.0f)),
+				surface.SampleDistance(position + glm::vec3(0.0f, 0.0f, h)) - surface.SampleDistance(position - glm::vec3(0.0f, 0.0f, h)));
+			const float gradientLength = glm::length(gradient);
+
+			intersection.distance = t;
+			intersection.normal = gradientLength > 0.0f ? gradient / gradientLength : -ray.dir;
+			intersection.hitPoint = position + 2.0f * hitDistance * intersection.normal;
+			intersection.sphereIndex = static_cast<int>(surface.GetNearestAtom(position));
+			return;
+		}
+
+		t += distance;
+	}
+}
+
+glm::vec3 CpuRaytracer::GetColor(const Intersection& intersection, const glm::vec2& lightSample, RayCounters& counters) const
+{
+	if (intersection.sphereIndex == -1)
+		return LightColor;
+	else if (intersection.sphereIndex == -2)
+		return mSpecification.environmentLighting ? mSpecification.environmentLighting->SampleSpecular(intersection.ray.dir, 0.0f) : mCubemap.Sample(intersection.ray.dir);
+	else if (intersection.sphereIndex == -3)
+		return glm::vec3(0.0f);
+
+	// Scenes without a material table shade every sphere with the default material
+	static const SphereMaterial DefaultMaterial;
+	const Sphere& sphere = mScene.spheres[intersection.sphereIndex];
+	const SphereMaterial& material = sphere.materialIndex < mScene.materialCount ? mScene.materials[sphere.materialIndex] : DefaultMaterial;
+	const glm::vec3 albedo(sphere.color);
+	const glm::vec3 view = -intersection.ray.dir;
+
+	glm::vec3 color = albedo;
+	if (mSpecification.environmentLighting)
+		color = ShadeImageBased(*mSpecification.environmentLighting, albedo, material, intersection.normal, view);
+	else if (mSpecification.directLighting)
+		color = AmbientFactor * albedo;
+
+	// Only the light arriving from all around is occluded, never the direct light
+	if (mSpecification.ambientOcclusion)
+		color *= 1.0f - sphere.occlusion / 65535.0f;
+
+	if (!mSpecification.shadows && !mSpecification.directLighting)
+		return color;
+
+	// The shadow ray aims at a point of the disk the light sphere covers seen from the hit, so the
+	// accumulated samples integrate the penumbra
+	Ray shadowRay;
+	shadowRay.origin = intersection.hitPoint + 0.001f * intersection.normal;
+	const glm::vec3 axis = glm::normalize(mSpecification.lightPosition - shadowRay.origin);
+	const float sign = std::copysign(1.0f, axis.z);
+	const float a = -1.0f / (sign + axis.z);
+	const float b = axis.x * axis.y * a;
+	const glm::vec3 tangent(1.0f + sign * axis.x * axis.x * a, sign * b, -sign * axis.x);
+	const glm::vec3 bitangent(b, sign + axis.y * axis.y * a, -axis.y);
+	const glm::vec3 lightPoint = mSpecification.lightPosition + LightRadius * (lightSample.x * tangent + lightSample.y * bitangent);
+
+	// Any sphere between the hit and the light sphere shadows it, the light itself is not an occluder
+	const glm::vec3 toLight = lightPoint - shadowRay.origin;
+	const float lightDistance = glm::length(toLight);
+	shadowRay.dir = toLight / lightDistance;
+	const bool inShadow = mSpecification.shadows && IsOccluded(shadowRay, lightDistance - LightRadius, counters);
+
+	// With direct light a shadow only takes the light away, without it the whole color darkens
+	if (mSpecification.directLighting)
+	{
+		if (!inShadow)
+			color += EvaluateCookTorrance(albedo, material, intersection.normal, view, shadowRay.dir) * LightIntensity;
+	}
+	else if (inShadow)
+	{
+		color *= ShadowFactor;
+	}
+
+	return color;
+}
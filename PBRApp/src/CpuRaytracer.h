@@ -0,0 +1,221 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Core/Base.h"
+#include "CompactKDTree.h"
+#include "Scene.h"
+
+class EnvironmentLighting;
+class MolecularSurface;
+class RayCaster;
+class ThreadPool;
+struct RayHit;
+
+// The shader storage buffers of Raytrace.frag, either owned by the caller or mapped from a
+// SceneCache. The compact kd-tree and the parent links are optional unless
+// CpuRaytracerSpecification asks for them
+struct RaytraceScene
+{
+	const Sphere* spheres = nullptr;
+	uint64_t sphereCount = 0;
+	const ArrayNode* nodes = nullptr;
+	uint64_t nodeCount = 0;
+	const uint32_t* atomIndices = nullptr;
+	uint64_t atomIndexCount = 0;
+
+	const CompactKDNode* compactNodes = nullptr;
+	uint64_t compactNodeCount = 0;
+	const uint32_t* compactAtomIndices = nullptr;
+	uint64_t compactAtomIndexCount = 0;
+	glm::vec3 compactBoxMin = glm::vec3(0.0f);
+	glm::vec3 compactBoxMax = glm::vec3(0.0f);
+
+	const int32_t* parentIndices = nullptr; // CreateParentIndices() of the nodes
+	uint64_t parentIndexCount = 0;
+
+	const SphereMaterial* materials = nullptr; // The table of CreateSpheres(), spheres use the default material without it
+	uint64_t materialCount = 0;
+
+	const MolecularSurface* surface = nullptr; // Of the same atoms, only traced if CpuRaytracerSpecification asks for it
+};
+
+// uCubemap on the CPU, same face order as LoadCubemap in MainLayer.cpp and sampled like
+// GL_LINEAR with GL_CLAMP_TO_EDGE
+class CpuCubemap
+{
+public:
+	CpuCubemap(const std::vector<std::string>& faces);
+
+	bool IsValid() const { return mIsValid; }
+
+	glm::vec3 Sample(const glm::vec3& direction) const;
+private:
+	struct Face
+	{
+		int width = 0;
+		int height = 0;
+		std::vector<glm::vec3> texels;
+	};
+private:
+	std::vector<Face> mFaces;
+	bool mIsValid = false;
+};
+
+struct CpuRaytracerSpecification
+{
+	uint32_t tileSize = 16;
+	uint32_t threadCount = 0; // 0 means one thread per hardware core, 1 renders on the calling thread
+	int maxDepth = 1;         // uMaxDepth, levels of reflection and refraction hits in the image, at most CpuRaytracer::MaxDepth
+	glm::vec3 lightPosition = glm::vec3(5.0f, 5.0f, 5.0f);
+	float nearPlane = 0.1f;   // uNear
+	float farPlane = 100.0f;  // uFar
+	bool useCompactKDTree = false;
+	bool useParentLinks = false; // Stackless closest-hit walk of the kd-tree instead of the stack one, unless the compact kd-tree is used
+	bool shadows = false;     // uShadows, darkens sphere hits whose shadow ray to the light is blocked
+	bool directLighting = false; // uDirectLighting, Cook-Torrance shading of the light on top of an ambient or image-based term
+	bool ambientOcclusion = false; // uAmbientOcclusion, darkens the ambient or image-based term by Sphere::occlusion
+	bool traceSurface = false; // uSurface, closest hits on RaytraceScene::surface instead of the spheres, shaded like the nearest atom
+	const EnvironmentLighting* environmentLighting = nullptr; // uUseIBL, lights sphere hits and replaces the cubemap when set
+	bool gammaCorrect = true; // false keeps the linear trace() color, for HDR output
+	// Closest hits of the primary rays of a tile in SIMD packets of RayCaster, secondary rays stay
+	// scalar. Only for the stack walk of the kd-tree, and the packet sphere test is not bit for bit
+	// the one of Raytrace.frag, so the GPU reference leaves it off. Node visits and sphere tests of
+	// the packets are not counted
+	bool packetPrimaryRays = false;
+};
+
+// Multi-sample rendering for offline images. The samples of every tile of
+// CpuRaytracerSpecification::tileSize pixels double until its noise estimate reaches targetError,
+// its pixels have maxSamples or the budget is spent, noisiest tiles first. Flat background stops
+// early and silhouettes and refractions get the rest of the samples
+struct AdaptiveSamplingSpecification
+{
+	uint32_t minSamples = 8;    // Every pixel gets these before its tile may stop, even beyond the budget
+	uint32_t maxSamples = 256;  // 1 renders the single sample of CpuRaytracer::Render
+	float targetError = 0.002f; // Estimated error of the average linear color of 99 in 100 pixels of a tile, RMS over the channels
+	uint32_t sampleBudget = 0;  // Samples per pixel on average over the image, 0 for no limit but maxSamples
+};
+
+struct CpuRenderStatistics
+{
+	uint64_t rayCount = 0;    // Primary, secondary and shadow rays
+	uint64_t nodeVisits = 0;  // Loop iterations of the kd-tree walks over all rays, steps through the surface when it is traced
+	uint64_t sphereTests = 0;
+	uint64_t sampleCount = 0; // Primary rays, pixels times samples
+	float milliseconds = 0.0f;
+	uint32_t threadCount = 0;
+
+	float GetMraysPerSecondPerCore() const { return rayCount / (milliseconds * 1e3f) / threadCount; }
+	float GetNodeVisitsPerRay() const { return rayCount > 0 ? static_cast<float>(nodeVisits) / rayCount : 0.0f; }
+	float GetSphereTestsPerRay() const { return rayCount > 0 ? static_cast<float>(sphereTests) / rayCount : 0.0f; }
+};
+
+// Renders what Raytrace.frag writes to oFragColor, walking the same trees in the same order, so
+// the GPU path can be checked against it and frames can be rendered on machines without a GPU
+class CpuRaytracer
+{
+public:
+	static constexpr int MaxDepth = 8;
+
+	struct Ray
+	{
+		glm::vec3 origin;
+		glm::vec3 dir;
+	};
+
+	// Work done by the rays of one thread, summed into CpuRenderStatistics
+	struct RayCounters
+	{
+		uint64_t rayCount = 0;
+		uint64_t nodeVisits = 0;
+		uint64_t sphereTests = 0;
+	};
+public:
+	CpuRaytracer(const RaytraceScene& scene, const CpuCubemap& cubemap, const CpuRaytracerSpecification& specification = CpuRaytracerSpecification());
+	~CpuRaytracer();
+
+	CpuRaytracer(const CpuRaytracer&) = delete;
+	CpuRaytracer(CpuRaytracer&&) = delete;
+
+	CpuRaytracer& operator=(const CpuRaytracer&) = delete;
+	CpuRaytracer& operator=(CpuRaytracer&&) = delete;
+
+	// One RGBA pixel per entry, gamma corrected unless the specification says otherwise, rows from
+	// the top of the image down. invProjView is the uInvProjView uniform of the frame
+	CpuRenderStatistics Render(const glm::mat4& invProjView, uint32_t width, uint32_t height, std::vector<glm::vec4>& pixels);
+
+	// Adds one sample of every pixel to accumulation like the progressive mode of Raytrace.frag: rgb
+	// sums the linear colors, a counts the samples, NaN samples are left out. Sample 0 starts over
+	// at the pixel centers, the later ones are jittered by GetSampleJitter()
+	CpuRenderStatistics Accumulate(const glm::mat4& invProjView, uint32_t width, uint32_t height, uint32_t sampleIndex, std::vector<glm::vec4>& accumulation);
+
+	// Renders several jittered samples of every pixel as AdaptiveSamplingSpecification describes and
+	// writes their average like Render. Every pass doubles the samples of the noisiest tiles the budget
+	// allows, tiles stop independently of each other and of the thread count, so the image is deterministic
+	CpuRenderStatistics RenderAdaptive(const glm::mat4& invProjView, uint32_t width, uint32_t height, const AdaptiveSamplingSpecification& sampling,
+		std::vector<glm::vec4>& pixels);
+
+	// Average color of every accumulated pixel, gamma corrected unless the specification says otherwise
+	void ResolveAccumulation(const std::vector<glm::vec4>& accumulation, std::vector<glm::vec4>& pixels) const;
+
+	// Offset of sample sampleIndex from the pixel center in pixels, y up, within [-0.5, 0.5). The
+	// uJitter uniform of Raytrace.vert is twice this divided by the viewport size
+	static glm::vec2 GetSampleJitter(uint32_t sampleIndex);
+
+	// Point of the unit disk the shadow rays of sample sampleIndex aim at, sample 0 is the center. Scaled
+	// by the light radius on the disk of the light sphere facing the hit. The uLightSample uniform of Raytrace.frag
+	static glm::vec2 GetLightSample(uint32_t sampleIndex);
+
+	// Linear color of a single primary ray, the trace() function of the shader with the shadow rays
+	// aimed at the light center
+	glm::vec3 Trace(const Ray& ray, RayCounters& counters) const;
+
+	// Any-hit query for shadow and occlusion rays: true if a sphere is hit in (0, maxDistance). Walks
+	// the kd-tree whatever tree the closest hits use
+	bool IsOccluded(const Ray& ray, float maxDistance, RayCounters& counters) const;
+private:
+	struct Intersection
+	{
+		Ray ray;
+		float distance;
+		glm::vec3 hitPoint;
+		glm::vec3 normal;
+		int sphereIndex; // -1 light, -2 cubemap, -3 black
+	};
+private:
+	// Calls store(pixel, linear color) for samples [firstSample, endSample) of every pixel of the
+	// given tiles, in sample order per pixel and tiles in parallel. Tiles are numbered in rows of
+	// tileSize squares from the top left
+	CpuRenderStatistics TraceTiles(const glm::mat4& invProjView, uint32_t width, uint32_t height, const std::vector<uint32_t>& tiles,
+		uint32_t firstSample, uint32_t endSample, const std::function<void(size_t, const glm::vec3&)>& store);
+
+	// TraceTiles() of one sample of the whole image
+	CpuRenderStatistics TracePixels(const glm::mat4& invProjView, uint32_t width, uint32_t height, uint32_t sampleIndex,
+		const std::function<void(size_t, const glm::vec3&)>& store);
+
+	// Trace() from the closest hit of the primary ray on
+	glm::vec3 TraceFrom(const Intersection& primary, const glm::vec2& lightSample, RayCounters& counters) const;
+
+	Intersection FindNearestIntersection(const Ray& ray, RayCounters& counters) const;
+	// FindNearestIntersection() from the sphere hit of a packet
+	Intersection GetPacketIntersection(const Ray& ray, const RayHit& hit) const;
+	void TestLight(const Ray& ray, Intersection& intersection) const;
+	void TraverseKDTree(const Ray& ray, Intersection& intersection, RayCounters& counters) const;
+	void TraverseKDTreeParentLinks(const Ray& ray, Intersection& intersection, RayCounters& counters) const;
+	void TraverseCompactKDTree(const Ray& ray, Intersection& intersection, RayCounters& counters) const;
+	void TestSphere(const Ray& ray, uint32_t sphereIndex, Intersection& intersection, RayCounters& counters) const;
+	void TraceSurface(const Ray& ray, Intersection& intersection, RayCounters& counters) const;
+	glm::vec3 GetColor(const Intersection& intersection, const glm::vec2& lightSample, RayCounters& counters) const;
+private:
+	RaytraceScene mScene;
+	const CpuCubemap& mCubemap;
+	CpuRaytracerSpecification mSpecification;
+	Scope<ThreadPool> mPool;
+	Scope<RayCaster> mRayCaster; // Only with CpuRaytracerSpecification::packetPrimaryRays
+};
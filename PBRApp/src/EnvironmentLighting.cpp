@@ -0,0 +1,651 @@
+#include "EnvironmentLighting.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define ENVIRONMENT_LIGHTING_SSE
+#include <immintrin.h>
+#endif
+
+#include <stb_image.h>
+
+// Defined next to the stb_image implementation
+int GetStbiFlipVerticallyOnLoad();
+
+#include "Core/MappedFile.h"
+#include "Core/ThreadPool.h"
+#include "Core/Timer.h"
+
+static constexpr float Pi = 3.14159265358979f;
+
+static constexpr char CacheMagic[8] = { 'P', 'B', 'R', 'I', 'B', 'L', 'C', 'A' };
+
+// Followed by the texels of every specular level from the sharpest one down, then the BRDF table
+struct CacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t specularLevelCount;
+	uint64_t inputHash;
+	glm::vec4 irradianceSH[EnvironmentLighting::SHCoefficientCount]; // w unused
+	uint32_t specularWidth;
+	uint32_t specularHeight;
+	uint32_t brdfSize;
+	uint32_t _padding;
+};
+
+static uint64_t Mix(uint64_t hash, uint64_t value)
+{
+	hash ^= value;
+	hash *= 0x9E3779B97F4A7C15ull;
+	return hash ^ (hash >> 29);
+}
+
+// Content of the .hdr and every setting that changes the result
+static uint64_t HashInputs(const MappedFile& file, const EnvironmentLightingSpecification& specification)
+{
+	uint64_t hash = Mix(0xCBF29CE484222325ull, EnvironmentLighting::Version);
+	hash = Mix(hash, file.GetSize());
+	uint64_t offset = 0;
+	for (; offset + sizeof(uint64_t) <= file.GetSize(); offset += sizeof(uint64_t))
+	{
+		uint64_t word;
+		std::memcpy(&word, file.GetData() + offset, sizeof(word));
+		hash = Mix(hash, word);
+	}
+
+	uint64_t tail = 0;
+	std::memcpy(&tail, file.GetData() + offset, file.GetSize() - offset);
+	hash = Mix(hash, tail);
+
+	for (uint32_t value : { specification.specularWidth, specification.specularLevelCount, specification.specularSampleCount, specification.brdfSize, specification.brdfSampleCount })
+	{
+		hash = Mix(hash, value);
+	}
+
+	return hash;
+}
+
+static glm::vec2 ToEquirect(const glm::vec3& direction)
+{
+	return glm::vec2(std::atan2(direction.z, direction.x) / (2.0f * Pi) + 0.5f, std::acos(std::clamp(direction.y, -1.0f, 1.0f)) / Pi);
+}
+
+static glm::vec3 FromEquirect(const glm::vec2& uv)
+{
+	const float phi = 2.0f * Pi * (uv.x - 0.5f);
+	const float theta = Pi * uv.y;
+	return glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+}
+
+static glm::vec2 Hammersley(uint32_t i, uint32_t count)
+{
+	uint32_t bits = i;
+	bits = (bits << 16) | (bits >> 16);
+	bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+	bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+	bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+	bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+	return glm::vec2(static_cast<float>(i) / count, bits * 2.3283064365386963e-10f);
+}
+
+// Real spherical harmonics of bands 0 to 2
+static void EvaluateSHBasis(const glm::vec3& d, float* basis)
+{
+	basis[0] = 0.282095f;
+	basis[1] = 0.488603f * d.y;
+	basis[2] = 0.488603f * d.z;
+	basis[3] = 0.488603f * d.x;
+	basis[4] = 1.092548f * d.x * d.y;
+	basis[5] = 1.092548f * d.y * d.z;
+	basis[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+	basis[7] = 1.092548f * d.x * d.z;
+	basis[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+}
+
+// One RGBA texel is one SSE register, so filtering and summing work on all channels at once.
+// Targets without SSE run the same operations on a glm::vec4
+#ifdef ENVIRONMENT_LIGHTING_SSE
+using Float4 = __m128;
+
+static Float4 Splat(float value) { return _mm_set1_ps(value); }
+static Float4 Set(float x, float y, float z, float w) { return _mm_set_ps(w, z, y, x); }
+static Float4 Load(const float* values) { return _mm_loadu_ps(values); }
+static void Store(float* values, Float4 a) { _mm_storeu_ps(values, a); }
+static Float4 Add(Float4 a, Float4 b) { return _mm_add_ps(a, b); }
+static Float4 Sub(Float4 a, Float4 b) { return _mm_sub_ps(a, b); }
+static Float4 Mul(Float4 a, Float4 b) { return _mm_mul_ps(a, b); }
+static Float4 Div(Float4 a, Float4 b) { return _mm_div_ps(a, b); }
+static Float4 Max(Float4 a, Float4 b) { return _mm_max_ps(a, b); }
+static Float4 Sqrt(Float4 a) { return _mm_sqrt_ps(a); }
+// Zero in every lane where test is not positive, even if value holds NaN there
+static Float4 ZeroUnlessPositive(Float4 test, Float4 value) { return _mm_and_ps(_mm_cmpgt_ps(test, _mm_setzero_ps()), value); }
+#else
+using Float4 = glm::vec4;
+
+static Float4 Splat(float value) { return glm::vec4(value); }
+static Float4 Set(float x, float y, float z, float w) { return glm::vec4(x, y, z, w); }
+static Float4 Load(const float* values) { return glm::vec4(values[0], values[1], values[2], values[3]); }
+static void Store(float* values, Float4 a) { std::memcpy(values, &a.x, 4 * sizeof(float)); }
+static Float4 Add(Float4 a, Float4 b) { return a + b; }
+static Float4 Sub(Float4 a, Float4 b) { return a - b; }
+static Float4 Mul(Float4 a, Float4 b) { return a * b; }
+static Float4 Div(Float4 a, Float4 b) { return a / b; }
+static Float4 Max(Float4 a, Float4 b) { return glm::max(a, b); }
+static Float4 Sqrt(Float4 a) { return glm::sqrt(a); }
+static Float4 ZeroUnlessPositive(Float4 test, Float4 value)
+{
+	for (int lane = 0; lane < 4; ++lane)
+		value[lane] = test[lane] > 0.0f ? value[lane] : 0.0f;
+	return value;
+}
+#endif
+
+static Float4 LoadTexel(const EnvironmentImage& image, uint32_t x, uint32_t y)
+{
+	return Load(&image.texels[static_cast<size_t>(y) * image.width + x].x);
+}
+
+static void StoreTexel(EnvironmentImage& image, uint32_t x, uint32_t y, Float4 texel)
+{
+	Store(&image.texels[static_cast<size_t>(y) * image.width + x].x, texel);
+}
+
+static Float4 Lerp(Float4 a, Float4 b, float t)
+{
+	return Add(a, Mul(Sub(b, a), Splat(t)));
+}
+
+// GL_LINEAR, GL_REPEAT in u for equirectangular images and GL_CLAMP_TO_EDGE otherwise
+static Float4 SampleBilinear(const EnvironmentImage& image, const glm::vec2& uv, bool wrapU)
+{
+	const int width = static_cast<int>(image.width);
+	const float x = wrapU ? uv.x * width - 0.5f : std::clamp(uv.x * width - 0.5f, 0.0f, width - 1.0f);
+	const float y = std::clamp(uv.y * image.height - 0.5f, 0.0f, image.height - 1.0f);
+	const float x0 = std::floor(x);
+	const float y0 = std::floor(y);
+
+	const uint32_t left = static_cast<uint32_t>((static_cast<int>(x0) % width + width) % width);
+	const uint32_t right = wrapU ? (left + 1) % width : std::min<uint32_t>(left + 1, width - 1);
+	const uint32_t top = static_cast<uint32_t>(y0);
+	const uint32_t bottom = std::min(top + 1, image.height - 1);
+	const Float4 upper = Lerp(LoadTexel(image, left, top), LoadTexel(image, right, top), x - x0);
+	const Float4 lower = Lerp(LoadTexel(image, left, bottom), LoadTexel(image, right, bottom), x - x0);
+	return Lerp(upper, lower, y - y0);
+}
+
+static Float4 SampleTrilinear(const std::vector<EnvironmentImage>& levels, const glm::vec2& uv, float lod)
+{
+	lod = std::clamp(lod, 0.0f, static_cast<float>(levels.size() - 1));
+	const uint32_t level = static_cast<uint32_t>(lod);
+	const Float4 texel = SampleBilinear(levels[level], uv, true);
+	if (lod == level)
+		return texel;
+
+	return Lerp(texel, SampleBilinear(levels[level + 1], uv, true), lod - level);
+}
+
+// 2x2 box filter, odd edges repeat their last texel
+static EnvironmentImage Downsample(const EnvironmentImage& source, ThreadPool& pool)
+{
+	EnvironmentImage image;
+	image.width = std::max(source.width / 2, 1u);
+	image.height = std::max(source.height / 2, 1u);
+	image.texels.resize(static_cast<size_t>(image.width) * image.height);
+	pool.ParallelFor(image.height, [&](uint32_t y)
+	{
+		const uint32_t top = std::min(2 * y, source.height - 1);
+		const uint32_t bottom = std::min(2 * y + 1, source.height - 1);
+		for (uint32_t x = 0; x < image.width; ++x)
+		{
+			const uint32_t left = std::min(2 * x, source.width - 1);
+			const uint32_t right = std::min(2 * x + 1, source.width - 1);
+			const Float4 sum = Add(Add(LoadTexel(source, left, top), LoadTexel(source, right, top)),
+				Add(LoadTexel(source, left, bottom), LoadTexel(source, right, bottom)));
+			StoreTexel(image, x, y, Mul(sum, Splat(0.25f)));
+		}
+	});
+
+	return image;
+}
+
+// Projects the radiance onto the basis, weighted by the solid angle of every texel, and convolves
+// it with the cosine lobe divided by pi (Ramamoorthi and Hanrahan 2001)
+static std::array<glm::vec3, EnvironmentLighting::SHCoefficientCount> ProjectIrradiance(const EnvironmentImage& source, ThreadPool& pool)
+{
+	constexpr uint32_t coefficientCount = EnvironmentLighting::SHCoefficientCount;
+	std::vector<float> cosPhi(source.width), sinPhi(source.width);
+	for (uint32_t x = 0; x < source.width; ++x)
+	{
+		const float phi = 2.0f * Pi * ((x + 0.5f) / source.width - 0.5f);
+		cosPhi[x] = std::cos(phi);
+		sinPhi[x] = std::sin(phi);
+	}
+
+	std::vector<std::array<glm::vec4, coefficientCount>> rowSums(source.height);
+	pool.ParallelFor(source.height, [&](uint32_t y)
+	{
+		const float theta = Pi * (y + 0.5f) / source.height;
+		const float sinTheta = std::sin(theta);
+		const float cosTheta = std::cos(theta);
+		const Float4 solidAngle = Splat(2.0f * Pi / source.width * Pi / source.height * sinTheta);
+
+		Float4 sums[coefficientCount];
+		for (Float4& sum : sums)
+			sum = Splat(0.0f);
+
+		float basis[coefficientCount];
+		for (uint32_t x = 0; x < source.width; ++x)
+		{
+			EvaluateSHBasis(glm::vec3(sinTheta * cosPhi[x], cosTheta, sinTheta * sinPhi[x]), basis);
+			const Float4 radiance = Mul(LoadTexel(source, x, y), solidAngle);
+			for (uint32_t i = 0; i < coefficientCount; ++i)
+			{
+				sums[i] = Add(sums[i], Mul(radiance, Splat(basis[i])));
+			}
+		}
+
+		for (uint32_t i = 0; i < coefficientCount; ++i)
+		{
+			Store(&rowSums[y][i].x, sums[i]);
+		}
+	});
+
+	// Rows in order, so the result does not depend on the thread count
+	std::array<glm::dvec3, coefficientCount> totals;
+	totals.fill(glm::dvec3(0.0));
+	for (const auto& sums : rowSums)
+	{
+		for (uint32_t i = 0; i < coefficientCount; ++i)
+		{
+			totals[i] += glm::dvec3(sums[i]);
+		}
+	}
+
+	constexpr float bandScales[3] = { 1.0f, 2.0f / 3.0f, 1.0f / 4.0f };
+	std::array<glm::vec3, coefficientCount> coefficients;
+	for (uint32_t i = 0; i < coefficientCount; ++i)
+	{
+		const uint32_t band = i == 0 ? 0 : i < 4 ? 1 : 2;
+		coefficients[i] = glm::vec3(totals[i]) * bandScales[band];
+	}
+
+	return coefficients;
+}
+
+struct PrefilterSample
+{
+	glm::vec3 direction; // Around +z
+	float weight;        // N.L
+	float lod;           // Level of the source chain
+};
+
+// GGX importance samples for N = V = R (Karis 2013). The lobe is the same for every texel of a
+// level, so the samples are only rotated per texel. Each one reads the source level whose texels
+// are about as large as its share of the lobe, which keeps bright spots of the .hdr from turning
+// into fireflies (Colbert and Krivanek 2007)
+static std::vector<PrefilterSample> CreatePrefilterSamples(float roughness, uint32_t sampleCount, const EnvironmentImage& source)
+{
+	const float alpha = roughness * roughness;
+	const float alpha2 = alpha * alpha;
+	const float texelSolidAngle = 4.0f * Pi / (static_cast<float>(source.width) * source.height);
+
+	std::vector<PrefilterSample> samples;
+	samples.reserve(sampleCount);
+	for (uint32_t i = 0; i < sampleCount; ++i)
+	{
+		const glm::vec2 xi = Hammersley(i, sampleCount);
+		const float phi = 2.0f * Pi * xi.x;
+		const float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (alpha2 - 1.0f) * xi.y));
+		const float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+		const glm::vec3 halfVector(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+		const glm::vec3 direction = 2.0f * cosTheta * halfVector - glm::vec3(0.0f, 0.0f, 1.0f);
+		if (direction.z <= 0.0f)
+			continue;
+
+		// pdf of the direction is D * N.H / (4 V.H), which is D / 4 with N = V
+		const float denominator = (alpha2 - 1.0f) * cosTheta * cosTheta + 1.0f;
+		const float pdf = alpha2 / (Pi * denominator * denominator) / 4.0f;
+		const float sampleSolidAngle = 1.0f / (sampleCount * pdf);
+		samples.push_back({ direction, direction.z, std::max(0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0f, 0.0f) });
+	}
+
+	return samples;
+}
+
+static EnvironmentImage PrefilterLevel(const std::vector<EnvironmentImage>& source, uint32_t width, uint32_t height, float roughness, uint32_t sampleCount, ThreadPool& pool)
+{
+	EnvironmentImage image;
+	image.width = width;
+	image.height = height;
+	image.texels.resize(static_cast<size_t>(width) * height);
+
+	// A mirror only needs the source filtered down to the size of the level
+	if (roughness == 0.0f)
+	{
+		const float lod = std::log2(static_cast<float>(source[0].width) / width);
+		pool.ParallelFor(height, [&](uint32_t y)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				StoreTexel(image, x, y, SampleTrilinear(source, glm::vec2((x + 0.5f) / width, (y + 0.5f) / height), lod));
+			}
+		});
+
+		return image;
+	}
+
+	const std::vector<PrefilterSample> samples = CreatePrefilterSamples(roughness, sampleCount, source[0]);
+	float weightSum = 0.0f;
+	for (const PrefilterSample& sample : samples)
+		weightSum += sample.weight;
+
+	const Float4 normalization = Splat(1.0f / weightSum);
+	pool.ParallelFor(height, [&](uint32_t y)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			const glm::vec3 normal = FromEquirect(glm::vec2((x + 0.5f) / width, (y + 0.5f) / height));
+			const glm::vec3 up = std::abs(normal.y) < 0.999f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+			const glm::vec3 tangent = glm::normalize(glm::cross(up, normal));
+			const glm::vec3 bitangent = glm::cross(normal, tangent);
+
+			Float4 sum = Splat(0.0f);
+			for (const PrefilterSample& sample : samples)
+			{
+				const glm::vec3 direction = tangent * sample.direction.x + bitangent * sample.direction.y + normal * sample.direction.z;
+				sum = Add(sum, Mul(SampleTrilinear(source, ToEquirect(direction), sample.lod), Splat(sample.weight)));
+			}
+
+			StoreTexel(image, x, y, Mul(sum, normalization));
+		}
+	});
+
+	return image;
+}
+
+// Scale and bias of F0 in the split-sum specular term, with the Smith-Schlick visibility of
+// Karis 2013. The half vectors of a row only depend on its roughness, so every sample is applied
+// to four values of N.V at once
+static EnvironmentImage IntegrateBrdf(uint32_t size, uint32_t sampleCount, ThreadPool& pool)
+{
+	EnvironmentImage table;
+	table.width = size;
+	table.height = size;
+	table.texels.resize(static_cast<size_t>(size) * size);
+	pool.ParallelFor(size, [&](uint32_t y)
+	{
+		const float roughness = (y + 0.5f) / size;
+		const float alpha = roughness * roughness;
+		const Float4 k = Splat(alpha / 2.0f);
+		const Float4 one = Splat(1.0f);
+		const Float4 oneMinusK = Sub(one, k);
+		for (uint32_t x = 0; x < size; x += 4)
+		{
+			const Float4 NdotV = Div(Add(Set(x + 0.0f, x + 1.0f, x + 2.0f, x + 3.0f), Splat(0.5f)), Splat(static_cast<float>(size)));
+			const Float4 viewX = Sqrt(Max(Sub(one, Mul(NdotV, NdotV)), Splat(0.0f)));
+			const Float4 visibilityV = Div(NdotV, Add(Mul(NdotV, oneMinusK), k));
+
+			Float4 scale = Splat(0.0f);
+			Float4 bias = Splat(0.0f);
+			for (uint32_t i = 0; i < sampleCount; ++i)
+			{
+				const glm::vec2 xi = Hammersley(i, sampleCount);
+				const float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (alpha * alpha - 1.0f) * xi.y));
+				const float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+				const Float4 halfX = Splat(sinTheta * std::cos(2.0f * Pi * xi.x));
+				const Float4 NdotH = Splat(cosTheta);
+
+				// V lies in the xz plane, the y of H does not matter
+				const Float4 VdotH = Add(Mul(viewX, halfX), Mul(NdotV, NdotH));
+				const Float4 NdotL = Sub(Mul(Mul(Splat(2.0f), VdotH), NdotH), NdotV);
+				const Float4 visibilityL = Div(NdotL, Add(Mul(NdotL, oneMinusK), k));
+				const Float4 visibility = Div(Mul(Mul(visibilityV, visibilityL), VdotH), Mul(NdotH, NdotV));
+				const Float4 c = Sub(one, VdotH);
+				const Float4 c2 = Mul(c, c);
+				const Float4 fresnel = Mul(Mul(c2, c2), c);
+
+				// Lanes with L below the horizon can hold NaN, they are masked instead of weighted by zero
+				scale = Add(scale, ZeroUnlessPositive(NdotL, Mul(Sub(one, fresnel), visibility)));
+				bias = Add(bias, ZeroUnlessPositive(NdotL, Mul(fresnel, visibility)));
+			}
+
+			float scales[4], biases[4];
+			Store(scales, Div(scale, Splat(static_cast<float>(sampleCount))));
+			Store(biases, Div(bias, Splat(static_cast<float>(sampleCount))));
+			for (uint32_t lane = 0; lane < 4 && x + lane < size; ++lane)
+			{
+				table.texels[static_cast<size_t>(y) * size + x + lane] = glm::vec4(scales[lane], biases[lane], 0.0f, 1.0f);
+			}
+		}
+	});
+
+	return table;
+}
+
+EnvironmentLighting::EnvironmentLighting(const std::string& hdrPath, const EnvironmentLightingSpecification& specification)
+	: mSpecification(specification)
+{
+	mSpecification.specularWidth = std::max(mSpecification.specularWidth, 2u);
+	mSpecification.specularLevelCount = std::max(mSpecification.specularLevelCount, 1u);
+	mSpecification.specularSampleCount = std::max(mSpecification.specularSampleCount, 1u);
+	mSpecification.brdfSize = std::max(mSpecification.brdfSize, 1u);
+	mSpecification.brdfSampleCount = std::max(mSpecification.brdfSampleCount, 1u);
+
+	Timer timer;
+	uint64_t inputHash;
+	{
+		MappedFile file(hdrPath);
+		if (!file.IsOpen())
+		{
+			std::cerr << "Environment map failed to load at path: " << hdrPath << '\n';
+			return;
+		}
+
+		inputHash = HashInputs(file, mSpecification);
+	}
+
+	const std::string cachePath = GetCachePath(hdrPath);
+	if (mSpecification.useCache && ReadCache(cachePath, inputHash))
+	{
+		mStatistics.fromCache = true;
+		mStatistics.loadMilliseconds = timer.ElapsedNs() / 1e6f;
+		mIsValid = true;
+		return;
+	}
+
+	// Texture flips every image it loads, the rows of the .hdr have to stay top down. The flag is
+	// global, so it is put back for whoever loads next
+	const int flipOnLoad = GetStbiFlipVerticallyOnLoad();
+	stbi_set_flip_vertically_on_load(0);
+	int width, height, channelCount;
+	float* data = stbi_loadf(hdrPath.c_str(), &width, &height, &channelCount, 4);
+	stbi_set_flip_vertically_on_load(flipOnLoad);
+	if (!data)
+	{
+		std::cerr << "Environment map failed to load at path: " << hdrPath << '\n';
+		return;
+	}
+
+	ThreadPool pool(mSpecification.threadCount);
+	std::vector<EnvironmentImage> source(1);
+	source[0].width = static_cast<uint32_t>(width);
+	source[0].height = static_cast<uint32_t>(height);
+	source[0].texels.assign(reinterpret_cast<const glm::vec4*>(data), reinterpret_cast<const glm::vec4*>(data) + static_cast<size_t>(width) * height);
+	stbi_image_free(data);
+
+	while (source.back().width > 1 && source.back().height > 1)
+	{
+		source.push_back(Downsample(source.back(), pool));
+	}
+
+	mStatistics.loadMilliseconds = timer.ElapsedNs() / 1e6f;
+
+	timer.Reset();
+	mIrradianceSH = ProjectIrradiance(source[0], pool);
+	mStatistics.irradianceMilliseconds = timer.ElapsedNs() / 1e6f;
+
+	timer.Reset();
+	const uint32_t levelCount = mSpecification.specularLevelCount;
+	for (uint32_t level = 0; level < levelCount; ++level)
+	{
+		const uint32_t levelWidth = std::max(mSpecification.specularWidth >> level, 1u);
+		const uint32_t levelHeight = std::max((mSpecification.specularWidth / 2) >> level, 1u);
+		const float roughness = levelCount > 1 ? static_cast<float>(level) / (levelCount - 1) : 0.0f;
+		mSpecularLevels.push_back(PrefilterLevel(source, levelWidth, levelHeight, roughness, mSpecification.specularSampleCount, pool));
+	}
+
+	mStatistics.specularMilliseconds = timer.ElapsedNs() / 1e6f;
+
+	timer.Reset();
+	mBrdfTable = IntegrateBrdf(mSpecification.brdfSize, mSpecification.brdfSampleCount, pool);
+	mStatistics.brdfMilliseconds = timer.ElapsedNs() / 1e6f;
+
+	mIsValid = true;
+	if (mSpecification.useCache)
+		WriteCache(cachePath, inputHash);
+}
+
+glm::vec3 EnvironmentLighting::EvaluateIrradiance(const glm::vec3& normal) const
+{
+	float basis[SHCoefficientCount];
+	EvaluateSHBasis(normal, basis);
+	glm::vec3 irradiance(0.0f);
+	for (uint32_t i = 0; i < SHCoefficientCount; ++i)
+	{
+		irradiance += mIrradianceSH[i] * basis[i];
+	}
+
+	return glm::max(irradiance, glm::vec3(0.0f));
+}
+
+glm::vec3 EnvironmentLighting::SampleSpecular(const glm::vec3& direction, float roughness) const
+{
+	glm::vec4 texel;
+	Store(&texel.x, SampleTrilinear(mSpecularLevels, ToEquirect(direction), roughness * (mSpecularLevels.size() - 1)));
+	return glm::vec3(texel);
+}
+
+glm::vec2 EnvironmentLighting::SampleBrdf(float NdotV, float roughness) const
+{
+	glm::vec4 texel;
+	Store(&texel.x, SampleBilinear(mBrdfTable, glm::vec2(NdotV, roughness), false));
+	return glm::vec2(texel.x, texel.y);
+}
+
+std::string EnvironmentLighting::GetCachePath(const std::string& hdrPath)
+{
+	return "cache/" + std::filesystem::path(hdrPath).stem().string() + ".iblcache";
+}
+
+bool EnvironmentLighting::ReadCache(const std::string& cachePath, uint64_t inputHash)
+{
+	if (!std::filesystem::exists(cachePath))
+		return false;
+
+	MappedFile file(cachePath);
+	if (!file.IsOpen() || file.GetSize() < sizeof(CacheHeader))
+		return false;
+
+	CacheHeader header;
+	std::memcpy(&header, file.GetData(), sizeof(header));
+	if (std::memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) != 0 || header.version != Version || header.inputHash != inputHash
+		|| header.specularLevelCount != mSpecification.specularLevelCount || header.brdfSize != mSpecification.brdfSize)
+	{
+		return false;
+	}
+
+	uint64_t texelCount = static_cast<uint64_t>(header.brdfSize) * header.brdfSize;
+	for (uint32_t level = 0; level < header.specularLevelCount; ++level)
+	{
+		texelCount += static_cast<uint64_t>(std::max(header.specularWidth >> level, 1u)) * std::max(header.specularHeight >> level, 1u);
+	}
+
+	if (file.GetSize() != sizeof(CacheHeader) + texelCount * sizeof(glm::vec4))
+	{
+		std::cerr << "Corrupted environment cache " << cachePath << '\n';
+		return false;
+	}
+
+	const char* data = file.GetData() + sizeof(CacheHeader);
+	const auto readImage = [&data](uint32_t width, uint32_t height)
+	{
+		EnvironmentImage image;
+		image.width = width;
+		image.height = height;
+		image.texels.resize(static_cast<size_t>(width) * height);
+		std::memcpy(image.texels.data(), data, image.texels.size() * sizeof(glm::vec4));
+		data += image.texels.size() * sizeof(glm::vec4);
+		return image;
+	};
+
+	for (uint32_t i = 0; i < SHCoefficientCount; ++i)
+	{
+		mIrradianceSH[i] = glm::vec3(header.irradianceSH[i]);
+	}
+
+	for (uint32_t level = 0; level < header.specularLevelCount; ++level)
+	{
+		mSpecularLevels.push_back(readImage(std::max(header.specularWidth >> level, 1u), std::max(header.specularHeight >> level, 1u)));
+	}
+
+	mBrdfTable = readImage(header.brdfSize, header.brdfSize);
+	return true;
+}
+
+bool EnvironmentLighting::WriteCache(const std::string& cachePath, uint64_t inputHash) const
+{
+	CacheHeader header = {};
+	std::memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+	header.version = Version;
+	header.specularLevelCount = static_cast<uint32_t>(mSpecularLevels.size());
+	header.inputHash = inputHash;
+	for (uint32_t i = 0; i < SHCoefficientCount; ++i)
+	{
+		header.irradianceSH[i] = glm::vec4(mIrradianceSH[i], 0.0f);
+	}
+
+	header.specularWidth = mSpecularLevels[0].width;
+	header.specularHeight = mSpecularLevels[0].height;
+	header.brdfSize = mBrdfTable.width;
+
+	// Write next to the destination and rename, so a crash never leaves a half-written cache behind
+	std::error_code error;
+	std::filesystem::path path(cachePath);
+	if (path.has_parent_path())
+	{
+		std::filesystem::create_directories(path.parent_path(), error);
+	}
+
+	const std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		for (const EnvironmentImage& level : mSpecularLevels)
+		{
+			file.write(reinterpret_cast<const char*>(level.texels.data()), level.texels.size() * sizeof(glm::vec4));
+		}
+
+		file.write(reinterpret_cast<const char*>(mBrdfTable.texels.data()), mBrdfTable.texels.size() * sizeof(glm::vec4));
+		if (!file)
+		{
+			std::cerr << "Could not write environment cache " << tempPath << '\n';
+			return false;
+		}
+	}
+
+	std::filesystem::rename(tempPath, cachePath, error);
+	if (error)
+	{
+		std::cerr << "Could not write environment cache " << cachePath << ": " << error.message() << '\n';
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+
+	return true;
+}
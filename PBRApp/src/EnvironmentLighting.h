@@ -0,0 +1,83 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Linear RGBA texels, rows from the top of the image down. Equirectangular images have +y in the
+// top row, u = atan2(z, x) / 2pi + 0.5 and v = acos(y) / pi, so they wrap around in u
+struct EnvironmentImage
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<glm::vec4> texels;
+};
+
+struct EnvironmentLightingSpecification
+{
+	uint32_t specularWidth = 512;       // Sharpest level of the prefiltered radiance, height is half of it and every level halves both
+	uint32_t specularLevelCount = 7;    // Roughness 0 at level 0 up to 1 at the last level in even steps
+	uint32_t specularSampleCount = 512; // GGX samples per texel of the rough levels
+	uint32_t brdfSize = 64;             // Texels of the BRDF table along N.V and along roughness
+	uint32_t brdfSampleCount = 512;
+	uint32_t threadCount = 0;           // 0 means one thread per hardware core
+	bool useCache = true;               // Reads and refreshes the file at GetCachePath()
+};
+
+struct EnvironmentLightingStatistics
+{
+	bool fromCache = false;
+	float loadMilliseconds = 0.0f;       // Decoding the .hdr and building its mip chain, or reading the cache
+	float irradianceMilliseconds = 0.0f;
+	float specularMilliseconds = 0.0f;
+	float brdfMilliseconds = 0.0f;
+};
+
+// Image-based lighting of an equirectangular .hdr for the split-sum approximation, precomputed on
+// the CPU: irradiance as 9 spherical harmonics, the radiance prefiltered with GGX lobes of growing
+// roughness as a mip chain, and the table of the scale and bias of F0. The shader then lights a
+// hit with a few texture fetches instead of extra rays
+class EnvironmentLighting
+{
+public:
+	static constexpr uint32_t SHCoefficientCount = 9;
+
+	// Bump whenever the layout of the cache or the result of the precompute changes
+	static constexpr uint32_t Version = 1;
+public:
+	EnvironmentLighting(const std::string& hdrPath, const EnvironmentLightingSpecification& specification = EnvironmentLightingSpecification());
+
+	bool IsValid() const { return mIsValid; }
+	const EnvironmentLightingStatistics& GetStatistics() const { return mStatistics; }
+
+	// Already convolved with the cosine lobe and divided by pi, so EvaluateIrradiance() is the
+	// radiance leaving a white Lambertian surface
+	const std::array<glm::vec3, SHCoefficientCount>& GetIrradianceSH() const { return mIrradianceSH; }
+
+	// Equirectangular, level i is prefiltered for roughness i / (level count - 1)
+	const std::vector<EnvironmentImage>& GetSpecularLevels() const { return mSpecularLevels; }
+
+	// x = scale and y = bias of F0, N.V along the rows and roughness down the columns
+	const EnvironmentImage& GetBrdfTable() const { return mBrdfTable; }
+
+	// The lookups of Raytrace.frag, filtered like GL_LINEAR_MIPMAP_LINEAR and GL_LINEAR
+	glm::vec3 EvaluateIrradiance(const glm::vec3& normal) const;
+	glm::vec3 SampleSpecular(const glm::vec3& direction, float roughness) const;
+	glm::vec2 SampleBrdf(float NdotV, float roughness) const;
+
+	static std::string GetCachePath(const std::string& hdrPath);
+private:
+	bool ReadCache(const std::string& cachePath, uint64_t inputHash);
+	bool WriteCache(const std::string& cachePath, uint64_t inputHash) const;
+private:
+	EnvironmentLightingSpecification mSpecification;
+	EnvironmentLightingStatistics mStatistics;
+	bool mIsValid = false;
+
+	std::array<glm::vec3, SHCoefficientCount> mIrradianceSH = {};
+	std::vector<EnvironmentImage> mSpecularLevels;
+	EnvironmentImage mBrdfTable;
+};
@@ -0,0 +1,231 @@
+#include "ImageWriter.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+static void AppendU32BigEndian(std::vector<uint8_t>& out, uint32_t value)
+{
+	out.push_back(static_cast<uint8_t>(value >> 24));
+	out.push_back(static_cast<uint8_t>(value >> 16));
+	out.push_back(static_cast<uint8_t>(value >> 8));
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+template<typename T>
+static void AppendLittleEndian(std::vector<uint8_t>& out, T value)
+{
+	uint8_t bytes[sizeof(T)];
+	std::memcpy(bytes, &value, sizeof(T));
+	out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+static void AppendString(std::vector<uint8_t>& out, const char* text)
+{
+	out.insert(out.end(), text, text + std::strlen(text) + 1);
+}
+
+static uint32_t Crc32(const uint8_t* data, size_t size)
+{
+	static const auto table = []
+	{
+		std::vector<uint32_t> entries(256);
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+				c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			entries[i] = c;
+		}
+
+		return entries;
+	}();
+
+	uint32_t crc = 0xFFFFFFFFu;
+	for (size_t i = 0; i < size; ++i)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFFu;
+}
+
+static void AppendChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data)
+{
+	AppendU32BigEndian(out, static_cast<uint32_t>(data.size()));
+	const size_t typeOffset = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	AppendU32BigEndian(out, Crc32(out.data() + typeOffset, out.size() - typeOffset));
+}
+
+static bool WriteFile(const std::string& path, const std::vector<uint8_t>& bytes)
+{
+	std::error_code error;
+	const std::filesystem::path filePath(path);
+	if (filePath.has_parent_path())
+		std::filesystem::create_directories(filePath.parent_path(), error);
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size()))
+	{
+		std::cerr << "Could not write image " << path << '\n';
+		return false;
+	}
+
+	return true;
+}
+
+static bool HasPixelCount(const std::string& path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels)
+{
+	if (pixels.size() == static_cast<size_t>(width) * height)
+		return true;
+
+	std::cerr << "Could not write image " << path << ": " << pixels.size() << " pixels for " << width << "x" << height << '\n';
+	return false;
+}
+
+std::string GetLowercaseExtension(const std::string& path)
+{
+	std::string extension = std::filesystem::path(path).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+	return extension;
+}
+
+bool WritePNG(const std::string& path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels)
+{
+	if (!HasPixelCount(path, width, height, pixels))
+		return false;
+
+	// Every row starts with filter type 0
+	std::vector<uint8_t> raw;
+	raw.reserve((static_cast<size_t>(width) * 3 + 1) * height);
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		raw.push_back(0);
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			const glm::vec4& pixel = pixels[static_cast<size_t>(y) * width + x];
+			for (int channel = 0; channel < 3; ++channel)
+				raw.push_back(static_cast<uint8_t>(std::clamp(pixel[channel], 0.0f, 1.0f) * 255.0f + 0.5f));
+		}
+	}
+
+	// zlib stream of stored deflate blocks
+	std::vector<uint8_t> zlib = { 0x78, 0x01 };
+	constexpr size_t maxBlockSize = 65535;
+	size_t offset = 0;
+	do
+	{
+		const size_t blockSize = std::min(maxBlockSize, raw.size() - offset);
+		const bool last = offset + blockSize == raw.size();
+		zlib.push_back(last ? 1 : 0);
+		AppendLittleEndian(zlib, static_cast<uint16_t>(blockSize));
+		AppendLittleEndian(zlib, static_cast<uint16_t>(~blockSize));
+		zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + blockSize);
+		offset += blockSize;
+	} while (offset < raw.size());
+
+	uint32_t a = 1, b = 0;
+	for (uint8_t byte : raw)
+	{
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	AppendU32BigEndian(zlib, (b << 16) | a);
+
+	std::vector<uint8_t> header;
+	AppendU32BigEndian(header, width);
+	AppendU32BigEndian(header, height);
+	header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8 bits per channel, RGB, deflate, no interlace
+
+	std::vector<uint8_t> file = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	AppendChunk(file, "IHDR", header);
+	AppendChunk(file, "IDAT", zlib);
+	AppendChunk(file, "IEND", {});
+	return WriteFile(path, file);
+}
+
+bool WriteEXR(const std::string& path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels)
+{
+	if (!HasPixelCount(path, width, height, pixels))
+		return false;
+
+	constexpr int32_t pixelTypeFloat = 2;
+
+	std::vector<uint8_t> file;
+	AppendLittleEndian<uint32_t>(file, 20000630); // Magic number
+	AppendLittleEndian<uint32_t>(file, 2);        // Version 2, single part scanline file
+
+	// Channels in alphabetical order, like the scanlines store them
+	const char* channelNames[] = { "B", "G", "R" };
+	std::vector<uint8_t> channels;
+	for (const char* name : channelNames)
+	{
+		AppendString(channels, name);
+		AppendLittleEndian<int32_t>(channels, pixelTypeFloat);
+		AppendLittleEndian<uint32_t>(channels, 0); // pLinear and reserved
+		AppendLittleEndian<int32_t>(channels, 1);  // x sampling
+		AppendLittleEndian<int32_t>(channels, 1);  // y sampling
+	}
+	channels.push_back(0);
+
+	auto appendAttribute = [&file](const char* name, const char* type, const std::vector<uint8_t>& value)
+	{
+		AppendString(file, name);
+		AppendString(file, type);
+		AppendLittleEndian<int32_t>(file, static_cast<int32_t>(value.size()));
+		file.insert(file.end(), value.begin(), value.end());
+	};
+
+	std::vector<uint8_t> window;
+	for (int32_t value : { 0, 0, static_cast<int32_t>(width) - 1, static_cast<int32_t>(height) - 1 })
+		AppendLittleEndian(window, value);
+
+	std::vector<uint8_t> one, center;
+	AppendLittleEndian(one, 1.0f);
+	AppendLittleEndian(center, 0.0f);
+	AppendLittleEndian(center, 0.0f);
+
+	appendAttribute("channels", "chlist", channels);
+	appendAttribute("compression", "compression", { 0 });
+	appendAttribute("dataWindow", "box2i", window);
+	appendAttribute("displayWindow", "box2i", window);
+	appendAttribute("lineOrder", "lineOrder", { 0 });
+	appendAttribute("pixelAspectRatio", "float", one);
+	appendAttribute("screenWindowCenter", "v2f", center);
+	appendAttribute("screenWindowWidth", "float", one);
+	file.push_back(0);
+
+	// One scanline per chunk: y, byte count, then all B, all G and all R values of the line
+	const uint32_t lineBytes = width * 3 * sizeof(float);
+	const uint64_t firstChunk = file.size() + static_cast<uint64_t>(height) * sizeof(uint64_t);
+	for (uint32_t y = 0; y < height; ++y)
+		AppendLittleEndian<uint64_t>(file, firstChunk + static_cast<uint64_t>(y) * (2 * sizeof(int32_t) + lineBytes));
+
+	file.reserve(file.size() + static_cast<size_t>(height) * (2 * sizeof(int32_t) + lineBytes));
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		AppendLittleEndian<int32_t>(file, static_cast<int32_t>(y));
+		AppendLittleEndian<uint32_t>(file, lineBytes);
+		for (int channel = 2; channel >= 0; --channel)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+				AppendLittleEndian(file, pixels[static_cast<size_t>(y) * width + x][channel]);
+		}
+	}
+
+	return WriteFile(path, file);
+}
+
+bool WriteImage(const std::string& path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels)
+{
+	const std::string extension = GetLowercaseExtension(path);
+	if (extension == ".png")
+		return WritePNG(path, width, height, pixels);
+	if (extension == ".exr")
+		return WriteEXR(path, width, height, pixels);
+
+	std::cerr << "Unknown image format " << path << ", expected .png or .exr\n";
+	return false;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Image files from RGBA pixels with rows from the top down, as CpuRaytracer::Render() writes
+// them. pixels has to hold width * height entries. All return false and report the reason on a
+// failure
+
+// 8-bit RGB, channels are clamped to [0, 1]. Stored without compression
+bool WritePNG(const std::string& path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels);
+
+// 32-bit float RGB scanlines without compression, meant for linear colors
+bool WriteEXR(const std::string& path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels);
+
+// Extension of path with the dot, in lowercase, what WriteImage() picks the writer by
+std::string GetLowercaseExtension(const std::string& path);
+
+// Picks the writer from the extension of path, .png or .exr
+bool WriteImage(const std::string& path, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels);
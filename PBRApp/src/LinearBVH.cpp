@@ -0,0 +1,489 @@
+#include "LinearBVH.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "AtomKDTree.h"
+#include "Core/ThreadPool.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static constexpr uint32_t InvalidNode = std::numeric_limits<uint32_t>::max();
+
+// Below this many items per block the pool costs more than it saves
+static constexpr size_t MinBlockSize = 4096;
+
+// 30-bit codes sort in 3 passes of 10 bits, 63-bit codes in 6 passes of 11 bits
+static constexpr uint32_t MaxRadixBits = 11;
+
+static int CountLeadingZeros(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	return _BitScanReverse64(&index, value) ? 63 - static_cast<int>(index) : 64;
+#else
+	return value ? __builtin_clzll(value) : 64;
+#endif
+}
+
+// Spreads the low 10 bits of value to every third bit
+static uint64_t ExpandBits10(uint32_t value)
+{
+	value = (value * 0x00010001u) & 0xFF0000FFu;
+	value = (value * 0x00000101u) & 0x0F00F00Fu;
+	value = (value * 0x00000011u) & 0xC30C30C3u;
+	value = (value * 0x00000005u) & 0x49249249u;
+	return value;
+}
+
+// Spreads the low 21 bits of value to every third bit
+static uint64_t ExpandBits21(uint64_t value)
+{
+	value &= 0x1FFFFF;
+	value = (value | value << 32) & 0x001F00000000FFFFull;
+	value = (value | value << 16) & 0x001F0000FF0000FFull;
+	value = (value | value << 8) & 0x100F00F00F00F00Full;
+	value = (value | value << 4) & 0x10C30C30C30C30C3ull;
+	value = (value | value << 2) & 0x1249249249249249ull;
+	return value;
+}
+
+template<typename T>
+static void ResizeIfSmaller(std::vector<T>& buffer, size_t size)
+{
+	if (buffer.size() < size)
+		buffer.resize(size);
+}
+
+LinearBVH::LinearBVH(const LinearBVHSpecification& specification)
+	: mSpecification(specification)
+{
+	mSpecification.maxLeafAtoms = std::max(mSpecification.maxLeafAtoms, 1u);
+	mPool = CreateScope<ThreadPool>(mSpecification.threadCount);
+}
+
+LinearBVH::~LinearBVH()
+{
+}
+
+void LinearBVH::Build(const std::vector<Atom>& atoms)
+{
+	if (atoms.empty())
+	{
+		// Nothing of the previous build may survive, clear() keeps the capacity for the next one
+		mAtomCount = 0;
+		mRootDelta = 0;
+		for (std::vector<uint32_t>* buffer : { &mChildren, &mParents, &mRangeFirst, &mRangeLast, &mOutputIndices, &mLeafAtomIndices })
+			buffer->clear();
+		mBoxMin.clear();
+		mBoxMax.clear();
+		mVisits.clear();
+
+		ArrayNode emptyLeaf = {};
+		emptyLeaf.boxMin = glm::vec4(0.0f);
+		emptyLeaf.boxMax = glm::vec4(0.0f);
+		emptyLeaf.childIndices = glm::ivec4(-1, -1, 0, 0);
+		mNodes.assign(1, emptyLeaf);
+		return;
+	}
+
+	mAtomCount = static_cast<uint32_t>(atoms.size());
+	ComputeMortonCodes(atoms);
+	SortMortonCodes();
+	BuildHierarchy();
+	ComputeOutputIndices();
+	ComputeBounds(atoms);
+	EmitNodes(atoms);
+}
+
+uint32_t LinearBVH::GetBlockCount(size_t count) const
+{
+	const size_t maxBlockCount = static_cast<size_t>(mPool->GetThreadCount()) * 4;
+	return static_cast<uint32_t>(std::clamp<size_t>(count / MinBlockSize, 1, maxBlockCount));
+}
+
+void LinearBVH::ComputeMortonCodes(const std::vector<Atom>& atoms)
+{
+	const size_t count = atoms.size();
+	const uint32_t blockCount = GetBlockCount(count);
+	const size_t blockSize = (count + blockCount - 1) / blockCount;
+
+	std::vector<glm::vec3> blockMin(blockCount), blockMax(blockCount);
+	mPool->ParallelFor(blockCount, [&](uint32_t block)
+	{
+		const size_t begin = std::min(count, block * blockSize);
+		const size_t end = std::min(count, begin + blockSize);
+		glm::vec3 centerMin(std::numeric_limits<float>::max());
+		glm::vec3 centerMax(std::numeric_limits<float>::lowest());
+		for (size_t i = begin; i < end; ++i)
+		{
+			centerMin = glm::min(centerMin, atoms[i].position);
+			centerMax = glm::max(centerMax, atoms[i].position);
+		}
+
+		blockMin[block] = centerMin;
+		blockMax[block] = centerMax;
+	});
+
+	glm::vec3 centerMin = blockMin[0], centerMax = blockMax[0];
+	for (uint32_t block = 1; block < blockCount; ++block)
+	{
+		centerMin = glm::min(centerMin, blockMin[block]);
+		centerMax = glm::max(centerMax, blockMax[block]);
+	}
+
+	// Every axis is stretched over the whole grid, flat molecules still get all bits of their plane
+	const bool wide = mSpecification.use63BitMortonCodes;
+	const float gridMax = wide ? static_cast<float>((1 << 21) - 1) : static_cast<float>((1 << 10) - 1);
+	const glm::vec3 extent = centerMax - centerMin;
+	glm::vec3 scale;
+	for (int axis = 0; axis < 3; ++axis)
+		scale[axis] = extent[axis] > 0.0f ? gridMax / extent[axis] : 0.0f;
+
+	ResizeIfSmaller(mCodes, count);
+	ResizeIfSmaller(mAtomIndices, count);
+	mPool->ParallelFor(blockCount, [&](uint32_t block)
+	{
+		const size_t begin = std::min(count, block * blockSize);
+		const size_t end = std::min(count, begin + blockSize);
+		for (size_t i = begin; i < end; ++i)
+		{
+			const glm::vec3 cell = glm::min((atoms[i].position - centerMin) * scale, glm::vec3(gridMax));
+			const uint32_t x = static_cast<uint32_t>(cell.x);
+			const uint32_t y = static_cast<uint32_t>(cell.y);
+			const uint32_t z = static_cast<uint32_t>(cell.z);
+			if (wide)
+				mCodes[i] = (ExpandBits21(x) << 2) | (ExpandBits21(y) << 1) | ExpandBits21(z);
+			else
+				mCodes[i] = (ExpandBits10(x) << 2) | (ExpandBits10(y) << 1) | ExpandBits10(z);
+			mAtomIndices[i] = static_cast<uint32_t>(i);
+		}
+	});
+}
+
+// Stable LSD radix sort of (code, atom index) pairs. Every block counts its own digits, so blocks
+// scatter in parallel and equal codes keep the order of the atoms
+void LinearBVH::SortMortonCodes()
+{
+	const size_t count = mAtomCount;
+	const uint32_t blockCount = GetBlockCount(count);
+	const size_t blockSize = (count + blockCount - 1) / blockCount;
+	const uint32_t radixBits = mSpecification.use63BitMortonCodes ? MaxRadixBits : 10;
+	const uint32_t passCount = mSpecification.use63BitMortonCodes ? 6 : 3;
+	const uint32_t radixSize = 1 << radixBits;
+	const uint64_t radixMask = radixSize - 1;
+
+	ResizeIfSmaller(mSortCodes, count);
+	ResizeIfSmaller(mSortAtomIndices, count);
+	ResizeIfSmaller(mHistograms, static_cast<size_t>(blockCount) << MaxRadixBits);
+
+	for (uint32_t pass = 0; pass < passCount; ++pass)
+	{
+		const uint32_t shift = pass * radixBits;
+		mPool->ParallelFor(blockCount, [&](uint32_t block)
+		{
+			const size_t begin = std::min(count, block * blockSize);
+			const size_t end = std::min(count, begin + blockSize);
+			uint32_t* histogram = &mHistograms[block * radixSize];
+			std::fill(histogram, histogram + radixSize, 0);
+			for (size_t i = begin; i < end; ++i)
+				++histogram[(mCodes[i] >> shift) & radixMask];
+		});
+
+		// Exclusive prefix over (digit, block), skipping passes where all codes share the digit
+		bool sorted = false;
+		uint32_t offset = 0;
+		for (uint32_t digit = 0; digit < radixSize && !sorted; ++digit)
+		{
+			uint32_t digitCount = 0;
+			for (uint32_t block = 0; block < blockCount; ++block)
+				digitCount += mHistograms[block * radixSize + digit];
+			sorted = digitCount == count;
+
+			for (uint32_t block = 0; block < blockCount; ++block)
+			{
+				uint32_t& slot = mHistograms[block * radixSize + digit];
+				const uint32_t blockDigitCount = slot;
+				slot = offset;
+				offset += blockDigitCount;
+			}
+		}
+
+		if (sorted)
+			continue;
+
+		mPool->ParallelFor(blockCount, [&](uint32_t block)
+		{
+			const size_t begin = std::min(count, block * blockSize);
+			const size_t end = std::min(count, begin + blockSize);
+			uint32_t* offsets = &mHistograms[block * radixSize];
+			for (size_t i = begin; i < end; ++i)
+			{
+				const uint32_t target = offsets[(mCodes[i] >> shift) & radixMask]++;
+				mSortCodes[target] = mCodes[i];
+				mSortAtomIndices[target] = mAtomIndices[i];
+			}
+		});
+
+		std::swap(mCodes, mSortCodes);
+		std::swap(mAtomIndices, mSortAtomIndices);
+	}
+}
+
+// Length of the common prefix of the codes at i and j, -1 outside of the sorted range. Equal
+// codes fall back to the indices so that duplicated positions still form a valid tree
+int LinearBVH::Delta(int64_t i, int64_t j) const
+{
+	if (j < 0 || j >= static_cast<int64_t>(mAtomCount))
+		return -1;
+
+	const uint64_t a = mCodes[i], b = mCodes[j];
+	if (a == b)
+		return 64 + CountLeadingZeros(static_cast<uint64_t>(i ^ j));
+
+	return CountLeadingZeros(a ^ b);
+}
+
+// Karras 2012: every internal node finds the direction and end of its range and the split inside
+// it from the neighbouring codes alone, so all of them are built at once
+void LinearBVH::BuildHierarchy()
+{
+	const uint32_t count = mAtomCount;
+	const size_t nodeCount = 2 * static_cast<size_t>(count) - 1;
+	const uint32_t internalCount = count - 1;
+
+	ResizeIfSmaller(mChildren, 2 * static_cast<size_t>(internalCount));
+	ResizeIfSmaller(mParents, nodeCount);
+	ResizeIfSmaller(mRangeFirst, nodeCount);
+	ResizeIfSmaller(mRangeLast, nodeCount);
+	mParents[0] = InvalidNode;
+
+	const uint32_t blockCount = GetBlockCount(count);
+	const uint32_t blockSize = (count + blockCount - 1) / blockCount;
+	mPool->ParallelFor(blockCount, [&](uint32_t block)
+	{
+		const uint32_t begin = std::min(count, block * blockSize);
+		const uint32_t end = std::min(count, begin + blockSize);
+		for (uint32_t k = begin; k < end; ++k)
+		{
+			mRangeFirst[internalCount + k] = k;
+			mRangeLast[internalCount + k] = k;
+		}
+
+		for (int64_t i = begin; i < std::min(end, internalCount); ++i)
+		{
+			const int64_t direction = Delta(i, i + 1) > Delta(i, i - 1) ? 1 : -1;
+
+			// Upper bound of the range length, then its exact end by binary search
+			const int deltaMin = Delta(i, i - direction);
+			int64_t lengthMax = 2;
+			while (Delta(i, i + lengthMax * direction) > deltaMin)
+				lengthMax *= 2;
+
+			int64_t length = 0;
+			for (int64_t step = lengthMax / 2; step >= 1; step /= 2)
+			{
+				if (Delta(i, i + (length + step) * direction) > deltaMin)
+					length += step;
+			}
+
+			const int64_t j = i + length * direction;
+
+			// Split where the common prefix of the range gets longer
+			const int deltaNode = Delta(i, j);
+			int64_t split = 0;
+			int64_t step;
+			int64_t divisor = 2;
+			do
+			{
+				step = (length + divisor - 1) / divisor;
+				if (Delta(i, i + (split + step) * direction) > deltaNode)
+					split += step;
+				divisor *= 2;
+			} while (step > 1);
+
+			const int64_t gamma = i + split * direction + std::min<int64_t>(direction, 0);
+			const uint32_t first = static_cast<uint32_t>(std::min(i, j));
+			const uint32_t last = static_cast<uint32_t>(std::max(i, j));
+			const uint32_t left = first == gamma ? internalCount + static_cast<uint32_t>(gamma) : static_cast<uint32_t>(gamma);
+			const uint32_t right = last == gamma + 1 ? internalCount + static_cast<uint32_t>(gamma) + 1 : static_cast<uint32_t>(gamma) + 1;
+
+			mChildren[2 * i] = left;
+			mChildren[2 * i + 1] = right;
+			mParents[left] = static_cast<uint32_t>(i);
+			mParents[right] = static_cast<uint32_t>(i);
+			mRangeFirst[i] = first;
+			mRangeLast[i] = last;
+		}
+	});
+
+	mRootDelta = Delta(mRangeFirst[0], mRangeLast[0]);
+}
+
+// Nodes with at most maxLeafAtoms atoms end up as leaves, and so do the ones at the depth limit
+bool LinearBVH::IsLeaf(uint32_t node) const
+{
+	return GetRangeSize(node) <= mSpecification.maxLeafAtoms || ReachesMaxDepth(node);
+}
+
+// Children of inner nodes are written out, everything below a leaf is dropped
+bool LinearBVH::IsEmitted(uint32_t node) const
+{
+	return node == 0 || !IsLeaf(mParents[node]);
+}
+
+// The common prefix grows by at least one bit per level, so only nodes whose prefix is MaxDepth
+// bits longer than the one of the root can be that deep. Those are near-duplicate positions and
+// rare, only they walk up to count their depth
+bool LinearBVH::ReachesMaxDepth(uint32_t node) const
+{
+	if (Delta(mRangeFirst[node], mRangeLast[node]) - mRootDelta < static_cast<int>(AtomKDTree::MaxDepth))
+		return false;
+
+	uint32_t depth = 0;
+	for (uint32_t parent = mParents[node]; parent != InvalidNode && depth < AtomKDTree::MaxDepth; parent = mParents[parent])
+		++depth;
+
+	return depth >= AtomKDTree::MaxDepth;
+}
+
+// Output slots in node order, so the root stays at 0 and the result does not depend on the threads
+void LinearBVH::ComputeOutputIndices()
+{
+	const size_t nodeCount = 2 * static_cast<size_t>(mAtomCount) - 1;
+	const uint32_t blockCount = GetBlockCount(nodeCount);
+	const size_t blockSize = (nodeCount + blockCount - 1) / blockCount;
+
+	ResizeIfSmaller(mOutputIndices, nodeCount);
+	ResizeIfSmaller(mBlockCounts, blockCount);
+	mPool->ParallelFor(blockCount, [&](uint32_t block)
+	{
+		const size_t begin = std::min(nodeCount, block * blockSize);
+		const size_t end = std::min(nodeCount, begin + blockSize);
+		uint32_t emitted = 0;
+		for (size_t node = begin; node < end; ++node)
+			emitted += IsEmitted(static_cast<uint32_t>(node));
+		mBlockCounts[block] = emitted;
+	});
+
+	uint32_t outputCount = 0;
+	for (uint32_t block = 0; block < blockCount; ++block)
+	{
+		const uint32_t emitted = mBlockCounts[block];
+		mBlockCounts[block] = outputCount;
+		outputCount += emitted;
+	}
+
+	mPool->ParallelFor(blockCount, [&](uint32_t block)
+	{
+		const size_t begin = std::min(nodeCount, block * blockSize);
+		const size_t end = std::min(nodeCount, begin + blockSize);
+		uint32_t outputIndex = mBlockCounts[block];
+		for (size_t node = begin; node < end; ++node)
+			mOutputIndices[node] = IsEmitted(static_cast<uint32_t>(node)) ? outputIndex++ : InvalidNode;
+	});
+
+	mNodes.resize(outputCount);
+}
+
+// Leaves compute their boxes from their atoms and walk up. The first child to arrive at a node
+// stops there, the second one merges both boxes and continues
+void LinearBVH::ComputeBounds(const std::vector<Atom>& atoms)
+{
+	const size_t nodeCount = 2 * static_cast<size_t>(mAtomCount) - 1;
+	const uint32_t blockCount = GetBlockCount(nodeCount);
+	const size_t blockSize = (nodeCount + blockCount - 1) / blockCount;
+
+	ResizeIfSmaller(mBoxMin, nodeCount);
+	ResizeIfSmaller(mBoxMax, nodeCount);
+
+	// Atomics cannot be moved, so the counters are only reallocated when the tree outgrows them
+	if (mVisits.size() < nodeCount)
+		mVisits = std::vector<std::atomic<uint32_t>>(nodeCount);
+	mPool->ParallelFor(blockCount, [&](uint32_t block)
+	{
+		const size_t begin = std::min(nodeCount, block * blockSize);
+		const size_t end = std::min(nodeCount, begin + blockSize);
+		for (size_t node = begin; node < end; ++node)
+			mVisits[node].store(0, std::memory_order_relaxed);
+	});
+
+	mPool->ParallelFor(blockCount, [&](uint32_t block)
+	{
+		const size_t begin = std::min(nodeCount, block * blockSize);
+		const size_t end = std::min(nodeCount, begin + blockSize);
+		for (size_t leaf = begin; leaf < end; ++leaf)
+		{
+			const uint32_t node = static_cast<uint32_t>(leaf);
+			if (mOutputIndices[node] == InvalidNode || !IsLeaf(node))
+				continue;
+
+			glm::vec3 boxMin(std::numeric_limits<float>::max());
+			glm::vec3 boxMax(std::numeric_limits<float>::lowest());
+			for (uint32_t i = mRangeFirst[node]; i <= mRangeLast[node]; ++i)
+			{
+				const Atom& atom = atoms[mAtomIndices[i]];
+				const glm::vec3 radius(atom.atomTemplate->radius);
+				boxMin = glm::min(boxMin, atom.position - radius);
+				boxMax = glm::max(boxMax, atom.position + radius);
+			}
+
+			mBoxMin[node] = boxMin;
+			mBoxMax[node] = boxMax;
+
+			for (uint32_t parent = mParents[node]; parent != InvalidNode; parent = mParents[parent])
+			{
+				if (mVisits[parent].fetch_add(1, std::memory_order_acq_rel) == 0)
+					break;
+
+				const uint32_t left = mChildren[2 * parent];
+				const uint32_t right = mChildren[2 * parent + 1];
+				mBoxMin[parent] = glm::min(mBoxMin[left], mBoxMin[right]);
+				mBoxMax[parent] = glm::max(mBoxMax[left], mBoxMax[right]);
+			}
+		}
+	});
+}
+
+void LinearBVH::EmitNodes(const std::vector<Atom>& atoms)
+{
+	const size_t nodeCount = 2 * static_cast<size_t>(mAtomCount) - 1;
+	const uint32_t blockCount = GetBlockCount(nodeCount);
+	const size_t blockSize = (nodeCount + blockCount - 1) / blockCount;
+
+	mLeafAtomIndices.resize(mAtomCount);
+	mPool->ParallelFor(blockCount, [&](uint32_t block)
+	{
+		const size_t begin = std::min(nodeCount, block * blockSize);
+		const size_t end = std::min(nodeCount, begin + blockSize);
+
+		// There are fewer atoms than nodes, so the node blocks cover the atoms too
+		for (size_t k = begin; k < std::min<size_t>(end, mAtomCount); ++k)
+			mLeafAtomIndices[k] = atoms[mAtomIndices[k]].index;
+
+		for (size_t i = begin; i < end; ++i)
+		{
+			const uint32_t node = static_cast<uint32_t>(i);
+			if (mOutputIndices[node] == InvalidNode)
+				continue;
+
+			ArrayNode& output = mNodes[mOutputIndices[node]];
+			output.boxMin = glm::vec4(mBoxMin[node], 0.0f);
+			output.boxMax = glm::vec4(mBoxMax[node], 0.0f);
+
+			// Leaves cover consecutive sorted atoms, so their ranges index the sorted order directly
+			if (IsLeaf(node))
+			{
+				output.childIndices = glm::ivec4(-1, -1, static_cast<int>(mRangeFirst[node]), static_cast<int>(GetRangeSize(node)));
+			}
+			else
+			{
+				const int left = static_cast<int>(mOutputIndices[mChildren[2 * node]]);
+				const int right = static_cast<int>(mOutputIndices[mChildren[2 * node + 1]]);
+				output.childIndices = glm::ivec4(left, right, 0, 0);
+			}
+		}
+	});
+}
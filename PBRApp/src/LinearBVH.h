@@ -0,0 +1,87 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "Core/Base.h"
+#include "AtomLoader.h"
+#include "Scene.h"
+
+class ThreadPool;
+
+struct LinearBVHSpecification
+{
+	bool use63BitMortonCodes = false; // 21 instead of 10 bits per axis, for very large or sparse scenes
+	uint32_t maxLeafAtoms = 4;        // Subtrees with at most this many atoms become one leaf
+	uint32_t threadCount = 0;         // 0 means one thread per hardware core
+};
+
+// Linear BVH (Karras 2012): atoms sorted along a Morton curve, every internal node of the
+// hierarchy found independently from the sorted codes. Meant to be rebuilt every frame, so all
+// buffers are kept between builds
+class LinearBVH
+{
+public:
+	LinearBVH(const LinearBVHSpecification& specification = LinearBVHSpecification());
+	~LinearBVH();
+
+	LinearBVH(const LinearBVH&) = delete;
+	LinearBVH(LinearBVH&&) = delete;
+
+	LinearBVH& operator=(const LinearBVH&) = delete;
+	LinearBVH& operator=(LinearBVH&&) = delete;
+
+	// Rebuilds from the current atom positions
+	void Build(const std::vector<Atom>& atoms);
+
+	// Same layout as CreateArrayNodes, the root is node 0. Subtrees that reach AtomKDTree::MaxDepth
+	// become one leaf, as in the kd-tree builders, so the stack-bounded walks see every atom
+	const std::vector<ArrayNode>& GetNodes() const { return mNodes; }
+
+	// Atom::index of the atoms of every leaf, each leaf owns one contiguous range
+	const std::vector<uint32_t>& GetAtomIndices() const { return mLeafAtomIndices; }
+private:
+	void ComputeMortonCodes(const std::vector<Atom>& atoms);
+	void SortMortonCodes();
+	void BuildHierarchy();
+	void ComputeOutputIndices();
+	void ComputeBounds(const std::vector<Atom>& atoms);
+	void EmitNodes(const std::vector<Atom>& atoms);
+
+	uint32_t GetBlockCount(size_t count) const;
+	uint32_t GetRangeSize(uint32_t node) const { return mRangeLast[node] - mRangeFirst[node] + 1; }
+	bool IsLeaf(uint32_t node) const;
+	bool IsEmitted(uint32_t node) const;
+	bool ReachesMaxDepth(uint32_t node) const;
+	int Delta(int64_t i, int64_t j) const;
+private:
+	LinearBVHSpecification mSpecification;
+	Scope<ThreadPool> mPool;
+	uint32_t mAtomCount = 0;
+	int mRootDelta = 0;
+
+	// Scratch buffers only grow, so rebuilding the same molecule does not allocate
+
+	std::vector<uint64_t> mCodes;
+	std::vector<uint32_t> mAtomIndices;
+	std::vector<uint64_t> mSortCodes;
+	std::vector<uint32_t> mSortAtomIndices;
+	std::vector<uint32_t> mHistograms;
+
+	// Binary radix tree over N atoms: internal nodes [0, N - 1), leaf of atom k at N - 1 + k
+	std::vector<uint32_t> mChildren; // Two per internal node
+	std::vector<uint32_t> mParents;
+	std::vector<uint32_t> mRangeFirst;
+	std::vector<uint32_t> mRangeLast;
+	std::vector<glm::vec3> mBoxMin;
+	std::vector<glm::vec3> mBoxMax;
+	std::vector<std::atomic<uint32_t>> mVisits;
+	std::vector<uint32_t> mOutputIndices; // Index in mNodes, InvalidNode if collapsed into a leaf
+	std::vector<uint32_t> mBlockCounts;
+
+	std::vector<ArrayNode> mNodes;
+	std::vector<uint32_t> mLeafAtomIndices;
+};
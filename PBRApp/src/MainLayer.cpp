@@ -33,8 +33,15 @@
 #include "Renderer/Camera.h"
 #include "Renderer\Framebuffer.h"
 
+#include "AmbientOcclusion.h"
 #include "AtomLoader.h"
 #include "AtomKDTree.h"
+#include "CompactKDTree.h"
+#include "CpuRaytracer.h"
+#include "EnvironmentLighting.h"
+#include "MolecularSurface.h"
+#include "Scene.h"
+#include "SceneCache.h"
 
 class Quad
 {
@@ -109,106 +116,184 @@ static uint32_t LoadCubemap(const std::vector<std::string>& faces)
 	return textureID;
 }
 
-static constexpr uint32_t KDTREE_MAX_ATOM_INDICES = 12;
-struct ArrayNode
+static void UploadDataToGPU(const Ref<Shader>& shader, const Sphere* spheres, uint64_t sphereCount, const SphereMaterial* materials, uint64_t materialCount, const ArrayNode* nodes, uint64_t nodeCount, const uint32_t* atomIndices, uint64_t atomIndexCount)
 {
-	glm::vec4 boxMin;
-	glm::vec4 boxMax;
-	glm::ivec4 childIndices;
-	int atomIndices[KDTREE_MAX_ATOM_INDICES] = { -1 };
-};
+	{
+		GLuint ssbo;
+		glGenBuffers(1, &ssbo);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sphereCount * sizeof(Sphere), spheres, GL_STATIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo);
+	}
 
-static void CreateArrayNodes(std::vector<ArrayNode>& kdTreeArray, int& index, const AtomKDTree* currentNode)
-{
-	kdTreeArray.emplace_back();
-	size_t curIndex = kdTreeArray.size() - 1;
-	int leftChildIndex = -1, rightChildIndex = -1;
+	shader->SetInt("uSpheresCount", sphereCount);
 
-	if (currentNode->GetLeftChild())
 	{
-		leftChildIndex = ++index;
-		CreateArrayNodes(kdTreeArray, index, currentNode->GetLeftChild());
-		rightChildIndex = ++index;
-		CreateArrayNodes(kdTreeArray, index, currentNode->GetRightChild());
+		GLuint ssbo;
+		glGenBuffers(1, &ssbo);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, materialCount * sizeof(SphereMaterial), materials, GL_STATIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, ssbo);
 	}
 
-	ArrayNode& node = kdTreeArray[curIndex];
-	for (uint32_t i = 0; i < KDTREE_MAX_ATOM_INDICES; ++i)
+	shader->SetInt("uMaterialCount", materialCount);
+
 	{
-		node.atomIndices[i] = -1;
+		GLuint ssbo;
+		glGenBuffers(1, &ssbo);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, nodeCount * sizeof(ArrayNode), nodes, GL_STATIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssbo);
 	}
 
-	node.boxMin = glm::vec4(currentNode->GetBoxMin(), 0.0f);
-	node.boxMax = glm::vec4(currentNode->GetBoxMax(), 0.0f);
-	if (!currentNode->GetAtoms().empty())
+	shader->SetInt("uKDTreeNodesCount", nodeCount);
+
 	{
-		for (size_t i = 0; i < currentNode->GetAtoms().size(); ++i)
-		{
-			node.atomIndices[i] = currentNode->GetAtoms()[i].index;
-		}
+		GLuint ssbo;
+		glGenBuffers(1, &ssbo);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, atomIndexCount * sizeof(uint32_t), atomIndices, GL_STATIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssbo);
 	}
 
-	node.childIndices[0] = leftChildIndex;
-	node.childIndices[1] = rightChildIndex;
-};
+	// Not part of the cache, one pass over the nodes
+	{
+		const std::vector<int32_t> parentIndices = CreateParentIndices(nodes, nodeCount);
+		GLuint ssbo;
+		glGenBuffers(1, &ssbo);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, parentIndices.size() * sizeof(int32_t), parentIndices.data(), GL_STATIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, ssbo);
+	}
+}
 
-#include <set>
+static void UploadCompactKDTreeToGPU(const Ref<Shader>& shader, const CompactKDNode* nodes, uint64_t nodeCount, const uint32_t* atomIndices, uint64_t atomIndexCount, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+	{
+		GLuint ssbo;
+		glGenBuffers(1, &ssbo);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, nodeCount * sizeof(CompactKDNode), nodes, GL_STATIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssbo);
+	}
 
-static void UploadDataToGPU(const Ref<Shader>& shader, const AtomLoader& loader)
+	{
+		GLuint ssbo;
+		glGenBuffers(1, &ssbo);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, atomIndexCount * sizeof(uint32_t), atomIndices, GL_STATIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssbo);
+	}
+
+	shader->SetFloat3("uCompactKDTreeMin", boxMin);
+	shader->SetFloat3("uCompactKDTreeMax", boxMax);
+}
+
+// Prefiltered radiance as one mip chain and the BRDF table as textures, the SH coefficients as
+// uniforms. Half floats are plenty for lighting that is filtered anyway
+static void UploadEnvironmentLighting(const Ref<Shader>& shader, const EnvironmentLighting& environment, uint32_t& specularTexture, uint32_t& brdfTexture)
 {
-	struct Sphere
+	const std::vector<EnvironmentImage>& levels = environment.GetSpecularLevels();
+	glCreateTextures(GL_TEXTURE_2D, 1, &specularTexture);
+	glTextureStorage2D(specularTexture, static_cast<GLsizei>(levels.size()), GL_RGBA16F, levels[0].width, levels[0].height);
+	for (size_t i = 0; i < levels.size(); ++i)
 	{
-		float radius;
-		float transparency = 0.0f;
-		float reflection = 0.0f;
-		float _unused = 0.0f;
-		glm::vec4 position;
-		glm::vec4 color;
-	};
+		glTextureSubImage2D(specularTexture, static_cast<GLint>(i), 0, 0, levels[i].width, levels[i].height, GL_RGBA, GL_FLOAT, levels[i].texels.data());
+	}
 
-	const auto& atoms = loader.GetAtoms();
-	const auto& atomTemplates = loader.GetAtomTemplates();
-	std::vector<Sphere> spheres;
-	spheres.reserve(atoms.size());
-	for (const Atom& atom : atoms)
+	glTextureParameteri(specularTexture, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTextureParameteri(specularTexture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTextureParameteri(specularTexture, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTextureParameteri(specularTexture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(specularTexture, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(levels.size() - 1));
+
+	const EnvironmentImage& brdfTable = environment.GetBrdfTable();
+	glCreateTextures(GL_TEXTURE_2D, 1, &brdfTexture);
+	glTextureStorage2D(brdfTexture, 1, GL_RG16F, brdfTable.width, brdfTable.height);
+	glTextureSubImage2D(brdfTexture, 0, 0, 0, brdfTable.width, brdfTable.height, GL_RGBA, GL_FLOAT, brdfTable.texels.data());
+	glTextureParameteri(brdfTexture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTextureParameteri(brdfTexture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTextureParameteri(brdfTexture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(brdfTexture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	for (uint32_t i = 0; i < EnvironmentLighting::SHCoefficientCount; ++i)
 	{
-		const AtomTemplate* t = atom.atomTemplate;
-		Sphere sphere;
-		sphere.position = glm::vec4(atom.position, 0.0f);
-		sphere.color = glm::vec4(t->color, 1.0f);
-		sphere.radius = t->radius;
-		spheres.push_back(std::move(sphere));
+		shader->SetFloat3("uIrradianceSH[" + std::to_string(i) + "]", environment.GetIrradianceSH()[i]);
 	}
 
+	shader->SetInt("uSpecularLevelCount", static_cast<int>(levels.size()));
+}
+
+static const std::string ScenePdbPath = "assets/data/1cqw.pdb";
+static const std::string SceneXmlPath = "assets/data/test.xml";
+
+static void UploadMolecularSurface(const Ref<Shader>& shader, const MolecularSurface& surface)
+{
 	{
 		GLuint ssbo;
 		glGenBuffers(1, &ssbo);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, spheres.size() * sizeof(Sphere), spheres.data(), GL_STATIC_DRAW);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, surface.GetBricks().size() * sizeof(uint32_t), surface.GetBricks().data(), GL_STATIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, ssbo);
 	}
 
-	shader->SetInt("uSpheresCount", spheres.size());
-
-	FramebufferSpecification fbSpec;
-	fbSpec.attachments = { FramebufferTextureFormat::Float32 };
-	fbSpec.width = 1280;
-	fbSpec.height = 720;
-	// Framebuffer f(fbSpec);
+	{
+		GLuint ssbo;
+		glGenBuffers(1, &ssbo);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, surface.GetDistances().size() * sizeof(float), surface.GetDistances().data(), GL_STATIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, ssbo);
+	}
 
-	AtomKDTree tree = AtomKDTree(atoms);
-	std::vector<ArrayNode> kdTreeArray;
-	int index = 0;
-	CreateArrayNodes(kdTreeArray, index, &tree);
 	{
 		GLuint ssbo;
 		glGenBuffers(1, &ssbo);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, kdTreeArray.size() * sizeof(ArrayNode), kdTreeArray.data(), GL_STATIC_DRAW);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssbo);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, surface.GetNearestAtoms().size() * sizeof(uint32_t), surface.GetNearestAtoms().data(), GL_STATIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, ssbo);
 	}
 
-	shader->SetInt("uKDTreeNodesCount", kdTreeArray.size());
+	shader->SetFloat3("uSurfaceOrigin", surface.GetOrigin());
+	shader->SetFloat("uSurfaceVoxelSize", surface.GetVoxelSize());
+	shader->SetFloat("uSurfaceBandWidth", surface.GetBandWidth());
+	shader->SetInt3("uSurfaceBrickCounts", glm::ivec3(surface.GetBrickCounts()));
+}
+
+// Uploads the scene straight from the mapped .pbrcache when it matches the inputs, otherwise
+// loads and builds everything and refreshes the cache for the next start. The spheres and the
+// kd-tree stay on the CPU as well, for what is only built once it is enabled
+static void LoadScene(const Ref<Shader>& shader, const std::string& pdbPath, const std::string& xmlPath, std::vector<Sphere>& spheres, std::vector<ArrayNode>& nodes,
+	std::vector<uint32_t>& atomIndices)
+{
+	const uint64_t inputHash = SceneCache::HashInputs(pdbPath, xmlPath);
+	const std::string cachePath = SceneCache::GetCachePath(pdbPath);
+	{
+		SceneCache cache(cachePath, inputHash);
+		if (cache.IsValid())
+		{
+			UploadDataToGPU(shader, cache.GetSpheres(), cache.GetSphereCount(), cache.GetMaterials(), cache.GetMaterialCount(), cache.GetNodes(), cache.GetNodeCount(), cache.GetAtomIndices(), cache.GetAtomIndexCount());
+			UploadCompactKDTreeToGPU(shader, cache.GetCompactNodes(), cache.GetCompactNodeCount(), cache.GetCompactAtomIndices(), cache.GetCompactAtomIndexCount(),
+				cache.GetCompactBoxMin(), cache.GetCompactBoxMax());
+			spheres.assign(cache.GetSpheres(), cache.GetSpheres() + cache.GetSphereCount());
+			nodes.assign(cache.GetNodes(), cache.GetNodes() + cache.GetNodeCount());
+			atomIndices.assign(cache.GetAtomIndices(), cache.GetAtomIndices() + cache.GetAtomIndexCount());
+			return;
+		}
+	}
+
+	AtomLoader loader(pdbPath, xmlPath);
+	std::vector<SphereMaterial> materials;
+	spheres = CreateSpheres(loader.GetAtoms(), materials);
+	const AtomKDTree tree(loader.GetAtoms());
+	nodes = CreateArrayNodes(tree);
+	atomIndices = tree.GetAtomIndices();
+	UploadDataToGPU(shader, spheres.data(), spheres.size(), materials.data(), materials.size(), nodes.data(), nodes.size(), atomIndices.data(), atomIndices.size());
+
+	const CompactKDTree compactTree(loader.GetAtoms());
+	UploadCompactKDTreeToGPU(shader, compactTree.GetNodes().data(), compactTree.GetNodes().size(), compactTree.GetAtomIndices().data(), compactTree.GetAtomIndices().size(),
+		compactTree.GetBoxMin(), compactTree.GetBoxMax());
+
+	SceneCache::Write(cachePath, inputHash, spheres, materials, nodes, atomIndices, compactTree);
 }
 
 void MainLayer::OnAttach()
@@ -217,6 +302,9 @@ void MainLayer::OnAttach()
 
 	glEnable(GL_DEPTH_TEST);
 
+	const std::string defines = "#define KDTREE_STACK_SIZE " + std::to_string(AtomKDTree::TraversalStackSize) + "\n"
+		"#define COMPACT_KDTREE_MAX_DEPTH " + std::to_string(CompactKDTree::MaxDepth) + "\n";
+	mRaytraceShader = Shader::CreateFromFile("assets/shaders/Raytrace.vert", "assets/shaders/Raytrace.frag", defines);
 	mRaytraceShader->Bind();
 	mRaytraceShader->SetFloat3("uLightPosition", glm::vec3(5.0f, 5.0f, 5.0f));
 
@@ -230,8 +318,27 @@ void MainLayer::OnAttach()
 	};
 	mCubemap = LoadCubemap(faces);
 
-	AtomLoader loader("assets/data/1cqw.pdb", "assets/data/test.xml");
-	UploadDataToGPU(mRaytraceShader, loader);
+	auto [width, height] = mWindow.GetSize();
+	FramebufferSpecification accumulationSpec;
+	accumulationSpec.width = width;
+	accumulationSpec.height = height;
+	accumulationSpec.attachments = { FramebufferTextureFormat::Vec4 };
+	mAccumulation = CreateScope<Framebuffer>(accumulationSpec);
+
+	// Rays, node visits and sphere tests of a frame, see TraversalStatistics in Raytrace.frag
+	glCreateBuffers(1, &mStatisticsBuffer);
+	glNamedBufferData(mStatisticsBuffer, sizeof(mStatistics), nullptr, GL_DYNAMIC_READ);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, mStatisticsBuffer);
+
+	// Precomputed on the first start, read from the cache after that
+	const EnvironmentLighting environment("assets/textures/hdr/newport.hdr");
+	if (environment.IsValid())
+	{
+		UploadEnvironmentLighting(mRaytraceShader, environment, mSpecularTexture, mBrdfTexture);
+		mHasEnvironmentLighting = true;
+	}
+
+	LoadScene(mRaytraceShader, ScenePdbPath, SceneXmlPath, mSpheres, mNodes, mAtomIndices);
 }
 
 void MainLayer::OnUpdate(Timestep ts)
@@ -247,14 +354,63 @@ void MainLayer::OnUpdate(Timestep ts)
 	glm::mat4 view = mCamera.GetViewMatrix();
 	glm::mat4 projview = projection * view;
 
+	const glm::mat4 invProjView = glm::inverse(projview);
+	if (invProjView != mLastInvProjView)
+	{
+		mSampleIndex = 0;
+		mLastInvProjView = invProjView;
+	}
+
+	// Same jitter and light samples as the CPU reference, sample 0 is the pixel and light center
+	const glm::vec2 jitter = mAccumulate ? 2.0f * CpuRaytracer::GetSampleJitter(mSampleIndex) / glm::vec2(width, height) : glm::vec2(0.0f);
+	const glm::vec2 lightSample = mAccumulate ? CpuRaytracer::GetLightSample(mSampleIndex) : glm::vec2(0.0f);
+
 	mRaytraceShader->SetFloat("uNear", 0.1f);
 	mRaytraceShader->SetFloat("uFar", 100.0f);
-	mRaytraceShader->SetMat4("uInvProjView", glm::inverse(projview));
+	mRaytraceShader->SetMat4("uInvProjView", invProjView);
+	mRaytraceShader->SetFloat2("uJitter", jitter);
+	mRaytraceShader->SetFloat2("uLightSample", lightSample);
+	mRaytraceShader->SetInt("uUseCompactKDTree", mUseCompactKDTree);
+	mRaytraceShader->SetInt("uUseParentLinks", mUseParentLinks);
+	mRaytraceShader->SetInt("uShadows", mShadows);
+	mRaytraceShader->SetInt("uUseIBL", mUseIBL && mHasEnvironmentLighting);
+	mRaytraceShader->SetInt("uDirectLighting", mDirectLighting);
+	mRaytraceShader->SetInt("uAmbientOcclusion", mAmbientOcclusion);
+	mRaytraceShader->SetInt("uSurface", mSurface && mHasSurface);
+	mRaytraceShader->SetInt("uCollectStatistics", mCollectStatistics);
+	mRaytraceShader->SetInt("uAccumulate", mAccumulate);
+	mRaytraceShader->SetInt("uSampleIndex", mSampleIndex);
+	mRaytraceShader->SetInt("uMaxSamples", mMaxSamples);
 
 	mRaytraceShader->SetInt("uCubemap", 0);
 	glBindTextureUnit(0, mCubemap);
+	mRaytraceShader->SetInt("uSpecular", 1);
+	glBindTextureUnit(1, mSpecularTexture);
+	mRaytraceShader->SetInt("uBrdfTable", 2);
+	glBindTextureUnit(2, mBrdfTexture);
+	glBindImageTexture(0, mAccumulation->GetColorAttachmentRendererID(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+
+	if (mCollectStatistics)
+	{
+		const uint32_t zeros[3] = {};
+		glNamedBufferSubData(mStatisticsBuffer, 0, sizeof(zeros), zeros);
+	}
 
 	Quad::Render();
+
+	// Reading back waits for the frame, which is fine for a diagnostics mode
+	if (mCollectStatistics)
+	{
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glGetNamedBufferSubData(mStatisticsBuffer, 0, sizeof(mStatistics), mStatistics);
+	}
+
+	// The next frame reads what this one stored
+	if (mAccumulate)
+	{
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		mSampleIndex = std::min<uint32_t>(mSampleIndex + 1, mMaxSamples);
+	}
 }
 
 void MainLayer::OnImGuiRender()
@@ -268,6 +424,46 @@ void MainLayer::OnImGuiRender()
 			mCamera.SetSpeed(cameraSpeed);
 		if (ImGui::DragFloat("Camera sensitivity", &cameraSens, 0.1f, 0.01f, 1000.0f))
 			mCamera.SetMouseSensitivity(cameraSens);
+		if (ImGui::Checkbox("Compact kd-tree", &mUseCompactKDTree))
+			mSampleIndex = 0;
+		if (ImGui::Checkbox("Stackless kd-tree walk", &mUseParentLinks))
+			mSampleIndex = 0;
+		if (ImGui::Checkbox("Shadows", &mShadows))
+			mSampleIndex = 0;
+		if (mHasEnvironmentLighting && ImGui::Checkbox("Image-based lighting", &mUseIBL))
+			mSampleIndex = 0;
+		if (ImGui::Checkbox("Direct light", &mDirectLighting))
+			mSampleIndex = 0;
+		if (ImGui::Checkbox("Ambient occlusion", &mAmbientOcclusion))
+		{
+			// Baked into the spheres the first time it is enabled
+			if (mAmbientOcclusion && !mHasOcclusion)
+			{
+				BakeAmbientOcclusion(mNodes, mAtomIndices, mSpheres);
+				GLint sphereBuffer = 0;
+				glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, 0, &sphereBuffer);
+				glNamedBufferSubData(sphereBuffer, 0, mSpheres.size() * sizeof(Sphere), mSpheres.data());
+				mHasOcclusion = true;
+			}
+			mSampleIndex = 0;
+		}
+		if (ImGui::Checkbox("Molecular surface", &mSurface))
+		{
+			// Not part of the scene cache, a fraction of a second for a protein
+			if (mSurface && !mHasSurface)
+			{
+				const MolecularSurface surface(mSpheres);
+				mRaytraceShader->Bind();
+				UploadMolecularSurface(mRaytraceShader, surface);
+				mHasSurface = true;
+			}
+			mSampleIndex = 0;
+		}
+		ImGui::Checkbox("Traversal statistics", &mCollectStatistics);
+		if (ImGui::Checkbox("Progressive accumulation", &mAccumulate))
+			mSampleIndex = 0;
+		if (ImGui::DragInt("Max samples", &mMaxSamples, 1.0f, 1, 65536))
+			mSampleIndex = std::min<uint32_t>(mSampleIndex, mMaxSamples);
 	}
 	ImGui::End();
 
@@ -275,6 +471,14 @@ void MainLayer::OnImGuiRender()
 	{
 		ImGui::Text("Frame time: %f ms", mLastTs.GetMilliseconds());
 		ImGui::Text("FPS: %f", 1.0f / mLastTs);
+		if (mAccumulate)
+			ImGui::Text("Samples: %u/%d", mSampleIndex, mMaxSamples);
+		if (mCollectStatistics && mStatistics[0] > 0)
+		{
+			ImGui::Text("Rays: %u", mStatistics[0]);
+			ImGui::Text("Nodes per ray: %.2f", static_cast<float>(mStatistics[1]) / mStatistics[0]);
+			ImGui::Text("Spheres per ray: %.2f", static_cast<float>(mStatistics[2]) / mStatistics[0]);
+		}
 	}
 	ImGui::End();
 }
@@ -306,6 +510,12 @@ void MainLayer::OnEvent(Event& e)
 bool MainLayer::OnWindowResize(WindowResizeEvent& e)
 {
 	glViewport(0, 0, e.GetWidth(), e.GetHeight());
+	if (e.GetWidth() > 0 && e.GetHeight() > 0)
+	{
+		mAccumulation->Resize(e.GetWidth(), e.GetHeight());
+		mSampleIndex = 0;
+	}
+
 	return false;
 }
 
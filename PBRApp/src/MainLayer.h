@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <glm/glm.hpp>
 
@@ -9,8 +10,11 @@
 #include "Core/Layer.h"
 
 #include "Renderer/Camera.h"
+#include "Renderer/Framebuffer.h"
 #include "Renderer/Shader.h"
 
+#include "Scene.h"
+
 class Window;
 class Event;
 class Shader;
@@ -55,8 +59,40 @@ private:
 
 	bool mFirstMouse = true;
 	bool mShowCursor = false;
-
-	Ref<Shader> mRaytraceShader = Shader::CreateFromFile("assets/shaders/Raytrace.vert", "assets/shaders/Raytrace.frag");
+	bool mUseCompactKDTree = false;
+	bool mUseParentLinks = false;
+	bool mShadows = false;
+	bool mDirectLighting = false; // Cook-Torrance shading of the light with the materials of the scheme
+	bool mAmbientOcclusion = false; // Occlusion baked per atom the first time it is enabled
+	bool mHasOcclusion = false;
+	bool mSurface = false;          // Solvent-excluded surface instead of the spheres, built the first time it is enabled
+	bool mHasSurface = false;
+
+	// CPU copy of the uploaded scene
+	std::vector<Sphere> mSpheres;
+	std::vector<ArrayNode> mNodes;
+	std::vector<uint32_t> mAtomIndices;
+
+	// Image-based lighting of newport.hdr
+	bool mHasEnvironmentLighting = false;
+	bool mUseIBL = false;
+	uint32_t mSpecularTexture = 0;
+	uint32_t mBrdfTexture = 0;
+
+	// Traversal work of the last frame: rays, node visits, sphere tests
+	bool mCollectStatistics = false;
+	uint32_t mStatisticsBuffer = 0;
+	uint32_t mStatistics[3] = {};
+
+	// Progressive accumulation, restarts whenever the frame would look different
+	Scope<Framebuffer> mAccumulation;
+	bool mAccumulate = true;
+	int mMaxSamples = 256;
+	uint32_t mSampleIndex = 0;
+	glm::mat4 mLastInvProjView = glm::mat4(0.0f);
+
+	// Created in OnAttach(), the stack sizes come from the tree builders
+	Ref<Shader> mRaytraceShader;
 
 	glm::vec3 mSpherePos = glm::vec3(0.0f, 0.0f, -5.0f);
 	float mSphereRadius = 1.0f;
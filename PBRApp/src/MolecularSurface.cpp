@@ -0,0 +1,431 @@
+#include "MolecularSurface.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "Core/Base.h"
+#include "Core/ThreadPool.h"
+#include "Core/Timer.h"
+#include "SpatialHashGrid.h"
+
+static constexpr float Pi = 3.14159265358979f;
+
+// Atoms per Shrake-Rupley task, the bricks of one row along x make a distance task
+static constexpr uint32_t AtomsPerTask = 1024;
+
+// Samples within this many voxels of the surface are stored, the rest only need to say which side
+// they are on. Two keeps every sample of a cell the surface passes through
+static constexpr float BandVoxels = 2.0f;
+
+// Evenly spread directions of the test points, a Fibonacci spiral like the occlusion rays
+static std::vector<glm::vec3> CreateSpherePoints(uint32_t count)
+{
+	constexpr float goldenAngle = 2.39996323f;
+	std::vector<glm::vec3> points(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const float z = 1.0f - 2.0f * (i + 0.5f) / count;
+		const float ringRadius = std::sqrt(std::max(1.0f - z * z, 0.0f));
+		const float phi = i * goldenAngle;
+		points[i] = glm::vec3(ringRadius * std::cos(phi), ringRadius * std::sin(phi), z);
+	}
+
+	return points;
+}
+
+// Shrake-Rupley: the test points of every inflated sphere that no other inflated sphere contains
+// are where the center of the probe can touch the atom. Tasks keep their points in atom order, so
+// the concatenation does not depend on the thread count
+static std::vector<glm::vec4> FindAccessiblePoints(const std::vector<glm::vec4>& spheres, const SpatialHashGrid& grid, float maxRadius, uint32_t pointsPerAtom,
+	ThreadPool& pool, double& accessibleArea)
+{
+	const std::vector<glm::vec3> directions = CreateSpherePoints(pointsPerAtom);
+	const uint32_t taskCount = static_cast<uint32_t>((spheres.size() + AtomsPerTask - 1) / AtomsPerTask);
+	std::vector<std::vector<glm::vec4>> taskPoints(taskCount);
+	std::vector<double> taskAreas(taskCount, 0.0);
+	pool.ParallelFor(taskCount, [&](uint32_t task)
+	{
+		const size_t begin = static_cast<size_t>(task) * AtomsPerTask;
+		const size_t end = std::min(begin + AtomsPerTask, spheres.size());
+		std::vector<glm::vec4> neighbors;
+		std::vector<glm::vec4>& points = taskPoints[task];
+		for (size_t i = begin; i < end; ++i)
+		{
+			const glm::vec3 center(spheres[i]);
+			const float radius = spheres[i].w;
+			neighbors.clear();
+			grid.ForEachInRadius(center, radius + maxRadius, [&](const SpatialHashGrid::Entry& entry)
+			{
+				const glm::vec3 offset = glm::vec3(entry.sphere) - center;
+				const float reach = radius + entry.sphere.w;
+				if (entry.index != i && glm::dot(offset, offset) < reach * reach)
+					neighbors.push_back(entry.sphere);
+			});
+
+			// Neighboring points tend to be buried by the same sphere, so it is tried first
+			uint32_t accessibleCount = 0;
+			size_t lastOccluder = 0;
+			for (const glm::vec3& direction : directions)
+			{
+				const glm::vec3 point = center + radius * direction;
+				const auto buries = [&](const glm::vec4& neighbor)
+				{
+					const glm::vec3 offset = point - glm::vec3(neighbor);
+					return glm::dot(offset, offset) < neighbor.w * neighbor.w;
+				};
+
+				bool buried = lastOccluder < neighbors.size() && buries(neighbors[lastOccluder]);
+				for (size_t j = 0; j < neighbors.size() && !buried; ++j)
+				{
+					if (buries(neighbors[j]))
+					{
+						buried = true;
+						lastOccluder = j;
+					}
+				}
+
+				if (!buried)
+				{
+					points.push_back(glm::vec4(point, 0.0f));
+					++accessibleCount;
+				}
+			}
+
+			taskAreas[task] += 4.0 * Pi * radius * radius * accessibleCount / pointsPerAtom;
+		}
+	});
+
+	size_t pointCount = 0;
+	for (const std::vector<glm::vec4>& points : taskPoints)
+		pointCount += points.size();
+
+	std::vector<glm::vec4> accessiblePoints;
+	accessiblePoints.reserve(pointCount);
+	accessibleArea = 0.0;
+	for (uint32_t task = 0; task < taskCount; ++task)
+	{
+		accessiblePoints.insert(accessiblePoints.end(), taskPoints[task].begin(), taskPoints[task].end());
+		std::vector<glm::vec4>().swap(taskPoints[task]);
+		accessibleArea += taskAreas[task];
+	}
+
+	return accessiblePoints;
+}
+
+// Calls func(sample index within the brick, sample position) for the samples of the brick within
+// radius of the center, the box of the sphere clipped to the brick
+template<typename Func>
+static void ForEachBrickSample(const glm::vec3& brickOrigin, float voxelSize, const glm::vec3& center, float radius, Func&& func)
+{
+	const glm::vec3 low = glm::ceil((center - radius - brickOrigin) / voxelSize);
+	const glm::vec3 high = glm::floor((center + radius - brickOrigin) / voxelSize);
+	const glm::ivec3 sampleMin = glm::max(glm::ivec3(low), glm::ivec3(0));
+	const glm::ivec3 sampleMax = glm::min(glm::ivec3(high), glm::ivec3(MolecularSurface::BrickSize - 1));
+	for (int z = sampleMin.z; z <= sampleMax.z; ++z)
+	{
+		for (int y = sampleMin.y; y <= sampleMax.y; ++y)
+		{
+			for (int x = sampleMin.x; x <= sampleMax.x; ++x)
+			{
+				const uint32_t sample = (z * MolecularSurface::BrickSize + y) * MolecularSurface::BrickSize + x;
+				func(sample, brickOrigin + voxelSize * glm::vec3(float(x), float(y), float(z)));
+			}
+		}
+	}
+}
+
+static std::vector<glm::vec4> PackAtoms(const std::vector<Atom>& atoms)
+{
+	std::vector<glm::vec4> spheres(atoms.size());
+	for (size_t i = 0; i < atoms.size(); ++i)
+		spheres[i] = glm::vec4(atoms[i].position, atoms[i].atomTemplate->radius);
+	return spheres;
+}
+
+static std::vector<glm::vec4> PackSpheres(const std::vector<Sphere>& sceneSpheres)
+{
+	std::vector<glm::vec4> spheres(sceneSpheres.size());
+	for (size_t i = 0; i < sceneSpheres.size(); ++i)
+		spheres[i] = glm::vec4(glm::vec3(sceneSpheres[i].position), sceneSpheres[i].radius);
+	return spheres;
+}
+
+MolecularSurface::MolecularSurface(const std::vector<Atom>& atoms, const MolecularSurfaceSpecification& specification)
+	: MolecularSurface(PackAtoms(atoms), specification)
+{
+}
+
+MolecularSurface::MolecularSurface(const std::vector<Sphere>& spheres, const MolecularSurfaceSpecification& specification)
+	: MolecularSurface(PackSpheres(spheres), specification)
+{
+}
+
+MolecularSurface::MolecularSurface(std::vector<glm::vec4> spheres, const MolecularSurfaceSpecification& specification)
+	: mSpecification(specification)
+{
+	Timer timer;
+	mStatistics.atomCount = spheres.size();
+	if (spheres.empty())
+		return;
+
+	const float probeRadius = std::max(mSpecification.probeRadius, 0.0f);
+	const float voxelSize = mSpecification.voxelSize;
+	const bool excluded = mSpecification.type == SurfaceType::SolventExcluded;
+	mBandWidth = BandVoxels * voxelSize;
+
+	// Atoms inflated by the probe, their union is the volume the probe center cannot enter
+	glm::vec3 boxMin(std::numeric_limits<float>::max());
+	glm::vec3 boxMax(std::numeric_limits<float>::lowest());
+	float maxRadius = 0.0f;
+	for (glm::vec4& sphere : spheres)
+	{
+		sphere.w += probeRadius;
+		boxMin = glm::min(boxMin, glm::vec3(sphere));
+		boxMax = glm::max(boxMax, glm::vec3(sphere));
+		maxRadius = std::max(maxRadius, sphere.w);
+	}
+
+	ThreadPool pool(mSpecification.threadCount);
+	mStatistics.threadCount = pool.GetThreadCount();
+	const SpatialHashGrid atomGrid(spheres, std::max(2.0f * maxRadius, voxelSize), &pool);
+
+	double accessibleArea = 0.0;
+	const std::vector<glm::vec4> accessiblePoints = FindAccessiblePoints(spheres, atomGrid, maxRadius, std::max(mSpecification.pointsPerAtom, 1u), pool, accessibleArea);
+	mStatistics.accessiblePointCount = accessiblePoints.size();
+	mStatistics.accessibleArea = static_cast<float>(accessibleArea);
+
+	// Inside the inflated spheres the excluded surface lies probeRadius below the nearest point the
+	// probe center can reach, so only points within that plus the band matter
+	const float pointReach = probeRadius + mBandWidth;
+	Scope<SpatialHashGrid> pointGrid;
+	if (excluded)
+		pointGrid = CreateScope<SpatialHashGrid>(accessiblePoints, std::max(pointReach, voxelSize), &pool);
+	mStatistics.pointsMilliseconds = timer.ElapsedNs() / 1e6f;
+
+	// Far enough around the atoms that the outermost samples are all empty
+	const float margin = maxRadius + mBandWidth + voxelSize;
+	mOrigin = boxMin - margin;
+	const glm::vec3 extent = (boxMax + margin - mOrigin) / voxelSize;
+	const float brickEdge = BrickSize * voxelSize;
+	mBrickCounts = glm::uvec3(glm::ceil((extent + 1.0f) / float(BrickSize)));
+	mStatistics.brickCount = static_cast<uint64_t>(mBrickCounts.x) * mBrickCounts.y * mBrickCounts.z;
+	mBricks.assign(mStatistics.brickCount, EmptyBrick);
+
+	// Around the center of a brick, far enough to cover its samples
+	const float brickRadius = 0.5f * std::sqrt(3.0f) * (BrickSize - 1) * voxelSize;
+	const float interiorDepth = brickRadius + mBandWidth + (excluded ? probeRadius : 0.0f);
+
+	struct BrickRow
+	{
+		std::vector<uint32_t> bricks; // Indices of the stored bricks, in order
+		std::vector<float> distances;
+		std::vector<uint32_t> nearestAtoms;
+	};
+
+	const uint32_t rowCount = mBrickCounts.y * mBrickCounts.z;
+	std::vector<BrickRow> rows(rowCount);
+	pool.ParallelFor(rowCount, [&](uint32_t row)
+	{
+		std::vector<glm::vec4> nearby;
+		std::vector<uint32_t> nearbyIndices;
+		float sas[BrickSampleCount];
+		float reach[BrickSampleCount];
+		uint32_t nearest[BrickSampleCount];
+		float distances[BrickSampleCount];
+		for (uint32_t x = 0; x < mBrickCounts.x; ++x)
+		{
+			const glm::uvec3 brick(x, row % mBrickCounts.y, row / mBrickCounts.y);
+			const uint64_t brickIndex = (static_cast<uint64_t>(brick.z) * mBrickCounts.y + brick.y) * mBrickCounts.x + brick.x;
+			const glm::vec3 brickOrigin = mOrigin + glm::vec3(brick) * brickEdge;
+			const glm::vec3 brickMax = brickOrigin + float(BrickSize - 1) * voxelSize;
+			const glm::vec3 center = 0.5f * (brickOrigin + brickMax);
+
+			// Every inflated sphere that comes within the band of a sample, the others cannot be the
+			// nearest one of a sample with a distance below the band
+			nearby.clear();
+			nearbyIndices.clear();
+			float centerDistance = mBandWidth + brickRadius;
+			atomGrid.ForEachInBox(brickOrigin - (maxRadius + mBandWidth), brickMax + (maxRadius + mBandWidth), [&](const SpatialHashGrid::Entry& entry)
+			{
+				const glm::vec3 closest = glm::clamp(glm::vec3(entry.sphere), brickOrigin, brickMax);
+				const glm::vec3 offset = closest - glm::vec3(entry.sphere);
+				const float sphereReach = entry.sphere.w + mBandWidth;
+				if (glm::dot(offset, offset) >= sphereReach * sphereReach)
+					return;
+
+				nearby.push_back(entry.sphere);
+				nearbyIndices.push_back(entry.index);
+				centerDistance = std::min(centerDistance, glm::length(glm::vec3(entry.sphere) - center) - entry.sphere.w);
+			});
+
+			if (nearby.empty())
+				continue;
+
+			if (centerDistance <= -interiorDepth)
+			{
+				mBricks[brickIndex] = InteriorBrick;
+				continue;
+			}
+
+			// Accessible surface distance of every sample, splatted sphere by sphere. Ties go to the
+			// sphere found first, so the nearest atoms only depend on the grid
+			std::fill(std::begin(sas), std::end(sas), mBandWidth);
+			std::fill(std::begin(nearest), std::end(nearest), nearbyIndices[0]);
+			for (size_t i = 0; i < nearby.size(); ++i)
+			{
+				const glm::vec3 sphereCenter(nearby[i]);
+				const float radius = nearby[i].w;
+				ForEachBrickSample(brickOrigin, voxelSize, sphereCenter, radius + mBandWidth, [&](uint32_t sample, const glm::vec3& position)
+				{
+					// Most spheres do not come closer than the nearest one so far, which needs no root
+					const glm::vec3 offset = position - sphereCenter;
+					const float bound = sas[sample] + radius;
+					if (bound > 0.0f && glm::dot(offset, offset) >= bound * bound)
+						return;
+
+					const float distance = glm::length(offset) - radius;
+					if (distance < sas[sample])
+					{
+						sas[sample] = distance;
+						nearest[sample] = nearbyIndices[i];
+					}
+				});
+			}
+
+			if (excluded)
+			{
+				// Distance from the samples inside the inflated spheres to the nearest point the probe
+				// center reaches, the points beyond pointReach cannot bring it below the band
+				std::fill(std::begin(reach), std::end(reach), pointReach);
+				pointGrid->ForEachInBox(brickOrigin - pointReach, brickMax + pointReach, [&](const SpatialHashGrid::Entry& entry)
+				{
+					const glm::vec3 point(entry.sphere);
+					ForEachBrickSample(brickOrigin, voxelSize, point, pointReach, [&](uint32_t sample, const glm::vec3& position)
+					{
+						const glm::vec3 offset = position - point;
+						if (glm::dot(offset, offset) < reach[sample] * reach[sample])
+							reach[sample] = glm::length(offset);
+					});
+				});
+
+				for (uint32_t i = 0; i < BrickSampleCount; ++i)
+				{
+					const float distance = sas[i] >= 0.0f ? sas[i] + probeRadius : probeRadius - reach[i];
+					distances[i] = std::clamp(distance, -mBandWidth, mBandWidth);
+				}
+			}
+			else
+			{
+				for (uint32_t i = 0; i < BrickSampleCount; ++i)
+					distances[i] = std::clamp(sas[i], -mBandWidth, mBandWidth);
+			}
+
+			bool anyOutside = false;
+			bool anyInside = false;
+			bool anyNear = false;
+			for (float distance : distances)
+			{
+				anyOutside |= distance >= mBandWidth;
+				anyInside |= distance <= -mBandWidth;
+				anyNear |= distance > -mBandWidth && distance < mBandWidth;
+			}
+
+			if (!anyNear && !(anyOutside && anyInside))
+			{
+				mBricks[brickIndex] = anyInside ? InteriorBrick : EmptyBrick;
+				continue;
+			}
+
+			BrickRow& brickRow = rows[row];
+			brickRow.bricks.push_back(static_cast<uint32_t>(brickIndex));
+			brickRow.distances.insert(brickRow.distances.end(), std::begin(distances), std::end(distances));
+			brickRow.nearestAtoms.insert(brickRow.nearestAtoms.end(), std::begin(nearest), std::end(nearest));
+		}
+	});
+
+	// Slots in brick order, whatever thread found the bricks
+	uint64_t surfaceBrickCount = 0;
+	for (const BrickRow& row : rows)
+		surfaceBrickCount += row.bricks.size();
+
+	mDistances.reserve(surfaceBrickCount * BrickSampleCount);
+	mNearestAtoms.reserve(surfaceBrickCount * BrickSampleCount);
+	for (BrickRow& row : rows)
+	{
+		for (size_t i = 0; i < row.bricks.size(); ++i)
+			mBricks[row.bricks[i]] = static_cast<uint32_t>(mDistances.size() / BrickSampleCount + i);
+
+		mDistances.insert(mDistances.end(), row.distances.begin(), row.distances.end());
+		mNearestAtoms.insert(mNearestAtoms.end(), row.nearestAtoms.begin(), row.nearestAtoms.end());
+		row = BrickRow();
+	}
+
+	mStatistics.surfaceBrickCount = surfaceBrickCount;
+	mStatistics.bytes = mBricks.size() * sizeof(uint32_t) + mDistances.size() * sizeof(float) + mNearestAtoms.size() * sizeof(uint32_t);
+	mStatistics.milliseconds = timer.ElapsedNs() / 1e6f;
+	mStatistics.distanceMilliseconds = mStatistics.milliseconds - mStatistics.pointsMilliseconds;
+}
+
+float MolecularSurface::GetDistance(const glm::ivec3& sample) const
+{
+	if (glm::any(glm::lessThan(sample, glm::ivec3(0))))
+		return mBandWidth;
+
+	const glm::uvec3 brick = glm::uvec3(sample) / BrickSize;
+	if (glm::any(glm::greaterThanEqual(brick, mBrickCounts)))
+		return mBandWidth;
+
+	const uint32_t slot = mBricks[(static_cast<uint64_t>(brick.z) * mBrickCounts.y + brick.y) * mBrickCounts.x + brick.x];
+	if (slot == EmptyBrick)
+		return mBandWidth;
+	if (slot == InteriorBrick)
+		return -mBandWidth;
+
+	const glm::uvec3 local = glm::uvec3(sample) % BrickSize;
+	return mDistances[static_cast<uint64_t>(slot) * BrickSampleCount + (local.z * BrickSize + local.y) * BrickSize + local.x];
+}
+
+float MolecularSurface::SampleDistance(const glm::vec3& position) const
+{
+	const glm::vec3 local = (position - mOrigin) / mSpecification.voxelSize;
+	const glm::vec3 base = glm::floor(local);
+	const glm::vec3 f = local - base;
+	const glm::ivec3 sample(base);
+
+	const float d000 = GetDistance(sample);
+	const float d100 = GetDistance(sample + glm::ivec3(1, 0, 0));
+	const float d010 = GetDistance(sample + glm::ivec3(0, 1, 0));
+	const float d110 = GetDistance(sample + glm::ivec3(1, 1, 0));
+	const float d001 = GetDistance(sample + glm::ivec3(0, 0, 1));
+	const float d101 = GetDistance(sample + glm::ivec3(1, 0, 1));
+	const float d011 = GetDistance(sample + glm::ivec3(0, 1, 1));
+	const float d111 = GetDistance(sample + glm::ivec3(1, 1, 1));
+
+	const float d00 = d000 + (d100 - d000) * f.x;
+	const float d10 = d010 + (d110 - d010) * f.x;
+	const float d01 = d001 + (d101 - d001) * f.x;
+	const float d11 = d011 + (d111 - d011) * f.x;
+	const float d0 = d00 + (d10 - d00) * f.y;
+	const float d1 = d01 + (d11 - d01) * f.y;
+	return d0 + (d1 - d0) * f.z;
+}
+
+uint32_t MolecularSurface::GetNearestAtom(const glm::vec3& position) const
+{
+	const glm::ivec3 sample(glm::floor((position - mOrigin) / mSpecification.voxelSize + 0.5f));
+	if (glm::any(glm::lessThan(sample, glm::ivec3(0))))
+		return 0;
+
+	const glm::uvec3 brick = glm::uvec3(sample) / BrickSize;
+	if (glm::any(glm::greaterThanEqual(brick, mBrickCounts)))
+		return 0;
+
+	const uint32_t slot = mBricks[(static_cast<uint64_t>(brick.z) * mBrickCounts.y + brick.y) * mBrickCounts.x + brick.x];
+	if (slot == EmptyBrick || slot == InteriorBrick)
+		return 0;
+
+	const glm::uvec3 local = glm::uvec3(sample) % BrickSize;
+	return mNearestAtoms[static_cast<uint64_t>(slot) * BrickSampleCount + (local.z * BrickSize + local.y) * BrickSize + local.x];
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "AtomLoader.h"
+#include "Scene.h"
+
+enum class SurfaceType
+{
+	SolventAccessible = 0, // Traced by the center of the probe, every atom inflated by the probe radius
+	SolventExcluded        // Traced by the front of the probe, fills the crevices it does not fit into
+};
+
+struct MolecularSurfaceSpecification
+{
+	SurfaceType type = SurfaceType::SolventExcluded;
+	float probeRadius = 1.4f;     // Water
+	float voxelSize = 0.5f;       // Spacing of the distance samples
+	uint32_t pointsPerAtom = 128; // Shrake-Rupley test points on the inflated sphere of every atom
+	uint32_t threadCount = 0;     // 0 means one thread per hardware core, 1 builds on the calling thread
+};
+
+struct MolecularSurfaceStatistics
+{
+	uint64_t atomCount = 0;
+	uint64_t accessiblePointCount = 0; // Test points of all atoms that no other inflated sphere buries
+	float accessibleArea = 0.0f;       // Solvent-accessible area of Shrake-Rupley, in square units of the positions
+	uint64_t brickCount = 0;           // Of the whole grid
+	uint64_t surfaceBrickCount = 0;    // Bricks with samples, the others are empty or interior
+	uint64_t bytes = 0;                // Brick table and samples
+	uint32_t threadCount = 0;
+
+	float pointsMilliseconds = 0.0f;   // Hash grid and accessible points
+	float distanceMilliseconds = 0.0f; // Brick classification and distance samples
+	float milliseconds = 0.0f;
+
+	float GetAtomsPerSecond() const { return milliseconds > 0.0f ? atomCount / (milliseconds * 1e-3f) : 0.0f; }
+};
+
+// Signed distance field of the surface, negative inside, sampled on a grid of voxelSize and stored
+// sparsely in bricks of BrickSize^3 samples. Only bricks near the surface have samples, the others
+// are EmptyBrick or InteriorBrick and read as +/-GetBandWidth(). The stored distances are clamped to
+// the same band. Every sample also keeps the atom whose inflated sphere is nearest, which colors
+// and shades the surface like that atom. SampleSurface in Raytrace.frag reads the same layout
+class MolecularSurface
+{
+public:
+	static constexpr uint32_t BrickSize = 8;
+	static constexpr uint32_t BrickSampleCount = BrickSize * BrickSize * BrickSize;
+	static constexpr uint32_t EmptyBrick = 0xFFFFFFFF;
+	static constexpr uint32_t InteriorBrick = 0xFFFFFFFE;
+public:
+	MolecularSurface(const std::vector<Atom>& atoms, const MolecularSurfaceSpecification& specification = MolecularSurfaceSpecification());
+	// From the CreateSpheres() of the atoms, the nearest atoms are the same sphere indices
+	MolecularSurface(const std::vector<Sphere>& spheres, const MolecularSurfaceSpecification& specification = MolecularSurfaceSpecification());
+
+	const MolecularSurfaceSpecification& GetSpecification() const { return mSpecification; }
+	const MolecularSurfaceStatistics& GetStatistics() const { return mStatistics; }
+
+	// Position of sample (0, 0, 0), sample (i, j, k) lies voxelSize * (i, j, k) away from it
+	const glm::vec3& GetOrigin() const { return mOrigin; }
+	float GetVoxelSize() const { return mSpecification.voxelSize; }
+	float GetBandWidth() const { return mBandWidth; }
+	const glm::uvec3& GetBrickCounts() const { return mBrickCounts; }
+	glm::vec3 GetBoxMax() const { return mOrigin + glm::vec3(mBrickCounts * BrickSize - 1u) * mSpecification.voxelSize; }
+
+	// Slot of every brick, x fastest, or EmptyBrick / InteriorBrick. The samples of slot s start at
+	// s * BrickSampleCount, x fastest within the brick
+	const std::vector<uint32_t>& GetBricks() const { return mBricks; }
+	const std::vector<float>& GetDistances() const { return mDistances; }
+	const std::vector<uint32_t>& GetNearestAtoms() const { return mNearestAtoms; }
+
+	// Sample of the grid, outside it reads as empty
+	float GetDistance(const glm::ivec3& sample) const;
+	// Trilinear between the samples
+	float SampleDistance(const glm::vec3& position) const;
+	// Atom::index of the nearest sample
+	uint32_t GetNearestAtom(const glm::vec3& position) const;
+private:
+	// Center and radius of every atom
+	MolecularSurface(std::vector<glm::vec4> spheres, const MolecularSurfaceSpecification& specification);
+private:
+	MolecularSurfaceSpecification mSpecification;
+	MolecularSurfaceStatistics mStatistics;
+	glm::vec3 mOrigin = glm::vec3(0.0f);
+	float mBandWidth = 0.0f;
+	glm::uvec3 mBrickCounts = glm::uvec3(0);
+	std::vector<uint32_t> mBricks;
+	std::vector<float> mDistances;
+	std::vector<uint32_t> mNearestAtoms;
+};
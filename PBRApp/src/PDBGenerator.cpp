@@ -0,0 +1,232 @@
+#include "PDBGenerator.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+static constexpr float Pi = 3.14159265358979f;
+
+// Largest magnitude the 8.3 coordinate columns hold on both sides of the origin
+static constexpr float MaxCoordinate = 999.999f;
+
+static constexpr uint32_t AtomsPerResidue = 10;
+static const char* const ResidueNames[] = {
+	"ALA", "ARG", "ASN", "ASP", "CYS", "GLU", "GLN", "GLY", "HIS", "ILE",
+	"LEU", "LYS", "MET", "PHE", "PRO", "SER", "THR", "TRP", "TYR", "VAL"
+};
+
+static glm::vec3 SampleUnitBall(std::mt19937& random)
+{
+	std::uniform_real_distribution<float> coordinate(-1.0f, 1.0f);
+	glm::vec3 point;
+	do
+	{
+		point = glm::vec3(coordinate(random), coordinate(random), coordinate(random));
+	} while (glm::dot(point, point) > 1.0f);
+
+	return point;
+}
+
+static glm::vec3 SampleUnitSphere(std::mt19937& random)
+{
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	const float z = 2.0f * unit(random) - 1.0f;
+	const float phi = 2.0f * Pi * unit(random);
+	const float r = std::sqrt(std::max(1.0f - z * z, 0.0f));
+	return glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// Atom positions of one distribution, centered on the origin. Atoms are handed out in file order,
+// so the atoms of a cluster or a filament are contiguous like the atoms of a chain
+class PositionSampler
+{
+public:
+	PositionSampler(const PDBGeneratorSpecification& specification, std::mt19937& random)
+		: mSpecification(specification), mRandom(random)
+	{
+		const float volume = specification.atomCount * specification.volumePerAtom;
+		switch (specification.distribution)
+		{
+			case AtomDistribution::Uniform:
+				mSize = std::cbrt(volume);
+				break;
+			case AtomDistribution::Clustered:
+			{
+				// Blobs keep a third of their neighbourhood, the rest is empty space
+				const uint64_t clusterCount = (specification.atomCount + ClusterAtoms - 1) / ClusterAtoms;
+				mSize = std::cbrt(3.0f * ClusterAtoms * specification.volumePerAtom / (4.0f * Pi));
+				const float side = 3.0f * mSize * std::cbrt(static_cast<float>(clusterCount));
+				std::uniform_real_distribution<float> coordinate(-0.5f * side, 0.5f * side);
+				for (uint64_t i = 0; i < clusterCount; ++i)
+					mCenters.emplace_back(coordinate(random), coordinate(random), coordinate(random));
+				break;
+			}
+			case AtomDistribution::HelicalFilaments:
+			{
+				const uint64_t filamentCount = (specification.atomCount + FilamentAtoms - 1) / FilamentAtoms;
+				const uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(filamentCount))));
+				for (uint64_t i = 0; i < filamentCount; ++i)
+				{
+					const float x = (static_cast<float>(i % side) - 0.5f * (side - 1)) * FilamentSpacing;
+					const float y = (static_cast<float>(i / side) - 0.5f * (side - 1)) * FilamentSpacing;
+					mCenters.emplace_back(x, y, 0.0f);
+				}
+
+				// Atoms per angstrom of filament, two strands filled at the packing density
+				mSize = 2.0f * Pi * StrandRadius * StrandRadius / specification.volumePerAtom;
+				break;
+			}
+			case AtomDistribution::HollowCapsid:
+			{
+				// Outer radius of a shell of CapsidThickness with the volume of all atoms, a solid
+				// ball if they do not even fill that
+				const float k = 3.0f * volume / (4.0f * Pi);
+				const float t = CapsidThickness;
+				const float outer = (3.0f * t * t + std::sqrt(9.0f * t * t * t * t - 12.0f * t * (t * t * t - k))) / (6.0f * t);
+				mSize = outer > t ? outer : std::cbrt(k);
+				mInnerRadius = outer > t ? outer - t : 0.0f;
+				break;
+			}
+		}
+	}
+
+	glm::vec3 Sample(uint64_t atomIndex)
+	{
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		switch (mSpecification.distribution)
+		{
+			case AtomDistribution::Uniform:
+				return (glm::vec3(unit(mRandom), unit(mRandom), unit(mRandom)) - 0.5f) * mSize;
+			case AtomDistribution::Clustered:
+			{
+				std::normal_distribution<float> offset(0.0f, 0.5f * mSize);
+				return mCenters[atomIndex / ClusterAtoms] + glm::vec3(offset(mRandom), offset(mRandom), offset(mRandom));
+			}
+			case AtomDistribution::HelicalFilaments:
+			{
+				const uint64_t filament = atomIndex / FilamentAtoms;
+				const uint64_t filamentAtoms = std::min<uint64_t>(FilamentAtoms, mSpecification.atomCount - filament * FilamentAtoms);
+				const float length = filamentAtoms / mSize;
+				const float z = (unit(mRandom) - 0.5f) * length;
+				const float angle = 2.0f * Pi * z / HelixPitch + (unit(mRandom) < 0.5f ? 0.0f : Pi);
+				const glm::vec3 strand(HelixRadius * std::cos(angle), HelixRadius * std::sin(angle), z);
+				return mCenters[filament] + strand + StrandRadius * SampleUnitBall(mRandom);
+			}
+			case AtomDistribution::HollowCapsid:
+			{
+				const float inner3 = mInnerRadius * mInnerRadius * mInnerRadius;
+				const float outer3 = mSize * mSize * mSize;
+				return std::cbrt(inner3 + unit(mRandom) * (outer3 - inner3)) * SampleUnitSphere(mRandom);
+			}
+		}
+
+		return glm::vec3(0.0f);
+	}
+private:
+	static constexpr uint64_t ClusterAtoms = 20000;
+	static constexpr uint64_t FilamentAtoms = 100000;
+	static constexpr float FilamentSpacing = 100.0f;
+	static constexpr float HelixRadius = 20.0f;
+	static constexpr float HelixPitch = 370.0f;
+	static constexpr float StrandRadius = 15.0f;
+	static constexpr float CapsidThickness = 30.0f;
+private:
+	const PDBGeneratorSpecification& mSpecification;
+	std::mt19937& mRandom;
+	float mSize = 0.0f; // Side of the cube, radius of a cluster, atoms per angstrom of filament or outer capsid radius
+	float mInnerRadius = 0.0f;
+	std::vector<glm::vec3> mCenters;
+};
+
+bool GeneratePDB(const std::string& path, const PDBGeneratorSpecification& specification)
+{
+	if (specification.elements.empty())
+	{
+		std::cerr << "No elements to generate " << path << " from\n";
+		return false;
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cerr << "Could not write " << path << '\n';
+		return false;
+	}
+
+	std::vector<float> weights;
+	for (const ElementWeight& element : specification.elements)
+		weights.push_back(element.weight);
+
+	std::mt19937 random(specification.seed);
+	std::discrete_distribution<size_t> elementDistribution(weights.begin(), weights.end());
+	PositionSampler sampler(specification, random);
+
+	std::string buffer;
+	char line[128];
+	for (uint64_t i = 0; i < specification.atomCount; ++i)
+	{
+		const glm::vec3 position = sampler.Sample(i);
+		if (glm::any(glm::greaterThan(glm::abs(position), glm::vec3(MaxCoordinate))))
+		{
+			std::cerr << "Structure of " << specification.atomCount << " atoms does not fit the PDB coordinate columns, " << path << " is incomplete\n";
+			return false;
+		}
+
+		const uint64_t residue = i / AtomsPerResidue;
+		const char element[2] = { specification.elements[elementDistribution(random)].element, '\0' };
+		const char chain = static_cast<char>('A' + residue / 9999 % 26);
+		std::snprintf(line, sizeof(line), "ATOM  %5u  %-3s %3s %c%4u    %8.3f%8.3f%8.3f  1.00  0.00          %2s  \n",
+			static_cast<uint32_t>(i % 99999 + 1), element, ResidueNames[residue % 20], chain, static_cast<uint32_t>(residue % 9999 + 1),
+			position.x, position.y, position.z, element);
+		buffer += line;
+
+		if (buffer.size() >= (1 << 20))
+		{
+			file.write(buffer.data(), buffer.size());
+			buffer.clear();
+		}
+	}
+
+	file << buffer << "END\n";
+	if (!file)
+	{
+		std::cerr << "Could not write " << path << '\n';
+		return false;
+	}
+
+	return true;
+}
+
+bool HasAtomTemplates(const PDBGeneratorSpecification& specification, const std::unordered_map<char, AtomTemplate>& atomTemplates)
+{
+	bool complete = true;
+	for (const ElementWeight& element : specification.elements)
+	{
+		const auto it = atomTemplates.find(element.element);
+		if (it == atomTemplates.end() || it->second.radius <= 0.0f)
+		{
+			std::cerr << "No atom template with a radius for element " << element.element << '\n';
+			complete = false;
+		}
+	}
+
+	return complete;
+}
+
+const char* AtomDistributionName(AtomDistribution distribution)
+{
+	switch (distribution)
+	{
+		case AtomDistribution::Uniform: return "uniform";
+		case AtomDistribution::Clustered: return "clustered";
+		case AtomDistribution::HelicalFilaments: return "filaments";
+		case AtomDistribution::HollowCapsid: return "capsid";
+	}
+
+	return "unknown";
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "AtomLoader.h"
+
+enum class AtomDistribution
+{
+	Uniform = 0,      // One cube
+	Clustered,        // Gaussian blobs of 20k atoms scattered with empty space between them
+	HelicalFilaments, // Parallel two-stranded helices of 100k atoms, like actin filaments
+	HollowCapsid      // Spherical shell 30 angstrom thick, like a virus capsid
+};
+
+struct ElementWeight
+{
+	char element;
+	float weight;
+};
+
+struct PDBGeneratorSpecification
+{
+	uint64_t atomCount = 100000;
+	AtomDistribution distribution = AtomDistribution::Uniform;
+	std::vector<ElementWeight> elements = { { 'C', 62.0f }, { 'N', 17.0f }, { 'O', 19.0f }, { 'S', 2.0f } }; // Protein without hydrogens
+	uint32_t seed = 1;
+	float volumePerAtom = 12.0f; // Cubic angstrom, about the packing density of a protein
+};
+
+// Synthetic structures in the ATOM records AtomLoader reads, one 81 byte record per atom. Serial
+// numbers wrap at 100000 and residue numbers at 10000, the chain changes with every wrap. Returns
+// false and reports the reason if the structure does not fit the fixed PDB coordinate columns or
+// the file cannot be written
+bool GeneratePDB(const std::string& path, const PDBGeneratorSpecification& specification);
+
+// True if every element of the specification has an atom template with a radius, reports the
+// ones that do not
+bool HasAtomTemplates(const PDBGeneratorSpecification& specification, const std::unordered_map<char, AtomTemplate>& atomTemplates);
+
+const char* AtomDistributionName(AtomDistribution distribution);
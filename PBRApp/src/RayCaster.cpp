@@ -0,0 +1,385 @@
+#include "RayCaster.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <immintrin.h>
+
+#include "AtomKDTree.h"
+
+// Constants of Raytrace.frag
+static constexpr float MinDistance = -0.001f;
+static constexpr float MaxDistance = 1000000000.0f;
+
+// A node pops itself before pushing at most two children, so a tree within AtomKDTree::MaxDepth
+// never holds more than TraversalStackSize entries. Deeper trees drop the far child instead
+static constexpr uint32_t StackSize = AtomKDTree::TraversalStackSize;
+
+// Same operand order as minps and maxps, so the scalar path matches the packets bit for bit even
+// for the NaN of an axis parallel ray lying in a slab plane
+static float Min(float a, float b) { return a < b ? a : b; }
+static float Max(float a, float b) { return a > b ? a : b; }
+
+struct SseFloat4
+{
+	static constexpr uint32_t Width = 4;
+	using Float = __m128;
+	using Int = __m128i;
+
+	static Float Set(float value) { return _mm_set1_ps(value); }
+	static Float Load(const float* values) { return _mm_loadu_ps(values); }
+	static void Store(float* values, Float a) { _mm_storeu_ps(values, a); }
+	static Int SetInt(int value) { return _mm_set1_epi32(value); }
+	static void StoreInt(int* values, Int a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(values), a); }
+
+	static Float Add(Float a, Float b) { return _mm_add_ps(a, b); }
+	static Float Sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+	static Float Mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+	static Float Div(Float a, Float b) { return _mm_div_ps(a, b); }
+	static Float Neg(Float a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+	static Float CopySign(Float magnitude, Float sign) { return _mm_or_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), magnitude), _mm_and_ps(_mm_set1_ps(-0.0f), sign)); }
+	static Float Sqrt(Float a) { return _mm_sqrt_ps(a); }
+	static Float Min(Float a, Float b) { return _mm_min_ps(a, b); }
+	static Float Max(Float a, Float b) { return _mm_max_ps(a, b); }
+
+	static Float Less(Float a, Float b) { return _mm_cmplt_ps(a, b); }
+	static Float LessEqual(Float a, Float b) { return _mm_cmple_ps(a, b); }
+	static Float Greater(Float a, Float b) { return _mm_cmpgt_ps(a, b); }
+	static Float GreaterEqual(Float a, Float b) { return _mm_cmpge_ps(a, b); }
+	static Float Equal(Float a, Float b) { return _mm_cmpeq_ps(a, b); }
+	static Float LessInt(Int a, Int b) { return _mm_castsi128_ps(_mm_cmplt_epi32(a, b)); }
+
+	static Float And(Float a, Float b) { return _mm_and_ps(a, b); }
+	static Float Or(Float a, Float b) { return _mm_or_ps(a, b); }
+	static Float Select(Float mask, Float a, Float b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+	static Int SelectInt(Float mask, Int a, Int b) { return _mm_castps_si128(Select(mask, _mm_castsi128_ps(a), _mm_castsi128_ps(b))); }
+	static uint32_t Mask(Float mask) { return static_cast<uint32_t>(_mm_movemask_ps(mask)); }
+};
+
+#if defined(__AVX2__)
+struct AvxFloat8
+{
+	static constexpr uint32_t Width = 8;
+	using Float = __m256;
+	using Int = __m256i;
+
+	static Float Set(float value) { return _mm256_set1_ps(value); }
+	static Float Load(const float* values) { return _mm256_loadu_ps(values); }
+	static void Store(float* values, Float a) { _mm256_storeu_ps(values, a); }
+	static Int SetInt(int value) { return _mm256_set1_epi32(value); }
+	static void StoreInt(int* values, Int a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(values), a); }
+
+	static Float Add(Float a, Float b) { return _mm256_add_ps(a, b); }
+	static Float Sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+	static Float Mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+	static Float Div(Float a, Float b) { return _mm256_div_ps(a, b); }
+	static Float Neg(Float a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+	static Float CopySign(Float magnitude, Float sign) { return _mm256_or_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), magnitude), _mm256_and_ps(_mm256_set1_ps(-0.0f), sign)); }
+	static Float Sqrt(Float a) { return _mm256_sqrt_ps(a); }
+	static Float Min(Float a, Float b) { return _mm256_min_ps(a, b); }
+	static Float Max(Float a, Float b) { return _mm256_max_ps(a, b); }
+
+	static Float Less(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	static Float LessEqual(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	static Float Greater(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+	static Float GreaterEqual(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+	static Float Equal(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+	static Float LessInt(Int a, Int b) { return _mm256_castsi256_ps(_mm256_cmpgt_epi32(b, a)); }
+
+	static Float And(Float a, Float b) { return _mm256_and_ps(a, b); }
+	static Float Or(Float a, Float b) { return _mm256_or_ps(a, b); }
+	static Float Select(Float mask, Float a, Float b) { return _mm256_blendv_ps(b, a, mask); }
+	static Int SelectInt(Float mask, Int a, Int b) { return _mm256_castps_si256(Select(mask, _mm256_castsi256_ps(a), _mm256_castsi256_ps(b))); }
+	static uint32_t Mask(Float mask) { return static_cast<uint32_t>(_mm256_movemask_ps(mask)); }
+};
+#endif
+
+struct StackEntry
+{
+	int node;
+	float entry; // Smallest entry distance of the rays that hit the node
+};
+
+// tNear of the box in tNear, hit when the slabs overlap in front of the origin and not behind the
+// closest hit so far. Equal distances still count, so ties can be resolved by sphere index
+static bool IntersectBox(const CpuRaytracer::Ray& ray, const glm::vec3& invDir, const ArrayNode& node, float closest, float& tNear)
+{
+	float t1[3], t2[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float lo = (node.boxMin[axis] - ray.origin[axis]) * invDir[axis];
+		const float hi = (node.boxMax[axis] - ray.origin[axis]) * invDir[axis];
+		t1[axis] = Min(lo, hi);
+		t2[axis] = Max(lo, hi);
+	}
+
+	tNear = Max(Max(t1[0], t1[1]), t1[2]);
+	const float tFar = Min(Min(t2[0], t2[1]), t2[2]);
+	return tNear <= tFar && tFar >= 0.0f && tNear <= closest;
+}
+
+// Nearer root of HitSphereOutside. The discriminant comes from the distance between the ray and
+// the center instead of b * b - 4 * a * c, which cancels so badly for distant spheres that a
+// packet would report spheres of leaves its ray never enters
+static float HitSphere(const CpuRaytracer::Ray& ray, const Sphere& sphere, bool& valid)
+{
+	const float trox = ray.origin.x - sphere.position.x;
+	const float troy = ray.origin.y - sphere.position.y;
+	const float troz = ray.origin.z - sphere.position.z;
+	const float a = ray.dir.x * ray.dir.x + ray.dir.y * ray.dir.y + ray.dir.z * ray.dir.z;
+	const float halfB = ray.dir.x * trox + ray.dir.y * troy + ray.dir.z * troz;
+	const float c = (trox * trox + troy * troy + troz * troz) - sphere.radius * sphere.radius;
+	const float s = halfB / a;
+	const float fx = trox - s * ray.dir.x;
+	const float fy = troy - s * ray.dir.y;
+	const float fz = troz - s * ray.dir.z;
+	const float D = a * (sphere.radius * sphere.radius - (fx * fx + fy * fy + fz * fz));
+	valid = D >= 0.0f;
+
+	const float q = -halfB - std::copysign(std::sqrt(D), halfB);
+	return Min(c / q, q / a);
+}
+
+RayCaster::RayCaster(const RaytraceScene& scene)
+	: mScene(scene)
+{
+}
+
+RayHit RayCaster::Intersect(const CpuRaytracer::Ray& ray) const
+{
+	RayHit hit = { MaxDistance, -1 };
+	if (mScene.nodeCount == 0)
+		return hit;
+
+	const glm::vec3 invDir(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+	float rootEntry;
+	if (!IntersectBox(ray, invDir, mScene.nodes[0], hit.distance, rootEntry))
+		return hit;
+
+	StackEntry stack[StackSize];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = { 0, rootEntry };
+	while (stackSize > 0)
+	{
+		const StackEntry current = stack[--stackSize];
+		if (current.entry > hit.distance)
+			continue;
+
+		const ArrayNode& node = mScene.nodes[current.node];
+		if (node.childIndices.x < 0)
+		{
+			for (int i = 0; i < node.childIndices.w; ++i)
+			{
+				const uint32_t sphereIndex = mScene.atomIndices[node.childIndices.z + i];
+				bool valid;
+				const float t = HitSphere(ray, mScene.spheres[sphereIndex], valid);
+				if (valid && t > MinDistance && (t < hit.distance || (t == hit.distance && static_cast<int>(sphereIndex) < hit.sphereIndex)))
+				{
+					hit.distance = t;
+					hit.sphereIndex = static_cast<int>(sphereIndex);
+				}
+			}
+
+			continue;
+		}
+
+		const int left = node.childIndices.x;
+		const int right = node.childIndices.y;
+		float leftEntry, rightEntry;
+		const bool leftHit = IntersectBox(ray, invDir, mScene.nodes[left], hit.distance, leftEntry);
+		const bool rightHit = IntersectBox(ray, invDir, mScene.nodes[right], hit.distance, rightEntry);
+		if (leftHit && rightHit)
+		{
+			const bool leftFirst = leftEntry <= rightEntry;
+			if (stackSize + 1 < StackSize)
+				stack[stackSize++] = leftFirst ? StackEntry{ right, rightEntry } : StackEntry{ left, leftEntry };
+			stack[stackSize++] = leftFirst ? StackEntry{ left, leftEntry } : StackEntry{ right, rightEntry };
+		}
+		else if (leftHit)
+		{
+			stack[stackSize++] = { left, leftEntry };
+		}
+		else if (rightHit)
+		{
+			stack[stackSize++] = { right, rightEntry };
+		}
+	}
+
+	return hit;
+}
+
+template<typename S>
+struct RayPacket
+{
+	typename S::Float origin[3];
+	typename S::Float invDir[3];
+	typename S::Float dir[3];
+};
+
+template<typename S>
+static typename S::Float IntersectBoxPacket(const RayPacket<S>& packet, const ArrayNode& node, typename S::Float closest, typename S::Float& tNear)
+{
+	typename S::Float t1[3], t2[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const typename S::Float lo = S::Mul(S::Sub(S::Set(node.boxMin[axis]), packet.origin[axis]), packet.invDir[axis]);
+		const typename S::Float hi = S::Mul(S::Sub(S::Set(node.boxMax[axis]), packet.origin[axis]), packet.invDir[axis]);
+		t1[axis] = S::Min(lo, hi);
+		t2[axis] = S::Max(lo, hi);
+	}
+
+	tNear = S::Max(S::Max(t1[0], t1[1]), t1[2]);
+	const typename S::Float tFar = S::Min(S::Min(t2[0], t2[1]), t2[2]);
+	return S::And(S::And(S::LessEqual(tNear, tFar), S::GreaterEqual(tFar, S::Set(0.0f))), S::LessEqual(tNear, closest));
+}
+
+// Smallest entry distance of the lanes in mask
+template<typename S>
+static float MinEntry(typename S::Float tNear, uint32_t mask)
+{
+	float values[S::Width];
+	S::Store(values, tNear);
+	float entry = std::numeric_limits<float>::infinity();
+	for (uint32_t lane = 0; lane < S::Width; ++lane)
+	{
+		if (mask & (1u << lane))
+			entry = std::min(entry, values[lane]);
+	}
+
+	return entry;
+}
+
+template<typename S>
+static void IntersectPacket(const RaytraceScene& scene, const CpuRaytracer::Ray* rays, uint32_t count, RayHit* hits)
+{
+	using Float = typename S::Float;
+	using Int = typename S::Int;
+
+	// Lanes past count start with a closest hit behind every box, so they never take part
+	float values[9][S::Width];
+	float initialClosest[S::Width];
+	for (uint32_t lane = 0; lane < S::Width; ++lane)
+	{
+		const CpuRaytracer::Ray& ray = rays[std::min(lane, count - 1)];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			values[axis][lane] = ray.origin[axis];
+			values[3 + axis][lane] = 1.0f / ray.dir[axis];
+			values[6 + axis][lane] = ray.dir[axis];
+		}
+
+		initialClosest[lane] = lane < count ? MaxDistance : -std::numeric_limits<float>::infinity();
+	}
+
+	RayPacket<S> packet;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		packet.origin[axis] = S::Load(values[axis]);
+		packet.invDir[axis] = S::Load(values[3 + axis]);
+		packet.dir[axis] = S::Load(values[6 + axis]);
+	}
+
+	Float closest = S::Load(initialClosest);
+	Int hitIndex = S::SetInt(-1);
+	float maxClosest = MaxDistance;
+
+	Float rootEntry;
+	const uint32_t rootMask = scene.nodeCount > 0 ? S::Mask(IntersectBoxPacket(packet, scene.nodes[0], closest, rootEntry)) : 0;
+
+	StackEntry stack[StackSize];
+	uint32_t stackSize = 0;
+	if (rootMask)
+		stack[stackSize++] = { 0, MinEntry<S>(rootEntry, rootMask) };
+
+	const Float a = S::Add(S::Add(S::Mul(packet.dir[0], packet.dir[0]), S::Mul(packet.dir[1], packet.dir[1])), S::Mul(packet.dir[2], packet.dir[2]));
+	while (stackSize > 0)
+	{
+		const StackEntry current = stack[--stackSize];
+		if (current.entry > maxClosest)
+			continue;
+
+		const ArrayNode& node = scene.nodes[current.node];
+		if (node.childIndices.x < 0)
+		{
+			for (int i = 0; i < node.childIndices.w; ++i)
+			{
+				const uint32_t sphereIndex = scene.atomIndices[node.childIndices.z + i];
+				const Sphere& sphere = scene.spheres[sphereIndex];
+				const Float trox = S::Sub(packet.origin[0], S::Set(sphere.position.x));
+				const Float troy = S::Sub(packet.origin[1], S::Set(sphere.position.y));
+				const Float troz = S::Sub(packet.origin[2], S::Set(sphere.position.z));
+				const Float radius2 = S::Set(sphere.radius * sphere.radius);
+				const Float halfB = S::Add(S::Add(S::Mul(packet.dir[0], trox), S::Mul(packet.dir[1], troy)), S::Mul(packet.dir[2], troz));
+				const Float c = S::Sub(S::Add(S::Add(S::Mul(trox, trox), S::Mul(troy, troy)), S::Mul(troz, troz)), radius2);
+				const Float s = S::Div(halfB, a);
+				const Float fx = S::Sub(trox, S::Mul(s, packet.dir[0]));
+				const Float fy = S::Sub(troy, S::Mul(s, packet.dir[1]));
+				const Float fz = S::Sub(troz, S::Mul(s, packet.dir[2]));
+				const Float D = S::Mul(a, S::Sub(radius2, S::Add(S::Add(S::Mul(fx, fx), S::Mul(fy, fy)), S::Mul(fz, fz))));
+				const Float q = S::Sub(S::Neg(halfB), S::CopySign(S::Sqrt(D), halfB));
+				const Float t = S::Min(S::Div(c, q), S::Div(q, a));
+
+				const Int index = S::SetInt(static_cast<int>(sphereIndex));
+				const Float closer = S::Or(S::Less(t, closest), S::And(S::Equal(t, closest), S::LessInt(index, hitIndex)));
+				const Float mask = S::And(S::And(S::GreaterEqual(D, S::Set(0.0f)), S::Greater(t, S::Set(MinDistance))), closer);
+				closest = S::Select(mask, t, closest);
+				hitIndex = S::SelectInt(mask, index, hitIndex);
+			}
+
+			float closestValues[S::Width];
+			S::Store(closestValues, closest);
+			maxClosest = *std::max_element(closestValues, closestValues + S::Width);
+			continue;
+		}
+
+		const int left = node.childIndices.x;
+		const int right = node.childIndices.y;
+		Float leftNear, rightNear;
+		const uint32_t leftMask = S::Mask(IntersectBoxPacket(packet, scene.nodes[left], closest, leftNear));
+		const uint32_t rightMask = S::Mask(IntersectBoxPacket(packet, scene.nodes[right], closest, rightNear));
+		const StackEntry leftEntry = { left, leftMask ? MinEntry<S>(leftNear, leftMask) : 0.0f };
+		const StackEntry rightEntry = { right, rightMask ? MinEntry<S>(rightNear, rightMask) : 0.0f };
+		if (leftMask && rightMask)
+		{
+			const bool leftFirst = leftEntry.entry <= rightEntry.entry;
+			if (stackSize + 1 < StackSize)
+				stack[stackSize++] = leftFirst ? rightEntry : leftEntry;
+			stack[stackSize++] = leftFirst ? leftEntry : rightEntry;
+		}
+		else if (leftMask)
+		{
+			stack[stackSize++] = leftEntry;
+		}
+		else if (rightMask)
+		{
+			stack[stackSize++] = rightEntry;
+		}
+	}
+
+	float closestValues[S::Width];
+	int indexValues[S::Width];
+	S::Store(closestValues, closest);
+	S::StoreInt(indexValues, hitIndex);
+	for (uint32_t lane = 0; lane < count; ++lane)
+	{
+		hits[lane] = { closestValues[lane], indexValues[lane] };
+	}
+}
+
+void RayCaster::IntersectPackets(const CpuRaytracer::Ray* rays, size_t count, RayHit* hits, uint32_t packetWidth) const
+{
+#if defined(__AVX2__)
+	if (packetWidth == 8)
+	{
+		for (size_t i = 0; i < count; i += 8)
+			IntersectPacket<AvxFloat8>(mScene, rays + i, static_cast<uint32_t>(std::min<size_t>(8, count - i)), hits + i);
+		return;
+	}
+#else
+	(void)packetWidth; // Only 4-wide packets without AVX2
+#endif
+
+	for (size_t i = 0; i < count; i += 4)
+		IntersectPacket<SseFloat4>(mScene, rays + i, static_cast<uint32_t>(std::min<size_t>(4, count - i)), hits + i);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "CpuRaytracer.h"
+
+struct RayHit
+{
+	float distance;  // MAX_DISTANCE of Raytrace.frag on a miss
+	int sphereIndex; // -1 on a miss
+};
+
+// Closest sphere along rays through the ArrayNode tree of a RaytraceScene, walked front to back
+// with the sphere test of HitSphereOutside. Packets trace coherent rays together with SSE or AVX2
+// and give every ray exactly the hit Intersect() gives it, ties go to the lower sphere index
+class RayCaster
+{
+public:
+	// Widest packet of the instruction set the application is compiled for
+#if defined(__AVX2__)
+	static constexpr uint32_t MaxPacketWidth = 8;
+#else
+	static constexpr uint32_t MaxPacketWidth = 4;
+#endif
+public:
+	RayCaster(const RaytraceScene& scene);
+
+	// Scalar path, for incoherent rays such as reflections and refractions
+	RayHit Intersect(const CpuRaytracer::Ray& ray) const;
+
+	// Every packetWidth consecutive rays form one packet, so neighbouring pixels should be next to
+	// each other. packetWidth is 4 or MaxPacketWidth, count does not have to be a multiple of it
+	void IntersectPackets(const CpuRaytracer::Ray* rays, size_t count, RayHit* hits, uint32_t packetWidth = MaxPacketWidth) const;
+private:
+	RaytraceScene mScene;
+};
@@ -24,7 +24,7 @@ namespace Utils {
 		glBindTexture(TextureTarget(multisampled), id);
 	}
 
-	static void AttachColorTexture(uint32_t id, int samples, GLenum internalFormat, GLenum format, uint32_t width, uint32_t height, int index)
+	static void AttachColorTexture(uint32_t id, int samples, GLenum internalFormat, GLenum format, GLenum type, uint32_t width, uint32_t height, int index)
 	{
 		bool multisampled = samples > 1;
 		if (multisampled)
@@ -33,7 +33,7 @@ namespace Utils {
 		}
 		else
 		{
-			glTextureSubImage2D(id, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+			glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
 
 			glTextureParameteri(id, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 			glTextureParameteri(id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -143,10 +143,19 @@ void Framebuffer::Invalidate()
 			switch (m_ColorAttachmentSpecifications[i].textureFormat)
 			{
 				case FramebufferTextureFormat::RGBA8:
-					Utils::AttachColorTexture(m_ColorAttachments[i], m_Specification.samples, GL_RGBA8, GL_RGBA, m_Specification.width, m_Specification.height, i);
+					Utils::AttachColorTexture(m_ColorAttachments[i], m_Specification.samples, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, m_Specification.width, m_Specification.height, i);
 					break;
 				case FramebufferTextureFormat::RED_INTEGER:
-					Utils::AttachColorTexture(m_ColorAttachments[i], m_Specification.samples, GL_R32I, GL_RED_INTEGER, m_Specification.width, m_Specification.height, i);
+					Utils::AttachColorTexture(m_ColorAttachments[i], m_Specification.samples, GL_R32I, GL_RED_INTEGER, GL_INT, m_Specification.width, m_Specification.height, i);
+					break;
+				case FramebufferTextureFormat::Float32:
+					Utils::AttachColorTexture(m_ColorAttachments[i], m_Specification.samples, GL_R32F, GL_RED, GL_FLOAT, m_Specification.width, m_Specification.height, i);
+					break;
+				case FramebufferTextureFormat::Vec3:
+					Utils::AttachColorTexture(m_ColorAttachments[i], m_Specification.samples, GL_RGB32F, GL_RGB, GL_FLOAT, m_Specification.width, m_Specification.height, i);
+					break;
+				case FramebufferTextureFormat::Vec4:
+					Utils::AttachColorTexture(m_ColorAttachments[i], m_Specification.samples, GL_RGBA32F, GL_RGBA, GL_FLOAT, m_Specification.width, m_Specification.height, i);
 					break;
 			}
 		}
@@ -67,6 +67,8 @@ public:
 
 	void ClearAttachment(uint32_t attachmentIndex, int value);
 
+	uint32_t GetColorAttachmentRendererID(uint32_t index = 0) const { return m_ColorAttachments[index]; }
+
 	const FramebufferSpecification& GetSpecification() const { return m_Specification; }
 private:
 	uint32_t m_RendererID = 0;
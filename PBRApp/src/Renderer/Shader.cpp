@@ -105,6 +105,11 @@ void Shader::SetIntArray(const std::string& name, int* values, uint32_t count)
 	UploadUniformIntArray(name, values, count);
 }
 
+void Shader::SetInt3(const std::string& name, const glm::ivec3& value)
+{
+	UploadUniformInt3(name, value);
+}
+
 void Shader::SetFloat(const std::string& name, float value)
 {
 	UploadUniformFloat(name, value);
@@ -142,6 +147,12 @@ void Shader::UploadUniformIntArray(const std::string& name, int* values, uint32_
 	glUniform1iv(location, count, values);
 }
 
+void Shader::UploadUniformInt3(const std::string& name, const glm::ivec3& value)
+{
+	GLint location = glGetUniformLocation(mRendererID, name.c_str());
+	glUniform3i(location, value.x, value.y, value.z);
+}
+
 void Shader::UploadUniformFloat(const std::string& name, float value)
 {
 	GLint location = glGetUniformLocation(mRendererID, name.c_str());
@@ -178,10 +189,22 @@ void Shader::UploadUniformMat4(const std::string& name, const glm::mat4& matrix)
 	glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(matrix));
 }
 
-Ref<Shader> Shader::CreateFromFile(const std::string& vertexFilepath, const std::string& fragmentFilepath)
+static void InsertDefines(std::string& source, const std::string& defines)
+{
+	if (defines.empty())
+		return;
+
+	// #version has to stay the first line
+	const size_t lineEnd = source.find('\n', source.find("#version"));
+	source.insert(lineEnd == std::string::npos ? source.size() : lineEnd + 1, defines);
+}
+
+Ref<Shader> Shader::CreateFromFile(const std::string& vertexFilepath, const std::string& fragmentFilepath, const std::string& defines)
 {
 	std::string vertexSource = ReadFile(vertexFilepath);
 	std::string fragmentSource = ReadFile(fragmentFilepath);
+	InsertDefines(vertexSource, defines);
+	InsertDefines(fragmentSource, defines);
 
 	return CreateRef<Shader>(vertexSource, fragmentSource);
 }
@@ -18,6 +18,7 @@ public:
 
 	void SetInt(const std::string& name, int value);
 	void SetIntArray(const std::string& name, int* values, uint32_t count);
+	void SetInt3(const std::string& name, const glm::ivec3& value);
 	void SetFloat(const std::string& name, float value);
 	void SetFloat2(const std::string& name, const glm::vec2& value);
 	void SetFloat3(const std::string& name, const glm::vec3& value);
@@ -26,6 +27,7 @@ public:
 
 	void UploadUniformInt(const std::string& name, int value);
 	void UploadUniformIntArray(const std::string& name, int* values, uint32_t count);
+	void UploadUniformInt3(const std::string& name, const glm::ivec3& value);
 
 	void UploadUniformFloat(const std::string& name, float value);
 	void UploadUniformFloat2(const std::string& name, const glm::vec2& value);
@@ -37,7 +39,8 @@ public:
 public:
 	static std::string ReadFile(const std::string& filepath);
 
-	static Ref<Shader> CreateFromFile(const std::string& vertexFilepath, const std::string& fragmentFilepath);
+	// defines holds #define lines, they go right after the #version line of both stages
+	static Ref<Shader> CreateFromFile(const std::string& vertexFilepath, const std::string& fragmentFilepath, const std::string& defines = "");
 	static Ref<Shader> CreateFromSource(const std::string& vertexSource, const std::string& fragmentSource);
 private:
 	uint32_t mRendererID;
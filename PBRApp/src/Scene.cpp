@@ -0,0 +1,107 @@
+#include "Scene.h"
+
+#include <algorithm>
+
+static SphereMaterial CreateSphereMaterial(const Material& material)
+{
+	SphereMaterial sphereMaterial;
+	sphereMaterial.metallic = material.metallic;
+	sphereMaterial.roughness = material.roughness;
+	sphereMaterial.dielectricF0 = 0.16f * material.reflectance * material.reflectance;
+	return sphereMaterial;
+}
+
+std::vector<Sphere> CreateSpheres(const std::vector<Atom>& atoms, std::vector<SphereMaterial>& materials)
+{
+	materials.clear();
+
+	// Atoms point to a handful of templates and residues, so the distinct materials are few and
+	// consecutive atoms mostly share one. Entries are only searched when the pointer changes
+	std::vector<Material> tableMaterials;
+	const Material* lastMaterial = nullptr;
+	uint16_t lastIndex = 0;
+
+	std::vector<Sphere> spheres;
+	spheres.reserve(atoms.size());
+	for (const Atom& atom : atoms)
+	{
+		const AtomTemplate* t = atom.atomTemplate;
+		Sphere sphere;
+		sphere.position = glm::vec4(atom.position, 0.0f);
+		sphere.color = glm::vec4(t->color, 1.0f);
+		sphere.radius = t->radius;
+
+		const Material* material = atom.residue && atom.residue->hasMaterial ? &atom.residue->material : &t->material;
+		if (material != lastMaterial)
+		{
+			const auto it = std::find(tableMaterials.begin(), tableMaterials.end(), *material);
+			if (it != tableMaterials.end())
+			{
+				lastIndex = static_cast<uint16_t>(it - tableMaterials.begin());
+			}
+			else if (tableMaterials.size() < MaxSphereMaterials)
+			{
+				lastIndex = static_cast<uint16_t>(tableMaterials.size());
+				tableMaterials.push_back(*material);
+				materials.push_back(CreateSphereMaterial(*material));
+			}
+			else
+			{
+				lastIndex = 0;
+			}
+
+			lastMaterial = material;
+		}
+
+		sphere.materialIndex = lastIndex;
+		spheres.push_back(std::move(sphere));
+	}
+
+	return spheres;
+}
+
+std::vector<Sphere> CreateSpheres(const std::vector<Atom>& atoms)
+{
+	std::vector<SphereMaterial> materials;
+	return CreateSpheres(atoms, materials);
+}
+
+std::vector<ArrayNode> CreateArrayNodes(const AtomKDTree& tree)
+{
+	const std::vector<KDTreeNode>& nodes = tree.GetNodes();
+
+	std::vector<ArrayNode> kdTreeArray(nodes.size());
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		const KDTreeNode& treeNode = nodes[i];
+		ArrayNode& node = kdTreeArray[i];
+		node.boxMin = glm::vec4(treeNode.boxMin, 0.0f);
+		node.boxMax = glm::vec4(treeNode.boxMax, 0.0f);
+		if (treeNode.IsLeaf())
+		{
+			node.childIndices = glm::ivec4(-1, -1, static_cast<int>(treeNode.offset), static_cast<int>(treeNode.atomCount));
+		}
+		else
+		{
+			node.childIndices = glm::ivec4(static_cast<int>(i + 1), static_cast<int>(treeNode.offset), 0, 0);
+		}
+	}
+
+	return kdTreeArray;
+}
+
+std::vector<int32_t> CreateParentIndices(const ArrayNode* nodes, uint64_t nodeCount)
+{
+	std::vector<int32_t> parentIndices(nodeCount, -1);
+	for (uint64_t i = 0; i < nodeCount; ++i)
+	{
+		const glm::ivec4& childIndices = nodes[i].childIndices;
+		if (childIndices.x >= 0)
+		{
+			parentIndices[childIndices.x] = static_cast<int32_t>(i);
+			parentIndices[childIndices.y] = static_cast<int32_t>(i);
+		}
+	}
+
+	return parentIndices;
+}
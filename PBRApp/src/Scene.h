@@ -0,0 +1,95 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "AtomLoader.h"
+#include "AtomKDTree.h"
+
+// std430 layout, matches BufferSphere in Raytrace.frag. The material index takes the low 16 bits
+// of properties.w and refers to the table CreateSpheres() fills, the baked occlusion the high ones
+struct Sphere
+{
+	float radius;
+	float transparency = 0.0f;
+	float reflection = 0.0f;
+	uint16_t materialIndex = 0;
+	uint16_t occlusion = 0; // Fraction of blocked ambient rays as unorm16, see BakeAmbientOcclusion()
+	glm::vec4 position;
+	glm::vec4 color;
+};
+
+// std430 layout, matches BufferMaterial in Raytrace.frag
+struct SphereMaterial
+{
+	float metallic = 0.0f;
+	float roughness = 0.5f;
+	float dielectricF0 = 0.04f; // 0.16 * Material::reflectance^2
+	float _unused = 0.0f;
+};
+
+static constexpr uint32_t MaxSphereMaterials = 1 << 16;
+
+// std430 layout, matches KDTreeNode in Raytrace.frag. Leaves own childIndices.w entries of the atom
+// index buffer starting at childIndices.z
+struct ArrayNode
+{
+	glm::vec4 boxMin;
+	glm::vec4 boxMax;
+	glm::ivec4 childIndices; // x = left, y = right child, both -1 for leaves
+};
+
+// Materials are deduplicated by value, a residue with its own material overrides the one of the
+// atom template. Past MaxSphereMaterials distinct materials the rest fall back to entry 0
+std::vector<Sphere> CreateSpheres(const std::vector<Atom>& atoms, std::vector<SphereMaterial>& materials);
+// For traversal only, the material indices refer to a table that is thrown away
+std::vector<Sphere> CreateSpheres(const std::vector<Atom>& atoms);
+// The atom index buffer of the nodes is AtomKDTree::GetAtomIndices()
+std::vector<ArrayNode> CreateArrayNodes(const AtomKDTree& tree);
+// Parent of every node for the stackless traversal of Raytrace.frag, -1 for the root
+std::vector<int32_t> CreateParentIndices(const ArrayNode* nodes, uint64_t nodeCount);
+
+// Any-hit walk of shadow and occlusion rays: children are visited in tree order and the walk ends at
+// the first leaf hitsLeaf(node) accepts. entersBox(node) says whether the ray reaches a node. Only
+// nodes with both children entered push, so trees within AtomKDTree::MaxDepth fit the stack and a
+// deeper one skips the right child instead of overrunning it
+template<typename EntersBox, typename HitsLeaf>
+bool FindAnyHit(const ArrayNode* nodes, uint64_t nodeCount, EntersBox&& entersBox, HitsLeaf&& hitsLeaf, uint64_t& nodeVisits)
+{
+	if (nodeCount == 0 || !entersBox(nodes[0]))
+		return false;
+
+	int stack[AtomKDTree::TraversalStackSize];
+	int stackSize = 0;
+	int index = 0;
+	while (true)
+	{
+		++nodeVisits;
+		const ArrayNode& node = nodes[index];
+		const glm::ivec4& children = node.childIndices;
+		if (children.x >= 0)
+		{
+			const bool leftHit = entersBox(nodes[children.x]);
+			const bool rightHit = entersBox(nodes[children.y]);
+			if (leftHit && rightHit && stackSize < AtomKDTree::TraversalStackSize)
+				stack[stackSize++] = children.y;
+
+			if (leftHit || rightHit)
+			{
+				index = leftHit ? children.x : children.y;
+				continue;
+			}
+		}
+		else if (hitsLeaf(node))
+		{
+			return true;
+		}
+
+		if (stackSize == 0)
+			return false;
+
+		index = stack[--stackSize];
+	}
+}
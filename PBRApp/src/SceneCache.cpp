@@ -0,0 +1,237 @@
+#include "SceneCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "Core/ThreadPool.h"
+
+static constexpr char CacheMagic[8] = { 'P', 'B', 'R', 'C', 'A', 'C', 'H', 'E' };
+
+// Every section starts at a multiple of this, so the mapped records are aligned for vec4 loads
+static constexpr uint64_t SectionAlignment = 16;
+
+struct CacheSection
+{
+	uint64_t offset;
+	uint64_t count;
+	uint64_t stride;
+};
+
+struct CacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t _padding;
+	uint64_t inputHash;
+
+	glm::vec3 compactBoxMin;
+	uint32_t _padding2;
+	glm::vec3 compactBoxMax;
+	uint32_t _padding3;
+
+	CacheSection spheres;
+	CacheSection materials;
+	CacheSection nodes;
+	CacheSection atomIndices;
+	CacheSection compactNodes;
+	CacheSection compactAtomIndices;
+};
+
+static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+static uint64_t Mix(uint64_t hash, uint64_t value)
+{
+	hash ^= value;
+	hash *= 0x9E3779B97F4A7C15ull;
+	return hash ^ (hash >> 29);
+}
+
+// Hashes fixed-size blocks in parallel and folds the block hashes in order, so the result does
+// not depend on the number of threads
+static uint64_t HashBytes(const char* data, uint64_t size, ThreadPool& pool)
+{
+	constexpr uint64_t blockSize = 4 << 20;
+	const uint32_t blockCount = static_cast<uint32_t>((size + blockSize - 1) / blockSize);
+
+	std::vector<uint64_t> blockHashes(blockCount);
+	pool.ParallelFor(blockCount, [&](uint32_t i)
+	{
+		const char* begin = data + i * blockSize;
+		const uint64_t length = std::min(blockSize, size - i * blockSize);
+
+		uint64_t hash = Mix(0xCBF29CE484222325ull, i);
+		uint64_t offset = 0;
+		for (; offset + sizeof(uint64_t) <= length; offset += sizeof(uint64_t))
+		{
+			uint64_t word;
+			std::memcpy(&word, begin + offset, sizeof(word));
+			hash = Mix(hash, word);
+		}
+
+		uint64_t tail = 0;
+		std::memcpy(&tail, begin + offset, length - offset);
+		blockHashes[i] = Mix(hash, tail);
+	});
+
+	uint64_t hash = Mix(0xCBF29CE484222325ull, size);
+	for (uint64_t blockHash : blockHashes)
+	{
+		hash = Mix(hash, blockHash);
+	}
+
+	return hash;
+}
+
+template<typename T>
+static const T* ResolveSection(const MappedFile& file, const CacheSection& section)
+{
+	if (section.stride != sizeof(T) || section.offset % SectionAlignment != 0
+		|| section.offset > file.GetSize() || section.count > (file.GetSize() - section.offset) / sizeof(T))
+	{
+		return nullptr;
+	}
+
+	return reinterpret_cast<const T*>(file.GetData() + section.offset);
+}
+
+template<typename T>
+static CacheSection AppendSection(std::vector<char>& layout, uint64_t count)
+{
+	CacheSection section;
+	section.offset = AlignUp(layout.size(), SectionAlignment);
+	section.count = count;
+	section.stride = sizeof(T);
+	layout.resize(section.offset + count * sizeof(T));
+	return section;
+}
+
+SceneCache::SceneCache(const std::string& cachePath, uint64_t inputHash)
+{
+	if (!std::filesystem::exists(cachePath))
+	{
+		return;
+	}
+
+	mFile = CreateScope<MappedFile>(cachePath);
+	if (!mFile->IsOpen() || mFile->GetSize() < sizeof(CacheHeader))
+	{
+		return;
+	}
+
+	CacheHeader header;
+	std::memcpy(&header, mFile->GetData(), sizeof(header));
+	if (std::memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) != 0 || header.version != Version || header.inputHash != inputHash)
+	{
+		return;
+	}
+
+	mSpheres = ResolveSection<Sphere>(*mFile, header.spheres);
+	mMaterials = ResolveSection<SphereMaterial>(*mFile, header.materials);
+	mNodes = ResolveSection<ArrayNode>(*mFile, header.nodes);
+	mAtomIndices = ResolveSection<uint32_t>(*mFile, header.atomIndices);
+	mCompactNodes = ResolveSection<CompactKDNode>(*mFile, header.compactNodes);
+	mCompactAtomIndices = ResolveSection<uint32_t>(*mFile, header.compactAtomIndices);
+	if (!mSpheres || !mMaterials || !mNodes || !mAtomIndices || !mCompactNodes || !mCompactAtomIndices)
+	{
+		std::cerr << "Corrupted scene cache " << cachePath << '\n';
+		return;
+	}
+
+	mSphereCount = header.spheres.count;
+	mMaterialCount = header.materials.count;
+	mNodeCount = header.nodes.count;
+	mAtomIndexCount = header.atomIndices.count;
+	mCompactNodeCount = header.compactNodes.count;
+	mCompactAtomIndexCount = header.compactAtomIndices.count;
+	mCompactBoxMin = header.compactBoxMin;
+	mCompactBoxMax = header.compactBoxMax;
+	mIsValid = true;
+}
+
+bool SceneCache::Write(const std::string& cachePath, uint64_t inputHash, const std::vector<Sphere>& spheres, const std::vector<SphereMaterial>& materials, const std::vector<ArrayNode>& nodes, const std::vector<uint32_t>& atomIndices, const CompactKDTree& compactTree)
+{
+	const auto& compactNodes = compactTree.GetNodes();
+	const auto& compactAtomIndices = compactTree.GetAtomIndices();
+
+	CacheHeader header = {};
+	std::memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+	header.version = Version;
+	header.inputHash = inputHash;
+	header.compactBoxMin = compactTree.GetBoxMin();
+	header.compactBoxMax = compactTree.GetBoxMax();
+
+	std::vector<char> layout(sizeof(CacheHeader));
+	header.spheres = AppendSection<Sphere>(layout, spheres.size());
+	header.materials = AppendSection<SphereMaterial>(layout, materials.size());
+	header.nodes = AppendSection<ArrayNode>(layout, nodes.size());
+	header.atomIndices = AppendSection<uint32_t>(layout, atomIndices.size());
+	header.compactNodes = AppendSection<CompactKDNode>(layout, compactNodes.size());
+	header.compactAtomIndices = AppendSection<uint32_t>(layout, compactAtomIndices.size());
+
+	std::memcpy(layout.data(), &header, sizeof(header));
+	std::memcpy(layout.data() + header.spheres.offset, spheres.data(), spheres.size() * sizeof(Sphere));
+	std::memcpy(layout.data() + header.materials.offset, materials.data(), materials.size() * sizeof(SphereMaterial));
+	std::memcpy(layout.data() + header.nodes.offset, nodes.data(), nodes.size() * sizeof(ArrayNode));
+	std::memcpy(layout.data() + header.atomIndices.offset, atomIndices.data(), atomIndices.size() * sizeof(uint32_t));
+	std::memcpy(layout.data() + header.compactNodes.offset, compactNodes.data(), compactNodes.size() * sizeof(CompactKDNode));
+	std::memcpy(layout.data() + header.compactAtomIndices.offset, compactAtomIndices.data(), compactAtomIndices.size() * sizeof(uint32_t));
+
+	// Write next to the destination and rename, so a crash never leaves a half-written cache behind
+	std::error_code error;
+	std::filesystem::path path(cachePath);
+	if (path.has_parent_path())
+	{
+		std::filesystem::create_directories(path.parent_path(), error);
+	}
+
+	const std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			std::cerr << "Could not write scene cache " << tempPath << '\n';
+			return false;
+		}
+
+		file.write(layout.data(), layout.size());
+		if (!file)
+		{
+			std::cerr << "Could not write scene cache " << tempPath << '\n';
+			return false;
+		}
+	}
+
+	std::filesystem::rename(tempPath, cachePath, error);
+	if (error)
+	{
+		std::cerr << "Could not write scene cache " << cachePath << ": " << error.message() << '\n';
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+
+	return true;
+}
+
+uint64_t SceneCache::HashInputs(const std::string& pdbPath, const std::string& xmlPath)
+{
+	ThreadPool pool;
+	uint64_t hash = Mix(0xCBF29CE484222325ull, Version);
+	for (const std::string& path : { pdbPath, xmlPath })
+	{
+		MappedFile file(path);
+		hash = Mix(hash, file.IsOpen() ? HashBytes(file.GetData(), file.GetSize(), pool) : 0);
+	}
+
+	return hash;
+}
+
+std::string SceneCache::GetCachePath(const std::string& pdbPath)
+{
+	return "cache/" + std::filesystem::path(pdbPath).stem().string() + ".pbrcache";
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Core/Base.h"
+#include "Core/MappedFile.h"
+#include "CompactKDTree.h"
+#include "Scene.h"
+
+// Read-only .pbrcache file. The sections are used in place from the mapped file, so they can be
+// handed to glBufferData without a copy
+class SceneCache
+{
+public:
+	// Bump whenever the layout of the file or of any stored record changes
+	static constexpr uint32_t Version = 7;
+public:
+	// The cache is only valid if it was written for exactly this input hash
+	SceneCache(const std::string& cachePath, uint64_t inputHash);
+
+	bool IsValid() const { return mIsValid; }
+
+	const Sphere* GetSpheres() const { return mSpheres; }
+	uint64_t GetSphereCount() const { return mSphereCount; }
+	const SphereMaterial* GetMaterials() const { return mMaterials; }
+	uint64_t GetMaterialCount() const { return mMaterialCount; }
+	const ArrayNode* GetNodes() const { return mNodes; }
+	uint64_t GetNodeCount() const { return mNodeCount; }
+	const uint32_t* GetAtomIndices() const { return mAtomIndices; }
+	uint64_t GetAtomIndexCount() const { return mAtomIndexCount; }
+	const CompactKDNode* GetCompactNodes() const { return mCompactNodes; }
+	uint64_t GetCompactNodeCount() const { return mCompactNodeCount; }
+	const uint32_t* GetCompactAtomIndices() const { return mCompactAtomIndices; }
+	uint64_t GetCompactAtomIndexCount() const { return mCompactAtomIndexCount; }
+	const glm::vec3& GetCompactBoxMin() const { return mCompactBoxMin; }
+	const glm::vec3& GetCompactBoxMax() const { return mCompactBoxMax; }
+public:
+	static bool Write(const std::string& cachePath, uint64_t inputHash, const std::vector<Sphere>& spheres, const std::vector<SphereMaterial>& materials, const std::vector<ArrayNode>& nodes, const std::vector<uint32_t>& atomIndices, const CompactKDTree& compactTree);
+
+	// Content hash of both inputs, the key a cache is valid for
+	static uint64_t HashInputs(const std::string& pdbPath, const std::string& xmlPath);
+	static std::string GetCachePath(const std::string& pdbPath);
+private:
+	Scope<MappedFile> mFile;
+	bool mIsValid = false;
+
+	const Sphere* mSpheres = nullptr;
+	uint64_t mSphereCount = 0;
+	const SphereMaterial* mMaterials = nullptr;
+	uint64_t mMaterialCount = 0;
+	const ArrayNode* mNodes = nullptr;
+	uint64_t mNodeCount = 0;
+	const uint32_t* mAtomIndices = nullptr;
+	uint64_t mAtomIndexCount = 0;
+	const CompactKDNode* mCompactNodes = nullptr;
+	uint64_t mCompactNodeCount = 0;
+	const uint32_t* mCompactAtomIndices = nullptr;
+	uint64_t mCompactAtomIndexCount = 0;
+	glm::vec3 mCompactBoxMin = glm::vec3(0.0f);
+	glm::vec3 mCompactBoxMax = glm::vec3(0.0f);
+};
@@ -0,0 +1,58 @@
+#include "Shading.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "EnvironmentLighting.h"
+
+static constexpr float Pi = 3.14159265358979f;
+
+// Below this the GGX lobe is narrower than the point light could ever hit
+static constexpr float MinRoughness = 0.045f;
+
+static glm::vec3 GetF0(const glm::vec3& albedo, const SphereMaterial& material)
+{
+	return glm::mix(glm::vec3(material.dielectricF0), albedo, material.metallic);
+}
+
+glm::vec3 EvaluateCookTorrance(const glm::vec3& albedo, const SphereMaterial& material, const glm::vec3& normal, const glm::vec3& view, const glm::vec3& light)
+{
+	const float NdotL = glm::dot(normal, light);
+	const float NdotV = glm::dot(normal, view);
+	if (NdotL <= 0.0f || NdotV <= 0.0f)
+		return glm::vec3(0.0f);
+
+	const glm::vec3 halfVector = glm::normalize(view + light);
+	const float NdotH = std::max(glm::dot(normal, halfVector), 0.0f);
+	const float VdotH = std::max(glm::dot(view, halfVector), 0.0f);
+
+	const float roughness = std::max(material.roughness, MinRoughness);
+	const float alpha = roughness * roughness;
+	const float alpha2 = alpha * alpha;
+	const float denominator = NdotH * NdotH * (alpha2 - 1.0f) + 1.0f;
+	const float distribution = alpha2 / (Pi * denominator * denominator);
+
+	// G / (4 N.L N.V) in one term, with the k Karis 2013 uses for analytic lights
+	const float k = (roughness + 1.0f) * (roughness + 1.0f) / 8.0f;
+	const float visibility = 1.0f / (4.0f * (NdotV * (1.0f - k) + k) * (NdotL * (1.0f - k) + k));
+
+	const float c = 1.0f - VdotH;
+	const glm::vec3 f0 = GetF0(albedo, material);
+	const glm::vec3 fresnel = f0 + (1.0f - f0) * (c * c * c * c * c);
+
+	const glm::vec3 diffuse = (1.0f - fresnel) * (1.0f - material.metallic) * albedo / Pi;
+	const glm::vec3 specular = fresnel * (distribution * visibility);
+	return (diffuse + specular) * NdotL;
+}
+
+glm::vec3 ShadeImageBased(const EnvironmentLighting& environment, const glm::vec3& albedo, const SphereMaterial& material, const glm::vec3& normal, const glm::vec3& view)
+{
+	const float NdotV = std::max(glm::dot(normal, view), 1e-4f);
+	const glm::vec2 brdf = environment.SampleBrdf(NdotV, material.roughness);
+	const glm::vec3 specularWeight = GetF0(albedo, material) * brdf.x + brdf.y;
+	const glm::vec3 specular = environment.SampleSpecular(glm::reflect(-view, normal), material.roughness) * specularWeight;
+
+	// The diffuse base gets the light the specular reflection leaves
+	const glm::vec3 diffuse = (1.0f - specularWeight) * (1.0f - material.metallic) * albedo * environment.EvaluateIrradiance(normal);
+	return diffuse + specular;
+}
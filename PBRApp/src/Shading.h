@@ -0,0 +1,18 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "Scene.h"
+
+class EnvironmentLighting;
+
+// Material shading of Raytrace.frag on the CPU, the reference the shader is checked against. All
+// vectors are normalized, view and light point away from the surface
+
+// Radiance leaving towards view per unit of radiance arriving from light, so the BRDF times N.L.
+// GGX distribution, the Smith-Schlick visibility of Karis 2013 and Schlick's Fresnel over a
+// Lambertian base. Metals have no base and tint the reflection with the albedo instead
+glm::vec3 EvaluateCookTorrance(const glm::vec3& albedo, const SphereMaterial& material, const glm::vec3& normal, const glm::vec3& view, const glm::vec3& light);
+
+// Split-sum image-based lighting of the same material, ShadeImageBased() of the shader
+glm::vec3 ShadeImageBased(const EnvironmentLighting& environment, const glm::vec3& albedo, const SphereMaterial& material, const glm::vec3& normal, const glm::vec3& view);
@@ -0,0 +1,54 @@
+#include "SpatialHashGrid.h"
+
+#include <algorithm>
+
+#include "Core/ThreadPool.h"
+
+// Spheres per task when the cells are found in parallel
+static constexpr uint32_t SpheresPerTask = 16384;
+
+SpatialHashGrid::SpatialHashGrid(const std::vector<glm::vec4>& spheres, float cellSize, ThreadPool* pool)
+	: mCellSize(cellSize), mInvCellSize(1.0f / cellSize)
+{
+	uint32_t bucketCount = 1;
+	while (bucketCount < 2 * spheres.size() && bucketCount < (1u << 31))
+		bucketCount <<= 1;
+	mBucketMask = bucketCount - 1;
+
+	std::vector<uint32_t> buckets(spheres.size());
+	std::vector<glm::ivec3> cells(spheres.size());
+	const auto findCells = [&](uint32_t task)
+	{
+		const size_t begin = static_cast<size_t>(task) * SpheresPerTask;
+		const size_t end = std::min(begin + SpheresPerTask, spheres.size());
+		for (size_t i = begin; i < end; ++i)
+		{
+			cells[i] = GetCell(glm::vec3(spheres[i]));
+			buckets[i] = GetBucket(cells[i]);
+		}
+	};
+
+	const uint32_t taskCount = static_cast<uint32_t>((spheres.size() + SpheresPerTask - 1) / SpheresPerTask);
+	if (pool)
+		pool->ParallelFor(taskCount, findCells);
+	else
+		for (uint32_t task = 0; task < taskCount; ++task)
+			findCells(task);
+
+	// Counting sort by bucket, stable so the order only depends on the input
+	mBucketStarts.assign(bucketCount + 1, 0);
+	for (uint32_t bucket : buckets)
+		++mBucketStarts[bucket + 1];
+	for (uint32_t i = 0; i < bucketCount; ++i)
+		mBucketStarts[i + 1] += mBucketStarts[i];
+
+	mEntries.resize(spheres.size());
+	std::vector<uint32_t> cursors(mBucketStarts.begin(), mBucketStarts.end() - 1);
+	for (size_t i = 0; i < spheres.size(); ++i)
+	{
+		Entry& entry = mEntries[cursors[buckets[i]]++];
+		entry.sphere = spheres[i];
+		entry.cell = cells[i];
+		entry.index = static_cast<uint32_t>(i);
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Uniform grid of cubic cells over a set of spheres, xyz = center and w = radius. Only occupied
+// cells cost memory: the cells are hashed into a table of about two buckets per sphere, and the
+// spheres are sorted by bucket so every bucket is one contiguous range. Neighbor lookups walk the
+// cells a box overlaps and skip the spheres of other cells that share their bucket
+class SpatialHashGrid
+{
+public:
+	struct Entry
+	{
+		glm::vec4 sphere;
+		glm::ivec3 cell;
+		uint32_t index; // Into the spheres the grid was built from
+	};
+public:
+	// cellSize is best about the largest query radius, so a query overlaps at most 27 cells. The
+	// cells are found in parallel on the pool if there is one
+	SpatialHashGrid(const std::vector<glm::vec4>& spheres, float cellSize, ThreadPool* pool = nullptr);
+
+	float GetCellSize() const { return mCellSize; }
+	uint64_t GetBucketCount() const { return mBucketStarts.size() - 1; }
+	const std::vector<Entry>& GetEntries() const { return mEntries; }
+
+	glm::ivec3 GetCell(const glm::vec3& position) const
+	{
+		return glm::ivec3(glm::floor(position * mInvCellSize));
+	}
+
+	// Calls func(const Entry&) for every sphere whose center lies in a cell the box overlaps, so
+	// every center inside the box and some around it. No allocations, spheres come in bucket order
+	template<typename Func>
+	void ForEachInBox(const glm::vec3& boxMin, const glm::vec3& boxMax, Func&& func) const
+	{
+		const glm::ivec3 cellMin = GetCell(boxMin);
+		const glm::ivec3 cellMax = GetCell(boxMax);
+		for (int z = cellMin.z; z <= cellMax.z; ++z)
+		{
+			for (int y = cellMin.y; y <= cellMax.y; ++y)
+			{
+				for (int x = cellMin.x; x <= cellMax.x; ++x)
+				{
+					const glm::ivec3 cell(x, y, z);
+					const uint32_t bucket = GetBucket(cell);
+					for (uint32_t i = mBucketStarts[bucket]; i < mBucketStarts[bucket + 1]; ++i)
+					{
+						const Entry& entry = mEntries[i];
+						if (entry.cell == cell)
+							func(entry);
+					}
+				}
+			}
+		}
+	}
+
+	// ForEachInBox() restricted to the centers within radius of the position
+	template<typename Func>
+	void ForEachInRadius(const glm::vec3& position, float radius, Func&& func) const
+	{
+		const float radius2 = radius * radius;
+		ForEachInBox(position - radius, position + radius, [&](const Entry& entry)
+		{
+			const glm::vec3 offset = glm::vec3(entry.sphere) - position;
+			if (glm::dot(offset, offset) <= radius2)
+				func(entry);
+		});
+	}
+private:
+	uint32_t GetBucket(const glm::ivec3& cell) const
+	{
+		const uint32_t hash = static_cast<uint32_t>(cell.x) * 73856093u ^ static_cast<uint32_t>(cell.y) * 19349663u ^ static_cast<uint32_t>(cell.z) * 83492791u;
+		return hash & mBucketMask;
+	}
+private:
+	float mCellSize = 1.0f;
+	float mInvCellSize = 1.0f;
+	uint32_t mBucketMask = 0;
+	std::vector<uint32_t> mBucketStarts; // Bucket count + 1 entries, bucket i owns [mBucketStarts[i], mBucketStarts[i + 1])
+	std::vector<Entry> mEntries;
+};
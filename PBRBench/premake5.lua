@@ -0,0 +1,73 @@
+project "PBRBench"
+	kind "ConsoleApp"
+	language "C++"
+	cppdialect "C++17"
+	staticruntime "on"
+
+	targetdir("%{wks.location}/bin/" .. outputdir .. "/%{prj.name}")
+	objdir("%{wks.location}/bin-int/" .. outputdir .. "/%{prj.name}")
+
+	debugdir "%{wks.location}/PBRApp"
+
+	-- 8-wide ray packets in RayCaster, 4-wide SSE packets without it
+	vectorextensions "AVX2"
+
+	defines
+	{
+		"_CRT_SECURE_NO_WARNINGS"
+	}
+
+	files
+	{
+		"src/**.h",
+		"src/**.cpp",
+
+		-- Window-less parts of the application under benchmark
+		"%{wks.location}/PBRApp/src/AmbientOcclusion.h",
+		"%{wks.location}/PBRApp/src/AmbientOcclusion.cpp",
+		"%{wks.location}/PBRApp/src/AtomLoader.h",
+		"%{wks.location}/PBRApp/src/AtomLoader.cpp",
+		"%{wks.location}/PBRApp/src/AtomKDTree.h",
+		"%{wks.location}/PBRApp/src/AtomKDTree.cpp",
+		"%{wks.location}/PBRApp/src/CompactKDTree.h",
+		"%{wks.location}/PBRApp/src/CompactKDTree.cpp",
+		"%{wks.location}/PBRApp/src/CpuRaytracer.h",
+		"%{wks.location}/PBRApp/src/CpuRaytracer.cpp",
+		"%{wks.location}/PBRApp/src/EnvironmentLighting.h",
+		"%{wks.location}/PBRApp/src/EnvironmentLighting.cpp",
+		"%{wks.location}/PBRApp/src/LinearBVH.h",
+		"%{wks.location}/PBRApp/src/LinearBVH.cpp",
+		"%{wks.location}/PBRApp/src/MolecularSurface.h",
+		"%{wks.location}/PBRApp/src/MolecularSurface.cpp",
+		"%{wks.location}/PBRApp/src/PDBGenerator.h",
+		"%{wks.location}/PBRApp/src/PDBGenerator.cpp",
+		"%{wks.location}/PBRApp/src/RayCaster.h",
+		"%{wks.location}/PBRApp/src/RayCaster.cpp",
+		"%{wks.location}/PBRApp/src/Scene.h",
+		"%{wks.location}/PBRApp/src/Scene.cpp",
+		"%{wks.location}/PBRApp/src/Shading.h",
+		"%{wks.location}/PBRApp/src/Shading.cpp",
+		"%{wks.location}/PBRApp/src/SpatialHashGrid.h",
+		"%{wks.location}/PBRApp/src/SpatialHashGrid.cpp",
+		"%{wks.location}/PBRApp/src/Core/MappedFile.h",
+		"%{wks.location}/PBRApp/src/Core/MappedFile.cpp",
+		"%{wks.location}/PBRApp/src/Core/ThreadPool.h",
+		"%{wks.location}/PBRApp/src/Core/ThreadPool.cpp",
+		"%{wks.location}/PBRApp/src/Core/Timer.h",
+		"%{wks.location}/PBRApp/vendor/stb_image/stb_image.h",
+		"%{wks.location}/PBRApp/vendor/stb_image/stb_image.cpp"
+	}
+
+	includedirs
+	{
+		"src",
+		"%{wks.location}/PBRApp/src",
+		"%{IncludeDir.glm}",
+		"%{IncludeDir.stb_image}"
+	}
+
+	filter "system:linux"
+		links
+		{
+			"pthread"
+		}
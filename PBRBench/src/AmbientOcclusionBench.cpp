@@ -0,0 +1,88 @@
+#include "Benchmarks.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "AmbientOcclusion.h"
+#include "AtomKDTree.h"
+#include "Harness.h"
+#include "Scene.h"
+
+// Blocked rays of one atom against every other sphere, the same test the bake runs on the leaves
+static uint32_t CountOccludedRays(const std::vector<Atom>& atoms, uint32_t atomIndex, const AmbientOcclusionSpecification& spec)
+{
+	const Atom& atom = atoms[atomIndex];
+	uint32_t blocked = 0;
+	for (uint32_t ray = 0; ray < spec.rayCount; ++ray)
+	{
+		const OcclusionRay occlusionRay = GetOcclusionRay(atom.position, atom.atomTemplate->radius, atomIndex, ray, spec.rayCount);
+		for (uint32_t other = 0; other < atoms.size(); ++other)
+		{
+			if (other == atomIndex)
+				continue;
+
+			const float radius = atoms[other].atomTemplate->radius;
+			const glm::vec3 toOrigin = occlusionRay.origin - atoms[other].position;
+			const float b = glm::dot(toOrigin, occlusionRay.direction);
+			const float discriminant = b * b - (glm::dot(toOrigin, toOrigin) - radius * radius);
+			if (discriminant < 0.0f)
+				continue;
+
+			const float root = std::sqrt(discriminant);
+			if (-b + root > 0.0f && -b - root < spec.maxDistance)
+			{
+				++blocked;
+				break;
+			}
+		}
+	}
+
+	return blocked;
+}
+
+static bool BenchmarkAmbientOcclusion(const std::vector<Atom>& atoms, const std::vector<Atom>& manyAtoms)
+{
+	bool valid = true;
+	AmbientOcclusionSpecification spec;
+	const AtomKDTree tree(atoms);
+	std::vector<Sphere> serialSpheres = CreateSpheres(atoms);
+	spec.threadCount = 1;
+	BakeAmbientOcclusion(tree, serialSpheres, spec);
+	for (uint32_t threadCount = 1; threadCount <= 16; threadCount *= 2)
+	{
+		spec.threadCount = threadCount;
+		std::vector<Sphere> spheres = CreateSpheres(atoms);
+		const AmbientOcclusionStatistics stats = BakeAmbientOcclusion(tree, spheres, spec);
+		valid &= std::memcmp(serialSpheres.data(), spheres.data(), spheres.size() * sizeof(Sphere)) == 0;
+		std::cout << "Ambient occlusion, " << stats.threadCount << " threads: " << stats.milliseconds << " ms, " << stats.GetAtomsPerSecond() / 1e3f << " k atoms/s, "
+			<< stats.GetMraysPerSecond() << " Mrays/s\n";
+	}
+
+	// The tree only prunes, every 64th atom has to block exactly the rays the brute force finds
+	double meanOcclusion = 0.0;
+	uint32_t mismatches = 0;
+	for (uint32_t i = 0; i < atoms.size(); ++i)
+	{
+		meanOcclusion += serialSpheres[i].occlusion / 65535.0;
+		if (i % 64 == 0)
+			mismatches += (static_cast<uint64_t>(CountOccludedRays(atoms, i, spec)) * 65535u + spec.rayCount / 2) / spec.rayCount != serialSpheres[i].occlusion;
+	}
+
+	meanOcclusion /= atoms.size();
+	std::cout << "  mean occlusion " << meanOcclusion << ", " << mismatches << " atoms differ from the brute force\n";
+	valid &= mismatches == 0 && meanOcclusion > 0.0 && meanOcclusion < 1.0;
+
+	const AtomKDTree manyTree(manyAtoms);
+	std::vector<Sphere> manySpheres = CreateSpheres(manyAtoms);
+	spec.threadCount = 0;
+	const AmbientOcclusionStatistics manyStats = BakeAmbientOcclusion(manyTree, manySpheres, spec);
+	std::cout << "  " << manyAtoms.size() << " atoms, " << manyStats.threadCount << " threads: " << manyStats.milliseconds << " ms, "
+		<< manyStats.GetAtomsPerSecond() / 1e3f << " k atoms/s, " << manyStats.GetMraysPerSecond() << " Mrays/s\n";
+	return valid;
+}
+
+bool RunAmbientOcclusionBenchmarks(const std::vector<Atom>& atoms, const std::vector<Atom>& manyAtoms)
+{
+	return ReportCheck("Ambient occlusion bake", BenchmarkAmbientOcclusion(atoms, manyAtoms));
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "AtomLoader.h"
+
+// One suite per feature under benchmark. Each prints its timings and the result of its checks,
+// and returns false if any check failed. manyAtoms is a copy grid of at least a million atoms
+
+bool RunLoaderBenchmarks(const std::string& pdbPath, const std::string& xmlPath, uint32_t iterations);
+bool RunKDTreeBenchmarks(const std::vector<Atom>& atoms);
+bool RunCpuRaytracerBenchmarks(const std::vector<Atom>& atoms);
+bool RunLinearBVHBenchmarks(const std::vector<Atom>& atoms, const std::vector<Atom>& manyAtoms, uint32_t iterations);
+bool RunRayCasterBenchmarks(const std::vector<Atom>& atoms, const std::vector<Atom>& manyAtoms);
+bool RunMaterialBenchmarks(const std::vector<Atom>& atoms);
+bool RunAmbientOcclusionBenchmarks(const std::vector<Atom>& atoms, const std::vector<Atom>& manyAtoms);
+bool RunKDTreeQueryBenchmarks(const std::vector<Atom>& atoms, const std::vector<Atom>& manyAtoms);
+bool RunMolecularSurfaceBenchmarks(const std::vector<Atom>& atoms, const std::vector<Atom>& manyAtoms);
+bool RunEnvironmentLightingBenchmarks(const std::string& hdrPath);
+
+// PBRBench --suite [xml] [--json path] [--max-atoms count] [--iterations count]
+// Every stage on the bundled molecule and on PDBGenerator structures of 10k atoms up to max-atoms, for
+// tracking regressions across commits. Returns 1 if a dataset could not be created
+int RunBenchmarkSuite(int argc, char** argv);
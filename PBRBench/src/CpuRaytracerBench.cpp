@@ -0,0 +1,356 @@
+#include "Benchmarks.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <utility>
+
+#include "CompactKDTree.h"
+#include "CpuRaytracer.h"
+#include "Harness.h"
+#include "Scene.h"
+#include "Core/Timer.h"
+
+// Frames of the CPU copy of Raytrace.frag from the default camera direction of MainLayer. Tiles
+// are independent, so any thread count has to produce the same image, and both walks of the
+// kd-tree find the closest hit, so they have to produce the same image too
+static bool BenchmarkCpuRaytracer(const std::vector<Atom>& atoms)
+{
+	const std::vector<Sphere> spheres = CreateSpheres(atoms);
+	const AtomKDTree tree(atoms);
+	const std::vector<ArrayNode> nodes = CreateArrayNodes(tree);
+	const CompactKDTree compactTree(atoms);
+
+	RaytraceScene scene;
+	scene.spheres = spheres.data();
+	scene.sphereCount = spheres.size();
+	scene.nodes = nodes.data();
+	scene.nodeCount = nodes.size();
+	scene.atomIndices = tree.GetAtomIndices().data();
+	scene.atomIndexCount = tree.GetAtomIndices().size();
+	const std::vector<int32_t> parentIndices = CreateParentIndices(nodes.data(), nodes.size());
+	scene.parentIndices = parentIndices.data();
+	scene.parentIndexCount = parentIndices.size();
+	scene.compactNodes = compactTree.GetNodes().data();
+	scene.compactNodeCount = compactTree.GetNodes().size();
+	scene.compactAtomIndices = compactTree.GetAtomIndices().data();
+	scene.compactAtomIndexCount = compactTree.GetAtomIndices().size();
+	scene.compactBoxMin = compactTree.GetBoxMin();
+	scene.compactBoxMax = compactTree.GetBoxMax();
+
+	const CpuCubemap cubemap({
+		"assets/textures/skybox/right.jpg",
+		"assets/textures/skybox/left.jpg",
+		"assets/textures/skybox/top.jpg",
+		"assets/textures/skybox/bottom.jpg",
+		"assets/textures/skybox/front.jpg",
+		"assets/textures/skybox/back.jpg"
+	});
+
+	constexpr uint32_t width = 640;
+	constexpr uint32_t height = 360;
+	CpuRaytracerSpecification spec;
+	const glm::mat4 invProjView = ComputeBenchmarkCamera(glm::vec3(nodes[0].boxMin), glm::vec3(nodes[0].boxMax), width, height, spec);
+
+	std::cout << "CPU raytracer, " << width << "x" << height << ", " << atoms.size() << " atoms:\n";
+	bool deterministic = true;
+	std::vector<glm::vec4> kdTreePixels, compactPixels;
+	for (bool compact : { false, true })
+	{
+		spec.useCompactKDTree = compact;
+		std::vector<glm::vec4> serialPixels, parallelPixels;
+		spec.threadCount = 1;
+		RenderCpuFrame(scene, cubemap, spec, invProjView, width, height, serialPixels);
+		spec.threadCount = 0;
+		RenderCpuFrame(scene, cubemap, spec, invProjView, width, height, parallelPixels);
+		deterministic &= std::memcmp(serialPixels.data(), parallelPixels.data(), serialPixels.size() * sizeof(glm::vec4)) == 0;
+
+		if (!compact)
+		{
+			kdTreePixels = std::move(serialPixels);
+			continue;
+		}
+
+		// Different trees put different leaves around the same spheres, only ties at the same
+		// distance could differ
+		size_t differentPixels = 0;
+		for (size_t i = 0; i < kdTreePixels.size(); ++i)
+			differentPixels += kdTreePixels[i] != serialPixels[i];
+		std::cout << "  " << 100.0f * differentPixels / kdTreePixels.size() << "% of the pixels differ between both trees\n";
+		compactPixels = std::move(serialPixels);
+	}
+
+	spec.useCompactKDTree = false;
+	spec.useParentLinks = true;
+	std::vector<glm::vec4> serialPixels, parallelPixels;
+	spec.threadCount = 1;
+	RenderCpuFrame(scene, cubemap, spec, invProjView, width, height, serialPixels);
+	spec.threadCount = 0;
+	RenderCpuFrame(scene, cubemap, spec, invProjView, width, height, parallelPixels);
+	deterministic &= std::memcmp(serialPixels.data(), parallelPixels.data(), serialPixels.size() * sizeof(glm::vec4)) == 0;
+	size_t differentPixels = 0;
+	for (size_t i = 0; i < compactPixels.size(); ++i)
+		differentPixels += compactPixels[i] != serialPixels[i];
+	std::cout << "  " << 100.0f * differentPixels / compactPixels.size() << "% of the pixels differ between the parent links and the compact kd-tree\n";
+	const bool walksAgree = std::memcmp(serialPixels.data(), kdTreePixels.data(), serialPixels.size() * sizeof(glm::vec4)) == 0;
+	if (!walksAgree)
+		std::cerr << "The stack and the parent link walks of the kd-tree render different images\n";
+	spec.useParentLinks = false;
+
+	// Primary rays in packets, what PBRRender does. The packet sphere test only rounds differently
+	spec.packetPrimaryRays = true;
+	spec.threadCount = 1;
+	RenderCpuFrame(scene, cubemap, spec, invProjView, width, height, serialPixels);
+	spec.threadCount = 0;
+	RenderCpuFrame(scene, cubemap, spec, invProjView, width, height, parallelPixels);
+	deterministic &= std::memcmp(serialPixels.data(), parallelPixels.data(), serialPixels.size() * sizeof(glm::vec4)) == 0;
+	size_t packetPixels = 0;
+	for (size_t i = 0; i < kdTreePixels.size(); ++i)
+		packetPixels += glm::length(glm::vec3(kdTreePixels[i] - serialPixels[i])) > 1e-3f;
+	std::cout << "  " << 100.0f * packetPixels / kdTreePixels.size() << "% of the pixels differ with packets of primary rays\n";
+	const bool packetsAgree = packetPixels * 1000 <= kdTreePixels.size();
+	if (!packetsAgree)
+		std::cerr << "Packets of primary rays render a different image than the scalar walk\n";
+	spec.packetPrimaryRays = false;
+
+	spec.shadows = true;
+	spec.threadCount = 1;
+	RenderCpuFrame(scene, cubemap, spec, invProjView, width, height, serialPixels);
+	spec.threadCount = 0;
+	RenderCpuFrame(scene, cubemap, spec, invProjView, width, height, parallelPixels);
+	deterministic &= std::memcmp(serialPixels.data(), parallelPixels.data(), serialPixels.size() * sizeof(glm::vec4)) == 0;
+	spec.shadows = false;
+
+	spec.maxDepth = 3;
+	std::vector<glm::vec4> pixels;
+	RenderCpuFrame(scene, cubemap, spec, invProjView, width, height, pixels);
+	return deterministic && walksAgree && packetsAgree;
+}
+
+static float ComputeRmsDifference(const std::vector<glm::vec4>& a, const std::vector<glm::vec4>& b)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		const glm::vec3 difference = glm::vec3(a[i]) - glm::vec3(b[i]);
+		sum += glm::dot(difference, difference);
+	}
+
+	return static_cast<float>(std::sqrt(sum / (3.0 * a.size())));
+}
+
+// Largest RMS difference of any tile, the noise a viewer notices first
+static float ComputeWorstTileRmsDifference(const std::vector<glm::vec4>& a, const std::vector<glm::vec4>& b, uint32_t width, uint32_t height, uint32_t tileSize)
+{
+	float worst = 0.0f;
+	for (uint32_t beginY = 0; beginY < height; beginY += tileSize)
+	{
+		for (uint32_t beginX = 0; beginX < width; beginX += tileSize)
+		{
+			const uint32_t endX = std::min(beginX + tileSize, width);
+			const uint32_t endY = std::min(beginY + tileSize, height);
+			double sum = 0.0;
+			for (uint32_t y = beginY; y < endY; ++y)
+			{
+				for (uint32_t x = beginX; x < endX; ++x)
+				{
+					const glm::vec3 difference = glm::vec3(a[y * width + x]) - glm::vec3(b[y * width + x]);
+					sum += glm::dot(difference, difference);
+				}
+			}
+
+			worst = std::max(worst, static_cast<float>(std::sqrt(sum / (3.0 * (endX - beginX) * (endY - beginY)))));
+		}
+	}
+
+	return worst;
+}
+
+// The progressive mode of Raytrace.frag on the CPU. Its first sample has to be the plain frame,
+// any thread count has to accumulate the same sums and more samples have to get closer to a
+// reference of many samples
+static bool BenchmarkProgressiveAccumulation(const std::vector<Atom>& atoms)
+{
+	const std::vector<Sphere> spheres = CreateSpheres(atoms);
+	const AtomKDTree tree(atoms);
+	const std::vector<ArrayNode> nodes = CreateArrayNodes(tree);
+
+	RaytraceScene scene;
+	scene.spheres = spheres.data();
+	scene.sphereCount = spheres.size();
+	scene.nodes = nodes.data();
+	scene.nodeCount = nodes.size();
+	scene.atomIndices = tree.GetAtomIndices().data();
+	scene.atomIndexCount = tree.GetAtomIndices().size();
+
+	const CpuCubemap cubemap({
+		"assets/textures/skybox/right.jpg",
+		"assets/textures/skybox/left.jpg",
+		"assets/textures/skybox/top.jpg",
+		"assets/textures/skybox/bottom.jpg",
+		"assets/textures/skybox/front.jpg",
+		"assets/textures/skybox/back.jpg"
+	});
+
+	constexpr uint32_t width = 160;
+	constexpr uint32_t height = 90;
+	constexpr uint32_t referenceSamples = 256;
+	CpuRaytracerSpecification spec;
+	spec.gammaCorrect = false;
+	const glm::mat4 invProjView = ComputeBenchmarkCamera(glm::vec3(nodes[0].boxMin), glm::vec3(nodes[0].boxMax), width, height, spec);
+
+	CpuRaytracer raytracer(scene, cubemap, spec);
+	std::vector<glm::vec4> frame, accumulation, resolved;
+	raytracer.Render(invProjView, width, height, frame);
+	raytracer.Accumulate(invProjView, width, height, 0, accumulation);
+	raytracer.ResolveAccumulation(accumulation, resolved);
+	bool valid = std::memcmp(frame.data(), resolved.data(), frame.size() * sizeof(glm::vec4)) == 0;
+
+	std::vector<glm::vec4> reference;
+	Timer timer;
+	for (uint32_t sample = 0; sample < referenceSamples; ++sample)
+		raytracer.Accumulate(invProjView, width, height, sample, reference);
+	const float referenceMs = timer.ElapsedNs() / 1e6f;
+
+	spec.threadCount = 1;
+	CpuRaytracer serialRaytracer(scene, cubemap, spec);
+	std::vector<glm::vec4> serialReference;
+	for (uint32_t sample = 0; sample < referenceSamples; ++sample)
+		serialRaytracer.Accumulate(invProjView, width, height, sample, serialReference);
+	valid &= std::memcmp(reference.data(), serialReference.data(), reference.size() * sizeof(glm::vec4)) == 0;
+
+	std::vector<glm::vec4> referenceColors;
+	raytracer.ResolveAccumulation(reference, referenceColors);
+
+	std::cout << "Progressive accumulation, " << width << "x" << height << ", " << atoms.size() << " atoms, " << referenceSamples << " sample reference in " << referenceMs << " ms:\n";
+	float lastError = std::numeric_limits<float>::max();
+	uint32_t samples = 0;
+	for (uint32_t targetSamples : { 1u, 4u, 16u, 64u })
+	{
+		for (; samples < targetSamples; ++samples)
+			raytracer.Accumulate(invProjView, width, height, samples, accumulation);
+
+		raytracer.ResolveAccumulation(accumulation, resolved);
+		const float error = ComputeRmsDifference(resolved, referenceColors);
+		std::cout << "  " << samples << " samples: RMS difference " << error << '\n';
+		valid &= error < lastError;
+		lastError = error;
+	}
+
+	return valid;
+}
+
+// Rays adaptive sampling needs to keep the noise of every tile below a target, measured against a
+// reference of many samples, compared to the uniform sample count that does the same. With
+// reflections and refractions in the image
+static bool BenchmarkAdaptiveSampling(const std::vector<Atom>& atoms)
+{
+	const std::vector<Sphere> spheres = CreateSpheres(atoms);
+	const AtomKDTree tree(atoms);
+	const std::vector<ArrayNode> nodes = CreateArrayNodes(tree);
+
+	RaytraceScene scene;
+	scene.spheres = spheres.data();
+	scene.sphereCount = spheres.size();
+	scene.nodes = nodes.data();
+	scene.nodeCount = nodes.size();
+	scene.atomIndices = tree.GetAtomIndices().data();
+	scene.atomIndexCount = tree.GetAtomIndices().size();
+
+	const CpuCubemap cubemap({
+		"assets/textures/skybox/right.jpg",
+		"assets/textures/skybox/left.jpg",
+		"assets/textures/skybox/top.jpg",
+		"assets/textures/skybox/bottom.jpg",
+		"assets/textures/skybox/front.jpg",
+		"assets/textures/skybox/back.jpg"
+	});
+
+	constexpr uint32_t width = 192;
+	constexpr uint32_t height = 108;
+	constexpr uint32_t referenceSamples = 1024;
+	constexpr uint32_t maxSamples = 256;
+	CpuRaytracerSpecification spec;
+	spec.gammaCorrect = false;
+	spec.maxDepth = 2;
+	const glm::mat4 invProjView = ComputeBenchmarkCamera(glm::vec3(nodes[0].boxMin), glm::vec3(nodes[0].boxMax), width, height, spec);
+
+	CpuRaytracer raytracer(scene, cubemap, spec);
+	std::vector<glm::vec4> reference, referenceColors;
+	for (uint32_t sample = 0; sample < referenceSamples; ++sample)
+		raytracer.Accumulate(invProjView, width, height, sample, reference);
+	raytracer.ResolveAccumulation(reference, referenceColors);
+
+	// A single sample is the plain frame, apart from the NaN pixels adaptive sampling leaves black
+	AdaptiveSamplingSpecification sampling;
+	sampling.maxSamples = 1;
+	std::vector<glm::vec4> frame, adaptive;
+	raytracer.Render(invProjView, width, height, frame);
+	raytracer.RenderAdaptive(invProjView, width, height, sampling, adaptive);
+	bool valid = true;
+	for (size_t i = 0; i < frame.size(); ++i)
+	{
+		if (!glm::any(glm::isnan(frame[i])))
+			valid &= std::memcmp(&frame[i], &adaptive[i], sizeof(glm::vec4)) == 0;
+	}
+
+	// Renders adaptively and prints the fewest uniform samples per pixel that leave no tile noisier
+	const auto compareToUniform = [&]()
+	{
+		const CpuRenderStatistics stats = raytracer.RenderAdaptive(invProjView, width, height, sampling, adaptive);
+		const float error = ComputeWorstTileRmsDifference(adaptive, referenceColors, width, height, spec.tileSize);
+
+		std::vector<glm::vec4> accumulation, uniform;
+		uint64_t uniformRays = 0;
+		uint32_t uniformSamples = 0;
+		float uniformError = std::numeric_limits<float>::max();
+		while (uniformError > error && uniformSamples < maxSamples)
+		{
+			uniformRays += raytracer.Accumulate(invProjView, width, height, uniformSamples++, accumulation).rayCount;
+			raytracer.ResolveAccumulation(accumulation, uniform);
+			uniformError = ComputeWorstTileRmsDifference(uniform, referenceColors, width, height, spec.tileSize);
+		}
+
+		std::cout << stats.milliseconds << " ms, " << static_cast<float>(stats.sampleCount) / (width * height) << " samples per pixel, "
+			<< stats.rayCount / 1e6f << " Mrays, worst tile RMS difference " << error << ", uniform needs " << uniformSamples << " samples per pixel and "
+			<< uniformRays / 1e6f << " Mrays, " << static_cast<float>(uniformRays) / stats.rayCount << "x the rays\n";
+		return std::make_pair(stats, error);
+	};
+
+	// The estimate of a tile is its 99th percentile pixel, so the RMS of every tile has to end up
+	// below the target
+	std::cout << "Adaptive sampling, " << width << "x" << height << ", depth " << spec.maxDepth << ", " << atoms.size() << " atoms, against " << referenceSamples << " samples:\n";
+	sampling.maxSamples = maxSamples;
+	for (float targetError : { 0.008f, 0.004f, 0.002f })
+	{
+		sampling.targetError = targetError;
+		std::cout << "  target " << targetError << ": ";
+		valid &= compareToUniform().second <= targetError;
+	}
+
+	// Without a target the whole budget goes to the noisiest tiles
+	sampling.targetError = 0.0f;
+	for (uint32_t sampleBudget : { 16u, 32u })
+	{
+		sampling.sampleBudget = sampleBudget;
+		std::cout << "  budget " << sampleBudget << ": ";
+		valid &= compareToUniform().first.sampleCount <= static_cast<uint64_t>(sampleBudget) * width * height;
+	}
+
+	spec.threadCount = 1;
+	CpuRaytracer serialRaytracer(scene, cubemap, spec);
+	std::vector<glm::vec4> serialAdaptive;
+	serialRaytracer.RenderAdaptive(invProjView, width, height, sampling, serialAdaptive);
+	valid &= std::memcmp(adaptive.data(), serialAdaptive.data(), adaptive.size() * sizeof(glm::vec4)) == 0;
+	return valid;
+}
+
+bool RunCpuRaytracerBenchmarks(const std::vector<Atom>& atoms)
+{
+	bool passed = ReportCheck("CPU raytracer determinism", BenchmarkCpuRaytracer(atoms));
+	passed &= ReportCheck("Progressive accumulation", BenchmarkProgressiveAccumulation(atoms));
+	passed &= ReportCheck("Adaptive sampling", BenchmarkAdaptiveSampling(atoms));
+	return passed;
+}
@@ -0,0 +1,126 @@
+#include "Benchmarks.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include <stb_image.h>
+
+#include "EnvironmentLighting.h"
+#include "Harness.h"
+#include "Shading.h"
+
+static bool SameEnvironmentLighting(const EnvironmentLighting& a, const EnvironmentLighting& b)
+{
+	if (a.GetIrradianceSH() != b.GetIrradianceSH() || a.GetSpecularLevels().size() != b.GetSpecularLevels().size()
+		|| a.GetBrdfTable().texels != b.GetBrdfTable().texels)
+	{
+		return false;
+	}
+
+	for (size_t level = 0; level < a.GetSpecularLevels().size(); ++level)
+	{
+		const std::vector<glm::vec4>& texelsA = a.GetSpecularLevels()[level].texels;
+		const std::vector<glm::vec4>& texelsB = b.GetSpecularLevels()[level].texels;
+		if (texelsA.size() != texelsB.size() || std::memcmp(texelsA.data(), texelsB.data(), texelsA.size() * sizeof(glm::vec4)) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+// Radiance leaving a white Lambertian surface, summed over every texel of the .hdr
+static glm::vec3 IntegrateIrradiance(const float* texels, int width, int height, const glm::vec3& normal)
+{
+	constexpr double pi = 3.14159265358979;
+	glm::dvec3 sum(0.0);
+	for (int y = 0; y < height; ++y)
+	{
+		const double theta = pi * (y + 0.5) / height;
+		const double solidAngle = 2.0 * pi / width * pi / height * std::sin(theta);
+		for (int x = 0; x < width; ++x)
+		{
+			const double phi = 2.0 * pi * ((x + 0.5) / width - 0.5);
+			const glm::dvec3 direction(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+			const double cosine = glm::dot(direction, glm::dvec3(normal));
+			if (cosine > 0.0)
+			{
+				const float* texel = texels + (static_cast<size_t>(y) * width + x) * 4;
+				sum += glm::dvec3(texel[0], texel[1], texel[2]) * (cosine * solidAngle);
+			}
+		}
+	}
+
+	return glm::vec3(sum / pi);
+}
+
+// Precompute time against the thread count and against the cache, and the result against brute force
+static bool BenchmarkEnvironmentLighting(const std::string& hdrPath)
+{
+	EnvironmentLightingSpecification spec;
+	spec.useCache = false;
+	spec.threadCount = 1;
+	const EnvironmentLighting serial(hdrPath, spec);
+	if (!serial.IsValid())
+		return false;
+
+	bool valid = true;
+	for (uint32_t threadCount = 1; threadCount <= 16; threadCount *= 2)
+	{
+		spec.threadCount = threadCount;
+		const EnvironmentLighting environment(hdrPath, spec);
+		const EnvironmentLightingStatistics& stats = environment.GetStatistics();
+		std::cout << "IBL precompute, " << threadCount << " threads: load " << stats.loadMilliseconds << " ms, irradiance " << stats.irradianceMilliseconds << " ms, specular "
+			<< stats.specularMilliseconds << " ms, BRDF " << stats.brdfMilliseconds << " ms\n";
+		valid &= SameEnvironmentLighting(serial, environment);
+	}
+
+	// Nine coefficients only keep the low frequencies, the sun of the .hdr rings a little
+	stbi_set_flip_vertically_on_load(0);
+	int width, height, channelCount;
+	float* texels = stbi_loadf(hdrPath.c_str(), &width, &height, &channelCount, 4);
+	if (!texels)
+		return false;
+
+	float worstError = 0.0f;
+	for (const glm::vec3& normal : { glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::normalize(glm::vec3(1.0f, 1.0f, 1.0f)) })
+	{
+		const glm::vec3 reference = IntegrateIrradiance(texels, width, height, normal);
+		const glm::vec3 irradiance = serial.EvaluateIrradiance(normal);
+		const float error = glm::length(irradiance - reference) / std::max(glm::length(reference), 1e-6f);
+		worstError = std::max(worstError, error);
+	}
+
+	stbi_image_free(texels);
+	std::cout << "SH irradiance against brute force: " << worstError * 100.0f << "% worst relative error\n";
+	valid &= worstError < 0.1f;
+
+	// Scale and bias stay within energy conservation, and a smooth surface seen head-on reflects F0
+	const EnvironmentImage& brdfTable = serial.GetBrdfTable();
+	float worstSum = 0.0f;
+	for (const glm::vec4& texel : brdfTable.texels)
+		worstSum = std::max(worstSum, texel.x + texel.y);
+	const glm::vec2 smooth = serial.SampleBrdf(1.0f, 0.0f);
+	std::cout << "BRDF table: largest scale + bias " << worstSum << ", smooth head-on " << smooth.x << " + " << smooth.y << '\n';
+	valid &= worstSum <= 1.01f && smooth.x > 0.9f && smooth.y < 0.05f;
+
+	// The first cached load writes the file, the second one reads it back
+	spec.useCache = true;
+	spec.threadCount = 0;
+	std::filesystem::remove(EnvironmentLighting::GetCachePath(hdrPath));
+	const EnvironmentLighting computed(hdrPath, spec);
+	const EnvironmentLighting cached(hdrPath, spec);
+	const EnvironmentLightingStatistics& computedStats = computed.GetStatistics();
+	const float computedMs = computedStats.loadMilliseconds + computedStats.irradianceMilliseconds + computedStats.specularMilliseconds + computedStats.brdfMilliseconds;
+	std::cout << "IBL cache: computed in " << computedMs << " ms, read back in " << cached.GetStatistics().loadMilliseconds << " ms\n";
+	valid &= !computedStats.fromCache && cached.GetStatistics().fromCache && SameEnvironmentLighting(computed, cached);
+	return valid;
+}
+
+bool RunEnvironmentLightingBenchmarks(const std::string& hdrPath)
+{
+	return ReportCheck("Image-based lighting precompute", BenchmarkEnvironmentLighting(hdrPath));
+}
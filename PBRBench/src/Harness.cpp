@@ -0,0 +1,87 @@
+#include "Harness.h"
+
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+std::vector<Atom> ReplicateAtoms(const std::vector<Atom>& atoms, size_t minCount)
+{
+	glm::vec3 boxMin(std::numeric_limits<float>::max()), boxMax(std::numeric_limits<float>::lowest());
+	for (const Atom& atom : atoms)
+	{
+		boxMin = glm::min(boxMin, atom.position);
+		boxMax = glm::max(boxMax, atom.position);
+	}
+
+	const uint32_t copies = static_cast<uint32_t>((minCount + atoms.size() - 1) / atoms.size());
+	const uint32_t side = static_cast<uint32_t>(std::ceil(std::cbrt(double(copies))));
+	const glm::vec3 spacing = boxMax - boxMin + glm::vec3(2.0f);
+
+	std::vector<Atom> replicated;
+	replicated.reserve(copies * atoms.size());
+	for (uint32_t copy = 0; copy < copies; ++copy)
+	{
+		const glm::vec3 offset = spacing * glm::vec3(float(copy % side), float(copy / side % side), float(copy / (side * side)));
+		for (const Atom& atom : atoms)
+		{
+			Atom copied = atom;
+			copied.position += offset;
+			copied.index = static_cast<uint32_t>(replicated.size());
+			replicated.push_back(copied);
+		}
+	}
+
+	return replicated;
+}
+
+glm::mat4 ComputeBenchmarkCamera(const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t width, uint32_t height, const CpuRaytracerSpecification& spec)
+{
+	const glm::vec3 center = 0.5f * (boxMin + boxMax);
+	const glm::vec3 eye = center + glm::vec3(0.0f, 0.0f, 1.2f * glm::length(boxMax - boxMin));
+	const glm::mat4 projection = glm::perspective(glm::radians(45.0f), float(width) / height, spec.nearPlane, spec.farPlane);
+	return glm::inverse(projection * glm::lookAt(eye, center, glm::vec3(0.0f, 1.0f, 0.0f)));
+}
+
+CpuRenderStatistics RenderCpuFrame(const RaytraceScene& scene, const CpuCubemap& cubemap, const CpuRaytracerSpecification& spec, const glm::mat4& invProjView,
+	uint32_t width, uint32_t height, std::vector<glm::vec4>& pixels)
+{
+	CpuRaytracer raytracer(scene, cubemap, spec);
+	const CpuRenderStatistics stats = raytracer.Render(invProjView, width, height, pixels);
+	std::cout << "  " << (spec.useCompactKDTree ? "compact kd-tree" : spec.useParentLinks ? "kd-tree parent links" : spec.packetPrimaryRays ? "kd-tree packets" : "kd-tree") << ", depth " << spec.maxDepth << ", " << stats.threadCount << " threads: "
+		<< stats.milliseconds << " ms, " << stats.rayCount / 1e6f << " Mrays, " << stats.GetMraysPerSecondPerCore() << " Mrays/s per core, "
+		<< stats.GetNodeVisitsPerRay() << " nodes and " << stats.GetSphereTestsPerRay() << " spheres per ray" << (spec.shadows ? " with shadows" : "") << '\n';
+	return stats;
+}
+
+std::vector<CpuRaytracer::Ray> GeneratePrimaryRays(const glm::mat4& invProjView, const CpuRaytracerSpecification& spec, uint32_t width, uint32_t height)
+{
+	std::vector<CpuRaytracer::Ray> rays;
+	rays.reserve(static_cast<size_t>(width) * height);
+	for (uint32_t blockY = 0; blockY < height; blockY += 2)
+	{
+		for (uint32_t blockX = 0; blockX < width; blockX += 4)
+		{
+			for (uint32_t y = blockY; y < std::min(blockY + 2, height); ++y)
+			{
+				for (uint32_t x = blockX; x < std::min(blockX + 4, width); ++x)
+				{
+					const glm::vec2 aPos((x + 0.5f) / width * 2.0f - 1.0f, 1.0f - (y + 0.5f) / height * 2.0f);
+					CpuRaytracer::Ray ray;
+					ray.origin = glm::vec3(invProjView * glm::vec4(aPos, -1.0f, 1.0f) * spec.nearPlane);
+					ray.dir = glm::normalize(glm::vec3(invProjView * glm::vec4(aPos * (spec.farPlane - spec.nearPlane), spec.farPlane + spec.nearPlane, spec.farPlane - spec.nearPlane)));
+					rays.push_back(ray);
+				}
+			}
+		}
+	}
+
+	return rays;
+}
+
+bool ReportCheck(const std::string& name, bool passed)
+{
+	std::cout << name << ": " << (passed ? "OK" : "FAILED") << '\n';
+	return passed;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "AtomLoader.h"
+#include "CpuRaytracer.h"
+#include "Scene.h"
+#include "Core/Timer.h"
+
+// Shared by the benchmarks: timing, the datasets they run on and the pass/fail report
+
+template<typename Func>
+float MeasureMedianMs(uint32_t iterations, Func&& func)
+{
+	std::vector<float> times(iterations);
+	for (float& ms : times)
+	{
+		Timer timer;
+		func();
+		ms = timer.ElapsedNs() / 1e6f;
+	}
+
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+// Copies of the molecule on a grid until there are at least minCount atoms
+std::vector<Atom> ReplicateAtoms(const std::vector<Atom>& atoms, size_t minCount);
+
+// uInvProjView of a camera on the +z side of the box looking at its center, the default direction
+// of the MainLayer camera
+glm::mat4 ComputeBenchmarkCamera(const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t width, uint32_t height, const CpuRaytracerSpecification& spec);
+
+// Camera rays of Raytrace.vert ordered in blocks of 4x2 pixels, so packets of 4 are rows and
+// packets of 8 whole blocks of neighbouring pixels
+std::vector<CpuRaytracer::Ray> GeneratePrimaryRays(const glm::mat4& invProjView, const CpuRaytracerSpecification& spec, uint32_t width, uint32_t height);
+
+// One frame of CpuRaytracer, printed with the walk and the depth it ran with
+CpuRenderStatistics RenderCpuFrame(const RaytraceScene& scene, const CpuCubemap& cubemap, const CpuRaytracerSpecification& spec, const glm::mat4& invProjView,
+	uint32_t width, uint32_t height, std::vector<glm::vec4>& pixels);
+
+// Prints the result of a check as "name: OK" or "name: FAILED" and returns it
+bool ReportCheck(const std::string& name, bool passed);
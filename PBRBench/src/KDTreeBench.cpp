@@ -0,0 +1,579 @@
+#include "Benchmarks.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include "AtomKDTree.h"
+#include "CompactKDTree.h"
+#include "Harness.h"
+#include "Scene.h"
+#include "Core/Timer.h"
+
+static const char* KDTreeBuilderName(KDTreeBuilder builder)
+{
+	switch (builder)
+	{
+		case KDTreeBuilder::MeanSplit: return "mean-split";
+		case KDTreeBuilder::SAH: return "sah";
+	}
+
+	return "unknown";
+}
+
+static float BenchmarkKDTreeBuilder(const std::vector<Atom>& atoms, const KDTreeSpecification& spec)
+{
+	Timer timer;
+	AtomKDTree tree(atoms, spec);
+	const float buildMs = timer.ElapsedNs() / 1e6f;
+
+	timer.Reset();
+	const std::vector<ArrayNode> kdTreeArray = CreateArrayNodes(tree);
+	const float flattenMs = timer.ElapsedNs() / 1e6f;
+
+	const KDTreeStatistics stats = tree.ComputeStatistics();
+	const size_t treeBytes = tree.GetNodes().size() * sizeof(KDTreeNode) + tree.GetAtomIndices().size() * sizeof(uint32_t);
+	std::cout << "KD-tree " << KDTreeBuilderName(spec.builder);
+	if (spec.builder == KDTreeBuilder::SAH)
+		std::cout << " (" << spec.sahBinCount << " bins)";
+	std::cout << ": " << buildMs << " ms, flatten " << flattenMs << " ms, " << treeBytes / 1024.0f << " KiB, SAH cost " << stats.sahCost
+		<< ", " << stats.nodeCount << " nodes, " << stats.leafCount << " leaves (" << stats.emptyLeafCount << " empty)"
+		<< ", atoms/leaf min " << stats.minLeafAtoms << " avg " << (stats.leafCount ? float(stats.leafAtomReferences) / stats.leafCount : 0.0f)
+		<< " max " << stats.maxLeafAtoms << ", depth " << stats.maxDepth << '\n';
+	return buildMs;
+}
+
+static void BenchmarkKDTreeScaling(const std::vector<Atom>& atoms, KDTreeBuilder builder)
+{
+	KDTreeSpecification spec;
+	spec.builder = builder;
+	spec.threadCount = 1;
+
+	std::cout << "KD-tree " << KDTreeBuilderName(builder) << " thread scaling:\n";
+	const float serialMs = BenchmarkKDTreeBuilder(atoms, spec);
+	for (uint32_t threadCount = 2; threadCount <= 16; threadCount *= 2)
+	{
+		spec.threadCount = threadCount;
+		const float parallelMs = BenchmarkKDTreeBuilder(atoms, spec);
+		std::cout << "  " << threadCount << " threads: " << serialMs / parallelMs << "x\n";
+	}
+}
+
+// The flat array the GPU consumes must not depend on how many threads built the tree
+static bool CheckParallelKDTreeDeterminism(const std::vector<Atom>& atoms, KDTreeBuilder builder, uint32_t threadCount)
+{
+	KDTreeSpecification spec;
+	spec.builder = builder;
+	spec.threadCount = 1;
+	const std::vector<ArrayNode> expected = CreateArrayNodes(AtomKDTree(atoms, spec));
+	spec.threadCount = threadCount;
+	const std::vector<ArrayNode> actual = CreateArrayNodes(AtomKDTree(atoms, spec));
+
+	if (expected.size() != actual.size() || std::memcmp(expected.data(), actual.data(), expected.size() * sizeof(ArrayNode)) != 0)
+	{
+		std::cerr << "KD-tree " << KDTreeBuilderName(builder) << " with " << threadCount << " threads differs from the serial build\n";
+		return false;
+	}
+
+	return true;
+}
+
+// A tight cluster far from the origin, where a float mean of the positions can land below every
+// atom. The mean-split builder must still stop instead of splitting the same atoms forever
+static bool CheckMeanSplitFarFromOrigin(const std::vector<Atom>& atoms)
+{
+	AtomTemplate atomTemplate = *atoms[0].atomTemplate;
+	atomTemplate.radius = 1.0f;
+	std::vector<Atom> cluster(35000, atoms[0]);
+	for (size_t i = 0; i < cluster.size(); ++i)
+	{
+		// R3 sequence over [9997, 9999]^3
+		const glm::vec3 fraction = glm::vec3(0.8191725f, 0.6710436f, 0.5497005f) * static_cast<float>(i);
+		cluster[i].position = glm::vec3(9997.0f) + 2.0f * (fraction - glm::floor(fraction));
+		cluster[i].atomTemplate = &atomTemplate;
+		cluster[i].index = static_cast<uint32_t>(i);
+	}
+
+	KDTreeSpecification spec;
+	spec.builder = KDTreeBuilder::MeanSplit;
+	const AtomKDTree tree(cluster, spec);
+	const KDTreeStatistics stats = tree.ComputeStatistics();
+	std::cout << "KD-tree mean-split far from the origin: " << stats.nodeCount << " nodes, depth " << stats.maxDepth << '\n';
+	return stats.leafAtomReferences == cluster.size() && stats.maxDepth <= AtomKDTree::MaxDepth;
+}
+
+struct BenchmarkRay
+{
+	glm::vec3 origin;
+	glm::vec3 dir;
+};
+
+// Pinhole views of the whole molecule from three sides
+static std::vector<BenchmarkRay> GenerateRays(const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t resolution)
+{
+	const glm::vec3 center = (boxMin + boxMax) * 0.5f;
+	const float radius = glm::length(boxMax - boxMin) * 0.5f;
+	const float tanHalfFov = 0.5f;
+
+	std::vector<BenchmarkRay> rays;
+	rays.reserve(3 * resolution * resolution);
+	for (const glm::vec3& side : { glm::vec3(1.0f, 0.3f, 0.2f), glm::vec3(-0.4f, 1.0f, 0.5f), glm::vec3(0.2f, -0.5f, -1.0f) })
+	{
+		const glm::vec3 origin = center + glm::normalize(side) * (radius / tanHalfFov);
+		const glm::vec3 forward = glm::normalize(center - origin);
+		const glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+		const glm::vec3 up = glm::cross(right, forward);
+		for (uint32_t y = 0; y < resolution; ++y)
+		{
+			for (uint32_t x = 0; x < resolution; ++x)
+			{
+				const float u = ((x + 0.5f) / resolution * 2.0f - 1.0f) * tanHalfFov;
+				const float v = ((y + 0.5f) / resolution * 2.0f - 1.0f) * tanHalfFov;
+				rays.push_back({ origin, glm::normalize(forward + right * u + up * v) });
+			}
+		}
+	}
+
+	return rays;
+}
+
+struct TraversalCounters
+{
+	uint64_t nodeFetches = 0;
+	uint64_t sphereTests = 0;
+	uint64_t hits = 0;
+};
+
+// tEntry is clamped to the ray origin, so rays starting inside a box enter it at 0
+static bool IntersectBox(const BenchmarkRay& ray, const glm::vec3& invDir, const glm::vec4& boxMin, const glm::vec4& boxMax, float& tEntry)
+{
+	const glm::vec3 tMin = (glm::vec3(boxMin) - ray.origin) * invDir;
+	const glm::vec3 tMax = (glm::vec3(boxMax) - ray.origin) * invDir;
+	const glm::vec3 t1 = glm::min(tMin, tMax);
+	const glm::vec3 t2 = glm::max(tMin, tMax);
+	const float tNear = std::max(std::max(t1.x, t1.y), t1.z);
+	const float tFar = std::min(std::min(t2.x, t2.y), t2.z);
+	tEntry = std::max(tNear, 0.0f);
+	return tNear <= tFar && tFar > 0.0f;
+}
+
+// The discriminant is taken from the distance of the sphere to the ray instead of b * b - c, which
+// cancels catastrophically for rays a thousand radii away and reorders nearby hits
+static bool IntersectSphere(const BenchmarkRay& ray, const Sphere& sphere, float& t)
+{
+	const glm::vec3 toOrigin = ray.origin - glm::vec3(sphere.position);
+	const float b = glm::dot(ray.dir, toOrigin);
+	const float c = glm::dot(toOrigin, toOrigin) - sphere.radius * sphere.radius;
+	const glm::vec3 toRay = toOrigin - b * ray.dir;
+	const float discriminant = sphere.radius * sphere.radius - glm::dot(toRay, toRay);
+	if (discriminant < 0.0f)
+		return false;
+
+	const float q = -b - std::copysign(std::sqrt(discriminant), b);
+	t = std::min(c / q, q);
+	return t > 0.0f;
+}
+
+// Spheres touching at the hit point are ordered by index, so every traversal picks the same one
+static bool IsCloserHit(float t, uint32_t sphereIndex, float closest, int hitIndex)
+{
+	return t < closest || (t == closest && static_cast<int>(sphereIndex) < hitIndex);
+}
+
+// Closest hit over the GPU buffers with the access pattern of Raytrace.frag: both child boxes are
+// fetched and tested at every interior node, leaves read their index range and the spheres
+static int TraceClosestHit(const BenchmarkRay& ray, const std::vector<ArrayNode>& nodes, const std::vector<uint32_t>& atomIndices, const std::vector<Sphere>& spheres, TraversalCounters& counters)
+{
+	const glm::vec3 invDir(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+	++counters.nodeFetches;
+	float rootEntry;
+	if (!IntersectBox(ray, invDir, nodes[0].boxMin, nodes[0].boxMax, rootEntry))
+		return -1;
+
+	float closest = std::numeric_limits<float>::max();
+	int hitIndex = -1;
+	std::pair<int, float> stack[AtomKDTree::TraversalStackSize];
+	int stackSize = 0;
+	stack[stackSize++] = { 0, rootEntry };
+	while (stackSize > 0)
+	{
+		const auto [index, entry] = stack[--stackSize];
+		if (entry > closest)
+			continue;
+
+		const ArrayNode& node = nodes[index];
+		if (node.childIndices[0] < 0)
+		{
+			for (int i = 0; i < node.childIndices[3]; ++i)
+			{
+				const uint32_t sphereIndex = atomIndices[node.childIndices[2] + i];
+				float t;
+				++counters.sphereTests;
+				if (IntersectSphere(ray, spheres[sphereIndex], t) && IsCloserHit(t, sphereIndex, closest, hitIndex))
+				{
+					closest = t;
+					hitIndex = static_cast<int>(sphereIndex);
+				}
+			}
+
+			continue;
+		}
+
+		counters.nodeFetches += 2;
+		const int left = node.childIndices[0];
+		const int right = node.childIndices[1];
+		float leftEntry, rightEntry;
+		const bool leftHit = IntersectBox(ray, invDir, nodes[left].boxMin, nodes[left].boxMax, leftEntry);
+		const bool rightHit = IntersectBox(ray, invDir, nodes[right].boxMin, nodes[right].boxMax, rightEntry);
+
+		// Far child first, so the near one is on top of the stack
+		if (leftHit && rightHit && leftEntry <= rightEntry)
+		{
+			stack[stackSize++] = { right, rightEntry };
+			stack[stackSize++] = { left, leftEntry };
+		}
+		else if (leftHit && rightHit)
+		{
+			stack[stackSize++] = { left, leftEntry };
+			stack[stackSize++] = { right, rightEntry };
+		}
+		else if (leftHit)
+		{
+			stack[stackSize++] = { left, leftEntry };
+		}
+		else if (rightHit)
+		{
+			stack[stackSize++] = { right, rightEntry };
+		}
+	}
+
+	if (hitIndex >= 0)
+		++counters.hits;
+	return hitIndex;
+}
+
+// TraverseKDTreeParentLinks of Raytrace.frag with exact sphere tests: no stack, the walk goes back
+// up over the parent links and visits the near child first
+static int TraceParentLinkClosestHit(const BenchmarkRay& ray, const std::vector<ArrayNode>& nodes, const std::vector<int32_t>& parentIndices, const std::vector<uint32_t>& atomIndices,
+	const std::vector<Sphere>& spheres, TraversalCounters& counters)
+{
+	const glm::vec3 invDir(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+	const auto nearChild = [&](int index)
+	{
+		const glm::ivec4& children = nodes[index].childIndices;
+		counters.nodeFetches += 2;
+		const glm::vec4 leftCenter = nodes[children.x].boxMin + nodes[children.x].boxMax;
+		const glm::vec4 rightCenter = nodes[children.y].boxMin + nodes[children.y].boxMax;
+		return glm::dot(glm::vec3(leftCenter - rightCenter), ray.dir) <= 0.0f ? children.x : children.y;
+	};
+	const auto sibling = [&](int index)
+	{
+		++counters.nodeFetches;
+		const glm::ivec4& children = nodes[parentIndices[index]].childIndices;
+		return children.x == index ? children.y : children.x;
+	};
+
+	enum class State { FromParent, FromSibling, FromChild };
+	float closest = std::numeric_limits<float>::max();
+	int hitIndex = -1;
+	int index = 0;
+	State state = State::FromParent;
+	while (true)
+	{
+		if (state == State::FromChild)
+		{
+			if (index == 0)
+				break;
+
+			const int parent = parentIndices[index];
+			if (index == nearChild(parent))
+			{
+				index = sibling(index);
+				state = State::FromSibling;
+			}
+			else
+			{
+				index = parent;
+			}
+
+			continue;
+		}
+
+		++counters.nodeFetches;
+		const ArrayNode& node = nodes[index];
+		float entry;
+		if (IntersectBox(ray, invDir, node.boxMin, node.boxMax, entry) && entry <= closest)
+		{
+			if (node.childIndices[0] >= 0)
+			{
+				index = nearChild(index);
+				state = State::FromParent;
+				continue;
+			}
+
+			for (int i = 0; i < node.childIndices[3]; ++i)
+			{
+				const uint32_t sphereIndex = atomIndices[node.childIndices[2] + i];
+				float t;
+				++counters.sphereTests;
+				if (IntersectSphere(ray, spheres[sphereIndex], t) && IsCloserHit(t, sphereIndex, closest, hitIndex))
+				{
+					closest = t;
+					hitIndex = static_cast<int>(sphereIndex);
+				}
+			}
+		}
+
+		if (index == 0)
+			break;
+
+		if (state == State::FromParent)
+		{
+			index = sibling(index);
+			state = State::FromSibling;
+		}
+		else
+		{
+			index = parentIndices[index];
+			state = State::FromChild;
+		}
+	}
+
+	if (hitIndex >= 0)
+		++counters.hits;
+	return hitIndex;
+}
+
+// GPU memory of both node layouts and closest-hit throughput over the resulting buffers
+static void BenchmarkLeafSizes(const std::vector<Atom>& atoms, KDTreeBuilder builder)
+{
+	const std::vector<Sphere> spheres = CreateSpheres(atoms);
+	std::cout << "Leaf sizes, KD-tree " << KDTreeBuilderName(builder) << ":\n";
+	for (uint32_t maxLeafAtoms : { 1u, 2u, 4u, 8u, 12u, 16u, 24u, 32u })
+	{
+		KDTreeSpecification spec;
+		spec.builder = builder;
+		spec.maxLeafAtoms = maxLeafAtoms;
+		const AtomKDTree tree(atoms, spec);
+		const std::vector<ArrayNode> nodes = CreateArrayNodes(tree);
+		const std::vector<uint32_t>& atomIndices = tree.GetAtomIndices();
+		const std::vector<BenchmarkRay> rays = GenerateRays(glm::vec3(nodes[0].boxMin), glm::vec3(nodes[0].boxMax), 256);
+
+		// The fixed layout had 12 index slots in every node and could not hold bigger leaves
+		const size_t gpuBytes = nodes.size() * sizeof(ArrayNode) + atomIndices.size() * sizeof(uint32_t);
+		const size_t fixedLayoutBytes = nodes.size() * (sizeof(ArrayNode) + 12 * sizeof(int));
+
+		TraversalCounters counters;
+		Timer timer;
+		for (const BenchmarkRay& ray : rays)
+			TraceClosestHit(ray, nodes, atomIndices, spheres, counters);
+		const float traceMs = timer.ElapsedNs() / 1e6f;
+
+		const double bytesPerRay = (double(counters.nodeFetches) * sizeof(ArrayNode) + double(counters.sphereTests) * (sizeof(uint32_t) + sizeof(Sphere))) / rays.size();
+		std::cout << "  " << maxLeafAtoms << " atoms/leaf: " << nodes.size() << " nodes, " << gpuBytes / 1024.0f << " KiB";
+		if (maxLeafAtoms <= 12)
+			std::cout << " (fixed slots " << fixedLayoutBytes / 1024.0f << " KiB)";
+		std::cout << ", " << rays.size() / (traceMs * 1e3f) << " Mrays/s, " << double(counters.nodeFetches) / rays.size() << " nodes and "
+			<< double(counters.sphereTests) / rays.size() << " spheres per ray, " << bytesPerRay << " bytes per ray, "
+			<< 100.0 * counters.hits / rays.size() << "% hits\n";
+	}
+}
+
+// Cells in front-to-back order with the ray interval clipped at every split plane, the CPU twin
+// of TraverseCompactKDTree in Raytrace.frag
+static int TraceCompactClosestHit(const BenchmarkRay& ray, const CompactKDTree& tree, const std::vector<Sphere>& spheres, TraversalCounters& counters)
+{
+	const glm::vec3 invDir(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+	const glm::vec3 t0 = (tree.GetBoxMin() - ray.origin) * invDir;
+	const glm::vec3 t1 = (tree.GetBoxMax() - ray.origin) * invDir;
+	const glm::vec3 tNear = glm::min(t0, t1);
+	const glm::vec3 tFar = glm::max(t0, t1);
+	float tMin = std::max(std::max(std::max(tNear.x, tNear.y), tNear.z), 0.0f);
+	float tMax = std::min(std::min(tFar.x, tFar.y), tFar.z);
+	if (tMin > tMax)
+		return -1;
+
+	struct Todo
+	{
+		uint32_t node;
+		float tMin, tMax;
+	};
+
+	const std::vector<CompactKDNode>& nodes = tree.GetNodes();
+	const std::vector<uint32_t>& atomIndices = tree.GetAtomIndices();
+	float closest = std::numeric_limits<float>::max();
+	int hitIndex = -1;
+	Todo todo[CompactKDTree::MaxDepth];
+	int todoCount = 0;
+	uint32_t index = 0;
+	while (closest >= tMin)
+	{
+		const CompactKDNode& node = nodes[index];
+		++counters.nodeFetches;
+		if (!node.IsLeaf())
+		{
+			const uint32_t axis = node.GetAxis();
+			const float split = node.GetSplit();
+			const float tPlane = (split - ray.origin[axis]) * invDir[axis];
+			const bool belowFirst = ray.origin[axis] < split || (ray.origin[axis] == split && ray.dir[axis] <= 0.0f);
+			const uint32_t first = belowFirst ? index + 1 : node.GetAboveChild();
+			const uint32_t second = belowFirst ? node.GetAboveChild() : index + 1;
+			if (tPlane > tMax || tPlane <= 0.0f)
+			{
+				index = first;
+			}
+			else if (tPlane < tMin)
+			{
+				index = second;
+			}
+			else
+			{
+				todo[todoCount++] = { second, tPlane, tMax };
+				index = first;
+				tMax = tPlane;
+			}
+
+			continue;
+		}
+
+		for (uint32_t i = 0; i < node.GetAtomCount(); ++i)
+		{
+			const uint32_t sphereIndex = atomIndices[node.GetAtomOffset() + i];
+			float t;
+			++counters.sphereTests;
+			if (IntersectSphere(ray, spheres[sphereIndex], t) && IsCloserHit(t, sphereIndex, closest, hitIndex))
+			{
+				closest = t;
+				hitIndex = static_cast<int>(sphereIndex);
+			}
+		}
+
+		if (todoCount == 0)
+			break;
+
+		const Todo& next = todo[--todoCount];
+		index = next.node;
+		tMin = next.tMin;
+		tMax = next.tMax;
+	}
+
+	if (hitIndex >= 0)
+		++counters.hits;
+	return hitIndex;
+}
+
+static void PrintTraversal(const char* name, size_t gpuBytes, float buildMs, const std::vector<BenchmarkRay>& rays, float traceMs, const TraversalCounters& counters, size_t nodeBytes)
+{
+	const double bytesPerRay = (double(counters.nodeFetches) * nodeBytes + double(counters.sphereTests) * (sizeof(uint32_t) + sizeof(Sphere))) / rays.size();
+	std::cout << "  " << name << ": build " << buildMs << " ms, " << gpuBytes / 1024.0f << " KiB, " << rays.size() / (traceMs * 1e3f) << " Mrays/s, "
+		<< double(counters.nodeFetches) / rays.size() << " nodes and " << double(counters.sphereTests) / rays.size() << " spheres per ray, "
+		<< bytesPerRay << " bytes per ray\n";
+}
+
+// Bytes fetched per ray by the box-per-child layout against the 8-byte kd-tree nodes. Both walks
+// find the exact closest hit, so they have to agree on every ray
+static bool BenchmarkNodeLayouts(const std::vector<Atom>& atoms)
+{
+	const std::vector<Sphere> spheres = CreateSpheres(atoms);
+	std::cout << "Node layouts, " << atoms.size() << " atoms:\n";
+
+	Timer timer;
+	const AtomKDTree tree(atoms);
+	const std::vector<ArrayNode> nodes = CreateArrayNodes(tree);
+	const float buildMs = timer.ElapsedNs() / 1e6f;
+	const std::vector<BenchmarkRay> rays = GenerateRays(glm::vec3(nodes[0].boxMin), glm::vec3(nodes[0].boxMax), 256);
+
+	std::vector<int> expectedHits(rays.size());
+	TraversalCounters counters;
+	timer.Reset();
+	for (size_t i = 0; i < rays.size(); ++i)
+		expectedHits[i] = TraceClosestHit(rays[i], nodes, tree.GetAtomIndices(), spheres, counters);
+	float traceMs = timer.ElapsedNs() / 1e6f;
+	PrintTraversal("ArrayNode (48 B, sah)", nodes.size() * sizeof(ArrayNode) + tree.GetAtomIndices().size() * sizeof(uint32_t), buildMs, rays, traceMs, counters, sizeof(ArrayNode));
+
+	bool agree = true;
+	{
+		timer.Reset();
+		const std::vector<int32_t> parentIndices = CreateParentIndices(nodes.data(), nodes.size());
+		const float parentsMs = timer.ElapsedNs() / 1e6f;
+
+		size_t mismatches = 0;
+		TraversalCounters parentCounters;
+		timer.Reset();
+		for (size_t i = 0; i < rays.size(); ++i)
+			mismatches += TraceParentLinkClosestHit(rays[i], nodes, parentIndices, tree.GetAtomIndices(), spheres, parentCounters) != expectedHits[i];
+		traceMs = timer.ElapsedNs() / 1e6f;
+
+		PrintTraversal("ArrayNode parent links, stackless", nodes.size() * (sizeof(ArrayNode) + sizeof(int32_t)) + tree.GetAtomIndices().size() * sizeof(uint32_t),
+			buildMs + parentsMs, rays, traceMs, parentCounters, sizeof(ArrayNode));
+		if (mismatches)
+			std::cout << "    " << mismatches << " rays disagree\n";
+		agree &= mismatches == 0;
+	}
+	for (uint32_t maxLeafAtoms : { 1u, 2u, 4u, 8u })
+	{
+		CompactKDTreeSpecification spec;
+		spec.maxLeafAtoms = maxLeafAtoms;
+		timer.Reset();
+		const CompactKDTree compactTree(atoms, spec);
+		const float compactBuildMs = timer.ElapsedNs() / 1e6f;
+
+		size_t mismatches = 0;
+		TraversalCounters compactCounters;
+		timer.Reset();
+		for (size_t i = 0; i < rays.size(); ++i)
+			mismatches += TraceCompactClosestHit(rays[i], compactTree, spheres, compactCounters) != expectedHits[i];
+		traceMs = timer.ElapsedNs() / 1e6f;
+
+		const KDTreeStatistics stats = compactTree.ComputeStatistics();
+		const std::string name = "CompactKDNode (8 B, " + std::to_string(maxLeafAtoms) + " atoms/leaf)";
+		PrintTraversal(name.c_str(), compactTree.GetNodes().size() * sizeof(CompactKDNode) + compactTree.GetAtomIndices().size() * sizeof(uint32_t),
+			compactBuildMs, rays, traceMs, compactCounters, sizeof(CompactKDNode));
+		std::cout << "    " << stats.nodeCount << " nodes, " << stats.leafCount << " leaves (" << stats.emptyLeafCount << " empty), "
+			<< float(stats.leafAtomReferences) / atoms.size() << " references per atom, depth " << stats.maxDepth;
+		if (mismatches)
+			std::cout << ", " << mismatches << " rays disagree";
+		std::cout << '\n';
+		agree &= mismatches == 0;
+	}
+
+	return agree;
+}
+
+bool RunKDTreeBenchmarks(const std::vector<Atom>& atoms)
+{
+	// Build time against expected traversal cost of both builders
+	KDTreeSpecification treeSpec;
+	treeSpec.builder = KDTreeBuilder::MeanSplit;
+	BenchmarkKDTreeBuilder(atoms, treeSpec);
+	treeSpec.builder = KDTreeBuilder::SAH;
+	for (uint32_t binCount : { 16u, 32u })
+	{
+		treeSpec.sahBinCount = binCount;
+		BenchmarkKDTreeBuilder(atoms, treeSpec);
+	}
+
+	BenchmarkLeafSizes(atoms, KDTreeBuilder::MeanSplit);
+	BenchmarkLeafSizes(atoms, KDTreeBuilder::SAH);
+
+	bool passed = ReportCheck("Node layout closest hits", BenchmarkNodeLayouts(atoms));
+
+	BenchmarkKDTreeScaling(atoms, KDTreeBuilder::MeanSplit);
+	BenchmarkKDTreeScaling(atoms, KDTreeBuilder::SAH);
+
+	bool treesDeterministic = true;
+	for (KDTreeBuilder builder : { KDTreeBuilder::MeanSplit, KDTreeBuilder::SAH })
+	{
+		for (uint32_t threadCount = 2; threadCount <= 16; threadCount *= 2)
+		{
+			treesDeterministic &= CheckParallelKDTreeDeterminism(atoms, builder, threadCount);
+		}
+	}
+
+	passed &= ReportCheck("Parallel KD-tree determinism", treesDeterministic);
+	passed &= ReportCheck("Mean-split cluster far from the origin", CheckMeanSplitFarFromOrigin(atoms));
+	return passed;
+}
@@ -0,0 +1,172 @@
+#include "Benchmarks.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "AtomKDTree.h"
+#include "Harness.h"
+#include "Core/ThreadPool.h"
+
+static bool IsNearerNeighbor(const AtomNeighbor& a, const AtomNeighbor& b)
+{
+	return a.distance2 < b.distance2 || (a.distance2 == b.distance2 && a.atomIndex < b.atomIndex);
+}
+
+static bool IsPairBefore(const AtomPair& a, const AtomPair& b)
+{
+	return a.first < b.first || (a.first == b.first && a.second < b.second);
+}
+
+static bool SameNeighborLists(const AtomNeighborLists& a, const AtomNeighborLists& b)
+{
+	return a.offsets == b.offsets && a.atomIndices == b.atomIndices;
+}
+
+static bool SameNeighbors(const std::vector<AtomNeighbor>& a, const std::vector<AtomNeighbor>& b)
+{
+	return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(AtomNeighbor)) == 0;
+}
+
+static bool SamePairs(const std::vector<AtomPair>& a, const std::vector<AtomPair>& b)
+{
+	return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(AtomPair)) == 0;
+}
+
+// Radius, k-nearest and overlap queries of both builders against brute force over the atoms, and
+// the batched variants against themselves on 1 to 16 threads. Atom::index equals the position in
+// the vector for loaded atoms, the brute force relies on that
+static bool BenchmarkKDTreeQueries(const std::vector<Atom>& atoms, const std::vector<Atom>& manyAtoms)
+{
+	// Every 7th atom center and a point next to it, so some queries start inside atoms and some between them
+	std::vector<glm::vec3> positions;
+	for (size_t i = 0; i < atoms.size(); i += 7)
+	{
+		positions.push_back(atoms[i].position);
+		positions.push_back(atoms[i].position + glm::vec3(0.7f, -0.4f, 1.1f));
+	}
+
+	bool valid = true;
+	uint64_t mismatches = 0;
+	for (KDTreeBuilder builder : { KDTreeBuilder::SAH, KDTreeBuilder::MeanSplit })
+	{
+		KDTreeSpecification treeSpec;
+		treeSpec.builder = builder;
+		const AtomKDTree tree(atoms, treeSpec);
+
+		for (float radius : { 0.0f, 2.0f, 6.0f })
+		{
+			AtomNeighborLists lists;
+			tree.FindInRadius(positions, radius, lists);
+			for (size_t i = 0; i < positions.size(); ++i)
+			{
+				std::vector<uint32_t> found(lists.atomIndices.begin() + lists.offsets[i], lists.atomIndices.begin() + lists.offsets[i + 1]);
+				std::sort(found.begin(), found.end());
+
+				std::vector<uint32_t> expected;
+				for (const Atom& atom : atoms)
+				{
+					const glm::vec3 offset = atom.position - positions[i];
+					if (glm::dot(offset, offset) <= radius * radius)
+						expected.push_back(atom.index);
+				}
+
+				mismatches += found != expected;
+			}
+
+			for (uint32_t threadCount = 2; threadCount <= 16; threadCount *= 2)
+			{
+				ThreadPool pool(threadCount);
+				AtomNeighborLists parallelLists;
+				tree.FindInRadius(positions, radius, parallelLists, &pool);
+				valid &= SameNeighborLists(lists, parallelLists);
+			}
+		}
+
+		for (uint32_t k : { 1u, 8u, 40u })
+		{
+			std::vector<AtomNeighbor> neighbors;
+			tree.FindNearest(positions, k, neighbors);
+			std::vector<AtomNeighbor> expected(atoms.size());
+			for (size_t i = 0; i < positions.size(); ++i)
+			{
+				for (const Atom& atom : atoms)
+				{
+					const glm::vec3 offset = atom.position - positions[i];
+					expected[atom.index] = { atom.index, glm::dot(offset, offset) };
+				}
+
+				std::partial_sort(expected.begin(), expected.begin() + k, expected.end(), IsNearerNeighbor);
+				mismatches += std::memcmp(neighbors.data() + i * k, expected.data(), k * sizeof(AtomNeighbor)) != 0;
+			}
+
+			for (uint32_t threadCount = 2; threadCount <= 16; threadCount *= 2)
+			{
+				ThreadPool pool(threadCount);
+				std::vector<AtomNeighbor> parallelNeighbors;
+				tree.FindNearest(positions, k, parallelNeighbors, &pool);
+				valid &= SameNeighbors(neighbors, parallelNeighbors);
+			}
+		}
+
+		// Touching van der Waals spheres and clashes of more than 0.4
+		for (float margin : { 0.0f, -0.4f })
+		{
+			std::vector<AtomPair> pairs;
+			tree.FindOverlappingPairs(margin, pairs);
+			for (uint32_t threadCount = 2; threadCount <= 16; threadCount *= 2)
+			{
+				ThreadPool pool(threadCount);
+				std::vector<AtomPair> parallelPairs;
+				tree.FindOverlappingPairs(margin, parallelPairs, &pool);
+				valid &= SamePairs(pairs, parallelPairs);
+			}
+
+			std::vector<AtomPair> expected;
+			for (uint32_t i = 0; i < atoms.size(); ++i)
+			{
+				for (uint32_t j = i + 1; j < atoms.size(); ++j)
+				{
+					const glm::vec3 offset = atoms[j].position - atoms[i].position;
+					const float contact = atoms[i].atomTemplate->radius + atoms[j].atomTemplate->radius + margin;
+					if (contact > 0.0f && glm::dot(offset, offset) < contact * contact)
+						expected.push_back({ i, j });
+				}
+			}
+
+			std::sort(pairs.begin(), pairs.end(), IsPairBefore);
+			mismatches += !SamePairs(pairs, expected);
+			if (builder == KDTreeBuilder::SAH)
+				std::cout << "KD-tree overlap pairs, margin " << margin << ": " << pairs.size() << '\n';
+		}
+	}
+
+	std::cout << "KD-tree queries: " << positions.size() << " positions, " << mismatches << " results differ from the brute force\n";
+	valid &= mismatches == 0;
+
+	// At scale, one query per atom: its bonded neighborhood, its 8 nearest atoms and all clashes
+	const AtomKDTree manyTree(manyAtoms);
+	std::vector<glm::vec3> manyPositions(manyAtoms.size());
+	for (size_t i = 0; i < manyAtoms.size(); ++i)
+		manyPositions[i] = manyAtoms[i].position;
+
+	for (uint32_t threadCount : { 1u, 0u })
+	{
+		ThreadPool pool(threadCount);
+		AtomNeighborLists lists;
+		const float radiusMs = MeasureMedianMs(3, [&]() { manyTree.FindInRadius(manyPositions, 2.0f, lists, &pool); });
+		std::vector<AtomNeighbor> neighbors;
+		const float nearestMs = MeasureMedianMs(3, [&]() { manyTree.FindNearest(manyPositions, 8, neighbors, &pool); });
+		std::vector<AtomPair> pairs;
+		const float pairsMs = MeasureMedianMs(3, [&]() { manyTree.FindOverlappingPairs(-0.4f, pairs, &pool); });
+		std::cout << "  " << manyAtoms.size() << " atoms, " << pool.GetThreadCount() << " threads: radius 2 " << radiusMs << " ms (" << lists.atomIndices.size() << " atoms), 8 nearest "
+			<< nearestMs << " ms, clashes " << pairsMs << " ms (" << pairs.size() << " pairs), " << manyAtoms.size() / (nearestMs * 1e3f) << " M nearest queries/s\n";
+	}
+
+	return valid;
+}
+
+bool RunKDTreeQueryBenchmarks(const std::vector<Atom>& atoms, const std::vector<Atom>& manyAtoms)
+{
+	return ReportCheck("KD-tree radius, k-nearest and overlap queries", BenchmarkKDTreeQueries(atoms, manyAtoms));
+}
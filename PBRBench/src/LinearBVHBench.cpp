@@ -0,0 +1,198 @@
+#include "Benchmarks.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "AtomKDTree.h"
+#include "Harness.h"
+#include "LinearBVH.h"
+#include "Scene.h"
+#include "Core/Timer.h"
+
+// Expected cost of a ray hitting the root box, same model as KDTreeStatistics::sahCost
+static float ComputeArrayNodesSAHCost(const std::vector<ArrayNode>& nodes, int index, float rootArea)
+{
+	const ArrayNode& node = nodes[index];
+	const glm::vec3 extent = glm::max(glm::vec3(node.boxMax - node.boxMin), glm::vec3(0.0f));
+	const float area = 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+	const float probability = rootArea > 0.0f ? area / rootArea : 1.0f;
+	if (node.childIndices[0] < 0)
+		return probability * node.childIndices[3] * AtomKDTree::IntersectionCost;
+
+	return probability * AtomKDTree::TraversalCost
+		+ ComputeArrayNodesSAHCost(nodes, node.childIndices[0], rootArea)
+		+ ComputeArrayNodesSAHCost(nodes, node.childIndices[1], rootArea);
+}
+
+// Every atom in exactly one leaf, inside the leaf box, and every box inside its parent
+static bool ValidateArrayNodes(const std::vector<Atom>& atoms, const std::vector<ArrayNode>& nodes, const std::vector<uint32_t>& atomIndices)
+{
+	std::vector<uint32_t> references(atoms.size(), 0);
+	std::vector<int> stack = { 0 };
+	while (!stack.empty())
+	{
+		const ArrayNode& node = nodes[stack.back()];
+		stack.pop_back();
+		if (node.childIndices[0] < 0)
+		{
+			for (int i = 0; i < node.childIndices[3]; ++i)
+			{
+				const uint32_t atomIndex = atomIndices[node.childIndices[2] + i];
+				const Atom& atom = atoms[atomIndex];
+				const glm::vec3 radius(atom.atomTemplate->radius);
+				++references[atomIndex];
+				if (glm::any(glm::lessThan(atom.position - radius, glm::vec3(node.boxMin))) || glm::any(glm::greaterThan(atom.position + radius, glm::vec3(node.boxMax))))
+					return false;
+			}
+
+			continue;
+		}
+
+		for (int c = 0; c < 2; ++c)
+		{
+			const ArrayNode& child = nodes[node.childIndices[c]];
+			if (glm::any(glm::lessThan(child.boxMin, node.boxMin)) || glm::any(glm::greaterThan(child.boxMax, node.boxMax)))
+				return false;
+			stack.push_back(node.childIndices[c]);
+		}
+	}
+
+	for (uint32_t count : references)
+	{
+		if (count != 1)
+			return false;
+	}
+
+	return true;
+}
+
+// The first build allocates, the rebuilds after it are what a per-frame update costs
+static float BenchmarkLinearBVH(const std::vector<Atom>& atoms, const LinearBVHSpecification& spec, uint32_t iterations, bool& valid)
+{
+	LinearBVH bvh(spec);
+	Timer timer;
+	bvh.Build(atoms);
+	const float firstMs = timer.ElapsedNs() / 1e6f;
+
+	timer.Reset();
+	for (uint32_t i = 0; i < iterations; ++i)
+		bvh.Build(atoms);
+	const float rebuildMs = timer.ElapsedNs() / 1e6f / iterations;
+
+	const std::vector<ArrayNode>& nodes = bvh.GetNodes();
+	const glm::vec3 rootExtent = glm::vec3(nodes[0].boxMax - nodes[0].boxMin);
+	const float rootArea = 2.0f * (rootExtent.x * rootExtent.y + rootExtent.y * rootExtent.z + rootExtent.z * rootExtent.x);
+	const bool nodesValid = ValidateArrayNodes(atoms, nodes, bvh.GetAtomIndices());
+	valid &= nodesValid;
+
+	std::cout << "LBVH " << (spec.use63BitMortonCodes ? 63 : 30) << "-bit, " << spec.maxLeafAtoms << " atoms/leaf, "
+		<< spec.threadCount << " threads, " << atoms.size() << " atoms: first " << firstMs << " ms, rebuild " << rebuildMs
+		<< " ms (" << atoms.size() / (rebuildMs * 1e3f) << " Matoms/s), SAH cost " << ComputeArrayNodesSAHCost(nodes, 0, rootArea)
+		<< ", " << nodes.size() << " nodes" << (nodesValid ? "" : ", INVALID") << '\n';
+	return rebuildMs;
+}
+
+static bool CheckParallelLinearBVHDeterminism(const std::vector<Atom>& atoms, uint32_t threadCount)
+{
+	LinearBVHSpecification spec;
+	spec.threadCount = 1;
+	LinearBVH expected(spec);
+	expected.Build(atoms);
+	spec.threadCount = threadCount;
+	LinearBVH actual(spec);
+	actual.Build(atoms);
+
+	const std::vector<ArrayNode>& a = expected.GetNodes();
+	const std::vector<ArrayNode>& b = actual.GetNodes();
+	if (a.size() != b.size() || std::memcmp(a.data(), b.data(), a.size() * sizeof(ArrayNode)) != 0 || expected.GetAtomIndices() != actual.GetAtomIndices())
+	{
+		std::cerr << "LBVH with " << threadCount << " threads differs from the serial build\n";
+		return false;
+	}
+
+	return true;
+}
+
+// One atom for every bit of the 63-bit codes and a pile of duplicates at the origin. The radix
+// tree over them is far deeper than AtomKDTree::MaxDepth, the emitted nodes must not be
+static bool CheckLinearBVHDepthLimit(const std::vector<Atom>& atoms)
+{
+	const float gridMax = static_cast<float>((1 << 21) - 1);
+	std::vector<Atom> chain(1, atoms[0]);
+	chain[0].position = glm::vec3(gridMax);
+	for (int bit = 0; bit < 21; ++bit)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			Atom atom = atoms[0];
+			atom.position = glm::vec3(0.0f);
+			atom.position[axis] = static_cast<float>(1 << bit);
+			chain.push_back(atom);
+		}
+	}
+
+	Atom duplicate = atoms[0];
+	duplicate.position = glm::vec3(0.0f);
+	chain.resize(chain.size() + (1 << 16), duplicate);
+	for (size_t i = 0; i < chain.size(); ++i)
+		chain[i].index = static_cast<uint32_t>(i);
+
+	LinearBVHSpecification spec;
+	spec.use63BitMortonCodes = true;
+	spec.maxLeafAtoms = 1;
+	LinearBVH bvh(spec);
+	bvh.Build(chain);
+
+	const std::vector<ArrayNode>& nodes = bvh.GetNodes();
+	uint32_t maxDepth = 0;
+	std::vector<std::pair<int, uint32_t>> stack = { { 0, 0 } };
+	while (!stack.empty())
+	{
+		const auto [index, depth] = stack.back();
+		stack.pop_back();
+		maxDepth = std::max(maxDepth, depth);
+		if (nodes[index].childIndices[0] >= 0)
+		{
+			stack.push_back({ nodes[index].childIndices[0], depth + 1 });
+			stack.push_back({ nodes[index].childIndices[1], depth + 1 });
+		}
+	}
+
+	std::cout << "LBVH of a 63-bit code chain over duplicates: " << nodes.size() << " nodes, depth " << maxDepth << '\n';
+	return maxDepth <= AtomKDTree::MaxDepth && ValidateArrayNodes(chain, nodes, bvh.GetAtomIndices());
+}
+
+bool RunLinearBVHBenchmarks(const std::vector<Atom>& atoms, const std::vector<Atom>& manyAtoms, uint32_t iterations)
+{
+	// Per-frame rebuilds, on the molecule and on the copy grid
+	bool valid = true;
+	for (const std::vector<Atom>* benchmarkAtoms : { &atoms, &manyAtoms })
+	{
+		LinearBVHSpecification spec;
+		for (bool wide : { false, true })
+		{
+			spec.use63BitMortonCodes = wide;
+			for (uint32_t maxLeafAtoms : { 1u, 4u, 12u })
+			{
+				spec.maxLeafAtoms = maxLeafAtoms;
+				BenchmarkLinearBVH(*benchmarkAtoms, spec, iterations, valid);
+			}
+		}
+
+		spec.maxLeafAtoms = 4;
+		spec.use63BitMortonCodes = false;
+		for (uint32_t threadCount = 1; threadCount <= 16; threadCount *= 2)
+		{
+			spec.threadCount = threadCount;
+			BenchmarkLinearBVH(*benchmarkAtoms, spec, iterations, valid);
+		}
+
+		for (uint32_t threadCount = 2; threadCount <= 16; threadCount *= 2)
+			valid &= CheckParallelLinearBVHDeterminism(*benchmarkAtoms, threadCount);
+	}
+
+	valid &= CheckLinearBVHDepthLimit(atoms);
+	return ReportCheck("LBVH validity and determinism", valid);
+}
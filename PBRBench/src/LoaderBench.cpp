@@ -0,0 +1,100 @@
+#include "Benchmarks.h"
+
+#include <iostream>
+#include <string>
+
+#include "AtomLoader.h"
+#include "Harness.h"
+#include "Core/Timer.h"
+
+static const char* PDBParserName(PDBParser parser)
+{
+	switch (parser)
+	{
+		case PDBParser::Stream: return "stream";
+		case PDBParser::Mapped: return "mapped";
+		case PDBParser::MappedParallel: return "mapped-parallel";
+	}
+
+	return "unknown";
+}
+
+static void BenchmarkPDBParser(const std::string& pdbPath, const std::string& xmlPath, const AtomLoaderSpecification& spec, uint32_t iterations)
+{
+	size_t atomCount = 0;
+	float totalSeconds = 0.0f;
+	for (uint32_t i = 0; i < iterations; ++i)
+	{
+		Timer timer;
+		AtomLoader loader(pdbPath, xmlPath, spec);
+		totalSeconds += timer.ElapsedNs() / 1e9f;
+		atomCount = loader.GetAtoms().size();
+	}
+
+	const float secondsPerLoad = totalSeconds / iterations;
+	std::cout << "PDB parser " << PDBParserName(spec.parser);
+	if (spec.parser == PDBParser::MappedParallel)
+		std::cout << " (" << spec.threadCount << " threads)";
+	std::cout << ": " << atomCount << " atoms, " << secondsPerLoad * 1000.0f << " ms/load, " << atomCount / secondsPerLoad << " atoms/s\n";
+}
+
+// The parallel loader must reproduce the serial one exactly, including Atom::index
+static bool CheckParallelLoaderDeterminism(const std::string& pdbPath, const std::string& xmlPath, uint32_t threadCount)
+{
+	AtomLoaderSpecification serialSpec;
+	serialSpec.parser = PDBParser::Mapped;
+	AtomLoaderSpecification parallelSpec;
+	parallelSpec.parser = PDBParser::MappedParallel;
+	parallelSpec.threadCount = threadCount;
+
+	AtomLoader serial(pdbPath, xmlPath, serialSpec);
+	AtomLoader parallel(pdbPath, xmlPath, parallelSpec);
+
+	const auto& expected = serial.GetAtoms();
+	const auto& actual = parallel.GetAtoms();
+	if (expected.size() != actual.size())
+	{
+		std::cerr << "Determinism check failed: " << actual.size() << " atoms, expected " << expected.size() << '\n';
+		return false;
+	}
+
+	for (size_t i = 0; i < expected.size(); ++i)
+	{
+		const Atom& a = expected[i];
+		const Atom& b = actual[i];
+		const bool sameTemplate = a.atomTemplate->radius == b.atomTemplate->radius && a.atomTemplate->color == b.atomTemplate->color;
+		const bool sameResidue = a.residue->color == b.residue->color;
+		if (a.position != b.position || a.index != b.index || !sameTemplate || !sameResidue)
+		{
+			std::cerr << "Determinism check failed at atom " << i << " with " << threadCount << " threads\n";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool RunLoaderBenchmarks(const std::string& pdbPath, const std::string& xmlPath, uint32_t iterations)
+{
+	// All parsers share the XML pass, so the difference between them is the PDB path alone
+	AtomLoaderSpecification spec;
+	spec.parser = PDBParser::Stream;
+	BenchmarkPDBParser(pdbPath, xmlPath, spec, iterations);
+	spec.parser = PDBParser::Mapped;
+	BenchmarkPDBParser(pdbPath, xmlPath, spec, iterations);
+
+	spec.parser = PDBParser::MappedParallel;
+	for (uint32_t threadCount = 1; threadCount <= 16; threadCount *= 2)
+	{
+		spec.threadCount = threadCount;
+		BenchmarkPDBParser(pdbPath, xmlPath, spec, iterations);
+	}
+
+	bool deterministic = true;
+	for (uint32_t threadCount = 2; threadCount <= 16; threadCount *= 2)
+	{
+		deterministic &= CheckParallelLoaderDeterminism(pdbPath, xmlPath, threadCount);
+	}
+
+	return ReportCheck("Parallel loader determinism", deterministic);
+}
@@ -0,0 +1,33 @@
+#include <cstring>
+#include <string>
+
+#include "AtomLoader.h"
+#include "Benchmarks.h"
+#include "Harness.h"
+
+int main(int argc, char** argv)
+{
+	if (argc > 1 && std::strcmp(argv[1], "--suite") == 0)
+		return RunBenchmarkSuite(argc, argv);
+
+	const std::string pdbPath = argc > 1 ? argv[1] : "assets/data/1cqw.pdb";
+	const std::string xmlPath = argc > 2 ? argv[2] : "assets/data/test.xml";
+	const uint32_t iterations = argc > 3 ? static_cast<uint32_t>(std::stoul(argv[3])) : 20;
+
+	bool passed = RunLoaderBenchmarks(pdbPath, xmlPath, iterations);
+
+	const AtomLoader loader(pdbPath, xmlPath);
+	const std::vector<Atom>& atoms = loader.GetAtoms();
+	passed &= RunKDTreeBenchmarks(atoms);
+	passed &= RunCpuRaytracerBenchmarks(atoms);
+
+	const std::vector<Atom> manyAtoms = ReplicateAtoms(atoms, 1000000);
+	passed &= RunLinearBVHBenchmarks(atoms, manyAtoms, iterations);
+	passed &= RunRayCasterBenchmarks(atoms, manyAtoms);
+	passed &= RunMaterialBenchmarks(atoms);
+	passed &= RunAmbientOcclusionBenchmarks(atoms, manyAtoms);
+	passed &= RunKDTreeQueryBenchmarks(atoms, manyAtoms);
+	passed &= RunMolecularSurfaceBenchmarks(atoms, manyAtoms);
+	passed &= RunEnvironmentLightingBenchmarks("assets/textures/hdr/newport.hdr");
+	return passed ? 0 : 1;
+}
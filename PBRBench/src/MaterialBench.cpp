@@ -0,0 +1,143 @@
+#include "Benchmarks.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "AtomKDTree.h"
+#include "CpuRaytracer.h"
+#include "Harness.h"
+#include "Scene.h"
+#include "Shading.h"
+
+// Every sphere refers to an entry equal to the material of its residue or atom template, and no
+// two entries are equal
+static bool ValidateSphereMaterials(const std::vector<Atom>& atoms, const std::vector<Sphere>& spheres, const std::vector<SphereMaterial>& materials)
+{
+	for (size_t i = 0; i < materials.size(); ++i)
+	{
+		for (size_t j = i + 1; j < materials.size(); ++j)
+		{
+			if (std::memcmp(&materials[i], &materials[j], sizeof(SphereMaterial)) == 0)
+				return false;
+		}
+	}
+
+	for (size_t i = 0; i < atoms.size(); ++i)
+	{
+		const Material& expected = atoms[i].residue && atoms[i].residue->hasMaterial ? atoms[i].residue->material : atoms[i].atomTemplate->material;
+		if (spheres[i].materialIndex >= materials.size())
+			return false;
+
+		const SphereMaterial& material = materials[spheres[i].materialIndex];
+		if (material.metallic != expected.metallic || material.roughness != expected.roughness || material.dielectricF0 != 0.16f * expected.reflectance * expected.reflectance)
+			return false;
+	}
+
+	return true;
+}
+
+// Light reflected by a white surface under uniform white light, the integral of
+// EvaluateCookTorrance() over the hemisphere of light directions. The grid misses the peak of
+// narrow lobes, so it is only meaningful from roughness 0.3 up
+static float IntegrateReflectance(const SphereMaterial& material, float NdotV, uint32_t sampleCount)
+{
+	constexpr float pi = 3.14159265358979f;
+	const glm::vec3 normal(0.0f, 0.0f, 1.0f);
+	const glm::vec3 view(std::sqrt(1.0f - NdotV * NdotV), 0.0f, NdotV);
+	double sum = 0.0;
+	for (uint32_t y = 0; y < sampleCount; ++y)
+	{
+		// Uniform in solid angle, stratified in cos(theta) and phi
+		const float cosTheta = (y + 0.5f) / sampleCount;
+		const float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+		for (uint32_t x = 0; x < 2 * sampleCount; ++x)
+		{
+			const float phi = pi * (x + 0.5f) / sampleCount;
+			const glm::vec3 light(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+			sum += EvaluateCookTorrance(glm::vec3(1.0f), material, normal, view, light).x;
+		}
+	}
+
+	return static_cast<float>(sum * 2.0 * pi / (2.0 * sampleCount * sampleCount));
+}
+
+// The material table of the scheme, and the CPU reference shading it is lit with
+static bool BenchmarkMaterials(const std::vector<Atom>& atoms)
+{
+	std::vector<SphereMaterial> materials;
+	std::vector<Sphere> spheres;
+	const float withMs = MeasureMedianMs(5, [&]() { spheres = CreateSpheres(atoms, materials); });
+	bool valid = ValidateSphereMaterials(atoms, spheres, materials);
+	std::cout << "Materials: " << materials.size() << " distinct of " << atoms.size() << " atoms, " << sizeof(Sphere) << " bytes per sphere, CreateSpheres " << withMs << " ms\n";
+
+	const std::vector<Atom> manyAtoms = ReplicateAtoms(atoms, 1000000);
+	std::vector<SphereMaterial> manyMaterials;
+	std::vector<Sphere> manySpheres;
+	const float manyMs = MeasureMedianMs(5, [&]() { manySpheres = CreateSpheres(manyAtoms, manyMaterials); });
+	valid &= ValidateSphereMaterials(manyAtoms, manySpheres, manyMaterials) && manyMaterials.size() == materials.size();
+	std::cout << "  " << manyAtoms.size() << " atoms: CreateSpheres " << manyMs << " ms\n";
+
+	// Energy conservation of the reference shading, and Helmholtz reciprocity of the BRDF. The
+	// Lambertian base loses the Fresnel of the half vector rather than of the whole lobe, which
+	// lets a dielectric reflect up to about 1.5% too much at grazing angles
+	float worstReflectance = 0.0f;
+	float worstReciprocity = 0.0f;
+	for (float metallic : { 0.0f, 1.0f })
+	{
+		for (float roughness : { 0.3f, 0.6f, 1.0f })
+		{
+			SphereMaterial material;
+			material.metallic = metallic;
+			material.roughness = roughness;
+			for (float NdotV : { 0.1f, 0.5f, 1.0f })
+				worstReflectance = std::max(worstReflectance, IntegrateReflectance(material, NdotV, 512));
+
+			const glm::vec3 normal(0.0f, 1.0f, 0.0f);
+			const glm::vec3 a = glm::normalize(glm::vec3(0.3f, 0.8f, 0.1f));
+			const glm::vec3 b = glm::normalize(glm::vec3(-0.5f, 0.4f, 0.6f));
+			const glm::vec3 albedo(0.8f, 0.5f, 0.2f);
+			const glm::vec3 forward = EvaluateCookTorrance(albedo, material, normal, a, b) / glm::dot(normal, b);
+			const glm::vec3 backward = EvaluateCookTorrance(albedo, material, normal, b, a) / glm::dot(normal, a);
+			worstReciprocity = std::max(worstReciprocity, glm::length(forward - backward) / glm::length(forward));
+		}
+	}
+
+	std::cout << "Cook-Torrance: largest white reflectance " << worstReflectance << ", largest reciprocity error " << worstReciprocity * 100.0f << "%\n";
+	valid &= worstReflectance <= 1.02f && worstReciprocity < 1e-4f;
+
+	// Lit frames of the materials are independent of the thread count like the flat ones
+	const AtomKDTree tree(atoms);
+	const std::vector<ArrayNode> nodes = CreateArrayNodes(tree);
+	RaytraceScene scene;
+	scene.spheres = spheres.data();
+	scene.sphereCount = spheres.size();
+	scene.materials = materials.data();
+	scene.materialCount = materials.size();
+	scene.nodes = nodes.data();
+	scene.nodeCount = nodes.size();
+	scene.atomIndices = tree.GetAtomIndices().data();
+	scene.atomIndexCount = tree.GetAtomIndices().size();
+	const CpuCubemap cubemap({});
+
+	constexpr uint32_t width = 640;
+	constexpr uint32_t height = 360;
+	CpuRaytracerSpecification spec;
+	spec.directLighting = true;
+	spec.shadows = true;
+	const glm::mat4 invProjView = ComputeBenchmarkCamera(glm::vec3(nodes[0].boxMin), glm::vec3(nodes[0].boxMax), width, height, spec);
+
+	std::vector<glm::vec4> serialPixels, pixels;
+	spec.threadCount = 1;
+	RenderCpuFrame(scene, cubemap, spec, invProjView, width, height, serialPixels);
+	spec.threadCount = 0;
+	RenderCpuFrame(scene, cubemap, spec, invProjView, width, height, pixels);
+	valid &= std::memcmp(serialPixels.data(), pixels.data(), serialPixels.size() * sizeof(glm::vec4)) == 0;
+	return valid;
+}
+
+bool RunMaterialBenchmarks(const std::vector<Atom>& atoms)
+{
+	return ReportCheck("Material table and Cook-Torrance reference", BenchmarkMaterials(atoms));
+}
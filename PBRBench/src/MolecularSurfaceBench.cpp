@@ -0,0 +1,172 @@
+#include "Benchmarks.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+#include "Harness.h"
+#include "MolecularSurface.h"
+#include "Scene.h"
+#include "SpatialHashGrid.h"
+
+static bool SameMolecularSurface(const MolecularSurface& a, const MolecularSurface& b)
+{
+	return a.GetBricks() == b.GetBricks() && a.GetNearestAtoms() == b.GetNearestAtoms() && a.GetDistances().size() == b.GetDistances().size()
+		&& std::memcmp(a.GetDistances().data(), b.GetDistances().data(), a.GetDistances().size() * sizeof(float)) == 0;
+}
+
+// Shrake-Rupley against every atom instead of the hash grid, same test points
+static std::vector<glm::vec3> FindAccessiblePointsBruteForce(const std::vector<glm::vec4>& spheres, uint32_t pointsPerAtom)
+{
+	std::vector<glm::vec3> points;
+	for (size_t i = 0; i < spheres.size(); ++i)
+	{
+		for (uint32_t j = 0; j < pointsPerAtom; ++j)
+		{
+			const float z = 1.0f - 2.0f * (j + 0.5f) / pointsPerAtom;
+			const float ringRadius = std::sqrt(std::max(1.0f - z * z, 0.0f));
+			const float phi = j * 2.39996323f;
+			const glm::vec3 point = glm::vec3(spheres[i]) + spheres[i].w * glm::vec3(ringRadius * std::cos(phi), ringRadius * std::sin(phi), z);
+			bool buried = false;
+			for (size_t k = 0; k < spheres.size() && !buried; ++k)
+			{
+				const glm::vec3 offset = point - glm::vec3(spheres[k]);
+				buried = k != i && glm::dot(offset, offset) < spheres[k].w * spheres[k].w;
+			}
+
+			if (!buried)
+				points.push_back(point);
+		}
+	}
+
+	return points;
+}
+
+static bool BenchmarkMolecularSurface(const std::vector<Atom>& atoms, const std::vector<Atom>& manyAtoms)
+{
+	bool valid = true;
+	MolecularSurfaceSpecification spec;
+	std::vector<glm::vec4> spheres(atoms.size());
+	for (size_t i = 0; i < atoms.size(); ++i)
+		spheres[i] = glm::vec4(atoms[i].position, atoms[i].atomTemplate->radius + spec.probeRadius);
+
+	// Radius queries of the grid against all spheres, around every 16th atom
+	const SpatialHashGrid grid(spheres, 3.0f);
+	uint64_t gridMisses = 0;
+	for (size_t i = 0; i < atoms.size(); i += 16)
+	{
+		for (float radius : { 1.0f, 3.0f, 8.0f })
+		{
+			uint64_t found = 0;
+			uint64_t indexSum = 0;
+			grid.ForEachInRadius(atoms[i].position, radius, [&](const SpatialHashGrid::Entry& entry) { ++found; indexSum += entry.index; });
+
+			uint64_t expected = 0;
+			uint64_t expectedSum = 0;
+			for (size_t j = 0; j < atoms.size(); ++j)
+			{
+				const glm::vec3 offset = atoms[j].position - atoms[i].position;
+				if (glm::dot(offset, offset) <= radius * radius)
+				{
+					++expected;
+					expectedSum += j;
+				}
+			}
+
+			gridMisses += found != expected || indexSum != expectedSum;
+		}
+	}
+
+	std::cout << "Spatial hash grid: " << grid.GetBucketCount() << " buckets for " << spheres.size() << " spheres, " << gridMisses << " radius queries differ from the brute force\n";
+	valid &= gridMisses == 0;
+
+	for (SurfaceType type : { SurfaceType::SolventAccessible, SurfaceType::SolventExcluded })
+	{
+		spec.type = type;
+		spec.threadCount = 1;
+		const MolecularSurface serial(atoms, spec);
+		for (uint32_t threadCount = 2; threadCount <= 16; threadCount *= 2)
+		{
+			spec.threadCount = threadCount;
+			const MolecularSurface surface(atoms, spec);
+			valid &= SameMolecularSurface(serial, surface);
+		}
+
+		// MainLayer builds it from the spheres of the scene
+		spec.threadCount = 0;
+		valid &= SameMolecularSurface(serial, MolecularSurface(CreateSpheres(atoms), spec));
+
+		const MolecularSurfaceStatistics& stats = serial.GetStatistics();
+		std::cout << (type == SurfaceType::SolventAccessible ? "SAS" : "SES") << ": " << stats.milliseconds << " ms on one thread (points " << stats.pointsMilliseconds << " ms, distances "
+			<< stats.distanceMilliseconds << " ms), " << stats.surfaceBrickCount << " of " << stats.brickCount << " bricks stored, " << stats.bytes / (1024.0f * 1024.0f) << " MiB, accessible area "
+			<< stats.accessibleArea << "\n";
+
+		// Every 37th stored sample against the field computed from all atoms and all accessible points
+		const std::vector<glm::vec3> points = type == SurfaceType::SolventExcluded ? FindAccessiblePointsBruteForce(spheres, spec.pointsPerAtom) : std::vector<glm::vec3>();
+		valid &= type != SurfaceType::SolventExcluded || points.size() == stats.accessiblePointCount;
+
+		const float voxelSize = serial.GetVoxelSize();
+		const float band = serial.GetBandWidth();
+		const glm::uvec3 brickCounts = serial.GetBrickCounts();
+		float worstError = 0.0f;
+		uint32_t wrongAtoms = 0;
+		for (uint64_t brick = 0; brick < serial.GetBricks().size(); ++brick)
+		{
+			const uint32_t slot = serial.GetBricks()[brick];
+			if (slot == MolecularSurface::EmptyBrick || slot == MolecularSurface::InteriorBrick)
+				continue;
+
+			const glm::uvec3 brickCoord(brick % brickCounts.x, brick / brickCounts.x % brickCounts.y, brick / (brickCounts.x * brickCounts.y));
+			for (uint32_t sample = slot % 37; sample < MolecularSurface::BrickSampleCount; sample += 37)
+			{
+				const glm::uvec3 local(sample % 8, sample / 8 % 8, sample / 64);
+				const glm::vec3 position = serial.GetOrigin() + glm::vec3(brickCoord) * (8 * voxelSize) + voxelSize * glm::vec3(local);
+
+				float sas = std::numeric_limits<float>::max();
+				for (const glm::vec4& sphere : spheres)
+					sas = std::min(sas, glm::length(position - glm::vec3(sphere)) - sphere.w);
+
+				float expected = sas;
+				if (type == SurfaceType::SolventExcluded)
+				{
+					float reach = std::numeric_limits<float>::max();
+					for (const glm::vec3& point : points)
+						reach = std::min(reach, glm::length(position - point));
+					expected = sas >= 0.0f ? sas + spec.probeRadius : spec.probeRadius - reach;
+				}
+
+				expected = std::clamp(expected, -band, band);
+				const uint64_t index = static_cast<uint64_t>(slot) * MolecularSurface::BrickSampleCount + sample;
+				worstError = std::max(worstError, std::abs(serial.GetDistances()[index] - expected));
+
+				const glm::vec4& nearest = spheres[serial.GetNearestAtoms()[index]];
+				wrongAtoms += sas < band && glm::length(position - glm::vec3(nearest)) - nearest.w > sas + 1e-5f;
+			}
+		}
+
+		// Atom centers are deep inside both surfaces
+		uint32_t outsideAtoms = 0;
+		for (const Atom& atom : atoms)
+			outsideAtoms += serial.SampleDistance(atom.position) >= 0.0f;
+
+		std::cout << "  largest error against the brute force " << worstError << ", " << wrongAtoms << " wrong nearest atoms, " << outsideAtoms << " atom centers outside\n";
+		valid &= worstError < 1e-4f && wrongAtoms == 0 && outsideAtoms == 0;
+	}
+
+	// Coarser samples on the big set, the excluded surface of a million atoms fits in a few hundred MiB
+	spec.threadCount = 0;
+	spec.voxelSize = 1.0f;
+	const MolecularSurface manySurface(manyAtoms, spec);
+	const MolecularSurfaceStatistics& manyStats = manySurface.GetStatistics();
+	std::cout << "  " << manyAtoms.size() << " atoms, " << manyStats.threadCount << " threads: " << manyStats.milliseconds << " ms (points " << manyStats.pointsMilliseconds << " ms, distances "
+		<< manyStats.distanceMilliseconds << " ms), " << manyStats.GetAtomsPerSecond() / 1e6f << " M atoms/s, " << manyStats.surfaceBrickCount << " of " << manyStats.brickCount << " bricks stored, "
+		<< manyStats.bytes / (1024.0f * 1024.0f) << " MiB\n";
+	return valid;
+}
+
+bool RunMolecularSurfaceBenchmarks(const std::vector<Atom>& atoms, const std::vector<Atom>& manyAtoms)
+{
+	return ReportCheck("Molecular surfaces", BenchmarkMolecularSurface(atoms, manyAtoms));
+}
@@ -0,0 +1,170 @@
+#include "Benchmarks.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "AtomKDTree.h"
+#include "CpuRaytracer.h"
+#include "Harness.h"
+#include "RayCaster.h"
+#include "Scene.h"
+#include "Core/Timer.h"
+
+// Primary ray throughput of the scalar and the packet closest-hit walks on one thread. Packets
+// have to give every ray exactly the scalar hit
+static bool BenchmarkPacketTraversal(const std::vector<Atom>& atoms)
+{
+	const std::vector<Sphere> spheres = CreateSpheres(atoms);
+	const AtomKDTree tree(atoms);
+	const std::vector<ArrayNode> nodes = CreateArrayNodes(tree);
+
+	RaytraceScene scene;
+	scene.spheres = spheres.data();
+	scene.sphereCount = spheres.size();
+	scene.nodes = nodes.data();
+	scene.nodeCount = nodes.size();
+	scene.atomIndices = tree.GetAtomIndices().data();
+	scene.atomIndexCount = tree.GetAtomIndices().size();
+	const RayCaster caster(scene);
+
+	constexpr uint32_t width = 512;
+	constexpr uint32_t height = 512;
+	const CpuRaytracerSpecification spec;
+	const glm::mat4 invProjView = ComputeBenchmarkCamera(glm::vec3(nodes[0].boxMin), glm::vec3(nodes[0].boxMax), width, height, spec);
+	const std::vector<CpuRaytracer::Ray> rays = GeneratePrimaryRays(invProjView, spec, width, height);
+
+	std::vector<RayHit> scalarHits(rays.size());
+	Timer timer;
+	for (size_t i = 0; i < rays.size(); ++i)
+		scalarHits[i] = caster.Intersect(rays[i]);
+	const float scalarMs = timer.ElapsedNs() / 1e6f;
+
+	size_t hitCount = 0;
+	for (const RayHit& hit : scalarHits)
+		hitCount += hit.sphereIndex >= 0;
+
+	std::cout << "Primary rays, " << width << "x" << height << ", " << atoms.size() << " atoms, " << 100.0f * hitCount / rays.size() << "% hits:\n";
+	std::cout << "  scalar: " << scalarMs << " ms, " << rays.size() / (scalarMs * 1e3f) << " Mrays/s\n";
+
+	bool agree = true;
+	for (uint32_t packetWidth = 4; packetWidth <= RayCaster::MaxPacketWidth; packetWidth *= 2)
+	{
+		std::vector<RayHit> packetHits(rays.size());
+		timer.Reset();
+		caster.IntersectPackets(rays.data(), rays.size(), packetHits.data(), packetWidth);
+		const float packetMs = timer.ElapsedNs() / 1e6f;
+
+		size_t mismatches = 0;
+		for (size_t i = 0; i < rays.size(); ++i)
+			mismatches += std::memcmp(&packetHits[i], &scalarHits[i], sizeof(RayHit)) != 0;
+
+		std::cout << "  " << packetWidth << "-wide packets: " << packetMs << " ms, " << rays.size() / (packetMs * 1e3f) << " Mrays/s, "
+			<< scalarMs / packetMs << "x scalar";
+		if (mismatches)
+			std::cout << ", " << mismatches << " rays disagree";
+		std::cout << '\n';
+		agree &= mismatches == 0;
+	}
+
+	return agree;
+}
+
+// Shadow rays from the primary hits of a frame to the light, answered by the any-hit walk and by
+// the closest-hit walk of RayCaster. Every 16th ray is checked against all spheres
+static bool BenchmarkShadowRays(const std::vector<Atom>& atoms)
+{
+	const std::vector<Sphere> spheres = CreateSpheres(atoms);
+	const AtomKDTree tree(atoms);
+	const std::vector<ArrayNode> nodes = CreateArrayNodes(tree);
+
+	RaytraceScene scene;
+	scene.spheres = spheres.data();
+	scene.sphereCount = spheres.size();
+	scene.nodes = nodes.data();
+	scene.nodeCount = nodes.size();
+	scene.atomIndices = tree.GetAtomIndices().data();
+	scene.atomIndexCount = tree.GetAtomIndices().size();
+	const RayCaster caster(scene);
+	const CpuCubemap cubemap({});
+	CpuRaytracerSpecification spec;
+	spec.threadCount = 1;
+	const CpuRaytracer raytracer(scene, cubemap, spec);
+
+	constexpr uint32_t width = 512;
+	constexpr uint32_t height = 512;
+	const glm::mat4 invProjView = ComputeBenchmarkCamera(glm::vec3(nodes[0].boxMin), glm::vec3(nodes[0].boxMax), width, height, spec);
+	const std::vector<CpuRaytracer::Ray> primaryRays = GeneratePrimaryRays(invProjView, spec, width, height);
+
+	// Same rays as the shadows of CpuRaytracer::GetColor()
+	std::vector<CpuRaytracer::Ray> rays;
+	std::vector<float> maxDistances;
+	for (const CpuRaytracer::Ray& primaryRay : primaryRays)
+	{
+		const RayHit hit = caster.Intersect(primaryRay);
+		if (hit.sphereIndex < 0)
+			continue;
+
+		const glm::vec3 center(spheres[hit.sphereIndex].position);
+		const glm::vec3 hitPoint = primaryRay.origin + hit.distance * primaryRay.dir;
+		CpuRaytracer::Ray ray;
+		ray.origin = hitPoint + 0.001f * glm::normalize(hitPoint - center);
+		const glm::vec3 toLight = spec.lightPosition - ray.origin;
+		ray.dir = glm::normalize(toLight);
+		rays.push_back(ray);
+		maxDistances.push_back(glm::length(toLight) - 0.5f);
+	}
+
+	std::vector<char> occluded(rays.size());
+	CpuRaytracer::RayCounters counters;
+	Timer timer;
+	for (size_t i = 0; i < rays.size(); ++i)
+		occluded[i] = raytracer.IsOccluded(rays[i], maxDistances[i], counters);
+	const float anyHitMs = timer.ElapsedNs() / 1e6f;
+
+	timer.Reset();
+	size_t closestHitCount = 0;
+	for (size_t i = 0; i < rays.size(); ++i)
+		closestHitCount += caster.Intersect(rays[i]).distance < maxDistances[i];
+	const float closestHitMs = timer.ElapsedNs() / 1e6f;
+
+	size_t mismatches = 0;
+	for (size_t i = 0; i < rays.size(); i += 16)
+	{
+		bool expected = false;
+		for (const Sphere& sphere : spheres)
+		{
+			const glm::vec3 tro = rays[i].origin - glm::vec3(sphere.position);
+			const float b = 2.0f * glm::dot(rays[i].dir, tro);
+			const float D = b * b - 4.0f * glm::dot(rays[i].dir, rays[i].dir) * (glm::dot(tro, tro) - sphere.radius * sphere.radius);
+			const float t = D < 0.0f ? -1.0f : (-b - std::sqrt(D)) / (2.0f * glm::dot(rays[i].dir, rays[i].dir));
+			expected |= t > 0.0f && t < maxDistances[i];
+		}
+
+		mismatches += expected != static_cast<bool>(occluded[i]);
+	}
+
+	size_t occludedCount = 0;
+	for (char value : occluded)
+		occludedCount += value;
+
+	std::cout << "Shadow rays, " << rays.size() << " primary hits of " << width << "x" << height << ", " << atoms.size() << " atoms, "
+		<< 100.0f * occludedCount / rays.size() << "% occluded:\n";
+	std::cout << "  any hit: " << anyHitMs << " ms, " << rays.size() / (anyHitMs * 1e3f) << " Mrays/s, "
+		<< static_cast<float>(counters.nodeVisits) / rays.size() << " nodes and " << static_cast<float>(counters.sphereTests) / rays.size() << " spheres per ray\n";
+	std::cout << "  closest hit: " << closestHitMs << " ms, " << rays.size() / (closestHitMs * 1e3f) << " Mrays/s, " << closestHitMs / anyHitMs << "x any hit\n";
+	if (mismatches)
+		std::cerr << "  " << mismatches << " shadow rays disagree with the brute force test\n";
+	return mismatches == 0;
+}
+
+bool RunRayCasterBenchmarks(const std::vector<Atom>& atoms, const std::vector<Atom>& manyAtoms)
+{
+	bool packetsAgree = true;
+	for (const std::vector<Atom>* benchmarkAtoms : { &atoms, &manyAtoms })
+		packetsAgree &= BenchmarkPacketTraversal(*benchmarkAtoms);
+
+	bool passed = ReportCheck("Packet traversal hits", packetsAgree);
+	passed &= ReportCheck("Shadow ray occlusion", BenchmarkShadowRays(atoms));
+	return passed;
+}
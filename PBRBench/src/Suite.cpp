@@ -0,0 +1,190 @@
+#include "Benchmarks.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "AtomLoader.h"
+#include "AtomKDTree.h"
+#include "CpuRaytracer.h"
+#include "Harness.h"
+#include "PDBGenerator.h"
+#include "RayCaster.h"
+#include "Scene.h"
+#include "Core/Base.h"
+
+struct SuiteResult
+{
+	std::string name;
+	uint64_t atomCount = 0;
+	uint64_t pdbBytes = 0;
+	uint32_t iterations = 0;
+	float loadMs = 0.0f;       // AtomLoader, PDB and XML
+	float xmlMs = 0.0f;        // AtomLoader without a PDB
+	float kdTreeMs = 0.0f;
+	uint64_t kdTreeNodeCount = 0;
+	float spheresMs = 0.0f;    // CreateSpheres
+	float flattenMs = 0.0f;    // CreateArrayNodes
+	uint64_t rayCount = 0;
+	float hitRate = 0.0f;
+	float scalarMraysPerSecond = 0.0f;
+	float packetMraysPerSecond = 0.0f;
+};
+
+// Median time of every stage between the PDB file and the closest hits of the primary rays of a
+// 512x512 frame. Large inputs get fewer iterations, at least one
+static SuiteResult RunSuiteStages(const std::string& name, const std::string& pdbPath, const std::string& xmlPath, uint32_t iterations)
+{
+	SuiteResult result;
+	result.name = name;
+	result.pdbBytes = std::filesystem::file_size(pdbPath);
+	result.iterations = std::clamp(static_cast<uint32_t>(2000000 / std::max<uint64_t>(result.pdbBytes / 81, 1)), 1u, iterations);
+
+	result.xmlMs = MeasureMedianMs(result.iterations, [&]() { AtomLoader loader("", xmlPath); });
+	result.loadMs = MeasureMedianMs(result.iterations, [&]() { AtomLoader loader(pdbPath, xmlPath); });
+
+	const AtomLoader loader(pdbPath, xmlPath);
+	const std::vector<Atom>& atoms = loader.GetAtoms();
+	result.atomCount = atoms.size();
+
+	Scope<AtomKDTree> tree;
+	result.kdTreeMs = MeasureMedianMs(result.iterations, [&]() { tree = CreateScope<AtomKDTree>(atoms); });
+	result.kdTreeNodeCount = tree->GetNodes().size();
+
+	std::vector<Sphere> spheres;
+	std::vector<ArrayNode> nodes;
+	result.spheresMs = MeasureMedianMs(result.iterations, [&]() { spheres = CreateSpheres(atoms); });
+	result.flattenMs = MeasureMedianMs(result.iterations, [&]() { nodes = CreateArrayNodes(*tree); });
+
+	RaytraceScene scene;
+	scene.spheres = spheres.data();
+	scene.sphereCount = spheres.size();
+	scene.nodes = nodes.data();
+	scene.nodeCount = nodes.size();
+	scene.atomIndices = tree->GetAtomIndices().data();
+	scene.atomIndexCount = tree->GetAtomIndices().size();
+	const RayCaster caster(scene);
+
+	constexpr uint32_t width = 512;
+	constexpr uint32_t height = 512;
+	const CpuRaytracerSpecification spec;
+	const glm::mat4 invProjView = ComputeBenchmarkCamera(glm::vec3(nodes[0].boxMin), glm::vec3(nodes[0].boxMax), width, height, spec);
+	const std::vector<CpuRaytracer::Ray> rays = GeneratePrimaryRays(invProjView, spec, width, height);
+	std::vector<RayHit> hits(rays.size());
+	result.rayCount = rays.size();
+
+	const float scalarMs = MeasureMedianMs(result.iterations, [&]()
+	{
+		for (size_t i = 0; i < rays.size(); ++i)
+			hits[i] = caster.Intersect(rays[i]);
+	});
+	const float packetMs = MeasureMedianMs(result.iterations, [&]() { caster.IntersectPackets(rays.data(), rays.size(), hits.data()); });
+	result.scalarMraysPerSecond = rays.size() / (scalarMs * 1e3f);
+	result.packetMraysPerSecond = rays.size() / (packetMs * 1e3f);
+
+	size_t hitCount = 0;
+	for (const RayHit& hit : hits)
+		hitCount += hit.sphereIndex >= 0;
+	result.hitRate = static_cast<float>(hitCount) / rays.size();
+
+	std::cout << name << ", " << result.atomCount << " atoms, " << result.iterations << " iterations: load " << result.loadMs << " ms (xml " << result.xmlMs << " ms), kd-tree "
+		<< result.kdTreeMs << " ms, spheres " << result.spheresMs << " ms, flatten " << result.flattenMs << " ms, trace " << result.scalarMraysPerSecond << " Mrays/s scalar, "
+		<< result.packetMraysPerSecond << " Mrays/s " << RayCaster::MaxPacketWidth << "-wide packets\n";
+	return result;
+}
+
+static void WriteSuiteJSON(std::ostream& out, const std::vector<SuiteResult>& results)
+{
+	out << "{\n";
+	out << "  \"threads\": " << std::max(std::thread::hardware_concurrency(), 1u) << ",\n";
+	out << "  \"packetWidth\": " << RayCaster::MaxPacketWidth << ",\n";
+	out << "  \"datasets\": [";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const SuiteResult& r = results[i];
+		out << (i ? ",\n" : "\n") << "    {\n";
+		out << "      \"name\": \"" << r.name << "\",\n";
+		out << "      \"atoms\": " << r.atomCount << ",\n";
+		out << "      \"pdbBytes\": " << r.pdbBytes << ",\n";
+		out << "      \"iterations\": " << r.iterations << ",\n";
+		out << "      \"loadMs\": " << r.loadMs << ",\n";
+		out << "      \"xmlMs\": " << r.xmlMs << ",\n";
+		out << "      \"pdbMs\": " << std::max(r.loadMs - r.xmlMs, 0.0f) << ",\n";
+		out << "      \"kdTreeBuildMs\": " << r.kdTreeMs << ",\n";
+		out << "      \"kdTreeNodes\": " << r.kdTreeNodeCount << ",\n";
+		out << "      \"createSpheresMs\": " << r.spheresMs << ",\n";
+		out << "      \"flattenMs\": " << r.flattenMs << ",\n";
+		out << "      \"rays\": " << r.rayCount << ",\n";
+		out << "      \"hitRate\": " << r.hitRate << ",\n";
+		out << "      \"scalarMraysPerSecond\": " << r.scalarMraysPerSecond << ",\n";
+		out << "      \"packetMraysPerSecond\": " << r.packetMraysPerSecond << "\n";
+		out << "    }";
+	}
+	out << "\n  ]\n}\n";
+}
+
+int RunBenchmarkSuite(int argc, char** argv)
+{
+	std::string xmlPath = "assets/data/test.xml";
+	std::string jsonPath = "bench_results.json";
+	uint64_t maxAtoms = 10000000;
+	uint32_t iterations = 5;
+	for (int i = 2; i < argc; ++i)
+	{
+		const std::string argument = argv[i];
+		if (argument == "--json" && i + 1 < argc)
+			jsonPath = argv[++i];
+		else if (argument == "--max-atoms" && i + 1 < argc)
+			maxAtoms = std::stoull(argv[++i]);
+		else if (argument == "--iterations" && i + 1 < argc)
+			iterations = std::max(static_cast<uint32_t>(std::stoul(argv[++i])), 1u);
+		else
+			xmlPath = argument;
+	}
+
+	const std::filesystem::path tempDirectory = std::filesystem::temp_directory_path();
+	std::vector<SuiteResult> results;
+	results.push_back(RunSuiteStages("1cqw", "assets/data/1cqw.pdb", xmlPath, iterations));
+
+	// Uniform clouds for the scaling, the other distributions at one size for their shape
+	std::vector<PDBGeneratorSpecification> datasets;
+	PDBGeneratorSpecification generatorSpec;
+	for (generatorSpec.atomCount = 10000; generatorSpec.atomCount <= maxAtoms; generatorSpec.atomCount *= 10)
+		datasets.push_back(generatorSpec);
+
+	generatorSpec.atomCount = std::min<uint64_t>(maxAtoms, 1000000);
+	for (AtomDistribution distribution : { AtomDistribution::Clustered, AtomDistribution::HelicalFilaments, AtomDistribution::HollowCapsid })
+	{
+		generatorSpec.distribution = distribution;
+		datasets.push_back(generatorSpec);
+	}
+
+	bool complete = true;
+	for (const PDBGeneratorSpecification& dataset : datasets)
+	{
+		const std::string name = std::string(AtomDistributionName(dataset.distribution)) + "_" + std::to_string(dataset.atomCount);
+		const std::string pdbPath = (tempDirectory / ("PBRBench_" + name + ".pdb")).string();
+		if (!GeneratePDB(pdbPath, dataset))
+		{
+			complete = false;
+			continue;
+		}
+
+		results.push_back(RunSuiteStages(name, pdbPath, xmlPath, iterations));
+		std::filesystem::remove(pdbPath);
+	}
+
+	std::ofstream json(jsonPath, std::ios::trunc);
+	if (!json)
+	{
+		std::cerr << "Could not write " << jsonPath << '\n';
+		return 1;
+	}
+
+	WriteSuiteJSON(json, results);
+	std::cout << "Wrote " << jsonPath << '\n';
+	return complete ? 0 : 1;
+}
@@ -0,0 +1,45 @@
+project "PBRGen"
+	kind "ConsoleApp"
+	language "C++"
+	cppdialect "C++17"
+	staticruntime "on"
+
+	targetdir("%{wks.location}/bin/" .. outputdir .. "/%{prj.name}")
+	objdir("%{wks.location}/bin-int/" .. outputdir .. "/%{prj.name}")
+
+	debugdir "%{wks.location}/PBRApp"
+
+	defines
+	{
+		"_CRT_SECURE_NO_WARNINGS"
+	}
+
+	files
+	{
+		"src/**.h",
+		"src/**.cpp",
+
+		-- The XML templates decide which elements can be generated
+		"%{wks.location}/PBRApp/src/AtomLoader.h",
+		"%{wks.location}/PBRApp/src/AtomLoader.cpp",
+		"%{wks.location}/PBRApp/src/PDBGenerator.h",
+		"%{wks.location}/PBRApp/src/PDBGenerator.cpp",
+		"%{wks.location}/PBRApp/src/Core/MappedFile.h",
+		"%{wks.location}/PBRApp/src/Core/MappedFile.cpp",
+		"%{wks.location}/PBRApp/src/Core/ThreadPool.h",
+		"%{wks.location}/PBRApp/src/Core/ThreadPool.cpp",
+		"%{wks.location}/PBRApp/src/Core/Timer.h"
+	}
+
+	includedirs
+	{
+		"src",
+		"%{wks.location}/PBRApp/src",
+		"%{IncludeDir.glm}"
+	}
+
+	filter "system:linux"
+		links
+		{
+			"pthread"
+		}
@@ -0,0 +1,135 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "AtomLoader.h"
+#include "PDBGenerator.h"
+#include "Core/Timer.h"
+
+// Writes synthetic structures of any size for the loaders, the tree builders and the renderers,
+// with only the elements the scheme XML has templates for
+static void PrintUsage()
+{
+	std::cerr <<
+		"Usage: PBRGen <output.pdb> [options]\n"
+		"  --atoms <count>              default 100000\n"
+		"  --distribution <name>        uniform, clustered, filaments or capsid, default uniform\n"
+		"  --elements <E:weight,...>    element mix, default C:62,N:17,O:19,S:2\n"
+		"  --seed <value>               default 1\n"
+		"  --xml <path>                 scheme XML the elements are checked against, default assets/data/test.xml\n";
+}
+
+static bool ParseDistribution(const char* text, AtomDistribution& distribution)
+{
+	for (AtomDistribution candidate : { AtomDistribution::Uniform, AtomDistribution::Clustered, AtomDistribution::HelicalFilaments, AtomDistribution::HollowCapsid })
+	{
+		if (std::strcmp(text, AtomDistributionName(candidate)) == 0)
+		{
+			distribution = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// C:62,N:17 -> { 'C', 62 }, { 'N', 17 }. The weights feed std::discrete_distribution, so they have
+// to be finite and add up to more than zero
+static bool ParseElements(const char* text, std::vector<ElementWeight>& elements)
+{
+	elements.clear();
+	float totalWeight = 0.0f;
+	while (*text)
+	{
+		ElementWeight element;
+		int consumed = 0;
+		if (std::sscanf(text, "%c:%f%n", &element.element, &element.weight, &consumed) != 2 || !std::isfinite(element.weight) || element.weight < 0.0f)
+			return false;
+
+		totalWeight += element.weight;
+		elements.push_back(element);
+		text += consumed;
+		if (*text == ',')
+			++text;
+		else if (*text)
+			return false;
+	}
+
+	return std::isfinite(totalWeight) && totalWeight > 0.0f;
+}
+
+int main(int argc, char** argv)
+{
+	std::string outputPath;
+	std::string xmlPath = "assets/data/test.xml";
+	PDBGeneratorSpecification spec;
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* argument = argv[i];
+		if (std::strncmp(argument, "--", 2) != 0)
+		{
+			outputPath = argument;
+			continue;
+		}
+
+		if (i + 1 >= argc)
+		{
+			std::cerr << "Missing value for " << argument << '\n';
+			PrintUsage();
+			return 1;
+		}
+
+		const char* value = argv[++i];
+		char end;
+		bool valid = true;
+		if (std::strcmp(argument, "--atoms") == 0)
+		{
+			char* atomCountEnd = nullptr;
+			spec.atomCount = std::strtoull(value, &atomCountEnd, 10);
+			valid = *value && *atomCountEnd == '\0' && spec.atomCount > 0;
+		}
+		else if (std::strcmp(argument, "--distribution") == 0)
+			valid = ParseDistribution(value, spec.distribution);
+		else if (std::strcmp(argument, "--elements") == 0)
+			valid = ParseElements(value, spec.elements);
+		else if (std::strcmp(argument, "--seed") == 0)
+			valid = std::sscanf(value, "%u%c", &spec.seed, &end) == 1;
+		else if (std::strcmp(argument, "--xml") == 0)
+			xmlPath = value;
+		else
+		{
+			std::cerr << "Unknown option " << argument << '\n';
+			PrintUsage();
+			return 1;
+		}
+
+		if (!valid)
+		{
+			std::cerr << "Invalid value " << value << " for " << argument << '\n';
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (outputPath.empty())
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	const AtomLoader schemes("", xmlPath);
+	if (!HasAtomTemplates(spec, schemes.GetAtomTemplates()))
+		return 1;
+
+	Timer timer;
+	if (!GeneratePDB(outputPath, spec))
+		return 1;
+
+	std::cout << "Wrote " << spec.atomCount << " atoms (" << AtomDistributionName(spec.distribution) << ", seed " << spec.seed << ") to " << outputPath
+		<< " in " << timer.ElapsedMs() << " ms\n";
+	return 0;
+}
@@ -0,0 +1,174 @@
+#include "BatchRenderer.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <glm/gtc/constants.hpp>
+
+#include "AtomLoader.h"
+#include "ImageWriter.h"
+#include "RenderScene.h"
+#include "Core/Base.h"
+#include "Core/BoundedQueue.h"
+#include "Core/Timer.h"
+
+struct LoadedStructure
+{
+	std::string name;
+	Scope<AtomLoader> loader;
+};
+
+struct BuiltStructure
+{
+	std::string name;
+	Scope<RenderScene> scene;
+};
+
+static std::vector<std::filesystem::path> FindStructures(const std::string& directory)
+{
+	std::vector<std::filesystem::path> paths;
+	std::error_code error;
+	for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+	{
+		if (entry.is_regular_file() && GetLowercaseExtension(entry.path().string()) == ".pdb")
+			paths.push_back(entry.path());
+	}
+
+	if (error)
+		std::cerr << "Could not read directory " << directory << ": " << error.message() << '\n';
+
+	std::sort(paths.begin(), paths.end());
+	return paths;
+}
+
+BatchStatistics RunBatch(const BatchSpecification& specification)
+{
+	BatchStatistics statistics;
+	const std::vector<std::filesystem::path> paths = FindStructures(specification.inputDirectory);
+	if (paths.empty())
+	{
+		std::cerr << "No .pdb files in " << specification.inputDirectory << '\n';
+		return statistics;
+	}
+
+	// Tracing takes most of the time, parsing and tree building a quarter of the budget each. The
+	// stages overlap, so the budget is split between them instead of every stage taking all cores
+	const uint32_t threadBudget = specification.threadCount > 0 ? specification.threadCount : std::max(std::thread::hardware_concurrency(), 1u);
+	const uint32_t loadThreads = std::max(threadBudget / 4, 1u);
+	const uint32_t buildThreads = std::max(threadBudget / 4, 1u);
+	const uint32_t renderThreads = threadBudget > loadThreads + buildThreads ? threadBudget - loadThreads - buildThreads : 1;
+	std::cout << "Batch of " << paths.size() << " structures, " << specification.viewCount << " views each, threads: "
+		<< loadThreads << " load, " << buildThreads << " build, " << renderThreads << " render\n";
+
+	BoundedQueue<LoadedStructure> loadedQueue(specification.queueCapacity);
+	BoundedQueue<BuiltStructure> builtQueue(specification.queueCapacity);
+	const bool buildCompactKDTree = specification.raytracer.useCompactKDTree;
+
+	Timer timer;
+	std::thread loadThread([&]()
+	{
+		AtomLoaderSpecification loaderSpec;
+		loaderSpec.threadCount = loadThreads;
+		for (const std::filesystem::path& path : paths)
+		{
+			Timer stageTimer;
+			LoadedStructure structure;
+			structure.name = path.stem().string();
+			structure.loader = CreateScope<AtomLoader>(path.string(), specification.xmlPath, loaderSpec);
+			statistics.loadSeconds += stageTimer.ElapsedNs() / 1e9f;
+			if (!loadedQueue.Push(std::move(structure)))
+				break;
+		}
+
+		loadedQueue.Close();
+	});
+
+	std::thread buildThread([&]()
+	{
+		while (std::optional<LoadedStructure> loaded = loadedQueue.Pop())
+		{
+			Timer stageTimer;
+			BuiltStructure structure;
+			structure.name = std::move(loaded->name);
+			const std::vector<Atom>& atoms = loaded->loader->GetAtoms();
+			if (!atoms.empty())
+				structure.scene = CreateScope<RenderScene>(atoms, buildCompactKDTree, buildThreads, specification.occlusionRayCount,
+					specification.raytracer.traceSurface ? &specification.surface : nullptr);
+
+			// The spheres hold copies of the colors and radii, the loader is not needed anymore
+			loaded->loader.reset();
+			statistics.buildSeconds += stageTimer.ElapsedNs() / 1e9f;
+			if (!builtQueue.Push(std::move(structure)))
+				break;
+		}
+
+		builtQueue.Close();
+	});
+
+	const CpuCubemap cubemap({
+		"assets/textures/skybox/right.jpg",
+		"assets/textures/skybox/left.jpg",
+		"assets/textures/skybox/top.jpg",
+		"assets/textures/skybox/bottom.jpg",
+		"assets/textures/skybox/front.jpg",
+		"assets/textures/skybox/back.jpg"
+	});
+
+	std::error_code error;
+	std::filesystem::create_directories(specification.outputDirectory, error);
+
+	while (std::optional<BuiltStructure> built = builtQueue.Pop())
+	{
+		if (!built->scene)
+		{
+			std::cerr << "No atoms in " << built->name << ", skipped\n";
+			++statistics.failedCount;
+			continue;
+		}
+
+		Timer stageTimer;
+		CpuRaytracerSpecification raytracerSpec = specification.raytracer;
+		raytracerSpec.threadCount = renderThreads;
+		raytracerSpec.gammaCorrect = specification.extension != ".exr";
+
+		// Every view of the orbit is as far from the center, so they share the far plane that
+		// ComputeInvProjView() sets before the raytracer copies the specification
+		const RenderScene& scene = *built->scene;
+		std::vector<glm::mat4> invProjViews;
+		for (uint32_t view = 0; view < specification.viewCount; ++view)
+		{
+			CameraPose pose = FrameRenderScene(scene, glm::two_pi<float>() * view / specification.viewCount);
+			pose.fov = specification.fov;
+			invProjViews.push_back(ComputeInvProjView(scene, pose, specification.width, specification.height, raytracerSpec));
+		}
+
+		CpuRaytracer raytracer(scene.GetRaytraceScene(), cubemap, raytracerSpec);
+		std::vector<glm::vec4> pixels;
+		bool written = true;
+		for (uint32_t view = 0; view < specification.viewCount; ++view)
+		{
+			statistics.rayCount += raytracer.RenderAdaptive(invProjViews[view], specification.width, specification.height, specification.sampling, pixels).rayCount;
+			const std::filesystem::path outputPath = std::filesystem::path(specification.outputDirectory) / (built->name + "_view" + std::to_string(view) + specification.extension);
+			if (WriteImage(outputPath.string(), specification.width, specification.height, pixels))
+				++statistics.imageCount;
+			else
+				written = false;
+		}
+
+		statistics.renderSeconds += stageTimer.ElapsedNs() / 1e9f;
+		if (written)
+			++statistics.structureCount;
+		else
+			++statistics.failedCount;
+
+		std::cout << "  " << built->name << ": " << built->scene->spheres.size() << " atoms, " << timer.ElapsedMs() / 1e3f << " s since start\n";
+	}
+
+	loadThread.join();
+	buildThread.join();
+	statistics.seconds = timer.ElapsedNs() / 1e9f;
+	return statistics;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "CpuRaytracer.h"
+#include "MolecularSurface.h"
+
+struct BatchSpecification
+{
+	std::string inputDirectory;           // Every .pdb file in it is one structure
+	std::string xmlPath;
+	std::string outputDirectory = "renders";
+	std::string extension = ".png";       // .png or .exr
+	uint32_t viewCount = 4;               // Views per structure, evenly spaced on an orbit around the y axis
+	uint32_t width = 1280;
+	uint32_t height = 720;
+	float fov = 45.0f;
+	uint32_t threadCount = 0;             // Budget of all stages together, 0 means one thread per hardware core
+	uint32_t queueCapacity = 2;           // Structures waiting between two stages
+	CpuRaytracerSpecification raytracer;  // threadCount and gammaCorrect are set by the batch
+	AdaptiveSamplingSpecification sampling = { 8, 1 }; // One sample per pixel unless maxSamples is raised
+	uint32_t occlusionRayCount = 0;       // Ambient occlusion rays per atom, baked in the build stage
+	MolecularSurfaceSpecification surface; // Built in the build stage if raytracer.traceSurface is set
+};
+
+struct BatchStatistics
+{
+	uint32_t structureCount = 0; // Rendered, failed ones are not counted
+	uint32_t failedCount = 0;
+	uint32_t imageCount = 0;
+	uint64_t rayCount = 0;
+	float seconds = 0.0f;        // End to end, from the first load to the last image on disk
+
+	// Time every stage spent working rather than waiting on its queues
+	float loadSeconds = 0.0f;
+	float buildSeconds = 0.0f;
+	float renderSeconds = 0.0f;
+
+	float GetStructuresPerHour() const { return seconds > 0.0f ? structureCount * 3600.0f / seconds : 0.0f; }
+};
+
+// Renders a directory of structures in a three stage pipeline: one thread parses the next
+// structure while another builds the trees of the current one and the calling thread traces and
+// writes the views of the previous one. Bounded queues between the stages keep at most
+// queueCapacity structures in memory per queue
+BatchStatistics RunBatch(const BatchSpecification& specification);
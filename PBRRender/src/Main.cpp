@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "AtomLoader.h"
+#include "BatchRenderer.h"
+#include "CpuRaytracer.h"
+#include "EnvironmentLighting.h"
+#include "ImageWriter.h"
+#include "RenderScene.h"
+#include "Core/Timer.h"
+
+// Renders a single frame of Raytrace.frag with the CPU raytracer and writes it to disk, without a
+// window or an OpenGL context, so it runs on headless machines and in scripts. With --batch the
+// first argument is a directory and every structure in it is rendered from several views
+struct RenderOptions
+{
+	std::string pdbPath; // Directory of .pdb files in batch mode
+	std::string xmlPath;
+	std::string outputPath = "render.png";
+	std::string environmentPath; // Image-based lighting from this .hdr when set
+	uint32_t occlusionRayCount = 0; // Rays per atom of the baked ambient occlusion, 0 skips the bake
+	MolecularSurfaceSpecification surface; // Traced instead of the spheres with --surface
+	uint32_t width = 1920;
+	uint32_t height = 1080;
+	float fov = 45.0f; // Vertical, in degrees
+	bool hasEye = false;
+	bool hasTarget = false;
+	glm::vec3 eye = glm::vec3(0.0f);
+	glm::vec3 target = glm::vec3(0.0f);
+	glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
+	CpuRaytracerSpecification raytracer; // Primary rays in packets unless --scalar
+	AdaptiveSamplingSpecification sampling = { 8, 1 }; // A single sample unless --samples asks for more
+
+	bool batch = false;
+	std::string outputDirectory = "renders";
+	std::string format = "png";
+	uint32_t viewCount = 4;
+	uint32_t queueCapacity = 2;
+};
+
+static void PrintUsage()
+{
+	std::cerr <<
+		"Usage: PBRRender <pdb> <xml> [options]\n"
+		"       PBRRender --batch <pdb directory> <xml> [options]\n"
+		"  --output <path>      .png (gamma corrected) or .exr (linear), default render.png\n"
+		"  --output-dir <path>  batch only, default renders\n"
+		"  --format <png|exr>   batch only, default png\n"
+		"  --views <count>      batch only, views per structure on an orbit around the y axis, default 4\n"
+		"  --queue <count>      batch only, structures waiting between two pipeline stages, default 2\n"
+		"  --width <pixels>     default 1920\n"
+		"  --height <pixels>    default 1080\n"
+		"  --eye <x,y,z>        camera position, default in front of the molecule on +z\n"
+		"  --target <x,y,z>     point the camera looks at, default the center of the molecule\n"
+		"  --up <x,y,z>         default 0,1,0\n"
+		"  --fov <degrees>      vertical field of view, default 45\n"
+		"  --depth <levels>     reflection and refraction levels, 1 to " << CpuRaytracer::MaxDepth << ", default 1\n"
+		"  --threads <count>    0 means one per hardware core, the budget of all stages in batch mode, default 0\n"
+		"  --tile <pixels>      edge length of the tiles handed to the threads, default 16\n"
+		"  --samples <count>    most samples per pixel, tiles stop early once their noise is below --noise, default 1\n"
+		"  --noise <error>      noise target of --samples in linear color, default " << AdaptiveSamplingSpecification().targetError << "\n"
+		"  --budget <samples>   average samples per pixel of --samples, the noisiest tiles get them first, default 0 for no limit\n"
+		"  --compact            traverse the compact kd-tree\n"
+		"  --parent-links       stackless closest-hit walk of the kd-tree\n"
+		"  --scalar             primary rays one at a time in the order of Raytrace.frag, not in SIMD packets\n"
+		"  --shadows            shadow rays from every sphere hit to the light\n"
+		"  --direct-light       Cook-Torrance shading of the light with the materials of the scheme XML\n"
+		"  --ibl <hdr>          image-based lighting from an equirectangular .hdr, precomputed once and cached\n"
+		"  --ao <rays>          ambient occlusion baked per atom with this many rays, 64 is plenty\n"
+		"  --surface <ses|sas>  trace the solvent-excluded or solvent-accessible surface instead of the spheres\n"
+		"  --probe <radius>     probe of --surface, default " << MolecularSurfaceSpecification().probeRadius << "\n"
+		"  --voxel <size>       sample spacing of --surface, default " << MolecularSurfaceSpecification().voxelSize << "\n";
+}
+
+static bool ParseVec3(const char* text, glm::vec3& value)
+{
+	char end;
+	return std::sscanf(text, "%f,%f,%f%c", &value.x, &value.y, &value.z, &end) == 3;
+}
+
+// strtoul would wrap a leading minus around and stop quietly at trailing garbage
+static bool ParseUInt(const char* text, uint32_t& value)
+{
+	if (!std::isdigit(static_cast<unsigned char>(text[0])))
+		return false;
+
+	char* end;
+	errno = 0;
+	const unsigned long parsed = std::strtoul(text, &end, 10);
+	if (*end != '\0' || errno == ERANGE || parsed > std::numeric_limits<uint32_t>::max())
+		return false;
+
+	value = static_cast<uint32_t>(parsed);
+	return true;
+}
+
+static bool ParseFloat(const char* text, float& value)
+{
+	char end;
+	return std::sscanf(text, "%f%c", &value, &end) == 1;
+}
+
+static bool ParseArguments(int argc, char** argv, RenderOptions& options)
+{
+	std::vector<const char*> positional;
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* argument = argv[i];
+		if (std::strncmp(argument, "--", 2) != 0)
+		{
+			positional.push_back(argument);
+			continue;
+		}
+
+		if (std::strcmp(argument, "--compact") == 0)
+		{
+			options.raytracer.useCompactKDTree = true;
+			continue;
+		}
+
+		if (std::strcmp(argument, "--parent-links") == 0)
+		{
+			options.raytracer.useParentLinks = true;
+			continue;
+		}
+
+		if (std::strcmp(argument, "--scalar") == 0)
+		{
+			options.raytracer.packetPrimaryRays = false;
+			continue;
+		}
+
+		if (std::strcmp(argument, "--shadows") == 0)
+		{
+			options.raytracer.shadows = true;
+			continue;
+		}
+
+		if (std::strcmp(argument, "--direct-light") == 0)
+		{
+			options.raytracer.directLighting = true;
+			continue;
+		}
+
+		if (std::strcmp(argument, "--batch") == 0)
+		{
+			options.batch = true;
+			continue;
+		}
+
+		if (i + 1 >= argc)
+		{
+			std::cerr << "Missing value for " << argument << '\n';
+			return false;
+		}
+
+		const char* value = argv[++i];
+		uint32_t depth = 0;
+		bool valid = true;
+		if (std::strcmp(argument, "--output") == 0)
+		{
+			// Checked here, so a typo does not cost a whole render before WriteImage() rejects it
+			options.outputPath = value;
+			const std::string extension = GetLowercaseExtension(options.outputPath);
+			valid = extension == ".png" || extension == ".exr";
+		}
+		else if (std::strcmp(argument, "--output-dir") == 0)
+			options.outputDirectory = value;
+		else if (std::strcmp(argument, "--format") == 0)
+		{
+			options.format = value;
+			valid = options.format == "png" || options.format == "exr";
+		}
+		else if (std::strcmp(argument, "--views") == 0)
+			valid = ParseUInt(value, options.viewCount) && options.viewCount > 0;
+		else if (std::strcmp(argument, "--queue") == 0)
+			valid = ParseUInt(value, options.queueCapacity) && options.queueCapacity > 0;
+		else if (std::strcmp(argument, "--width") == 0)
+			valid = ParseUInt(value, options.width) && options.width > 0;
+		else if (std::strcmp(argument, "--height") == 0)
+			valid = ParseUInt(value, options.height) && options.height > 0;
+		else if (std::strcmp(argument, "--eye") == 0)
+			valid = options.hasEye = ParseVec3(value, options.eye);
+		else if (std::strcmp(argument, "--target") == 0)
+			valid = options.hasTarget = ParseVec3(value, options.target);
+		else if (std::strcmp(argument, "--up") == 0)
+			valid = ParseVec3(value, options.up) && glm::length(options.up) > 0.0f;
+		else if (std::strcmp(argument, "--fov") == 0)
+			valid = ParseFloat(value, options.fov) && options.fov > 0.0f && options.fov < 180.0f;
+		else if (std::strcmp(argument, "--depth") == 0)
+		{
+			valid = ParseUInt(value, depth) && depth >= 1 && depth <= CpuRaytracer::MaxDepth;
+			options.raytracer.maxDepth = static_cast<int>(depth);
+		}
+		else if (std::strcmp(argument, "--threads") == 0)
+			valid = ParseUInt(value, options.raytracer.threadCount);
+		else if (std::strcmp(argument, "--tile") == 0)
+			valid = ParseUInt(value, options.raytracer.tileSize) && options.raytracer.tileSize > 0;
+		else if (std::strcmp(argument, "--samples") == 0)
+			valid = ParseUInt(value, options.sampling.maxSamples) && options.sampling.maxSamples > 0;
+		else if (std::strcmp(argument, "--noise") == 0)
+			valid = ParseFloat(value, options.sampling.targetError) && options.sampling.targetError > 0.0f;
+		else if (std::strcmp(argument, "--budget") == 0)
+			valid = ParseUInt(value, options.sampling.sampleBudget);
+		else if (std::strcmp(argument, "--ibl") == 0)
+			options.environmentPath = value;
+		else if (std::strcmp(argument, "--ao") == 0)
+			valid = options.raytracer.ambientOcclusion = ParseUInt(value, options.occlusionRayCount) && options.occlusionRayCount > 0;
+		else if (std::strcmp(argument, "--surface") == 0)
+		{
+			options.raytracer.traceSurface = true;
+			options.surface.type = std::strcmp(value, "sas") == 0 ? SurfaceType::SolventAccessible : SurfaceType::SolventExcluded;
+			valid = std::strcmp(value, "sas") == 0 || std::strcmp(value, "ses") == 0;
+		}
+		else if (std::strcmp(argument, "--probe") == 0)
+			valid = ParseFloat(value, options.surface.probeRadius) && options.surface.probeRadius >= 0.0f;
+		else if (std::strcmp(argument, "--voxel") == 0)
+			valid = ParseFloat(value, options.surface.voxelSize) && options.surface.voxelSize > 0.0f;
+		else
+		{
+			std::cerr << "Unknown option " << argument << '\n';
+			return false;
+		}
+
+		if (!valid)
+		{
+			std::cerr << "Invalid value " << value << " for " << argument << '\n';
+			return false;
+		}
+	}
+
+	if (positional.size() != 2)
+		return false;
+
+	options.pdbPath = positional[0];
+	options.xmlPath = positional[1];
+	return true;
+}
+
+static int RunBatchMode(const RenderOptions& options)
+{
+	BatchSpecification spec;
+	spec.inputDirectory = options.pdbPath;
+	spec.xmlPath = options.xmlPath;
+	spec.outputDirectory = options.outputDirectory;
+	spec.extension = "." + options.format;
+	spec.viewCount = options.viewCount;
+	spec.width = options.width;
+	spec.height = options.height;
+	spec.fov = options.fov;
+	spec.threadCount = options.raytracer.threadCount;
+	spec.queueCapacity = options.queueCapacity;
+	spec.raytracer = options.raytracer;
+	spec.sampling = options.sampling;
+	spec.occlusionRayCount = options.occlusionRayCount;
+	spec.surface = options.surface;
+
+	const BatchStatistics stats = RunBatch(spec);
+	std::cout << "Rendered " << stats.structureCount << " structures (" << stats.failedCount << " failed), " << stats.imageCount << " images in " << stats.seconds << " s, "
+		<< stats.GetStructuresPerHour() << " structures per hour\n";
+	std::cout << "Busy time per stage: load " << stats.loadSeconds << " s, build " << stats.buildSeconds << " s, render " << stats.renderSeconds << " s\n";
+	return stats.structureCount > 0 && stats.failedCount == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	RenderOptions options;
+	options.raytracer.packetPrimaryRays = true;
+	if (!ParseArguments(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	// Shared by every frame and, in batch mode, by every render thread
+	Scope<EnvironmentLighting> environment;
+	if (!options.environmentPath.empty())
+	{
+		environment = CreateScope<EnvironmentLighting>(options.environmentPath);
+		if (!environment->IsValid())
+			return 1;
+
+		const EnvironmentLightingStatistics& environmentStats = environment->GetStatistics();
+		if (environmentStats.fromCache)
+			std::cout << "Read the lighting of " << options.environmentPath << " from " << EnvironmentLighting::GetCachePath(options.environmentPath) << " in " << environmentStats.loadMilliseconds << " ms\n";
+		else
+			std::cout << "Precomputed the lighting of " << options.environmentPath << ": load " << environmentStats.loadMilliseconds << " ms, irradiance " << environmentStats.irradianceMilliseconds
+				<< " ms, specular " << environmentStats.specularMilliseconds << " ms, BRDF " << environmentStats.brdfMilliseconds << " ms\n";
+		options.raytracer.environmentLighting = environment.get();
+	}
+
+	if (options.batch)
+		return RunBatchMode(options);
+
+	options.raytracer.gammaCorrect = GetLowercaseExtension(options.outputPath) != ".exr";
+
+	Timer timer;
+	AtomLoader loader(options.pdbPath, options.xmlPath);
+	const std::vector<Atom>& atoms = loader.GetAtoms();
+	if (atoms.empty())
+	{
+		std::cerr << "No atoms in " << options.pdbPath << '\n';
+		return 1;
+	}
+
+	const RenderScene scene(atoms, options.raytracer.useCompactKDTree, 0, options.occlusionRayCount, options.raytracer.traceSurface ? &options.surface : nullptr);
+	std::cout << "Loaded " << atoms.size() << " atoms in " << timer.ElapsedMs() << " ms\n";
+	if (scene.surface)
+	{
+		const MolecularSurfaceStatistics& surfaceStats = scene.surface->GetStatistics();
+		std::cout << "Built the surface in " << surfaceStats.milliseconds << " ms, " << surfaceStats.surfaceBrickCount << " bricks, " << surfaceStats.bytes / (1024.0f * 1024.0f) << " MiB\n";
+	}
+
+	// Without a pose the whole molecule is framed from +z, like the default view of the application
+	CameraPose pose = FrameRenderScene(scene);
+	if (options.hasTarget)
+		pose.target = options.target;
+	if (options.hasEye)
+		pose.eye = options.eye;
+	else if (options.hasTarget)
+		pose.eye += options.target - 0.5f * (scene.GetBoxMin() + scene.GetBoxMax());
+	pose.up = options.up;
+	pose.fov = options.fov;
+	const glm::mat4 invProjView = ComputeInvProjView(scene, pose, options.width, options.height, options.raytracer);
+
+	const CpuCubemap cubemap({
+		"assets/textures/skybox/right.jpg",
+		"assets/textures/skybox/left.jpg",
+		"assets/textures/skybox/top.jpg",
+		"assets/textures/skybox/bottom.jpg",
+		"assets/textures/skybox/front.jpg",
+		"assets/textures/skybox/back.jpg"
+	});
+
+	CpuRaytracer raytracer(scene.GetRaytraceScene(), cubemap, options.raytracer);
+	std::vector<glm::vec4> pixels;
+	const CpuRenderStatistics stats = raytracer.RenderAdaptive(invProjView, options.width, options.height, options.sampling, pixels);
+	std::cout << "Rendered " << options.width << "x" << options.height << " on " << stats.threadCount << " threads in " << stats.milliseconds << " ms, "
+		<< static_cast<float>(stats.sampleCount) / (static_cast<uint64_t>(options.width) * options.height) << " samples per pixel, "
+		<< stats.rayCount / 1e6f << " Mrays, " << stats.GetMraysPerSecondPerCore() << " Mrays/s per core, "
+		<< stats.GetNodeVisitsPerRay() << " nodes and " << stats.GetSphereTestsPerRay() << " spheres per ray\n";
+
+	if (!WriteImage(options.outputPath, options.width, options.height, pixels))
+		return 1;
+
+	std::cout << "Wrote " << options.outputPath << '\n';
+	return 0;
+}
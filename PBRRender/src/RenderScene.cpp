@@ -0,0 +1,84 @@
+#include "RenderScene.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "AmbientOcclusion.h"
+
+RenderScene::RenderScene(const std::vector<Atom>& atoms, bool buildCompactKDTree, uint32_t threadCount, uint32_t occlusionRayCount,
+	const MolecularSurfaceSpecification* surfaceSpecification)
+{
+	KDTreeSpecification treeSpec;
+	treeSpec.threadCount = threadCount;
+
+	spheres = CreateSpheres(atoms, materials);
+	tree = CreateScope<AtomKDTree>(atoms, treeSpec);
+	nodes = CreateArrayNodes(*tree);
+	parentIndices = CreateParentIndices(nodes.data(), nodes.size());
+	if (occlusionRayCount > 0)
+	{
+		AmbientOcclusionSpecification occlusionSpec;
+		occlusionSpec.rayCount = occlusionRayCount;
+		occlusionSpec.threadCount = threadCount;
+		BakeAmbientOcclusion(nodes, tree->GetAtomIndices(), spheres, occlusionSpec);
+	}
+	if (buildCompactKDTree)
+		compactTree = CreateScope<CompactKDTree>(atoms);
+	if (surfaceSpecification)
+	{
+		MolecularSurfaceSpecification surfaceSpec = *surfaceSpecification;
+		surfaceSpec.threadCount = threadCount;
+		surface = CreateScope<MolecularSurface>(atoms, surfaceSpec);
+	}
+}
+
+RaytraceScene RenderScene::GetRaytraceScene() const
+{
+	RaytraceScene scene;
+	scene.spheres = spheres.data();
+	scene.sphereCount = spheres.size();
+	scene.nodes = nodes.data();
+	scene.nodeCount = nodes.size();
+	scene.atomIndices = tree->GetAtomIndices().data();
+	scene.atomIndexCount = tree->GetAtomIndices().size();
+	scene.parentIndices = parentIndices.data();
+	scene.parentIndexCount = parentIndices.size();
+	scene.materials = materials.data();
+	scene.materialCount = materials.size();
+	if (compactTree)
+	{
+		scene.compactNodes = compactTree->GetNodes().data();
+		scene.compactNodeCount = compactTree->GetNodes().size();
+		scene.compactAtomIndices = compactTree->GetAtomIndices().data();
+		scene.compactAtomIndexCount = compactTree->GetAtomIndices().size();
+		scene.compactBoxMin = compactTree->GetBoxMin();
+		scene.compactBoxMax = compactTree->GetBoxMax();
+	}
+
+	scene.surface = surface.get();
+	return scene;
+}
+
+CameraPose FrameRenderScene(const RenderScene& scene, float angle)
+{
+	const glm::vec3 boxMin = scene.GetBoxMin();
+	const glm::vec3 boxMax = scene.GetBoxMax();
+	const float distance = 1.2f * glm::length(boxMax - boxMin);
+
+	CameraPose pose;
+	pose.target = 0.5f * (boxMin + boxMax);
+	pose.eye = pose.target + distance * glm::vec3(std::sin(angle), 0.0f, std::cos(angle));
+	return pose;
+}
+
+glm::mat4 ComputeInvProjView(const RenderScene& scene, const CameraPose& pose, uint32_t width, uint32_t height, CpuRaytracerSpecification& specification)
+{
+	// Rays are not clipped by the far plane, it only has to keep the projection invertible
+	const float diagonal = glm::length(scene.GetBoxMax() - scene.GetBoxMin());
+	specification.farPlane = std::max(specification.farPlane, glm::length(pose.eye - pose.target) + diagonal);
+
+	const glm::mat4 projection = glm::perspective(glm::radians(pose.fov), float(width) / height, specification.nearPlane, specification.farPlane);
+	return glm::inverse(projection * glm::lookAt(pose.eye, pose.target, pose.up));
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "Core/Base.h"
+#include "AtomKDTree.h"
+#include "CompactKDTree.h"
+#include "CpuRaytracer.h"
+#include "MolecularSurface.h"
+#include "Scene.h"
+
+// Everything CpuRaytracer reads of one structure. Owns its buffers, so the AtomLoader the atoms
+// came from can be destroyed once it is built
+struct RenderScene
+{
+	std::vector<Sphere> spheres;
+	std::vector<SphereMaterial> materials;
+	Scope<AtomKDTree> tree;
+	std::vector<ArrayNode> nodes;
+	std::vector<int32_t> parentIndices;
+	Scope<CompactKDTree> compactTree; // Only built when asked for
+	Scope<MolecularSurface> surface;  // Same
+
+	// Bakes Sphere::occlusion with occlusionRayCount rays per atom unless it is 0, builds the
+	// molecular surface if there is a specification for it
+	RenderScene(const std::vector<Atom>& atoms, bool buildCompactKDTree, uint32_t threadCount = 0, uint32_t occlusionRayCount = 0,
+		const MolecularSurfaceSpecification* surfaceSpecification = nullptr);
+
+	glm::vec3 GetBoxMin() const { return glm::vec3(nodes[0].boxMin); }
+	glm::vec3 GetBoxMax() const { return glm::vec3(nodes[0].boxMax); }
+
+	RaytraceScene GetRaytraceScene() const;
+};
+
+struct CameraPose
+{
+	glm::vec3 eye;
+	glm::vec3 target;
+	glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
+	float fov = 45.0f; // Vertical, in degrees
+};
+
+// Looks at the center of the scene from 1.2 box diagonals away, like the default view of the
+// application at angle 0. Other angles orbit around the y axis
+CameraPose FrameRenderScene(const RenderScene& scene, float angle = 0.0f);
+
+// uInvProjView of the pose. Moves the far plane of the specification out to the back of the scene,
+// the projection has to match the planes CpuRaytracer generates its rays with
+glm::mat4 ComputeInvProjView(const RenderScene& scene, const CameraPose& pose, uint32_t width, uint32_t height, CpuRaytracerSpecification& specification);
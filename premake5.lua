@@ -56,3 +56,6 @@ workspace "PBRApp"
 	group ""
 
 	include "PBRApp"
+	include "PBRBench"
+	include "PBRRender"
+	include "PBRGen"